@@ -1,23 +1,47 @@
 ﻿#include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cmath>            // cosf, sinf, sqrtf
+#include <cstring>          // memset
+#include <algorithm>        // sort
+#include <atomic>           // atomic
+#include <thread>           // thread
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "camera.h"
+#include "cluster_lighting.h"
+#include "deferred_renderer.h"
+#include "fixed_timestep.h"
+#include "gl_backend.h"
+#include "gl_state_cache.h"
+#include "input_queue.h"
+#include "texture_manager.h"
+#include "asset_pack.h"
+#include "asset_pipeline.h"
+#include "job_system.h"
+#include "light_baker.h"
+#include "light_block.h"
+#include "program_cache.h"
+#include "program_reflection.h"
+#include "render_graph.h"
+#include "shadow_cascades.h"
+#include "snapshot_queue.h"
+#include "shader_batch.h"
+#include "shader_permutations.h"
+#include "shader_preprocessor.h"
+#include "shader_watcher.h"
+#include "soft_rasterizer.h"
+
+// stb_image implementation, compiled once here after every header that includes it
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
 
 using namespace std; // Standard namespace
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
-
 // Unnamed namespace
 namespace
 {
@@ -27,29 +51,216 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
+    // Scene shaders; edits to these files are picked up while the app runs
+    const char* const SCENE_VERTEX_SHADER = "shaderfiles/scene.vs";
+    const char* const SCENE_FRAGMENT_SHADER = "shaderfiles/scene.fs";
+    const char* const DEPTH_PREPASS_FRAGMENT_SHADER = "shaderfiles/depth_prepass.fs";
+
+    // Lit path shaders (--lit)
+    const char* const LIT_VERTEX_SHADER = "shaderfiles/6.multiple_lights.vs";
+    const char* const LIT_FRAGMENT_SHADER = "shaderfiles/6.multiple_lights.fs";
+    const char* const CLUSTERED_FRAGMENT_SHADER = "shaderfiles/clustered_lights.fs";
+
+    // Scene shader uniforms, hashed at compile time
+    constexpr uint32_t UNIFORM_MODEL = ShaderNameId("model");
+    constexpr uint32_t UNIFORM_VIEW = ShaderNameId("view");
+    constexpr uint32_t UNIFORM_PROJECTION = ShaderNameId("projection");
+    constexpr uint32_t UNIFORM_VIEW_POS = ShaderNameId("viewPos");
+    constexpr uint32_t UNIFORM_MATERIAL_DIFFUSE = ShaderNameId("material.diffuse");
+    constexpr uint32_t UNIFORM_MATERIAL_SHININESS = ShaderNameId("material.shininess");
+
+    // Default lit path values
+    const int DEFAULT_POINT_LIGHTS = 4;         // --point-lights
+    const float LIT_SHININESS = 32.0f;
+
+    // Texture applied to the scene
+    const char* const TEXTURE_FILENAME = "../../resources/textures/smiley.png";
+
+    // Loose files cooked into the asset pack by --cook-pack
+    const char* const PACK_TEXTURES[] = {
+        TEXTURE_FILENAME,
+        "container.jpg",
+        "container2.png",
+        "container2_specular.png",
+    };
+    const char* const PACK_SHADERS[] = {
+        SCENE_VERTEX_SHADER,
+        SCENE_FRAGMENT_SHADER,
+        DEPTH_PREPASS_FRAGMENT_SHADER,
+        "shaderfiles/6.light_cube.vs",
+        "shaderfiles/6.light_cube.fs",
+        "shaderfiles/6.multiple_lights.vs",
+        "shaderfiles/6.multiple_lights.fs",
+        "shaderfiles/lights.glsl",
+        "shaderfiles/clusters.glsl",
+        "shaderfiles/clustered_lights.fs",
+        "shaderfiles/gbuffer.glsl",
+        "shaderfiles/gbuffer.fs",
+        "shaderfiles/deferred_fullscreen.vs",
+        "shaderfiles/deferred_lights.fs",
+        "shaderfiles/deferred_volume.vs",
+        "shaderfiles/deferred_volume.fs",
+        "shaderfiles/shadows.glsl",
+        "shaderfiles/shadow_depth.vs",
+        "shaderfiles/shadow_depth.fs",
+        "shaderfiles/core.vs",
+        "shaderfiles/core.frag",
+    };
+
+    // Objects of the scene, in the order UBuildScene fills them
+    enum SceneObjectId
+    {
+        SCENE_PLANE,
+        SCENE_TRUNK,
+        SCENE_TREE_TOP,
+        SCENE_OBJECT_COUNT
+    };
+
+    // Every scene object stores a position followed by an RGBA color per vertex
+    const GLuint FLOATS_PER_VERTEX = 3;
+    const GLuint FLOATS_PER_COLOR = 4;
+
+    // The lit programs read a position, a normal and texture coordinates instead
+    const GLuint FLOATS_PER_NORMAL = 3;
+    const GLuint FLOATS_PER_UV = 2;
+
+    // How the scene is shaded
+    enum SceneLighting
+    {
+        LIGHTING_VERTEX_COLORS,     // scene.vs/scene.fs, unlit
+        LIGHTING_FORWARD,           // 6.multiple_lights.fs, every light at every fragment (--lit)
+        LIGHTING_CLUSTERED,         // clustered_lights.fs, the point lights listed for the fragment's cluster (--clustered)
+        LIGHTING_DEFERRED           // the G-buffer first, then DeferredRenderer::Shade() lights it (--deferred)
+    };
+
+    // CPU copy of one scene object, shared by the GL and software renderers
+    struct SceneObject
+    {
+        vector<GLfloat> vertices;
+        vector<GLushort> indices;
+    };
+
+    // The draws URender issues: object and index of the model placement it is drawn with
+    const struct SceneDraw
+    {
+        SceneObjectId object;
+        int model;
+    } SCENE_DRAWS[] = {
+        { SCENE_PLANE, 1 },
+        { SCENE_TRUNK, 3 },
+        { SCENE_TREE_TOP, 2 },
+    };
+    const int SCENE_DRAW_COUNT = int(sizeof(SCENE_DRAWS) / sizeof(SCENE_DRAWS[0]));
+
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
-        GLuint vao1;         // Handle for the vertex array object
-        GLuint vao2;
-        GLuint vao3;
-        GLuint vbos1[2];     // Handles for the vertex buffer objects
-        GLuint vbos2[2];
-        GLuint vbos3[2];
-        GLuint nIndices1;    // Number of indices of the mesh
-        GLuint nIndices2;
-        GLuint nIndices3;
-        GLuint nIndices4;
+        GLuint vaos[SCENE_OBJECT_COUNT];        // Handle for the vertex array object of each scene object
+        GLuint vbos[SCENE_OBJECT_COUNT][2];     // Handles for the vertex buffer objects
+        GLuint nIndices[SCENE_OBJECT_COUNT];    // Number of indices of the mesh
+        glm::vec3 centers[SCENE_OBJECT_COUNT];  // Bounding box centers in model space, for sorting
+        glm::vec3 extents[SCENE_OBJECT_COUNT];  // Half sizes of the same boxes, for the shadow casters' spheres
+        ShadowMesh positions[SCENE_OBJECT_COUNT]; // Position-only copies for the depth prepass and the shadows
+        GLuint litVaos[SCENE_OBJECT_COUNT];     // Lit vertices with the scene object's indices, for the lit path
+        GLuint litVbos[SCENE_OBJECT_COUNT];
+    };
+
+    // Everything the render thread draws a frame from, built by the main thread and not changed after
+    struct SceneFrame
+    {
+        int width, height;                      // framebuffer size
+        glm::mat4 models[4];
+        glm::vec3 eye;                          // camera position, between the last two simulation steps
+        glm::mat4 view;                         // orders the draws; the passes draw with gLatchedView
+        glm::mat4 projection;
+        float fovY, aspect, nearPlane, farPlane; // the perspective 'projection' was built from
+        bool depthPrepass;                      // lay depth down first, then shade with GL_EQUAL
+        SceneLighting lighting;
+        bool shadows;                           // render the cascades, and sample them in the lit pass
+        double simulationDropped;               // for the --gl-stats report
     };
 
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
     // Triangle mesh data
     GLMesh gMesh;
-    //Texture id
-    GLuint gTextureId;
+    // Owns every texture and keeps them under the VRAM budget
+    TextureManager gTextures;
+    // Shared texture handle
+    TextureHandle gTexture;
+    // Streams assets in after the first frame
+    AssetPipeline* gAssets = nullptr;
+    // Scene texture request; the placeholder is drawn until it is ready
+    AssetPipeline::TextureFuture gTextureRequest;
     // Shader program
     GLuint gProgramId;
+    // Uniform table and shadow values of the scene program
+    ProgramReflection gSceneUniforms;
+    // Worker threads, once main() has started them
+    JobSystem* gJobs = nullptr;
+    // Bake sun and sky light into the tree's vertex colors before uploading them (--bake-lighting)
+    bool gBakeLighting = false;
+    // Count the scene's GL calls instead of issuing them and report the CPU cost of frames (--null-gl)
+    bool gNullGL = false;
+    // Report the CPU cost of frames, the GL calls the state cache filtered and the input latency (--gl-stats, implied by --null-gl)
+    bool gGLStats = false;
+    const int GL_STATS_REPORT_FRAMES = 300; // frames averaged per report
+    // Lay down depth with position-only streams first, then shade only the visible surface (--depth-prepass)
+    bool gDepthPrepass = false;
+    GLuint gDepthProgramId = 0;
+    ProgramReflection gDepthUniforms;
+    // Shade the scene with lights instead of its vertex colors (--lit)
+    SceneLighting gLighting = LIGHTING_VERTEX_COLORS;
+    GLuint gLitProgramId = 0;
+    ProgramReflection gLitUniforms;
+    // Lights of the lit path; the point lights are in world space (--point-lights)
+    LightBlock* gLights = nullptr;
+    int gPointLightCount = DEFAULT_POINT_LIGHTS;
+    vector<LightBlockPointLight> gPointLights;
+    // Point light lists per cluster of the view, rebuilt every frame (--clustered, and --deferred unless --light-volumes)
+    ClusterLighting* gClusters = nullptr;
+    // G-buffer and lighting passes of the deferred path, and how it shades the point lights (--light-volumes)
+    DeferredRenderer* gDeferred = nullptr;
+    DeferredLightMode gDeferredMode = DEFERRED_LIGHT_TILED;
+    ProgramReflection gGeometryUniforms;
+    // Cascaded shadows of the sun over the lit path (--shadows); the scene only has static casters
+    bool gShadows = false;
+    ShadowCascades* gCascades = nullptr;
+    vector<ShadowCaster> gShadowCasters;
+    // Filters the scene's GL calls; passes that call GL directly make it forget what it knew
+    GLStateCache* gStateCache = nullptr;
+
+    // Terminates GLFW when main leaves; declared before every GL object of main, so their destructors
+    // run while the context still exists
+    struct GLFWSession
+    {
+        ~GLFWSession() { glfwTerminate(); }
+    };
+
+    // Makes a state cache the backend and gStateCache while it lives, and puts the driver back however
+    // main leaves, so neither points at the cache once it is gone
+    class StateCacheScope
+    {
+    public:
+        explicit StateCacheScope(GLStateCache& cache)
+        {
+            SetGLBackend(&cache);
+            gStateCache = &cache;
+        }
+        ~StateCacheScope() { Release(); }
+
+        void Release()
+        {
+            SetGLBackend(nullptr);
+            gStateCache = nullptr;
+        }
+
+    private:
+        StateCacheScope(const StateCacheScope&);
+        StateCacheScope& operator=(const StateCacheScope&);
+    };
+    // The snapshot the render thread is drawing
+    const SceneFrame* gFrame = nullptr;
 
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -57,9 +268,29 @@ namespace
     float gLastY = WINDOW_HEIGHT / 2.0f;
     bool gFirstMouse = true;
 
+    // Mouse movement from the cursor callback, applied by the render thread right before it submits a frame
+    InputQueue gMouseInput;
+    // Camera angles the render thread latched last; the main thread moves the camera along them
+    struct LookAngles
+    {
+        float yaw, pitch;
+    };
+    atomic<LookAngles> gLatchedLook;
+    // View the render thread latched for the frame it is submitting, and the draws sorted along it
+    glm::mat4 gLatchedView;
+    int gLatchedOrder[SCENE_DRAW_COUNT];        // SCENE_DRAWS indices, nearest first
+
     // timing
-    float gDeltaTime = 0.0f; // time between current frame and last frame
-    float gLastFrame = 0.0f;
+    double gLastFrame = 0.0;
+
+    // The simulation advances in fixed steps (--sim-hz); frames draw the camera between the last two
+    FixedTimestep gTimestep;
+    glm::vec3 gPreviousCameraPosition = gCamera.Position;  // before the last step
+    float gInterpolation = 1.0f;                            // where the frame falls between the two
+    unsigned gMoveKeys = 0;                                 // 1 << Camera_Movement of every key held this frame
+    bool gOverviewKeyHeld = false;
+    // Frame rate cap (--max-fps); 0 runs uncapped, negative leaves the pacing to the driver's vsync
+    int gMaxFps = -1;
 }
 
 /* User-defined Function prototypes to:
@@ -68,90 +299,234 @@ namespace
  * and render graphics on the screen
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
-void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
+void USimulate(float stepSeconds);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
-void UCreateMesh(GLMesh& mesh);
-bool UCreateTexture(const char* filename, GLuint& textureId);
+void UBuildScene(SceneObject objects[SCENE_OBJECT_COUNT]);
+void UBuildLights(LightBlock& lights);
+void UCreateMesh(GLMesh& mesh, const SceneObject objects[SCENE_OBJECT_COUNT]);
+void UBuildShadowCasters(const GLMesh& mesh, vector<ShadowCaster>& casters);
+void ULitVertices(const SceneObject& object, const glm::mat4& model, vector<GLfloat>& lit);
+bool UCreateTexture(const char* filename, TextureHandle& texture);
+void UDestroyTexture(TextureHandle& texture);
 void UDestroyMesh(GLMesh& mesh);
+glm::vec3 UCameraPosition();
+void USceneModels(glm::mat4 models[4]);
+void USceneTransforms(glm::mat4 models[4], glm::mat4& view, glm::mat4& projection);
+void UPrepareFrame(SceneFrame& frame);
+void UBuildFrameGraph(RenderGraph& graph, const SceneFrame& frame);
+double ULatchCamera(Camera& look, const SceneFrame& frame, float seconds);
+void URenderShadows();
+void UDepthPrepass();
+void UBindSceneTexture(GLBackend& gl);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void UBuildClusters();
+void UDrawLit(ProgramReflection& uniforms);
+void URenderLit();
+void UDeferredGeometry();
+void UDeferredShade();
+bool URenderSoftware(const char* filename);
+bool UReadShaderFile(const char* filename, string& source);
 void UDestroyShaderProgram(GLuint programId);
+bool UCookAssetPack(const char* packFilename);
 
 
-/* Vertex Shader Source Code*/
-const GLchar* vertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
-layout(location = 1) in vec4 color;  // Color data from Vertex Attrib Pointer 1
+int main(int argc, char* argv[])
+{
+    // Command line options
+    const char* packFilename = nullptr;
+    const char* softwareFilename = nullptr;
+    unsigned packFlags = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--cook-pack" && hasValue)
+            return UCookAssetPack(argv[i + 1]) ? EXIT_SUCCESS : EXIT_FAILURE; // cook the loose assets and exit
+        else if (arg == "--asset-pack" && hasValue)
+            packFilename = argv[++i];
+        else if (arg == "--populate")
+            packFlags |= ASSET_PACK_POPULATE;
+        else if (arg == "--huge-pages")
+            packFlags |= ASSET_PACK_HUGE_PAGES;
+        else if (arg == "--texture-budget-mb" && hasValue)
+            gTextures.SetBudget(size_t(atoi(argv[++i])) * 1024u * 1024u);
+        else if (arg == "--bake-lighting")
+            gBakeLighting = true;
+        else if (arg == "--null-gl")
+            gNullGL = gGLStats = true;
+        else if (arg == "--gl-stats")
+            gGLStats = true;
+        else if (arg == "--depth-prepass")
+            gDepthPrepass = true;
+        else if (arg == "--lit")
+            gLighting = LIGHTING_FORWARD;
+        else if (arg == "--clustered")
+            gLighting = LIGHTING_CLUSTERED;
+        else if (arg == "--deferred")
+            gLighting = LIGHTING_DEFERRED;
+        else if (arg == "--light-volumes")
+            gDeferredMode = DEFERRED_LIGHT_VOLUMES;
+        else if (arg == "--shadows")
+            gShadows = true;
+        else if (arg == "--point-lights" && hasValue)
+            gPointLightCount = atoi(argv[++i]);
+        else if (arg == "--sim-hz" && hasValue)
+            gTimestep.SetRate(atof(argv[++i]));
+        else if (arg == "--max-fps" && hasValue)
+            gMaxFps = atoi(argv[++i]);
+        else if (arg == "--camera-damping" && hasValue)
+            gCamera.Damping = float(atof(argv[++i]));
+        else if (arg == "--software-render" && hasValue)
+            softwareFilename = argv[++i];
+    }
 
-out vec4 vertexColor; // variable to transfer color data to the fragment shader
+    // Only the lit path samples shadows
+    if (gShadows && gLighting == LIGHTING_VERTEX_COLORS)
+        gLighting = LIGHTING_FORWARD;
 
-//Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+    // The lit programs transform with their own vertex shader, whose depth need not match the prepass exactly
+    if (gLighting != LIGHTING_VERTEX_COLORS)
+        gDepthPrepass = false;
 
-void main()
-{
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
-    vertexColor = color; // references incoming color data
-}
-);
+    // Creates a perspective projection
+    gCamera.SetPerspective(gCamera.Zoom, (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
+    // Render one frame on the CPU into an image and exit; works without an OpenGL driver
+    if (softwareFilename != nullptr)
+        return URenderSoftware(softwareFilename) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-/* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource = GLSL(440,
-    in vec4 vertexColor; // Variable to hold incoming color data from vertex shader
+    GLFWSession glfwSession;
+    if (!UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
 
-out vec4 fragmentColor;
+    // Serve assets from the pack when one is given; anything missing from it falls back to loose files
+    if (packFilename != nullptr && !MountAssetPack(packFilename, packFlags))
+        cout << "Failed to mount asset pack " << packFilename << ", using loose files" << endl;
 
-void main()
-{
-    fragmentColor = vec4(vertexColor);
-}
-);
+    // Worker threads for CPU-side work; this thread is worker 0
+    JobSystem jobs;
+    gJobs = &jobs;
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
+    // Stream the scene texture in; the first frames draw with the placeholder
+    AssetPipeline assets(gTextures, jobs);
+    gAssets = &assets;
+    gTextureRequest = assets.RequestTexture(TEXTURE_FILENAME);
+    assets.Flush();
+
+    // Queue the shader programs from the scene shader files
+    string vertexSource, fragmentSource;
+    if (!UReadShaderFile(SCENE_VERTEX_SHADER, vertexSource) || !UReadShaderFile(SCENE_FRAGMENT_SHADER, fragmentSource))
     {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
+        cout << "Failed to read the scene shaders " << SCENE_VERTEX_SHADER << " and " << SCENE_FRAGMENT_SHADER << endl;
+        return EXIT_FAILURE;
+    }
+    ShaderBatch shaderBatch;
+    shaderBatch.Add(&gProgramId, vertexSource, fragmentSource, "scene");
 
-        for (int i = width * channels; i > 0; --i)
+    // The prepass runs the scene vertex shader, so both passes compute the same depth
+    if (gDepthPrepass)
+    {
+        string depthFragmentSource;
+        if (!UReadShaderFile(DEPTH_PREPASS_FRAGMENT_SHADER, depthFragmentSource))
         {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
+            cout << "Failed to read the depth prepass shader " << DEPTH_PREPASS_FRAGMENT_SHADER << endl;
+            return EXIT_FAILURE;
         }
+        shaderBatch.Add(&gDepthProgramId, vertexSource, depthFragmentSource, "depth prepass");
     }
-}
 
-
-int main(int argc, char* argv[])
-{
-    if (!UInitialize(argc, argv, &gWindow))
+    // The lit path's program compiles in the same batch; the scene has no specular map
+    ShaderPermutationCache shaderPermutations;
+    ShaderDefines litDefines;
+    litDefines.Set("HAS_SPECULAR_MAP", 0);
+    if (gShadows)
+        litDefines.Set("HAS_SHADOWS", 1);
+    const char* litFragmentShader = gLighting == LIGHTING_CLUSTERED ? CLUSTERED_FRAGMENT_SHADER : LIT_FRAGMENT_SHADER;
+    const GLuint* litProgram = nullptr;
+    if (gLighting == LIGHTING_FORWARD || gLighting == LIGHTING_CLUSTERED)
+        litProgram = shaderPermutations.Queue(ShaderPermutation(LIT_VERTEX_SHADER, litFragmentShader, litDefines), shaderBatch);
+    shaderBatch.Submit();
+
+    // Swap the scene's GL calls for counters before anything is uploaded through them
+    GLNullBackend nullBackend;
+    if (gNullGL)
+        SetGLBackend(&nullBackend);
+
+    // Drop state changes that would not change anything before they reach the backend
+    GLStateCache stateCache(CurrentGLBackend());
+    StateCacheScope stateCacheScope(stateCache);
+
+    // Create the mesh while the driver compiles
+    SceneObject sceneObjects[SCENE_OBJECT_COUNT];
+    UBuildScene(sceneObjects);
+    UCreateMesh(gMesh, sceneObjects); // Calls the function to create the Vertex Buffer Object
+    stateCache.InvalidateBindings();
+
+    // Wait for the programs to link (and pre-warm)
+    if (!shaderBatch.Finish())
         return EXIT_FAILURE;
+    if (gDepthProgramId == 0)
+        gDepthPrepass = false;
+    if (litProgram != nullptr)
+        gLitProgramId = *litProgram;
+    if (litProgram != nullptr && gLitProgramId == 0)
+    {
+        cout << "Failed to build the lit program, drawing vertex colors" << endl;
+        gLighting = LIGHTING_VERTEX_COLORS;
+    }
 
-    // Create the mesh
-    UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
+    // The deferred path builds its geometry and lighting programs as a batch of their own
+    DeferredRenderer deferred;
+    if (gLighting == LIGHTING_DEFERRED)
+    {
+        deferred.SetMode(gDeferredMode);
+        gDeferred = &deferred;
+        if (!deferred.Create(shaderPermutations, litDefines))
+        {
+            cout << "Failed to build the deferred programs, drawing vertex colors" << endl;
+            gDeferred = nullptr;
+            gLighting = LIGHTING_VERTEX_COLORS;
+        }
+    }
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-        return EXIT_FAILURE;
+    // The lit path's lights, uploaded once here; the lit pass binds them again every frame
+    LightBlock lights;
+    if (gLighting != LIGHTING_VERTEX_COLORS)
+    {
+        UBuildLights(lights);
+        lights.Upload();
+        gLights = &lights;
+    }
+
+    // Cuts the view into clusters and lists the point lights reaching each; built by the lit pass
+    ClusterLighting clusters(jobs);
+    if (gLighting == LIGHTING_CLUSTERED || (gLighting == LIGHTING_DEFERRED && gDeferredMode == DEFERRED_LIGHT_TILED))
+        gClusters = &clusters;
 
-    // Load texture
-    const char* texFilename = "../../resources/textures/smiley.png";
-    if (!UCreateTexture(texFilename, gTextureId))
+    // The sun's shadow cascades; the plane and the tree are rendered into their static layers once
+    ShadowCascades cascades;
+    gShadows = gShadows && gLighting != LIGHTING_VERTEX_COLORS;
+    if (gShadows && cascades.Create(shaderPermutations))
     {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
+        cascades.SetLightDirection(lights.Data().dirLight.direction);
+        UBuildShadowCasters(gMesh, gShadowCasters);
+        gCascades = &cascades;
+    }
+    else if (gShadows)
+    {
+        cout << "Failed to create the shadow cascades, drawing without shadows" << endl;
+        gShadows = false;
     }
+
+    // Rebuild the scene program in the background whenever its files are saved
+    ShaderReloader shaderReloader(gWindow);
+    shaderReloader.Watch(&gProgramId, SCENE_VERTEX_SHADER, SCENE_FRAGMENT_SHADER);
+    if (gDepthPrepass)
+        shaderReloader.Watch(&gDepthProgramId, SCENE_VERTEX_SHADER, DEPTH_PREPASS_FRAGMENT_SHADER);
+
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     glUseProgram(gProgramId);
     // We set the texture as texture unit 0
@@ -160,33 +535,195 @@ int main(int argc, char* argv[])
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    // Snapshots of the scene, handed from this thread to the render thread
+    SnapshotQueue<SceneFrame> frames;
+    gLatchedLook.store(LookAngles{ gCamera.Yaw, gCamera.Pitch });
+
+    // The render thread owns the GL context from here on: it swaps in rebuilt shaders, draws the
+    // snapshots, presents them and uploads streamed textures, while this thread handles input and
+    // simulation and builds the next snapshot
+    glfwMakeContextCurrent(NULL);
+    thread renderThread([&]()
+    {
+        glfwMakeContextCurrent(gWindow);
+
+        // With a cap the main loop paces itself, so the swap must not wait for vsync as well
+        if (gMaxFps >= 0)
+            glfwSwapInterval(0);
+
+        // The frame's passes, declared anew every frame; its textures and framebuffers are pooled across frames
+        RenderGraph frameGraph;
+
+        // Turned by the queued mouse movement right before each frame is submitted
+        Camera look = gCamera;
+        double lastLatch = glfwGetTime();
+
+        // CPU time of building and submitting the frame, averaged for the --gl-stats reports
+        double renderSeconds = 0.0;
+        int renderFrames = 0;
+        bool firstFrame = true;
+
+        // Time from a mouse movement to the swap of the first frame showing it, averaged for the --gl-stats reports
+        double latencySeconds = 0.0;
+        double latencyWorst = 0.0;
+        int latencyFrames = 0;
+
+        while (const SceneFrame* frame = frames.BeginRead())
+        {
+            // Swap in shader programs rebuilt since the last frame
+            shaderReloader.Update();
+
+            // Render this frame
+            stateCache.ResetStats();
+            chrono::steady_clock::time_point renderStart = chrono::steady_clock::now();
+            gFrame = frame;
+            UBuildFrameGraph(frameGraph, *frame);
+            double inputTime = -1.0;
+            if (frameGraph.Compile())
+            {
+                // Latch the view as late as possible: mouse movement up to here is in this frame
+                double latchTime = glfwGetTime();
+                inputTime = ULatchCamera(look, *frame, float(latchTime - lastLatch));
+                lastLatch = latchTime;
+                frameGraph.Execute();
+            }
+            gFrame = nullptr;
+            renderSeconds += chrono::duration<double>(chrono::steady_clock::now() - renderStart).count();
+            double simulationDropped = frame->simulationDropped;
+            frames.EndRead();
+
+            // Shader swaps and texture uploads below bind behind the cache's back
+            stateCache.InvalidateBindings();
+
+            // glfw: swap buffers (the null backend has drawn nothing to show)
+            if (!gNullGL)
+                glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+
+            if (inputTime >= 0.0)
+            {
+                double latency = glfwGetTime() - inputTime;
+                latencySeconds += latency;
+                latencyWorst = max(latencyWorst, latency);
+                ++latencyFrames;
+            }
+
+            if (gGLStats && ++renderFrames == GL_STATS_REPORT_FRAMES)
+            {
+                const GLBackendStats& stats = stateCache.Next().Stats();
+                cout << "INFO: Frame CPU time " << renderSeconds * 1e6 / renderFrames << " us, " << stateCache.Stats().calls
+                     << " GL calls requested, " << stats.calls << " issued, " << stateCache.FilteredCalls() << " filtered, "
+                     << stats.draws << " draws, " << stats.bytes << " bytes, " << simulationDropped
+                     << " s of simulation dropped, main thread waited " << frames.ProducerWaits() << " times" << endl;
+                if (latencyFrames > 0)
+                    cout << "INFO: Input to swap " << latencySeconds * 1000.0 / latencyFrames << " ms average, " << latencyWorst * 1000.0
+                         << " ms worst over " << latencyFrames << " frames with mouse input, " << gMouseInput.Dropped()
+                         << " mouse samples dropped" << endl;
+                renderSeconds = 0.0;
+                renderFrames = 0;
+                latencySeconds = latencyWorst = 0.0;
+                latencyFrames = 0;
+            }
+
+            // Report how long it took until something was on screen
+            if (firstFrame)
+            {
+                cout << "INFO: First frame after " << int(glfwGetTime() * 1000.0) << " ms" << endl;
+                if (gGLStats)
+                    cout << "INFO: Frame graph\n" << frameGraph.Describe();
+                firstFrame = false;
+            }
+
+            // Upload streamed assets within this frame's budget
+            assets.PumpUploads();
+            if (!gTexture && gTextureRequest.valid() && gTextureRequest.wait_for(chrono::seconds(0)) == future_status::ready)
+            {
+                gTexture = gTextureRequest.get();
+                if (!gTexture)
+                    cout << "Failed to load texture " << TEXTURE_FILENAME << endl;
+                gTextureRequest = AssetPipeline::TextureFuture();
+            }
+
+            // Restore touched textures and evict mips down to the VRAM budget
+            gTextures.Update();
+        }
+
+        glfwMakeContextCurrent(NULL);
+    });
+
+    // Start of the next frame when --max-fps caps the rate
+    chrono::steady_clock::time_point nextFrame = chrono::steady_clock::now();
+
     // render loop
     // -----------
+    gLastFrame = glfwGetTime();
     while (!glfwWindowShouldClose(gWindow))
     {   
         // per-frame timing
         // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
+        double currentFrame = glfwGetTime();
+        double frameSeconds = currentFrame - gLastFrame;
         gLastFrame = currentFrame;
 
-        // input
+        // input: polled before simulating, so the snapshot built below has the newest keys
         // -----
+        glfwPollEvents();
         UProcessInput(gWindow);
 
-        // Render this frame
-        URender();
+        // Simulate the steps due by now, then draw between the last two
+        int steps = gTimestep.Advance(frameSeconds);
+        for (int i = 0; i < steps; ++i)
+            USimulate(float(gTimestep.StepSeconds()));
+        gInterpolation = gTimestep.Alpha();
 
-        glfwPollEvents();
+        // Build the next snapshot while the render thread draws the previous one; waits only when
+        // the render thread is a whole frame behind
+        SceneFrame* frame = frames.BeginWrite();
+        UPrepareFrame(*frame);
+        frames.EndWrite();
+
+        // Hold the frame rate down to the cap; the simulation keeps its own rate either way
+        if (gMaxFps > 0)
+        {
+            nextFrame += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / gMaxFps));
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            if (nextFrame <= now)
+                nextFrame = now; // late frames do not bank time for a burst
+
+            // Wait on window events rather than sleep, so mouse movement keeps reaching the render
+            // thread, which latches it into the frame it submits next
+            while (now < nextFrame)
+            {
+                glfwWaitEventsTimeout(chrono::duration<double>(nextFrame - now).count());
+                now = chrono::steady_clock::now();
+            }
+        }
     }
 
+    // Let the render thread finish what was handed over, then take the context back
+    frames.Stop();
+    renderThread.join();
+    glfwMakeContextCurrent(gWindow);
+
     // Release mesh data
     UDestroyMesh(gMesh);
+    stateCacheScope.Release();
 
-    // Release shader program
+    // Stop streaming and release texture
+    gTextureRequest = AssetPipeline::TextureFuture();
+    assets.Shutdown();
+    gAssets = nullptr;
+    UDestroyTexture(gTexture);
+
+    // Unmap the asset pack once nothing points into it
+    UnmountAssetPack();
+
+    // Stop watching shaders and release shader program
+    shaderReloader.Shutdown();
     UDestroyShaderProgram(gProgramId);
+    if (gDepthProgramId != 0)
+        UDestroyShaderProgram(gDepthProgramId);
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
+    return EXIT_SUCCESS; // Destroys the locals, the render objects and the reloader's context, then terminates GLFW
 }
 
 
@@ -214,7 +751,8 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
         return false;
     }
     glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    // no resize callback: the render thread owns the context, and each frame's snapshot carries the
+    // framebuffer size the frame graph sets the viewport from
     glfwSetCursorPosCallback(*window, UMousePositionCallback);
     glfwSetScrollCallback(*window, UMouseScrollCallback);
     glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
@@ -239,6 +777,9 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     // Displays GPU OpenGL version
     cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
 
+    // Query what the program binary cache needs from the driver here, before any other thread compiles
+    InitProgramCache();
+
     return true;
 }
 
@@ -246,36 +787,49 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window)
 {
-    static const float cameraSpeed = 2.5f * gDeltaTime;
-
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
+    // The render thread turns the camera; move along the angles it showed last
+    LookAngles look = gLatchedLook.load(memory_order_acquire);
+    gCamera.SetOrientation(look.yaw, look.pitch);
+
+    // Keys are sampled once per frame; USimulate moves the camera by them at every step
+    gMoveKeys = 0;
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
+        gMoveKeys |= 1u << FORWARD;
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
+        gMoveKeys |= 1u << BACKWARD;
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
+        gMoveKeys |= 1u << LEFT;
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+        gMoveKeys |= 1u << RIGHT;
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(UP, gDeltaTime);
+        gMoveKeys |= 1u << UP;
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
-    
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-        gCamera.ToggleDisplay(0);
+        gMoveKeys |= 1u << DOWN;
+
+    gOverviewKeyHeld = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
 }
 
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
-void UResizeWindow(GLFWwindow* window, int width, int height)
+// Advances the simulation by one fixed step
+void USimulate(float stepSeconds)
 {
-    glViewport(0, 0, width, height);
+    gPreviousCameraPosition = gCamera.Position;
+    for (int direction = FORWARD; direction <= DOWN; ++direction)
+        if (gMoveKeys & (1u << direction))
+            gCamera.ProcessKeyboard(Camera_Movement(direction), stepSeconds);
 
+    // a jump, not a move: nothing to interpolate across
+    if (gOverviewKeyHeld)
+    {
+        gCamera.ToggleDisplay(0);
+        gPreviousCameraPosition = gCamera.Position;
+    }
 }
 
+
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
@@ -293,7 +847,8 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
     gLastX = xpos;
     gLastY = ypos;
 
-    gCamera.ProcessMouseMovement(xoffset, yoffset);
+    // Timestamped for the render thread, which turns the camera right before it submits the next frame
+    gMouseInput.Push(InputSample{ xoffset, yoffset, glfwGetTime() });
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
@@ -350,143 +905,378 @@ void UKeyButtonCallBack(GLFWwindow* window, string button)
            
 }
 
-// Functioned called to render a frame
-void URender()
-{   
-    const int nrows = 10;
-    const int ncols = 10;
-    const int nlevels = 10;
-
-    const float xsize = 10.0f;
-    const float ysize = 10.0f;
-    const float zsize = 10.0f;
-
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
-
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Camera position the frame shows: between the last two simulation steps
+glm::vec3 UCameraPosition()
+{
+    return gPreviousCameraPosition + (gCamera.Position - gPreviousCameraPosition) * gInterpolation;
+}
 
+// Model placements of the scene
+void USceneModels(glm::mat4 models[4])
+{
     // Scaling, rotation, translation for 1st model
     glm::mat4 scale1 = glm::scale(glm::vec3(15.0f, -2.0f, 15.0f));
     glm::mat4 rotation1 = glm::rotate(40.0f, glm::vec3(0.0, 1.0f, 0.0f));
     glm::mat4 translation1 = glm::translate(glm::vec3(-1.0f, 0.0f, 0.0f));
-    glm::mat4 model1 = translation1 * rotation1 * scale1;
+    models[0] = translation1 * rotation1 * scale1;
 
     // Scaling, rotation, translation for 2nd model
     glm::mat4 translation2 = glm::translate(glm::vec3(4.0f, 0.0f, 0.0f));//moving Model2 
-    glm::mat4 model2 = translation2 * rotation1 * scale1;
+    models[1] = translation2 * rotation1 * scale1;
 
     // Scaling, rotation, translation for 3rd model
     glm::mat4 translation3 = glm::translate(glm::vec3(23.0f, 0.0f, 1.0f));//moving Model3. Leave for project
     glm::mat4 scale2 = glm::scale(glm::vec3(5.0f, 2.0f, 5.0f));
-    glm::mat4 model3 = translation3 * rotation1 * scale2;
+    models[2] = translation3 * rotation1 * scale2;
 
     // Scaling, rotation, translation for 4rd model
     glm::mat4 translation4 = glm::translate(glm::vec3(23.0f, 0.0f, 1.0f));//moving Model4. Leave for project
     glm::mat4 scale3 = glm::scale(glm::vec3(1.0f, 2.0f, 1.0f));
-    glm::mat4 model4 = translation4 * rotation1 * scale3;
+    models[3] = translation4 * rotation1 * scale3;
+}
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+// Model placements, camera view and projection of the scene
+void USceneTransforms(glm::mat4 models[4], glm::mat4& view, glm::mat4& projection)
+{
+    USceneModels(models);
 
+    // camera/view transformation, with the camera between the last two simulation steps
+    Camera camera = gCamera;
+    camera.SetPosition(UCameraPosition());
+    view = camera.GetViewMatrix();
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    
-    // Set the shader to be used
-    glUseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    // The camera's perspective projection, cached until it changes
+    projection = camera.GetProjectionMatrix();
+}
+
+
+// Declares this frame's passes: the scene is drawn straight into the window. Passes that feed it
+// (shadows, a depth prepass, post-processing) declare their textures here and the graph orders them.
+void UBuildFrameGraph(RenderGraph& graph, const SceneFrame& frame)
+{
+    graph.Reset();
+    RenderResource backbuffer = graph.ImportBackbuffer(frame.width, frame.height);
+
+    // The cascades belong to ShadowCascades; the lit pass samples them after this pass renders them
+    RenderResource shadowMap = RENDER_GRAPH_NONE;
+    if (frame.shadows)
+    {
+        shadowMap = graph.ImportTexture("shadow cascades", gCascades->Texture(),
+                                        RenderTextureDesc(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, GL_DEPTH_COMPONENT32F));
+        RenderPass shadows = graph.AddPass("shadows", [](RenderGraph&) { URenderShadows(); });
+        graph.Write(shadows, shadowMap, RENDER_ACCESS_EXTERNAL);
+    }
+
+    // The G-buffer belongs to the deferred renderer; its depth target stands in for all of its targets,
+    // which orders the lighting after the geometry
+    if (frame.lighting == LIGHTING_DEFERRED)
+    {
+        if (!gDeferred->Resize(frame.width, frame.height))
+            return;
+        RenderResource gbuffer = graph.ImportTexture("g-buffer", gDeferred->DepthTexture(),
+                                                     RenderTextureDesc(frame.width, frame.height, GL_DEPTH24_STENCIL8));
+        RenderPass geometry = graph.AddPass("g-buffer", [](RenderGraph&) { UDeferredGeometry(); });
+        graph.Write(geometry, gbuffer, RENDER_ACCESS_EXTERNAL);
+        RenderPass shade = graph.AddPass("deferred shade", [](RenderGraph&) { UDeferredShade(); });
+        graph.Read(shade, gbuffer, RENDER_ACCESS_EXTERNAL);
+        if (frame.shadows)
+            graph.Read(shade, shadowMap);
+        graph.Write(shade, backbuffer);
+        return;
+    }
 
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // both passes write the window, which keeps them in this order
+    if (frame.depthPrepass)
+    {
+        RenderPass depth = graph.AddPass("depth prepass", [](RenderGraph&) { UDepthPrepass(); });
+        graph.Write(depth, backbuffer);
+    }
+    RenderPass scene = frame.lighting == LIGHTING_VERTEX_COLORS ? graph.AddPass("scene", [](RenderGraph&) { URender(); })
+                                                                : graph.AddPass("lit scene", [](RenderGraph&) { URenderLit(); });
+    if (frame.shadows)
+        graph.Read(scene, shadowMap);
+    graph.Write(scene, backbuffer);
+}
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.vao1);//Plane
 
-    // Linking and drawing Model1
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model1));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//sets color mode to line
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model1
+// Snapshot of the scene for the render thread: framebuffer size, transforms and the draws sorted front
+// to back by the view depth of their centers, so the depth test rejects as many hidden fragments as it
+// can before they are shaded
+void UPrepareFrame(SceneFrame& frame)
+{
+    glfwGetFramebufferSize(gWindow, &frame.width, &frame.height);
+    frame.eye = UCameraPosition();
+    USceneTransforms(frame.models, frame.view, frame.projection);
+    frame.fovY = glm::radians(gCamera.Zoom);
+    frame.aspect = gCamera.AspectRatio();
+    frame.nearPlane = gCamera.NearPlane();
+    frame.farPlane = gCamera.FarPlane();
+    frame.depthPrepass = gDepthPrepass;
+    frame.lighting = gLighting;
+    frame.shadows = gShadows;
+    frame.simulationDropped = gTimestep.DroppedSeconds();
+}
 
-    // Linking and drawing Model2
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model2));//PLANE
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
-    glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model2
 
-    // Linking and drawing Model3
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model3));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//sets color mode to fill
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model3
+// Render thread, right before the frame graph executes: adds up the mouse movement queued since the
+// last frame, turns the render thread's camera by it once ('seconds' after the last turn, for damping)
+// and latches the view the passes draw with, sorting the draws front to back along it. Returns when the
+// oldest of that movement arrived, or -1 if there was none.
+double ULatchCamera(Camera& look, const SceneFrame& frame, float seconds)
+{
+    double oldest = -1.0;
+    InputSample sample;
+    while (gMouseInput.Pop(sample))
+    {
+        look.ProcessMouseMovement(sample.dx, sample.dy);
+        if (oldest < 0.0)
+            oldest = sample.time;
+    }
+    look.Update(seconds);
+    gLatchedLook.store(LookAngles{ look.Yaw, look.Pitch }, memory_order_release);
 
-     // Linking and drawing Model4
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model4));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model4
+    look.SetPosition(frame.eye);
+    gLatchedView = look.GetViewMatrix();
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    float depths[SCENE_DRAW_COUNT];
+    for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+    {
+        const SceneDraw& draw = SCENE_DRAWS[i];
+        glm::vec4 center = gLatchedView * frame.models[draw.model] * glm::vec4(gMesh.centers[draw.object], 1.0f);
+        depths[i] = -center.z;
+        gLatchedOrder[i] = i;
+    }
+    sort(gLatchedOrder, gLatchedOrder + SCENE_DRAW_COUNT, [&depths](int a, int b) { return depths[a] < depths[b]; });
+    return oldest;
+}
 
-    glBindVertexArray(gMesh.vao2);//Starting the second VBO, Tree Trunk
 
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model1));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//sets color mode to line
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices2, GL_UNSIGNED_SHORT, NULL); // Draws the Model1. Leave for project
+// Fits the sun's cascades to the latched view and renders the casters into the layers that went stale
+void URenderShadows()
+{
+    // nothing in the scene moves, so every caster stays in the cached static layers
+    static const vector<ShadowCaster> dynamicCasters;
 
-    // Linking and drawing Model2
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model2));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices2, GL_UNSIGNED_SHORT, NULL); // Draws the Model2. Leave for project
+    gCascades->SetProjection(gFrame->fovY, gFrame->aspect, gFrame->nearPlane, gFrame->farPlane);
+    gStateCache->InvalidateBindings();
+    gCascades->Render(gLatchedView, gShadowCasters, dynamicCasters);
+    gStateCache->Invalidate();
+}
 
-    // Linking and drawing Model3
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model3));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//sets color mode to fill
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices2, GL_UNSIGNED_SHORT, NULL); // Draws the Model3. Leave for project
 
-     // Linking and drawing Model4
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model4));//Tree Trunk
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
-    glDrawElements(GL_TRIANGLES, gMesh.nIndices2, GL_UNSIGNED_SHORT, NULL); // Draws the Model4. Leave for project
+// Depth only, from the position-only streams; color writes are off and the scene pass turns them back on
+void UDepthPrepass()
+{
+    GLBackend& gl = CurrentGLBackend();
+
+    gl.Enable(GL_DEPTH_TEST);
+    gl.DepthFunc(GL_LESS);
+    gl.DepthMask(GL_TRUE);
+    gl.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    gl.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    gl.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    gl.UseProgram(gDepthProgramId);
+    if (gDepthUniforms.Program() != gDepthProgramId)
+        gDepthUniforms.Reflect(gDepthProgramId);
+    gDepthUniforms.Set(UNIFORM_VIEW, 'm', glm::value_ptr(gLatchedView), 16);
+    gDepthUniforms.Set(UNIFORM_PROJECTION, 'm', glm::value_ptr(gFrame->projection), 16);
+
+    gl.PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+    {
+        const SceneDraw& draw = SCENE_DRAWS[gLatchedOrder[i]];
+        const ShadowMesh& positions = gMesh.positions[draw.object];
+        gl.BindVertexArray(positions.vao);
+        gDepthUniforms.Set(UNIFORM_MODEL, 'm', glm::value_ptr(gFrame->models[draw.model]), 16);
+        gDepthUniforms.Flush();
+        gl.DrawElements(GL_TRIANGLES, positions.count, GL_UNSIGNED_SHORT, NULL);
+    }
+    gl.BindVertexArray(0);
+}
 
-    glBindVertexArray(0);
 
-    glBindVertexArray(gMesh.vao3);//Tree Top
+// Binds the scene texture to unit 0, or the placeholder while it streams in, and keeps it resident while in use
+void UBindSceneTexture(GLBackend& gl)
+{
+    TextureHandle texture = gTexture ? gTexture : gAssets->Resolve(gTextureRequest);
+    if (texture)
+    {
+        gl.ActiveTexture(GL_TEXTURE0);
+        gl.BindTexture(GL_TEXTURE_2D, *texture);
+        gTextures.Touch(*texture);
+    }
+}
 
-    // Linking and drawing Model1
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model1));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//sets color mode to line
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model1
 
-    // Linking and drawing Model2
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model2));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model2
+// Functioned called to render a frame
+void URender()
+{   
+    const int nrows = 10;
+    const int ncols = 10;
+    const int nlevels = 10;
 
-    // Linking and drawing Model3
-    //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model3));
-    //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);//sets color mode to fill
-    //glDrawElements(GL_TRIANGLES, gMesh.nIndices2, GL_UNSIGNED_SHORT, NULL); // Draws the Model3
+    const float xsize = 10.0f;
+    const float ysize = 10.0f;
+    const float zsize = 10.0f;
 
-     // Linking and drawing Model4
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model3));//Tree Top
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
-    glDrawElements(GL_TRIANGLES, gMesh.nIndices1, GL_UNSIGNED_SHORT, NULL); // Draws the Model4
+    GLBackend& gl = CurrentGLBackend();
+
+    // Enable z-depth; after a prepass only the nearest surface passes and depth is not written again
+    gl.Enable(GL_DEPTH_TEST);
+    if (gFrame->depthPrepass)
+    {
+        gl.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        gl.DepthFunc(GL_EQUAL);
+        gl.DepthMask(GL_FALSE);
+    }
+    else
+    {
+        gl.DepthFunc(GL_LESS);
+        gl.DepthMask(GL_TRUE);
+
+        // Clear the frame and z buffers
+        gl.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        gl.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // Set the shader to be used
+    gl.UseProgram(gProgramId);
+    UBindSceneTexture(gl);
+
+    // Passes transform matrices to the Shader program; the table is re-read after a hot reload swaps the program
+    if (gSceneUniforms.Program() != gProgramId)
+        gSceneUniforms.Reflect(gProgramId);
+    gSceneUniforms.Set(UNIFORM_VIEW, 'm', glm::value_ptr(gLatchedView), 16);
+    gSceneUniforms.Set(UNIFORM_PROJECTION, 'm', glm::value_ptr(gFrame->projection), 16);
+
+    // Draws the plane, tree trunk and tree top nearest first
+    gl.PolygonMode(GL_FRONT_AND_BACK, GL_FILL);//sets color mode to fill
+    for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+    {
+        const SceneDraw& draw = SCENE_DRAWS[gLatchedOrder[i]];
+
+        // Activate the VBOs contained within the mesh's VAO
+        gl.BindVertexArray(gMesh.vaos[draw.object]);
+
+        // Linking and drawing the model
+        gSceneUniforms.Set(UNIFORM_MODEL, 'm', glm::value_ptr(gFrame->models[draw.model]), 16);
+        gSceneUniforms.Flush();
+        gl.DrawElements(GL_TRIANGLES, gMesh.nIndices[draw.object], GL_UNSIGNED_SHORT, NULL);
+    }
 
     // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    gl.BindVertexArray(0);
+}
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+
+// Assigns the point lights to the clusters of the latched view, uploads the lists and binds them
+void UBuildClusters()
+{
+    gClusters->SetProjection(gFrame->fovY, gFrame->aspect, gFrame->nearPlane, gFrame->farPlane, gFrame->width, gFrame->height);
+    gClusters->Build(gLatchedView, gPointLights);
+    gClusters->Bind();
 }
 
 
-// Implements the UCreateMesh function
-void UCreateMesh(GLMesh& mesh)
+// The scene lit by the LightBlock through 6.multiple_lights.fs, or through clustered_lights.fs with
+// the cluster lists built for this frame, with the scene texture as its material
+void URenderLit()
+{
+    GLBackend& gl = CurrentGLBackend();
+
+    gl.Enable(GL_DEPTH_TEST);
+    gl.DepthFunc(GL_LESS);
+    gl.DepthMask(GL_TRUE);
+    gl.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    gl.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Writes the lights if they changed and binds them and the shadows, behind the state cache's back
+    gLights->Upload();
+    if (gFrame->lighting == LIGHTING_CLUSTERED)
+        UBuildClusters();
+    if (gFrame->shadows)
+        gCascades->Bind();
+    gStateCache->InvalidateBindings();
+
+    gl.UseProgram(gLitProgramId);
+    if (gLitUniforms.Program() != gLitProgramId)
+        gLitUniforms.Reflect(gLitProgramId);
+    UDrawLit(gLitUniforms);
+}
+
+
+// Draws the lit vertex arrays nearest first with the program in use, whose table is 'uniforms'
+void UDrawLit(ProgramReflection& uniforms)
+{
+    GLBackend& gl = CurrentGLBackend();
+    UBindSceneTexture(gl);
+
+    const GLint diffuseUnit = 0;
+    uniforms.Set(UNIFORM_MATERIAL_DIFFUSE, 'i', &diffuseUnit, 1);
+    uniforms.Set(UNIFORM_MATERIAL_SHININESS, 'f', &LIT_SHININESS, 1);
+    uniforms.Set(UNIFORM_VIEW, 'm', glm::value_ptr(gLatchedView), 16);
+    uniforms.Set(UNIFORM_PROJECTION, 'm', glm::value_ptr(gFrame->projection), 16);
+    uniforms.Set(UNIFORM_VIEW_POS, 'f', glm::value_ptr(gFrame->eye), 3);
+
+    gl.PolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+    {
+        const SceneDraw& draw = SCENE_DRAWS[gLatchedOrder[i]];
+        gl.BindVertexArray(gMesh.litVaos[draw.object]);
+        uniforms.Set(UNIFORM_MODEL, 'm', glm::value_ptr(gFrame->models[draw.model]), 16);
+        uniforms.Flush();
+        gl.DrawElements(GL_TRIANGLES, gMesh.nIndices[draw.object], GL_UNSIGNED_SHORT, NULL);
+    }
+    gl.BindVertexArray(0);
+}
+
+
+// Deferred path, first pass: the lit vertex arrays into the G-buffer, which the renderer binds and clears
+void UDeferredGeometry()
+{
+    GLBackend& gl = CurrentGLBackend();
+
+    // the renderer sets its framebuffer, viewport and depth state itself
+    gDeferred->BeginGeometry();
+    gStateCache->Invalidate();
+
+    GLuint program = gDeferred->GeometryProgram();
+    gl.UseProgram(program);
+    if (gGeometryUniforms.Program() != program)
+        gGeometryUniforms.Reflect(program);
+    UDrawLit(gGeometryUniforms);
+
+    // sends the pending VAO unbinding before the framebuffer changes
+    gStateCache->InvalidateBindings();
+    gDeferred->EndGeometry();
+}
+
+
+// Deferred path, second pass: lights the G-buffer into the window, with the point lights either listed
+// per cluster of the latched view or drawn as volumes
+void UDeferredShade()
+{
+    GLBackend& gl = CurrentGLBackend();
+
+    // the lighting only writes where the G-buffer holds a surface
+    gl.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    gl.Clear(GL_COLOR_BUFFER_BIT);
+    gStateCache->InvalidateBindings();
+
+    gLights->Upload();
+    if (gClusters != nullptr)
+        UBuildClusters();
+    if (gFrame->shadows)
+        gCascades->Bind();
+    gDeferred->Shade(gLatchedView, gFrame->projection, gFrame->eye, gPointLights, gClusters);
+    gStateCache->Invalidate();
+}
+
+
+// Fills the CPU copy of every scene object
+void UBuildScene(SceneObject objects[SCENE_OBJECT_COUNT])
 {
     // Position and Color data
     GLfloat verts1[] = {//tree trunk
@@ -644,208 +1434,338 @@ void UCreateMesh(GLMesh& mesh)
         2, 3, 1
     };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
+    objects[SCENE_PLANE].vertices.assign(verts3, verts3 + sizeof(verts3) / sizeof(verts3[0]));
+    objects[SCENE_PLANE].indices.assign(indices3, indices3 + sizeof(indices3) / sizeof(indices3[0]));
+    objects[SCENE_TRUNK].vertices.assign(verts1, verts1 + sizeof(verts1) / sizeof(verts1[0]));
+    objects[SCENE_TRUNK].indices.assign(indices1, indices1 + sizeof(indices1) / sizeof(indices1[0]));
+    objects[SCENE_TREE_TOP].vertices.assign(verts2, verts2 + sizeof(verts2) / sizeof(verts2[0]));
+    objects[SCENE_TREE_TOP].indices.assign(indices2, indices2 + sizeof(indices2) / sizeof(indices2[0]));
+
+    // Trace sun, sky and occlusion into the scene's colors, with every draw placed by its own model,
+    // so the tree shades the plane and the top shades the trunk. Each object is drawn once, so its
+    // colors can hold the light of that one placement
+    if (gBakeLighting && gJobs != nullptr)
+    {
+        const size_t floatsPerBakedVertex = FLOATS_PER_VERTEX + FLOATS_PER_COLOR;
+        glm::mat4 models[4];
+        USceneModels(models);
 
-    //------------------------OBJECT 1(PLANE)----------------------------------------------------
+        LightBaker baker(*gJobs);
+        size_t meshes[SCENE_DRAW_COUNT];
+        for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+        {
+            const SceneObject& object = objects[SCENE_DRAWS[i].object];
+            meshes[i] = baker.AddMesh(object.vertices.data(), object.vertices.size() / floatsPerBakedVertex, floatsPerBakedVertex, FLOATS_PER_VERTEX,
+                                      object.indices.data(), object.indices.size(), models[SCENE_DRAWS[i].model]);
+        }
+        baker.Build();
+        for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+            baker.BakeVertexColors(meshes[i], objects[SCENE_DRAWS[i].object].vertices.data());
+        cout << "INFO: Baked lighting into " << baker.TriangleCount() << " triangles" << endl;
+    }
+}
 
-    glGenVertexArrays(2, &mesh.vao1); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao1);
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices. THIS THE PLANE OF THE SCENE
-    glGenBuffers(2, mesh.vbos1);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos1[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts3), verts3, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    //glBufferData(GL_ARRAY_BUFFER, sizeof(verts2), verts2, GL_STATIC_DRAW);
+// Lights of the lit path: a sun, a spot light on the tree and gPointLightCount colored point lights
+// spread over the plane, of which the first LIGHT_BLOCK_MAX_POINT_LIGHTS go into the block
+void UBuildLights(LightBlock& lights)
+{
+    LightBlockDirLight sun;
+    memset(static_cast<void*>(&sun), 0, sizeof(sun));
+    sun.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+    sun.ambient = glm::vec3(0.05f);
+    sun.diffuse = glm::vec3(0.4f);
+    sun.specular = glm::vec3(0.5f);
+    lights.SetDirLight(sun);
+
+    LightBlockSpotLight spot;
+    memset(static_cast<void*>(&spot), 0, sizeof(spot));
+    spot.position = glm::vec3(23.0f, 10.0f, 1.0f);
+    spot.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    spot.cutOff = cosf(glm::radians(12.5f));
+    spot.outerCutOff = cosf(glm::radians(17.5f));
+    spot.diffuse = glm::vec3(1.0f);
+    spot.specular = glm::vec3(1.0f);
+    spot.constant = 1.0f;
+    spot.linear = 0.022f;
+    spot.quadratic = 0.0019f;
+    lights.SetSpotLight(spot);
+
+    gPointLights.resize(size_t(max(gPointLightCount, 0)));
+    for (size_t i = 0; i < gPointLights.size(); ++i)
+    {
+        // a golden angle spiral covers the plane evenly for any number of lights
+        float angle = float(i) * 2.3999632f;
+        float radius = 14.0f * sqrtf((float(i) + 0.5f) / float(gPointLights.size()));
+        glm::vec3 color = glm::vec3(0.5f) + 0.5f * glm::vec3(cosf(angle), cosf(angle + 2.0943951f), cosf(angle + 4.1887902f));
+
+        LightBlockPointLight& light = gPointLights[i];
+        light.position = glm::vec3(4.0f + radius * cosf(angle), -0.5f, radius * sinf(angle));
+        light.ambient = color * 0.05f;
+        light.diffuse = color;
+        light.specular = color;
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        light.radius = PointLightRange(light);
+        lights.SetPointLight(int(i), light);
+    }
+    lights.SetPointLightCount(int(gPointLights.size()));
+}
 
-    mesh.nIndices1 = sizeof(indices1) / sizeof(indices1[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos1[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices3), indices3, GL_STATIC_DRAW);
-    
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride1 = sizeof(float) * (floatsPerVertex + floatsPerColor);// The number of floats before each
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride1, 0);
-    glEnableVertexAttribArray(0);
+// Position, normal and texture coordinates of every vertex of a scene object, for the lit programs.
+// The scene's triangles do not share one winding, so each face normal is turned away from the
+// object's center (or up, for a flat object) in world space under the model the object is drawn
+// with, then taken back to model space for the shader's normal matrix.
+void ULitVertices(const SceneObject& object, const glm::mat4& model, vector<GLfloat>& lit)
+{
+    const size_t stride = FLOATS_PER_VERTEX + FLOATS_PER_COLOR;
+    const size_t vertexCount = object.vertices.size() / stride;
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride1, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    vector<glm::vec3> world(vertexCount);
+    glm::vec3 center(0.0f);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const GLfloat* position = &object.vertices[v * stride];
+        world[v] = glm::vec3(model * glm::vec4(position[0], position[1], position[2], 1.0f));
+        center += world[v];
+    }
+    center /= float(max(vertexCount, size_t(1)));
 
-    //-------------------------OBJECT 2(Tree Trunk)-----------------------------------------------------
+    // area-weighted face normals summed per vertex
+    const glm::mat3 toModel = glm::transpose(glm::mat3(model));
+    vector<glm::vec3> normals(vertexCount, glm::vec3(0.0f));
+    for (size_t t = 0; t + 2 < object.indices.size(); t += 3)
+    {
+        const GLushort* corner = &object.indices[t];
+        glm::vec3 normal = glm::cross(world[corner[1]] - world[corner[0]], world[corner[2]] - world[corner[0]]);
+        float area = glm::length(normal);
+        if (area <= 0.0f)
+            continue;
+        glm::vec3 outward = (world[corner[0]] + world[corner[1]] + world[corner[2]]) / 3.0f - center;
+        float side = glm::dot(normal / area, outward);
+        if (side < -1e-4f || (side <= 1e-4f && normal.y < 0.0f))
+            normal = -normal;
+        for (int k = 0; k < 3; ++k)
+            normals[corner[k]] += toModel * normal;
+    }
 
-    glGenVertexArrays(2, &mesh.vao2); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao2);
+    lit.clear();
+    lit.reserve(vertexCount * (FLOATS_PER_VERTEX + FLOATS_PER_NORMAL + FLOATS_PER_UV));
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const GLfloat* position = &object.vertices[v * stride];
+        glm::vec3 normal = glm::length(normals[v]) > 0.0f ? glm::normalize(normals[v]) : glm::vec3(0.0f, 1.0f, 0.0f);
+        // the texture is projected straight down onto the object
+        const GLfloat vertex[] = { position[0], position[1], position[2], normal.x, normal.y, normal.z,
+                                   position[0] * 0.5f + 0.5f, position[2] * 0.5f + 0.5f };
+        lit.insert(lit.end(), vertex, vertex + sizeof(vertex) / sizeof(vertex[0]));
+    }
+}
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(2, mesh.vbos2);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos2[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts1), verts1, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts1), verts1, GL_STATIC_DRAW);
 
-    mesh.nIndices2 = sizeof(indices1) / sizeof(indices1[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos2[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices1), indices1, GL_STATIC_DRAW);
+// Implements the UCreateMesh function
+void UCreateMesh(GLMesh& mesh, const SceneObject objects[SCENE_OBJECT_COUNT])
+{
+    GLBackend& gl = CurrentGLBackend();
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride2 = sizeof(float) * (floatsPerVertex + floatsPerColor);// The number of floats before each
+    // Strides between vertex coordinates is 7 (x, y, z, r, g, b, a). A tightly packed stride is 0.
+    const GLint stride = sizeof(float) * (FLOATS_PER_VERTEX + FLOATS_PER_COLOR);
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride2, 0);
-    glEnableVertexAttribArray(0);
+    gl.GenVertexArrays(SCENE_OBJECT_COUNT, mesh.vaos); // we can also generate multiple VAOs or buffers at the same time
+    for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+    {
+        gl.BindVertexArray(mesh.vaos[i]);
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride2, (char*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        // Create 2 buffers: first one for the vertex data; second one for the indices
+        gl.GenBuffers(2, mesh.vbos[i]);
+        gl.BindBuffer(GL_ARRAY_BUFFER, mesh.vbos[i][0]); // Activates the buffer
+        gl.BufferData(GL_ARRAY_BUFFER, objects[i].vertices.size() * sizeof(GLfloat), objects[i].vertices.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    //------------------------OBJECT 3(Tree Top)----------------------------------------------------
+        mesh.nIndices[i] = GLuint(objects[i].indices.size());
+        gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[i][1]);
+        gl.BufferData(GL_ELEMENT_ARRAY_BUFFER, objects[i].indices.size() * sizeof(GLushort), objects[i].indices.data(), GL_STATIC_DRAW);
 
-    glGenVertexArrays(2, &mesh.vao3); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao3);
+        // Create Vertex Attribute Pointers
+        gl.VertexAttribPointer(0, FLOATS_PER_VERTEX, GL_FLOAT, GL_FALSE, stride, 0);
+        gl.EnableVertexAttribArray(0);
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices. THIS THE PLANE OF THE SCENE
-    glGenBuffers(2, mesh.vbos3);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos3[0]); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts2), verts2, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts2), verts2, GL_STATIC_DRAW);
+        gl.VertexAttribPointer(1, FLOATS_PER_COLOR, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * FLOATS_PER_VERTEX));
+        gl.EnableVertexAttribArray(1);
 
-    mesh.nIndices1 = sizeof(indices2) / sizeof(indices2[0]);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos3[1]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices2), indices2, GL_STATIC_DRAW);
+        // Bounding box center, the point draws are sorted by
+        const size_t floatsPerVertex = FLOATS_PER_VERTEX + FLOATS_PER_COLOR;
+        glm::vec3 low(objects[i].vertices[0], objects[i].vertices[1], objects[i].vertices[2]);
+        glm::vec3 high = low;
+        for (size_t v = floatsPerVertex; v + 2 < objects[i].vertices.size(); v += floatsPerVertex)
+        {
+            glm::vec3 position(objects[i].vertices[v], objects[i].vertices[v + 1], objects[i].vertices[v + 2]);
+            low = glm::min(low, position);
+            high = glm::max(high, position);
+        }
+        mesh.centers[i] = (low + high) * 0.5f;
+        mesh.extents[i] = (high - low) * 0.5f;
+    }
+    gl.BindVertexArray(0);
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride3 = sizeof(float) * (floatsPerVertex + floatsPerColor);// The number of floats before each
+    // Normals and texture coordinates for the lit path, computed under the model each object is drawn with
+    if (gLighting != LIGHTING_VERTEX_COLORS)
+    {
+        const GLint litStride = sizeof(float) * (FLOATS_PER_VERTEX + FLOATS_PER_NORMAL + FLOATS_PER_UV);
+        glm::mat4 models[4];
+        USceneModels(models);
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride1, 0);
-    glEnableVertexAttribArray(0);
+        gl.GenVertexArrays(SCENE_OBJECT_COUNT, mesh.litVaos);
+        gl.GenBuffers(SCENE_OBJECT_COUNT, mesh.litVbos);
+        for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+        {
+            SceneObjectId object = SCENE_DRAWS[i].object;
+            vector<GLfloat> lit;
+            ULitVertices(objects[object], models[SCENE_DRAWS[i].model], lit);
+
+            gl.BindVertexArray(mesh.litVaos[object]);
+            gl.BindBuffer(GL_ARRAY_BUFFER, mesh.litVbos[object]);
+            gl.BufferData(GL_ARRAY_BUFFER, lit.size() * sizeof(GLfloat), lit.data(), GL_STATIC_DRAW);
+            gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[object][1]);
+
+            gl.VertexAttribPointer(0, FLOATS_PER_VERTEX, GL_FLOAT, GL_FALSE, litStride, 0);
+            gl.EnableVertexAttribArray(0);
+            gl.VertexAttribPointer(1, FLOATS_PER_NORMAL, GL_FLOAT, GL_FALSE, litStride, (char*)(sizeof(float) * FLOATS_PER_VERTEX));
+            gl.EnableVertexAttribArray(1);
+            gl.VertexAttribPointer(2, FLOATS_PER_UV, GL_FLOAT, GL_FALSE, litStride, (char*)(sizeof(float) * (FLOATS_PER_VERTEX + FLOATS_PER_NORMAL)));
+            gl.EnableVertexAttribArray(2);
+        }
+        gl.BindVertexArray(0);
+    }
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride1, (char*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    // A third of the bytes per vertex for the depth prepass and the shadows, which only need positions
+    if (gDepthPrepass || gShadows)
+        for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+            CreateShadowMesh(mesh.positions[i], objects[i].vertices.data(), objects[i].vertices.size() / (FLOATS_PER_VERTEX + FLOATS_PER_COLOR),
+                             FLOATS_PER_VERTEX + FLOATS_PER_COLOR, objects[i].indices.data(), objects[i].indices.size());
 }
 
 
-void UDestroyMesh(GLMesh& mesh)
+// One static shadow caster per scene draw, with a world space sphere around its bounding box
+void UBuildShadowCasters(const GLMesh& mesh, vector<ShadowCaster>& casters)
 {
-    glDeleteVertexArrays(1, &mesh.vao1);
-    glDeleteVertexArrays(1, &mesh.vao2);
-    glDeleteVertexArrays(1, &mesh.vao3);
-    glDeleteBuffers(2, mesh.vbos1);
-    glDeleteBuffers(2, mesh.vbos2);
-    glDeleteBuffers(2, mesh.vbos3);
+    glm::mat4 models[4];
+    USceneModels(models);
+
+    casters.resize(SCENE_DRAW_COUNT);
+    for (int i = 0; i < SCENE_DRAW_COUNT; ++i)
+    {
+        const SceneDraw& draw = SCENE_DRAWS[i];
+        const glm::mat4& model = models[draw.model];
+        float scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+        ShadowCaster& caster = casters[i];
+        caster.mesh = &mesh.positions[draw.object];
+        caster.model = model;
+        caster.center = glm::vec3(model * glm::vec4(mesh.centers[draw.object], 1.0f));
+        caster.radius = glm::length(mesh.extents[draw.object]) * scale;
+    }
 }
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+
+void UDestroyMesh(GLMesh& mesh)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    GLBackend& gl = CurrentGLBackend();
+    gl.DeleteVertexArrays(SCENE_OBJECT_COUNT, mesh.vaos);
+    gl.DeleteVertexArrays(SCENE_OBJECT_COUNT, mesh.litVaos);
+    gl.DeleteBuffers(SCENE_OBJECT_COUNT, mesh.litVbos);
+    for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
     {
-        flipImageVertically(image, width, height, channels);
+        gl.DeleteBuffers(2, mesh.vbos[i]);
+        DestroyShadowMesh(mesh.positions[i]);
+    }
+}
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// Renders one frame of the scene with the software rasterizer and writes it to a PPM image
+bool URenderSoftware(const char* filename)
+{
+    // Worker threads; every core shades tiles
+    JobSystem jobs;
+    gJobs = &jobs;
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
-        {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
-        }
+    SceneObject objects[SCENE_OBJECT_COUNT];
+    UBuildScene(objects);
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+    glm::mat4 models[4], view, projection;
+    USceneTransforms(models, view, projection);
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+    SoftRasterizer rasterizer(jobs);
+    rasterizer.Resize(WINDOW_WIDTH, WINDOW_HEIGHT);
+    rasterizer.SetClearColor(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
 
-        return true;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    rasterizer.Begin(view, projection);
+    for (size_t i = 0; i < sizeof(SCENE_DRAWS) / sizeof(SCENE_DRAWS[0]); ++i)
+    {
+        const SceneObject& object = objects[SCENE_DRAWS[i].object];
+        SoftDraw draw;
+        draw.vertices = object.vertices.data();
+        draw.stride = FLOATS_PER_VERTEX + FLOATS_PER_COLOR;
+        draw.vertexCount = object.vertices.size() / draw.stride;
+        draw.colorOffset = FLOATS_PER_VERTEX;
+        draw.indices = object.indices.data();
+        draw.indexCount = object.indices.size();
+        draw.model = models[SCENE_DRAWS[i].model];
+        rasterizer.Draw(draw);
     }
+    rasterizer.End();
+    double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-    // Error loading the image
-    return false;
+    gJobs = nullptr;
+    cout << "INFO: Software frame of " << rasterizer.TriangleCount() << " triangles in " << milliseconds << " ms on "
+         << jobs.WorkerCount() << " workers" << endl;
+    return rasterizer.WritePpm(filename);
 }
 
-
-void UDestroyTexture(GLuint textureId)
+/*Generate and load the texture, sharing it with every other user of the same image*/
+bool UCreateTexture(const char* filename, TextureHandle& texture)
 {
-    glGenTextures(1, &textureId);
+    texture = gTextures.Acquire(filename);
+    return texture != nullptr;
 }
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+void UDestroyTexture(TextureHandle& texture)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
+    texture.reset();
+}
 
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+void UDestroyShaderProgram(GLuint programId)
+{
+    glDeleteProgram(programId);
+}
 
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
 
-        return false;
-    }
+// Reads a shader from the mounted asset pack or from disk, expanding its #includes
+bool UReadShaderFile(const char* filename, string& source)
+{
+    return PreprocessShader(filename, ShaderDefines(), source);
+}
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
 
-        return false;
-    }
+// Cooks every scene asset into a single memory-mappable pack
+bool UCookAssetPack(const char* packFilename)
+{
+    AssetPackWriter writer;
+    bool complete = true;
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+    for (size_t i = 0; i < sizeof(PACK_TEXTURES) / sizeof(PACK_TEXTURES[0]); ++i)
+        complete &= writer.AddTexture(PACK_TEXTURES[i], PACK_TEXTURES[i]);
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    for (size_t i = 0; i < sizeof(PACK_SHADERS) / sizeof(PACK_SHADERS[0]); ++i)
+        complete &= writer.AddFile(PACK_SHADERS[i], PACK_SHADERS[i], ASSET_SHADER);
 
+    if (!writer.Write(packFilename))
         return false;
-    }
-
-    glUseProgram(programId);    // Uses the shader program
 
+    cout << "INFO: Cooked asset pack " << packFilename << (complete ? "" : " (some assets were skipped)") << endl;
     return true;
 }
-
-
-void UDestroyShaderProgram(GLuint programId)
-{
-    glDeleteProgram(programId);
-}
-
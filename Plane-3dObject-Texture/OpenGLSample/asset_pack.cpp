@@ -0,0 +1,396 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "stb_image.h"
+#include "resource_cache.h"
+#include "asset_pack.h"
+
+namespace
+{
+    AssetPack gMountedPack;
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+
+uint64_t AssetNameHash(const std::string& name)
+{
+    uint64_t hash = HashString(NormalizePath(name));
+    return hash != 0 ? hash : 1;
+}
+
+
+AssetPack::AssetPack() : base(nullptr), length(0)
+#ifdef _WIN32
+    , fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#else
+    , fd(-1)
+#endif
+{
+}
+
+
+AssetPack::~AssetPack()
+{
+    Close();
+}
+
+
+bool AssetPack::Open(const char* path, unsigned flags)
+{
+    Close();
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(fileHandle, &size);
+    length = uint64_t(size.QuadPart);
+
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle != NULL)
+        base = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+
+    // huge pages are not available for file mappings on Windows; populating means touching every page
+    if (base != nullptr && (flags & ASSET_PACK_POPULATE))
+    {
+        volatile unsigned char sink = 0;
+        for (uint64_t offset = 0; offset < length; offset += 4096)
+            sink ^= base[offset];
+        (void)sink;
+    }
+#else
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        Close();
+        return false;
+    }
+    length = uint64_t(info.st_size);
+
+    int mapFlags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (flags & ASSET_PACK_POPULATE)
+        mapFlags |= MAP_POPULATE;
+#endif
+    void* mapping = length > 0 ? mmap(NULL, size_t(length), PROT_READ, mapFlags, fd, 0) : MAP_FAILED;
+    if (mapping != MAP_FAILED)
+    {
+        base = static_cast<const unsigned char*>(mapping);
+#ifdef MADV_HUGEPAGE
+        if (flags & ASSET_PACK_HUGE_PAGES)
+            madvise(mapping, size_t(length), MADV_HUGEPAGE);
+#endif
+#ifndef MAP_POPULATE
+        if (flags & ASSET_PACK_POPULATE)
+            madvise(mapping, size_t(length), MADV_WILLNEED);
+#endif
+    }
+#endif
+
+    if (base == nullptr)
+    {
+        std::cout << "ERROR::ASSET_PACK::MAP_FAILED " << path << std::endl;
+        Close();
+        return false;
+    }
+
+    // validate the header and table before trusting any offsets in them
+    const AssetPackHeader* h = header();
+    bool valid = length >= sizeof(AssetPackHeader) &&
+        h->magic == ASSET_PACK_MAGIC &&
+        h->version == ASSET_PACK_VERSION &&
+        h->tableSlots != 0 && (h->tableSlots & (h->tableSlots - 1)) == 0 &&
+        h->tableOffset % ASSET_PACK_ALIGNMENT == 0 &&
+        h->tableOffset + uint64_t(h->tableSlots) * sizeof(AssetPackEntry) <= length;
+    if (!valid)
+    {
+        std::cout << "ERROR::ASSET_PACK::INVALID " << path << std::endl;
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+
+void AssetPack::Close()
+{
+#ifdef _WIN32
+    if (base != nullptr)
+        UnmapViewOfFile(base);
+    if (mappingHandle != NULL)
+        CloseHandle(mappingHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(fileHandle);
+    mappingHandle = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (base != nullptr)
+        munmap(const_cast<unsigned char*>(base), size_t(length));
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+#endif
+    base = nullptr;
+    length = 0;
+}
+
+
+AssetView AssetPack::Find(const std::string& name) const
+{
+    AssetView view;
+    if (!IsOpen())
+        return view;
+
+    std::string normalized = NormalizePath(name);
+    uint64_t hash = AssetNameHash(normalized);
+    uint32_t mask = header()->tableSlots - 1;
+    const AssetPackEntry* entries = table();
+
+    for (uint32_t probe = 0; probe <= mask; ++probe)
+    {
+        const AssetPackEntry& entry = entries[(uint32_t(hash) + probe) & mask];
+        if (entry.nameHash == 0)
+            break;
+        if (entry.nameHash != hash || entry.nameLength != normalized.size())
+            continue;
+        if (entry.nameOffset + entry.nameLength > length ||
+            memcmp(base + entry.nameOffset, normalized.data(), normalized.size()) != 0)
+            continue;
+
+        if (entry.offset + entry.size > length)
+            break;
+        view.data = base + entry.offset;
+        view.size = entry.size;
+        view.contentHash = entry.contentHash;
+        view.type = entry.type;
+        break;
+    }
+    return view;
+}
+
+
+bool AssetPackWriter::AddFile(const std::string& name, const char* path, AssetType type)
+{
+    Pending asset;
+    asset.name = name;
+    asset.type = type;
+    if (!ReadFileBytes(path, asset.bytes))
+    {
+        std::cout << "ERROR::ASSET_PACK::FILE_NOT_FOUND " << path << std::endl;
+        return false;
+    }
+    assets.push_back(asset);
+    return true;
+}
+
+
+bool AssetPackWriter::AddTexture(const std::string& name, const char* path)
+{
+    // cook the texture upside down once so the runtime can upload it without touching the pixels; the
+    // rows are flipped while copying, since stb_image's flip flag is shared with loads on other threads
+    int width, height, channels;
+    unsigned char* image = stbi_load(path, &width, &height, &channels, 0);
+    if (!image)
+    {
+        std::cout << "ERROR::ASSET_PACK::TEXTURE_NOT_LOADED " << path << std::endl;
+        return false;
+    }
+    if (channels != 3 && channels != 4)
+    {
+        std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
+        stbi_image_free(image);
+        return false;
+    }
+
+    CookedTextureHeader cooked;
+    memset(&cooked, 0, sizeof(cooked));
+    cooked.width = uint32_t(width);
+    cooked.height = uint32_t(height);
+    cooked.channels = uint32_t(channels);
+
+    Pending asset;
+    asset.name = name;
+    asset.type = ASSET_TEXTURE;
+    size_t pixelBytes = size_t(width) * height * channels;
+    asset.bytes.resize(sizeof(cooked) + pixelBytes);
+    memcpy(&asset.bytes[0], &cooked, sizeof(cooked));
+    size_t rowBytes = size_t(width) * channels;
+    for (int row = 0; row < height; ++row)
+        memcpy(&asset.bytes[sizeof(cooked) + rowBytes * row], image + rowBytes * (height - 1 - row), rowBytes);
+    stbi_image_free(image);
+
+    assets.push_back(asset);
+    return true;
+}
+
+
+void AssetPackWriter::AddMesh(const std::string& name, const float* vertices, uint32_t vertexCount, uint32_t floatsPerVertex,
+    const uint32_t* indices, uint32_t indexCount)
+{
+    CookedMeshHeader cooked;
+    memset(&cooked, 0, sizeof(cooked));
+    cooked.vertexCount = vertexCount;
+    cooked.indexCount = indexCount;
+    cooked.floatsPerVertex = floatsPerVertex;
+
+    size_t vertexBytes = size_t(vertexCount) * floatsPerVertex * sizeof(float);
+    size_t indexBytes = size_t(indexCount) * sizeof(uint32_t);
+
+    Pending asset;
+    asset.name = name;
+    asset.type = ASSET_MESH;
+    asset.bytes.resize(sizeof(cooked) + vertexBytes + indexBytes);
+    memcpy(&asset.bytes[0], &cooked, sizeof(cooked));
+    memcpy(&asset.bytes[sizeof(cooked)], vertices, vertexBytes);
+    memcpy(&asset.bytes[sizeof(cooked) + vertexBytes], indices, indexBytes);
+    assets.push_back(asset);
+}
+
+
+void AssetPackWriter::AddBlob(const std::string& name, const void* data, size_t size, AssetType type)
+{
+    Pending asset;
+    asset.name = name;
+    asset.type = type;
+    asset.bytes.assign(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size);
+    assets.push_back(asset);
+}
+
+
+bool AssetPackWriter::Write(const char* path) const
+{
+    uint32_t slots = 8;
+    while (slots < assets.size() * 2)
+        slots *= 2;
+    std::vector<AssetPackEntry> entries(slots);
+    memset(&entries[0], 0, entries.size() * sizeof(AssetPackEntry));
+
+    // lay the blobs out back to back on 64-byte boundaries after the header
+    uint64_t offset = alignUp(sizeof(AssetPackHeader), ASSET_PACK_ALIGNMENT);
+    std::vector<uint64_t> offsets(assets.size());
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        offsets[i] = offset;
+        offset = alignUp(offset + assets[i].bytes.size(), ASSET_PACK_ALIGNMENT);
+    }
+
+    // then the names, so lookups can tell colliding hashes apart
+    std::vector<std::string> names(assets.size());
+    uint64_t namesOffset = offset;
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        names[i] = NormalizePath(assets[i].name);
+        offset += names[i].size();
+    }
+    offset = alignUp(offset, ASSET_PACK_ALIGNMENT);
+
+    std::vector<size_t> slotAssets(slots);     // asset stored in each filled slot
+    uint64_t nameOffset = namesOffset;
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        uint64_t hash = AssetNameHash(names[i]);
+        uint32_t slot = uint32_t(hash) & (slots - 1);
+        for (; entries[slot].nameHash != 0; slot = (slot + 1) & (slots - 1))
+        {
+            if (entries[slot].nameHash == hash && names[slotAssets[slot]] == names[i])
+            {
+                std::cout << "ERROR::ASSET_PACK::DUPLICATE_NAME " << assets[i].name << std::endl;
+                return false;
+            }
+        }
+
+        AssetPackEntry& entry = entries[slot];
+        entry.nameHash = hash;
+        entry.contentHash = HashBytes(assets[i].bytes.data(), assets[i].bytes.size());
+        entry.offset = offsets[i];
+        entry.size = assets[i].bytes.size();
+        entry.nameOffset = nameOffset;
+        entry.nameLength = uint32_t(names[i].size());
+        entry.type = assets[i].type;
+        slotAssets[slot] = i;
+        nameOffset += names[i].size();
+    }
+
+    AssetPackHeader header;
+    header.magic = ASSET_PACK_MAGIC;
+    header.version = ASSET_PACK_VERSION;
+    header.tableSlots = slots;
+    header.entryCount = 0;
+    for (uint32_t i = 0; i < slots; ++i)
+        header.entryCount += entries[i].nameHash != 0 ? 1 : 0;
+    header.tableOffset = offset;
+    header.fileSize = offset + slots * sizeof(AssetPackEntry);
+
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+
+    static const char padding[ASSET_PACK_ALIGNMENT] = { 0 };
+    uint64_t written = 0;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    written += sizeof(header);
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        file.write(padding, std::streamsize(offsets[i] - written));
+        file.write(reinterpret_cast<const char*>(assets[i].bytes.data()), std::streamsize(assets[i].bytes.size()));
+        written = offsets[i] + assets[i].bytes.size();
+    }
+    file.write(padding, std::streamsize(namesOffset - written));
+    written = namesOffset;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        file.write(names[i].data(), std::streamsize(names[i].size()));
+        written += names[i].size();
+    }
+    file.write(padding, std::streamsize(header.tableOffset - written));
+    file.write(reinterpret_cast<const char*>(&entries[0]), std::streamsize(slots * sizeof(AssetPackEntry)));
+
+    return file.good();
+}
+
+
+AssetPack* MountedAssetPack()
+{
+    return gMountedPack.IsOpen() ? &gMountedPack : nullptr;
+}
+
+
+bool MountAssetPack(const char* path, unsigned flags)
+{
+    if (!gMountedPack.Open(path, flags))
+        return false;
+    std::cout << "INFO: Mounted asset pack " << path << " (" << gMountedPack.EntryCount() << " assets)" << std::endl;
+    return true;
+}
+
+
+void UnmountAssetPack()
+{
+    gMountedPack.Close();
+}
@@ -0,0 +1,160 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Single-file asset pack
+ *
+ * [AssetPackHeader][blob][blob]...[names][AssetPackEntry table]
+ *
+ * Every blob starts on a 64-byte boundary so it can be handed to GL (or SIMD code) straight from
+ * the mapping. The table of contents is an open-addressed hash table keyed by the hash of the
+ * normalized asset name, so a lookup touches one or two entries instead of scanning the pack. Each
+ * entry also points at its normalized name, which a lookup compares, so a hash collision can never
+ * return the wrong asset.
+ */
+
+const uint32_t ASSET_PACK_MAGIC = 0x4B415041;  // "APAK"
+const uint32_t ASSET_PACK_VERSION = 2;
+const uint64_t ASSET_PACK_ALIGNMENT = 64;
+
+enum AssetType
+{
+    ASSET_RAW = 0,      // bytes exactly as they were on disk
+    ASSET_SHADER = 1,   // GLSL source text
+    ASSET_TEXTURE = 2,  // CookedTextureHeader followed by flipped, tightly packed level 0 pixels
+    ASSET_MESH = 3,     // CookedMeshHeader followed by vertex floats and 32-bit indices
+};
+
+struct AssetPackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tableSlots;    // power of two
+    uint32_t entryCount;
+    uint64_t tableOffset;
+    uint64_t fileSize;
+};
+
+struct AssetPackEntry
+{
+    uint64_t nameHash;      // 0 marks an empty slot
+    uint64_t contentHash;   // XXH64 of the blob, used as the resource cache key
+    uint64_t offset;
+    uint64_t size;
+    uint64_t nameOffset;    // normalized name, not terminated
+    uint32_t nameLength;
+    uint32_t type;
+};
+
+struct CookedTextureHeader
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;      // 3 or 4
+    uint32_t reserved[13];  // pads the header to 64 bytes so the pixels stay aligned
+};
+
+struct CookedMeshHeader
+{
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t floatsPerVertex;
+    uint32_t reserved[13];  // pads the header to 64 bytes so the vertices stay aligned
+};
+
+// A read-only view of one blob inside a mapped pack
+struct AssetView
+{
+    const unsigned char* data;
+    uint64_t size;
+    uint64_t contentHash;
+    uint32_t type;
+
+    AssetView() : data(nullptr), size(0), contentHash(0), type(ASSET_RAW) {}
+    bool valid() const { return data != nullptr; }
+
+    const CookedTextureHeader* texture() const { return reinterpret_cast<const CookedTextureHeader*>(data); }
+    const unsigned char* texturePixels() const { return data + sizeof(CookedTextureHeader); }
+
+    const CookedMeshHeader* mesh() const { return reinterpret_cast<const CookedMeshHeader*>(data); }
+    const float* meshVertices() const { return reinterpret_cast<const float*>(data + sizeof(CookedMeshHeader)); }
+    const uint32_t* meshIndices() const { return reinterpret_cast<const uint32_t*>(meshVertices() + size_t(mesh()->vertexCount) * mesh()->floatsPerVertex); }
+};
+
+// Flags for AssetPack::Open
+const unsigned ASSET_PACK_POPULATE = 1u << 0;     // prefault the whole mapping up front (MAP_POPULATE)
+const unsigned ASSET_PACK_HUGE_PAGES = 1u << 1;   // ask for transparent huge pages on the mapping
+
+
+// Memory-maps a pack written by AssetPackWriter and resolves asset names to zero-copy views.
+class AssetPack
+{
+public:
+    AssetPack();
+    ~AssetPack();
+
+    bool Open(const char* path, unsigned flags = 0);
+    void Close();
+    bool IsOpen() const { return base != nullptr; }
+
+    // looks up an asset by name; returns an invalid view if the pack does not contain it
+    AssetView Find(const std::string& name) const;
+
+    uint32_t EntryCount() const { return IsOpen() ? header()->entryCount : 0; }
+
+private:
+    const unsigned char* base;
+    uint64_t length;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fd;
+#endif
+
+    const AssetPackHeader* header() const { return reinterpret_cast<const AssetPackHeader*>(base); }
+    const AssetPackEntry* table() const { return reinterpret_cast<const AssetPackEntry*>(base + header()->tableOffset); }
+
+    AssetPack(const AssetPack&);
+    AssetPack& operator=(const AssetPack&);
+};
+
+
+// Builds a pack on disk from loose files (the "cook" step).
+class AssetPackWriter
+{
+public:
+    // adds a file verbatim; shaders should use ASSET_SHADER so loaders know they are text
+    bool AddFile(const std::string& name, const char* path, AssetType type = ASSET_RAW);
+    // decodes an image and stores it flipped and ready for glTexImage2D
+    bool AddTexture(const std::string& name, const char* path);
+    // stores interleaved vertices and 32-bit indices ready for glBufferData
+    void AddMesh(const std::string& name, const float* vertices, uint32_t vertexCount, uint32_t floatsPerVertex,
+        const uint32_t* indices, uint32_t indexCount);
+    void AddBlob(const std::string& name, const void* data, size_t size, AssetType type);
+
+    // fails without writing if two assets have the same normalized name
+    bool Write(const char* path) const;
+
+private:
+    struct Pending
+    {
+        std::string name;
+        AssetType type;
+        std::vector<unsigned char> bytes;
+    };
+    std::vector<Pending> assets;
+};
+
+// Hash used for table lookups; never returns the empty-slot marker 0
+uint64_t AssetNameHash(const std::string& name);
+
+// The pack the loaders consult before falling back to loose files (nullptr if none is mounted)
+AssetPack* MountedAssetPack();
+bool MountAssetPack(const char* path, unsigned flags = 0);
+void UnmountAssetPack();
+
+#endif
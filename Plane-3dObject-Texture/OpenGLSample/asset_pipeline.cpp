@@ -0,0 +1,187 @@
+#include <chrono>
+#include <iostream>
+
+#include "asset_pipeline.h"
+
+
+AssetPipeline::AssetPipeline(TextureManager& textures, JobSystem& jobs) : textures(textures), jobs(jobs)
+{
+}
+
+
+AssetPipeline::~AssetPipeline()
+{
+    Shutdown();
+}
+
+
+AssetPipeline::TextureFuture AssetPipeline::RequestTexture(const std::string& path)
+{
+    std::string key = NormalizePath(path);
+    Promise promise(new std::promise<TextureHandle>());
+    TextureFuture future = promise->get_future().share();
+
+    // already resident: ready immediately
+    TextureHandle loaded = textures.FindLoaded(path.c_str());
+    if (loaded)
+    {
+        promise->set_value(loaded);
+        return future;
+    }
+
+    // checked and claimed under one lock, so concurrent requests for a path share a single load
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, TextureFuture>::iterator pending = inFlight.find(key);
+        if (pending != inFlight.end())
+            return pending->second;
+        inFlight[key] = future;
+    }
+
+    // cooked into the mounted pack: the pixels are already mapped and flipped, so go straight to upload
+    AssetPack* pack = MountedAssetPack();
+    if (pack && pack->Find(path).valid())
+    {
+        TextureManager* manager = &textures;
+        queueUpload(path, [manager, path]() { return manager->Acquire(path.c_str()); }, promise);
+        return future;
+    }
+
+    // the read buffer is recycled once the callback returns, so the bytes are copied into the decode job
+    reader.Enqueue(path, [this, promise](const AsyncRead& read)
+    {
+        if (!read.ok)
+        {
+            queueUpload(*read.path, []() { return TextureHandle(); }, promise);
+            return;
+        }
+
+        std::shared_ptr<std::vector<unsigned char> > bytes(new std::vector<unsigned char>(read.data, read.data + read.size));
+        std::string path = *read.path;
+        jobs.Run([this, path, bytes, promise]() { decode(path, *bytes, promise); }, &decodes);
+    });
+    return future;
+}
+
+
+void AssetPipeline::Flush()
+{
+    reader.Submit();
+}
+
+
+unsigned AssetPipeline::PumpUploads(double budgetMs)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned uploaded = 0;
+
+    for (;;)
+    {
+        Upload upload;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (uploads.empty())
+                break;
+            upload = uploads.front();
+            uploads.pop_front();
+        }
+
+        TextureHandle handle = upload.work();
+        if (!handle)
+            std::cout << "ERROR::ASSET_PIPELINE::LOAD_FAILED " << upload.path << std::endl;
+        else
+            ++uploaded;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inFlight.erase(NormalizePath(upload.path));
+        }
+        upload.promise->set_value(handle);
+
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (elapsedMs >= budgetMs)
+            break;
+    }
+    return uploaded;
+}
+
+
+const TextureHandle& AssetPipeline::Placeholder()
+{
+    if (!placeholder)
+        placeholder = textures.CreatePlaceholder();
+    return placeholder;
+}
+
+
+TextureHandle AssetPipeline::Resolve(const TextureFuture& request)
+{
+    if (request.valid() && request.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        TextureHandle handle = request.get();
+        if (handle)
+            return handle;
+    }
+    return Placeholder();
+}
+
+
+size_t AssetPipeline::Pending()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return inFlight.size();
+}
+
+
+void AssetPipeline::Shutdown()
+{
+    // let outstanding reads land and decode so nothing calls back into a half-destroyed pipeline
+    reader.Submit();
+    reader.WaitAll();
+    jobs.Wait(decodes);
+
+    // anyone still waiting gets an empty handle rather than a broken promise
+    std::deque<Upload> unfinishedUploads;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unfinishedUploads.swap(uploads);
+        inFlight.clear();
+    }
+    for (size_t i = 0; i < unfinishedUploads.size(); ++i)
+    {
+        if (unfinishedUploads[i].pixels)
+            stbi_image_free(unfinishedUploads[i].pixels);
+        unfinishedUploads[i].promise->set_value(TextureHandle());
+    }
+
+    placeholder.reset();
+}
+
+
+void AssetPipeline::decode(const std::string& path, const std::vector<unsigned char>& bytes, const Promise& promise)
+{
+    DecodedImage image;
+    if (!DecodeImage(path, bytes.data(), bytes.size(), image))
+    {
+        queueUpload(path, []() { return TextureHandle(); }, promise);
+        return;
+    }
+
+    // the GL thread takes ownership of the pixels when it runs the upload
+    TextureManager* manager = &textures;
+    queueUpload(path, [manager, image]() mutable { return manager->AcquireDecoded(image); }, promise, image.pixels);
+}
+
+
+void AssetPipeline::queueUpload(const std::string& path, const std::function<TextureHandle()>& work, const Promise& promise,
+    unsigned char* pixels)
+{
+    Upload upload;
+    upload.path = path;
+    upload.work = work;
+    upload.promise = promise;
+    upload.pixels = pixels;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    uploads.push_back(upload);
+}
@@ -0,0 +1,90 @@
+#ifndef ASSET_PIPELINE_H
+#define ASSET_PIPELINE_H
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "async_reader.h"
+#include "job_system.h"
+#include "texture_manager.h"
+
+// Default pipeline values
+const double ASSET_PIPELINE_UPLOAD_BUDGET_MS = 2.0;    // GL upload time allowed per frame
+
+
+/* Streams assets in without blocking the frame.
+ *
+ * I/O      RequestTexture() queues the file on the AsyncFileReader; Flush() issues everything
+ *          requested since the last flush as one batch.
+ * decode   bytes that land are decoded and flipped as jobs on the JobSystem.
+ * upload   decoded images wait in a queue that the GL thread drains from PumpUploads() until the
+ *          frame's time budget is spent.
+ *
+ * Every request returns a shared_future that becomes ready once the texture is resident (or holds
+ * an empty handle if it failed). Until then callers draw with Placeholder().
+ */
+class AssetPipeline
+{
+public:
+    typedef std::shared_future<TextureHandle> TextureFuture;
+
+    AssetPipeline(TextureManager& textures, JobSystem& jobs);
+    ~AssetPipeline();
+
+    // requests a texture; textures already loaded or cooked into the mounted pack skip I/O and decode
+    TextureFuture RequestTexture(const std::string& path);
+
+    // issues the reads requested since the last flush in one batch
+    void Flush();
+
+    // GL thread: uploads finished assets until 'budgetMs' has been spent (at least one per call);
+    // returns the number of assets that became resident
+    unsigned PumpUploads(double budgetMs = ASSET_PIPELINE_UPLOAD_BUDGET_MS);
+
+    // GL thread: the texture to draw with until a request is ready
+    const TextureHandle& Placeholder();
+
+    // returns the requested texture if it is resident, otherwise the placeholder
+    TextureHandle Resolve(const TextureFuture& request);
+
+    // requests that have not finished uploading yet
+    size_t Pending();
+
+    // GL thread: waits for outstanding decodes, fails anything still in flight and releases the placeholder
+    void Shutdown();
+
+private:
+    typedef std::shared_ptr<std::promise<TextureHandle> > Promise;
+
+    struct Upload
+    {
+        std::string path;
+        std::function<TextureHandle()> work;   // runs on the GL thread
+        Promise promise;
+        unsigned char* pixels;                  // decoded pixels 'work' frees; freed by Shutdown() if it never runs
+    };
+
+    TextureManager& textures;
+    JobSystem& jobs;
+    JobCounter decodes;
+    AsyncFileReader reader;
+    TextureHandle placeholder;
+
+    std::mutex mutex;
+    std::deque<Upload> uploads;
+    std::unordered_map<std::string, TextureFuture> inFlight;   // normalized path -> request
+
+    void decode(const std::string& path, const std::vector<unsigned char>& bytes, const Promise& promise);
+    void queueUpload(const std::string& path, const std::function<TextureHandle()>& work, const Promise& promise,
+        unsigned char* pixels = nullptr);
+
+    AssetPipeline(const AssetPipeline&);
+    AssetPipeline& operator=(const AssetPipeline&);
+};
+#endif
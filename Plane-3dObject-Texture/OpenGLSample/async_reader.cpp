@@ -0,0 +1,577 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ASYNC_READER_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+#include "async_reader.h"
+
+
+// Issues the reads for a batch of jobs and reports each one back through complete()
+class ReaderBackend
+{
+public:
+    explicit ReaderBackend(AsyncFileReader& reader) : owner(reader) {}
+    virtual ~ReaderBackend() {}
+
+    virtual void Submit(std::vector<AsyncFileReader::Job*>& jobs) = 0;
+    virtual bool IsIoUring() const = 0;
+
+protected:
+    typedef AsyncFileReader::Job Job;
+    AsyncFileReader& owner;
+
+    void complete(Job* job, const unsigned char* data, size_t size, bool ok)
+    {
+        AsyncRead read;
+        read.path = &job->path;
+        read.data = data;
+        read.size = size;
+        read.ok = ok;
+        job->callback(read);
+        owner.finish(job, ok ? size : 0);
+    }
+};
+
+
+namespace
+{
+    // Portable fallback: a few threads each reading one whole file at a time
+    class ThreadPoolBackend : public ReaderBackend
+    {
+    public:
+        ThreadPoolBackend(AsyncFileReader& reader, unsigned threadCount) : ReaderBackend(reader), stopping(false)
+        {
+            if (threadCount == 0)
+                threadCount = 1;
+            for (unsigned i = 0; i < threadCount; ++i)
+                workers.push_back(std::thread(&ThreadPoolBackend::work, this));
+        }
+
+        ~ThreadPoolBackend()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (size_t i = 0; i < workers.size(); ++i)
+                workers[i].join();
+        }
+
+        void Submit(std::vector<Job*>& jobs)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.insert(queue.end(), jobs.begin(), jobs.end());
+            }
+            wake.notify_all();
+        }
+
+        bool IsIoUring() const { return false; }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<Job*> queue;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+
+        void work()
+        {
+            std::vector<unsigned char> buffer;
+            for (;;)
+            {
+                Job* job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                    if (queue.empty())
+                        return;
+                    job = queue.front();
+                    queue.pop_front();
+                }
+
+                bool ok = readWholeFile(job->path, buffer);
+                complete(job, buffer.empty() ? nullptr : &buffer[0], buffer.size(), ok);
+            }
+        }
+
+        static bool readWholeFile(const std::string& path, std::vector<unsigned char>& buffer)
+        {
+#ifdef _WIN32
+            buffer.clear();
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size;
+            bool ok = GetFileSizeEx(file, &size) != 0;
+            if (ok)
+            {
+                buffer.resize(size_t(size.QuadPart));
+                size_t done = 0;
+                while (ok && done < buffer.size())
+                {
+                    DWORD chunk = DWORD(std::min<size_t>(buffer.size() - done, 1u << 30));
+                    DWORD got = 0;
+                    if (!ReadFile(file, &buffer[done], chunk, &got, NULL))
+                        ok = false;
+                    else if (got == 0)
+                        buffer.resize(done); // file shrank underneath us
+                    else
+                        done += got;
+                }
+            }
+            CloseHandle(file);
+            return ok;
+#else
+            buffer.clear();
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+            bool ok = fstat(fd, &info) == 0;
+            if (ok)
+            {
+                buffer.resize(size_t(info.st_size));
+                size_t done = 0;
+                while (ok && done < buffer.size())
+                {
+                    ssize_t got = pread(fd, &buffer[done], buffer.size() - done, off_t(done));
+                    if (got > 0)
+                        done += size_t(got);
+                    else if (got == 0)
+                        buffer.resize(done); // file shrank underneath us
+                    else
+                        ok = false;
+                }
+            }
+            close(fd);
+            return ok;
+#endif
+        }
+    };
+
+
+#ifdef ASYNC_READER_IO_URING
+    // Linux io_uring backend driven through the raw system calls (no liburing dependency)
+    class IoUringBackend : public ReaderBackend
+    {
+    public:
+        IoUringBackend(AsyncFileReader& reader) : ReaderBackend(reader), ringFd(-1), sqRing(nullptr), cqRing(nullptr), sqes(nullptr),
+            sqRingSize(0), cqRingSize(0), toSubmit(0), buffers(nullptr), fixedBuffers(false), inFlight(0), stopping(false)
+        {
+        }
+
+        ~IoUringBackend()
+        {
+            if (completer.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                    // a no-op with user_data 0 wakes the completion thread so it can see 'stopping'
+                    io_uring_sqe* sqe = nextSqe();
+                    memset(sqe, 0, sizeof(*sqe));
+                    sqe->opcode = IORING_OP_NOP;
+                    submitLocked();
+                }
+                completer.join();
+            }
+
+            if (sqes != nullptr)
+                munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+            if (cqRing != nullptr && cqRing != sqRing)
+                munmap(cqRing, cqRingSize);
+            if (sqRing != nullptr)
+                munmap(sqRing, sqRingSize);
+            if (ringFd >= 0)
+                close(ringFd);
+            free(buffers);
+        }
+
+        // sets up the rings and registered buffers; false means the kernel does not support io_uring
+        bool Initialize()
+        {
+            memset(&params, 0, sizeof(params));
+            ringFd = int(syscall(__NR_io_uring_setup, ASYNC_READER_QUEUE_DEPTH, &params));
+            if (ringFd < 0)
+                return false;
+
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (singleMmap && cqRingSize > sqRingSize)
+                sqRingSize = cqRingSize;
+
+            void* sq = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+            if (sq == MAP_FAILED)
+                return false;
+            sqRing = static_cast<unsigned char*>(sq);
+
+            if (singleMmap)
+                cqRing = sqRing;
+            else
+            {
+                void* cq = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+                if (cq == MAP_FAILED)
+                    return false;
+                cqRing = static_cast<unsigned char*>(cq);
+            }
+
+            void* entries = mmap(NULL, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+            if (entries == MAP_FAILED)
+                return false;
+            sqes = static_cast<io_uring_sqe*>(entries);
+
+            // register the fixed buffers; this can fail under a low RLIMIT_MEMLOCK, in which case
+            // every read simply goes to a heap buffer instead
+            if (posix_memalign(reinterpret_cast<void**>(&buffers), 4096, ASYNC_READER_BUFFER_COUNT * ASYNC_READER_BUFFER_SIZE) == 0)
+            {
+                iovec vectors[ASYNC_READER_BUFFER_COUNT];
+                for (unsigned i = 0; i < ASYNC_READER_BUFFER_COUNT; ++i)
+                {
+                    vectors[i].iov_base = buffers + i * ASYNC_READER_BUFFER_SIZE;
+                    vectors[i].iov_len = ASYNC_READER_BUFFER_SIZE;
+                }
+                fixedBuffers = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, vectors, ASYNC_READER_BUFFER_COUNT) == 0;
+                for (unsigned i = 0; fixedBuffers && i < ASYNC_READER_BUFFER_COUNT; ++i)
+                    freeSlots.push_back(int(i));
+            }
+
+            completer = std::thread(&IoUringBackend::reap, this);
+            return true;
+        }
+
+        void Submit(std::vector<Job*>& jobs)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < jobs.size(); ++i)
+            {
+                Read* read = new Read();
+                read->job = jobs[i];
+                read->fd = -1;
+                read->size = 0;
+                read->done = 0;
+                read->slot = -1;
+                waiting.push_back(read);
+            }
+            startWaitingLocked();
+            submitLocked();
+        }
+
+        bool IsIoUring() const { return true; }
+
+    private:
+        struct Read
+        {
+            Job* job;
+            int fd;
+            size_t size;
+            size_t done;
+            int slot;                           // registered buffer index, or -1 for 'heap'
+            std::vector<unsigned char> heap;
+            iovec vector;
+
+            unsigned char* data(unsigned char* buffers) { return slot >= 0 ? buffers + size_t(slot) * ASYNC_READER_BUFFER_SIZE : (heap.empty() ? nullptr : &heap[0]); }
+        };
+
+        int ringFd;
+        io_uring_params params;
+        unsigned char* sqRing;
+        unsigned char* cqRing;
+        io_uring_sqe* sqes;
+        size_t sqRingSize;
+        size_t cqRingSize;
+        unsigned toSubmit;
+
+        unsigned char* buffers;
+        bool fixedBuffers;
+        std::vector<int> freeSlots;
+
+        std::mutex mutex;                       // guards the submission ring and everything below
+        std::deque<Read*> waiting;              // not yet issued: queue full or no free fixed buffer
+        unsigned inFlight;
+        bool stopping;
+        std::thread completer;
+
+        unsigned* sqField(unsigned offset) { return reinterpret_cast<unsigned*>(sqRing + offset); }
+        unsigned* cqField(unsigned offset) { return reinterpret_cast<unsigned*>(cqRing + offset); }
+
+        io_uring_sqe* nextSqe()
+        {
+            unsigned tail = *sqField(params.sq_off.tail);
+            unsigned index = tail & *sqField(params.sq_off.ring_mask);
+            sqField(params.sq_off.array)[index] = index;
+            __atomic_store_n(sqField(params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+            ++toSubmit;
+            return &sqes[index];
+        }
+
+        void submitLocked()
+        {
+            while (toSubmit > 0)
+            {
+                int submitted = int(syscall(__NR_io_uring_enter, ringFd, toSubmit, 0, 0, NULL, 0));
+                if (submitted < 0)
+                {
+                    std::cout << "ERROR::ASYNC_READER::SUBMIT_FAILED" << std::endl;
+                    break;
+                }
+                toSubmit -= unsigned(submitted);
+            }
+            toSubmit = 0;
+        }
+
+        // opens and issues as many waiting reads as the queue depth and free buffers allow
+        void startWaitingLocked()
+        {
+            std::deque<Read*> blocked;
+            std::vector<std::pair<Read*, bool> > unissued;     // reads finished here, and whether they succeeded
+            while (!waiting.empty() && inFlight < ASYNC_READER_QUEUE_DEPTH)
+            {
+                Read* read = waiting.front();
+                waiting.pop_front();
+
+                if (read->fd < 0)
+                {
+                    struct stat info;
+                    read->fd = open(read->job->path.c_str(), O_RDONLY);
+                    if (read->fd < 0 || fstat(read->fd, &info) != 0)
+                    {
+                        unissued.push_back(std::make_pair(read, false));
+                        continue;
+                    }
+                    read->size = size_t(info.st_size);
+                }
+
+                if (read->size <= ASYNC_READER_BUFFER_SIZE && fixedBuffers)
+                {
+                    // small file: wait for a registered buffer rather than allocating
+                    if (freeSlots.empty())
+                    {
+                        blocked.push_back(read);
+                        continue;
+                    }
+                    read->slot = freeSlots.back();
+                    freeSlots.pop_back();
+                }
+                else
+                    read->heap.resize(read->size);
+
+                if (read->size == 0)
+                {
+                    unissued.push_back(std::make_pair(read, true)); // completes below with an empty, successful read
+                    continue;
+                }
+
+                issueLocked(read);
+            }
+            waiting.insert(waiting.begin(), blocked.begin(), blocked.end());
+
+            // completions for reads that never reached the kernel
+            for (size_t i = 0; i < unissued.size(); ++i)
+            {
+                Read* read = unissued[i].first;
+                mutex.unlock();
+                complete(read->job, nullptr, 0, unissued[i].second);
+                mutex.lock();
+                release(read);
+            }
+        }
+
+        void issueLocked(Read* read)
+        {
+            io_uring_sqe* sqe = nextSqe();
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = read->fd;
+            sqe->off = read->done;
+            sqe->user_data = reinterpret_cast<uint64_t>(read);
+            if (read->slot >= 0)
+            {
+                sqe->opcode = IORING_OP_READ_FIXED;
+                sqe->addr = reinterpret_cast<uint64_t>(read->data(buffers) + read->done);
+                sqe->len = unsigned(read->size - read->done);
+                sqe->buf_index = uint16_t(read->slot);
+            }
+            else
+            {
+                read->vector.iov_base = read->data(buffers) + read->done;
+                read->vector.iov_len = read->size - read->done;
+                sqe->opcode = IORING_OP_READV;
+                sqe->addr = reinterpret_cast<uint64_t>(&read->vector);
+                sqe->len = 1;
+            }
+            ++inFlight;
+        }
+
+        // closes the file, recycles its buffer and frees the bookkeeping; called with the mutex held
+        void release(Read* read)
+        {
+            if (read->fd >= 0)
+                close(read->fd);
+            if (read->slot >= 0)
+                freeSlots.push_back(read->slot);
+            delete read;
+        }
+
+        // completion thread: waits for CQEs, reissues short reads and runs callbacks as reads land
+        void reap()
+        {
+            for (;;)
+            {
+                syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+                unsigned head = *cqField(params.cq_off.head);
+                unsigned tail = __atomic_load_n(cqField(params.cq_off.tail), __ATOMIC_ACQUIRE);
+                unsigned mask = *cqField(params.cq_off.ring_mask);
+                io_uring_cqe* cqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+
+                std::vector<std::pair<Read*, int> > landed;
+                for (; head != tail; ++head)
+                {
+                    const io_uring_cqe& cqe = cqes[head & mask];
+                    if (cqe.user_data != 0)
+                        landed.push_back(std::make_pair(reinterpret_cast<Read*>(cqe.user_data), cqe.res));
+                }
+                __atomic_store_n(cqField(params.cq_off.head), head, __ATOMIC_RELEASE);
+
+                for (size_t i = 0; i < landed.size(); ++i)
+                {
+                    Read* read = landed[i].first;
+                    int result = landed[i].second;
+
+                    std::unique_lock<std::mutex> lock(mutex);
+                    --inFlight;
+                    if (result == -EINTR || result == -EAGAIN)
+                    {
+                        issueLocked(read);
+                        submitLocked();
+                        continue;
+                    }
+                    if (result > 0)
+                    {
+                        read->done += size_t(result);
+                        if (read->done < read->size)
+                        {
+                            issueLocked(read); // short read: ask for the rest
+                            submitLocked();
+                            continue;
+                        }
+                    }
+                    lock.unlock();
+
+                    // result 0 means the file shrank: deliver what was read
+                    complete(read->job, read->data(buffers), read->done, result >= 0);
+
+                    lock.lock();
+                    release(read);
+                    startWaitingLocked();
+                    submitLocked();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping && inFlight == 0 && waiting.empty())
+                    return;
+            }
+        }
+    };
+#endif
+}
+
+
+AsyncFileReader::AsyncFileReader(unsigned fallbackThreads) : backend(nullptr), pending(0), bytesRead(0)
+{
+#ifdef ASYNC_READER_IO_URING
+    IoUringBackend* ring = new IoUringBackend(*this);
+    if (ring->Initialize())
+        backend = ring;
+    else
+    {
+        delete ring;
+        std::cout << "INFO: io_uring unavailable, reading assets on " << fallbackThreads << " threads" << std::endl;
+    }
+#endif
+    if (backend == nullptr)
+        backend = new ThreadPoolBackend(*this, fallbackThreads);
+}
+
+
+AsyncFileReader::~AsyncFileReader()
+{
+    Submit();
+    WaitAll();
+    delete backend;
+}
+
+
+void AsyncFileReader::Enqueue(const std::string& path, AsyncReadCallback onComplete)
+{
+    Job* job = new Job();
+    job->path = path;
+    job->callback = onComplete;
+    queued.push_back(job);
+}
+
+
+void AsyncFileReader::Submit()
+{
+    if (queued.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending += unsigned(queued.size());
+    }
+    std::vector<Job*> batch;
+    batch.swap(queued);
+    backend->Submit(batch);
+}
+
+
+void AsyncFileReader::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    pendingDone.wait(lock, [this] { return pending == 0; });
+}
+
+
+bool AsyncFileReader::UsingIoUring() const
+{
+    return backend->IsIoUring();
+}
+
+
+void AsyncFileReader::finish(Job* job, size_t size)
+{
+    delete job;
+    bytesRead += size;
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (--pending == 0)
+        pendingDone.notify_all();
+}
@@ -0,0 +1,75 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A finished read. 'data' is only valid for the duration of the callback: it may live in a
+// registered kernel buffer that is recycled for the next read as soon as the callback returns.
+struct AsyncRead
+{
+    const std::string* path;
+    const unsigned char* data;
+    size_t size;
+    bool ok;
+};
+
+typedef std::function<void(const AsyncRead& read)> AsyncReadCallback;
+
+// Default reader values
+const unsigned ASYNC_READER_QUEUE_DEPTH = 64;              // reads in flight at once
+const unsigned ASYNC_READER_BUFFER_COUNT = 16;             // registered (fixed) buffers
+const size_t ASYNC_READER_BUFFER_SIZE = 1u << 20;          // size of each registered buffer
+const unsigned ASYNC_READER_FALLBACK_THREADS = 4;          // pread workers when io_uring is unavailable
+
+class ReaderBackend;
+
+
+// Reads whole files asynchronously. Reads queued with Enqueue() are handed to the kernel together
+// by Submit(); on Linux that is a single io_uring submission using registered buffers for files
+// that fit in them, elsewhere (or when io_uring is unavailable) a small pool of threads issues
+// pread/ReadFile calls. Callbacks run on the reader's own threads as each read lands, so decode
+// work overlaps the remaining I/O.
+class AsyncFileReader
+{
+public:
+    AsyncFileReader(unsigned fallbackThreads = ASYNC_READER_FALLBACK_THREADS);
+    ~AsyncFileReader();
+
+    // queues a whole-file read; nothing is issued until Submit()
+    void Enqueue(const std::string& path, AsyncReadCallback onComplete);
+    // issues every queued read in one batch
+    void Submit();
+    // blocks until every submitted read has completed and its callback returned
+    void WaitAll();
+
+    bool UsingIoUring() const;
+    unsigned long long BytesRead() const { return bytesRead.load(); }
+
+private:
+    struct Job
+    {
+        std::string path;
+        AsyncReadCallback callback;
+    };
+
+    ReaderBackend* backend;
+    std::vector<Job*> queued;
+
+    std::mutex pendingMutex;
+    std::condition_variable pendingDone;
+    unsigned pending;
+    std::atomic<unsigned long long> bytesRead;
+
+    // called by the backends once a job's callback has run
+    void finish(Job* job, size_t size);
+    friend class ReaderBackend;
+
+    AsyncFileReader(const AsyncFileReader&);
+    AsyncFileReader& operator=(const AsyncFileReader&);
+};
+#endif
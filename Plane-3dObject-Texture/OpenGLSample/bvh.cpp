@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE 1
+#endif
+
+#include "bvh.h"
+
+namespace
+{
+    const float TRIANGLE_EPSILON = 1e-9f;   // determinant below which a ray is parallel to a triangle
+    const float RAY_T_MIN = 1e-5f;          // ignores hits on the surface a ray starts from
+    const float MIN_DIRECTION = 1e-12f;     // keeps reciprocal directions finite
+
+    // Four floats with the handful of operations traversal needs; SSE where available
+#if BVH_SSE
+    typedef __m128 Lane;
+
+    inline Lane Load(const float* values) { return _mm_loadu_ps(values); }
+    inline void Store(float* values, Lane a) { _mm_storeu_ps(values, a); }
+    inline Lane Splat(float value) { return _mm_set1_ps(value); }
+    inline Lane Add(Lane a, Lane b) { return _mm_add_ps(a, b); }
+    inline Lane Sub(Lane a, Lane b) { return _mm_sub_ps(a, b); }
+    inline Lane Mul(Lane a, Lane b) { return _mm_mul_ps(a, b); }
+    inline Lane Div(Lane a, Lane b) { return _mm_div_ps(a, b); }
+    inline Lane Min(Lane a, Lane b) { return _mm_min_ps(a, b); }
+    inline Lane Max(Lane a, Lane b) { return _mm_max_ps(a, b); }
+    inline Lane Abs(Lane a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    inline Lane Less(Lane a, Lane b) { return _mm_cmplt_ps(a, b); }
+    inline Lane LessEqual(Lane a, Lane b) { return _mm_cmple_ps(a, b); }
+    inline Lane And(Lane a, Lane b) { return _mm_and_ps(a, b); }
+    inline Lane Select(Lane mask, Lane a, Lane b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    inline unsigned Mask(Lane mask) { return unsigned(_mm_movemask_ps(mask)); }
+#else
+    struct Lane
+    {
+        float f[4];
+    };
+
+    inline Lane Load(const float* values) { Lane r; memcpy(r.f, values, sizeof(r.f)); return r; }
+    inline void Store(float* values, Lane a) { memcpy(values, a.f, sizeof(a.f)); }
+    inline Lane Splat(float value) { Lane r; r.f[0] = r.f[1] = r.f[2] = r.f[3] = value; return r; }
+
+#define BVH_LANE_OP(name, expression) \
+    inline Lane name(Lane a, Lane b) { Lane r; for (int i = 0; i < 4; ++i) { float x = a.f[i], y = b.f[i]; r.f[i] = (expression); } return r; }
+    BVH_LANE_OP(Add, x + y)
+    BVH_LANE_OP(Sub, x - y)
+    BVH_LANE_OP(Mul, x * y)
+    BVH_LANE_OP(Div, x / y)
+    BVH_LANE_OP(Min, y < x ? y : x)
+    BVH_LANE_OP(Max, y > x ? y : x)
+#undef BVH_LANE_OP
+
+    // comparison masks hold all bits set (read back as a negative NaN) or zero
+    inline float MaskValue(bool set) { uint32_t bits = set ? 0xFFFFFFFFu : 0u; float r; memcpy(&r, &bits, 4); return r; }
+    inline bool MaskBit(float value) { uint32_t bits; memcpy(&bits, &value, 4); return (bits >> 31) != 0; }
+
+    inline Lane Abs(Lane a) { for (int i = 0; i < 4; ++i) a.f[i] = fabsf(a.f[i]); return a; }
+    inline Lane Less(Lane a, Lane b) { Lane r; for (int i = 0; i < 4; ++i) r.f[i] = MaskValue(a.f[i] < b.f[i]); return r; }
+    inline Lane LessEqual(Lane a, Lane b) { Lane r; for (int i = 0; i < 4; ++i) r.f[i] = MaskValue(a.f[i] <= b.f[i]); return r; }
+    inline Lane And(Lane a, Lane b) { Lane r; for (int i = 0; i < 4; ++i) r.f[i] = MaskValue(MaskBit(a.f[i]) && MaskBit(b.f[i])); return r; }
+    inline Lane Select(Lane mask, Lane a, Lane b) { Lane r; for (int i = 0; i < 4; ++i) r.f[i] = MaskBit(mask.f[i]) ? a.f[i] : b.f[i]; return r; }
+    inline unsigned Mask(Lane mask)
+    {
+        unsigned bits = 0;
+        for (int i = 0; i < 4; ++i)
+            bits |= MaskBit(mask.f[i]) ? 1u << i : 0u;
+        return bits;
+    }
+#endif
+
+    inline float SurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        glm::vec3 size = boundsMax - boundsMin;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    struct Bin
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        uint32_t count;
+    };
+}
+
+
+void Bvh::Build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+    nodes.clear();
+    triangles.clear();
+    ids.clear();
+
+    const uint32_t count = uint32_t(indices.size() / 3);
+    if (count == 0)
+        return;
+
+    std::vector<BuildReference> references(count);
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const glm::vec3& a = positions[indices[i * 3 + 0]];
+        const glm::vec3& b = positions[indices[i * 3 + 1]];
+        const glm::vec3& c = positions[indices[i * 3 + 2]];
+        references[i].boundsMin = glm::min(a, glm::min(b, c));
+        references[i].boundsMax = glm::max(a, glm::max(b, c));
+        references[i].centroid = (references[i].boundsMin + references[i].boundsMax) * 0.5f;
+        order[i] = i;
+    }
+
+    nodes.reserve(size_t(count) * 2);
+    nodes.push_back(Node());
+    subdivide(0, references, order, 0, count, 0);
+
+    // store the triangles in leaf order so a leaf reads one contiguous run
+    triangles.resize(count);
+    ids = order;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t id = order[i];
+        const glm::vec3& a = positions[indices[id * 3 + 0]];
+        glm::vec3 edge1 = positions[indices[id * 3 + 1]] - a;
+        glm::vec3 edge2 = positions[indices[id * 3 + 2]] - a;
+        Triangle& triangle = triangles[i];
+        for (int k = 0; k < 3; ++k)
+        {
+            triangle.v0[k] = a[k];
+            triangle.edge1[k] = edge1[k];
+            triangle.edge2[k] = edge2[k];
+        }
+    }
+}
+
+
+void Bvh::subdivide(uint32_t nodeIndex, std::vector<BuildReference>& references, std::vector<uint32_t>& order,
+                    uint32_t first, uint32_t count, unsigned depth)
+{
+    glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+    glm::vec3 centroidMin(1e30f), centroidMax(-1e30f);
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        const BuildReference& reference = references[order[i]];
+        boundsMin = glm::min(boundsMin, reference.boundsMin);
+        boundsMax = glm::max(boundsMax, reference.boundsMax);
+        centroidMin = glm::min(centroidMin, reference.centroid);
+        centroidMax = glm::max(centroidMax, reference.centroid);
+    }
+
+    Node& node = nodes[nodeIndex];
+    for (int k = 0; k < 3; ++k)
+    {
+        node.boundsMin[k] = boundsMin[k];
+        node.boundsMax[k] = boundsMax[k];
+    }
+    node.offset = first;
+    node.count = count;
+    node.axis = 0;
+    if (count <= 1 || depth >= BVH_MAX_DEPTH)
+        return;
+
+    // bin the centroids along each axis and sweep for the cheapest plane
+    float bestCost = 1e30f;
+    int bestAxis = -1;
+    unsigned bestPlane = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f)
+            continue;
+        float scale = float(BVH_SAH_BINS) / extent;
+
+        Bin bins[BVH_SAH_BINS];
+        for (unsigned b = 0; b < BVH_SAH_BINS; ++b)
+        {
+            bins[b].boundsMin = glm::vec3(1e30f);
+            bins[b].boundsMax = glm::vec3(-1e30f);
+            bins[b].count = 0;
+        }
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const BuildReference& reference = references[order[i]];
+            unsigned b = std::min(unsigned((reference.centroid[axis] - centroidMin[axis]) * scale), BVH_SAH_BINS - 1);
+            bins[b].boundsMin = glm::min(bins[b].boundsMin, reference.boundsMin);
+            bins[b].boundsMax = glm::max(bins[b].boundsMax, reference.boundsMax);
+            ++bins[b].count;
+        }
+
+        // area * count of everything left of each plane, then sweep back from the right
+        float leftCost[BVH_SAH_BINS - 1];
+        glm::vec3 sweepMin(1e30f), sweepMax(-1e30f);
+        uint32_t sweepCount = 0;
+        for (unsigned b = 0; b < BVH_SAH_BINS - 1; ++b)
+        {
+            sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+            sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+            sweepCount += bins[b].count;
+            leftCost[b] = sweepCount > 0 ? SurfaceArea(sweepMin, sweepMax) * float(sweepCount) : 0.0f;
+        }
+        sweepMin = glm::vec3(1e30f);
+        sweepMax = glm::vec3(-1e30f);
+        sweepCount = 0;
+        for (unsigned b = BVH_SAH_BINS - 1; b > 0; --b)
+        {
+            sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+            sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+            sweepCount += bins[b].count;
+            if (sweepCount == 0 || sweepCount == count)
+                continue;
+            float cost = leftCost[b - 1] + SurfaceArea(sweepMin, sweepMax) * float(sweepCount);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestPlane = b;
+            }
+        }
+    }
+
+    // a leaf costs one test per triangle; keep it when splitting would not pay off
+    float parentArea = std::max(SurfaceArea(boundsMin, boundsMax), 1e-20f);
+    float splitCost = BVH_TRAVERSAL_COST + bestCost / parentArea;
+    if (count <= BVH_MAX_LEAF_TRIANGLES && (bestAxis < 0 || splitCost >= float(count)))
+        return;
+
+    uint32_t leftCount;
+    if (bestAxis >= 0)
+    {
+        float scale = float(BVH_SAH_BINS) / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        float low = centroidMin[bestAxis];
+        uint32_t* middle = std::partition(&order[first], &order[first] + count, [&](uint32_t id) {
+            return std::min(unsigned((references[id].centroid[bestAxis] - low) * scale), BVH_SAH_BINS - 1) < bestPlane;
+        });
+        leftCount = uint32_t(middle - &order[first]);
+    }
+    else
+    {
+        // every centroid in the same spot: split the list in half
+        leftCount = count / 2;
+        bestAxis = 0;
+    }
+
+    node.count = 0;
+    node.axis = uint32_t(bestAxis);
+    uint32_t left = uint32_t(nodes.size());
+    nodes.push_back(Node());
+    subdivide(left, references, order, first, leftCount, depth + 1);
+    uint32_t right = uint32_t(nodes.size());
+    nodes.push_back(Node());
+    nodes[nodeIndex].offset = right;    // 'node' may have moved with the pushes
+    subdivide(right, references, order, first + leftCount, count - leftCount, depth + 1);
+}
+
+
+unsigned Bvh::Intersect(const BvhRayPacket& packet, BvhPacketHit& hit) const
+{
+    return traverse(packet, &hit);
+}
+
+
+unsigned Bvh::Occluded(const BvhRayPacket& packet) const
+{
+    return traverse(packet, NULL);
+}
+
+
+// Shared packet traversal; a null 'hit' asks for any hit instead of the nearest
+unsigned Bvh::traverse(const BvhRayPacket& packet, BvhPacketHit* hit) const
+{
+    unsigned active = Mask(Less(Splat(0.0f), Load(packet.tMax)));
+    if (nodes.empty() || active == 0)
+    {
+        if (hit != NULL)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                hit->t[i] = packet.tMax[i];
+                hit->triangle[i] = BVH_NO_HIT;
+                hit->u[i] = hit->v[i] = 0.0f;
+            }
+        }
+        return 0;
+    }
+
+    const Lane originX = Load(packet.originX), originY = Load(packet.originY), originZ = Load(packet.originZ);
+    const Lane directionX = Load(packet.directionX), directionY = Load(packet.directionY), directionZ = Load(packet.directionZ);
+
+    // reciprocal directions for the slab tests, kept finite for axis-aligned rays
+    float inverse[3][4];
+    const float* directions[3] = { packet.directionX, packet.directionY, packet.directionZ };
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            float d = directions[k][i];
+            inverse[k][i] = 1.0f / (fabsf(d) > MIN_DIRECTION ? d : (d < 0.0f ? -MIN_DIRECTION : MIN_DIRECTION));
+        }
+    }
+    const Lane inverseX = Load(inverse[0]), inverseY = Load(inverse[1]), inverseZ = Load(inverse[2]);
+
+    // the packet's first active ray orders the children
+    int lead = 0;
+    while (((active >> lead) & 1u) == 0)
+        ++lead;
+    const bool negative[3] = { packet.directionX[lead] < 0.0f, packet.directionY[lead] < 0.0f, packet.directionZ[lead] < 0.0f };
+
+    Lane nearest = Select(Less(Splat(0.0f), Load(packet.tMax)), Load(packet.tMax), Splat(0.0f));
+    Lane nearestU = Splat(0.0f), nearestV = Splat(0.0f);
+    uint32_t nearestTriangle[4] = { BVH_NO_HIT, BVH_NO_HIT, BVH_NO_HIT, BVH_NO_HIT };
+    unsigned hitMask = 0;
+
+    uint32_t stack[BVH_MAX_DEPTH * 2 + 2];
+    unsigned stackSize = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const Node& node = nodes[current];
+
+        // slab test of the box against every ray still looking
+        Lane t0 = Mul(Sub(Splat(node.boundsMin[0]), originX), inverseX);
+        Lane t1 = Mul(Sub(Splat(node.boundsMax[0]), originX), inverseX);
+        Lane enter = Min(t0, t1), leave = Max(t0, t1);
+        t0 = Mul(Sub(Splat(node.boundsMin[1]), originY), inverseY);
+        t1 = Mul(Sub(Splat(node.boundsMax[1]), originY), inverseY);
+        enter = Max(enter, Min(t0, t1));
+        leave = Min(leave, Max(t0, t1));
+        t0 = Mul(Sub(Splat(node.boundsMin[2]), originZ), inverseZ);
+        t1 = Mul(Sub(Splat(node.boundsMax[2]), originZ), inverseZ);
+        enter = Max(Max(enter, Min(t0, t1)), Splat(0.0f));
+        leave = Min(Min(leave, Max(t0, t1)), nearest);
+        unsigned boxMask = Mask(LessEqual(enter, leave)) & active;
+
+        if (boxMask != 0 && node.count == 0)
+        {
+            uint32_t nearChild = current + 1;
+            uint32_t farChild = node.offset;
+            if (negative[node.axis])
+                std::swap(nearChild, farChild);
+            stack[stackSize++] = farChild;
+            current = nearChild;
+            continue;
+        }
+
+        if (boxMask != 0)
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                const Triangle& triangle = triangles[i];
+                const Lane e1x = Splat(triangle.edge1[0]), e1y = Splat(triangle.edge1[1]), e1z = Splat(triangle.edge1[2]);
+                const Lane e2x = Splat(triangle.edge2[0]), e2y = Splat(triangle.edge2[1]), e2z = Splat(triangle.edge2[2]);
+
+                // p = d x e2, det = e1 . p
+                Lane px = Sub(Mul(directionY, e2z), Mul(directionZ, e2y));
+                Lane py = Sub(Mul(directionZ, e2x), Mul(directionX, e2z));
+                Lane pz = Sub(Mul(directionX, e2y), Mul(directionY, e2x));
+                Lane det = Add(Add(Mul(e1x, px), Mul(e1y, py)), Mul(e1z, pz));
+                Lane valid = Less(Splat(TRIANGLE_EPSILON), Abs(det));
+                Lane inverseDet = Div(Splat(1.0f), Select(valid, det, Splat(1.0f)));
+
+                Lane sx = Sub(originX, Splat(triangle.v0[0]));
+                Lane sy = Sub(originY, Splat(triangle.v0[1]));
+                Lane sz = Sub(originZ, Splat(triangle.v0[2]));
+                Lane u = Mul(Add(Add(Mul(sx, px), Mul(sy, py)), Mul(sz, pz)), inverseDet);
+
+                // q = s x e1
+                Lane qx = Sub(Mul(sy, e1z), Mul(sz, e1y));
+                Lane qy = Sub(Mul(sz, e1x), Mul(sx, e1z));
+                Lane qz = Sub(Mul(sx, e1y), Mul(sy, e1x));
+                Lane v = Mul(Add(Add(Mul(directionX, qx), Mul(directionY, qy)), Mul(directionZ, qz)), inverseDet);
+                Lane t = Mul(Add(Add(Mul(e2x, qx), Mul(e2y, qy)), Mul(e2z, qz)), inverseDet);
+
+                valid = And(valid, LessEqual(Splat(0.0f), u));
+                valid = And(valid, LessEqual(Splat(0.0f), v));
+                valid = And(valid, LessEqual(Add(u, v), Splat(1.0f)));
+                valid = And(valid, Less(Splat(RAY_T_MIN), t));
+                valid = And(valid, Less(t, nearest));
+                unsigned triangleMask = Mask(valid) & active;
+                if (triangleMask == 0)
+                    continue;
+
+                hitMask |= triangleMask;
+                if (hit == NULL)
+                {
+                    // any hit settles a shadow ray; stop once every ray is settled
+                    active &= ~triangleMask;
+                    if (active == 0)
+                        return hitMask;
+                    continue;
+                }
+                nearest = Select(valid, t, nearest);
+                nearestU = Select(valid, u, nearestU);
+                nearestV = Select(valid, v, nearestV);
+                for (int r = 0; r < 4; ++r)
+                {
+                    if ((triangleMask >> r) & 1u)
+                        nearestTriangle[r] = ids[i];
+                }
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+
+    if (hit != NULL)
+    {
+        Store(hit->t, nearest);
+        Store(hit->u, nearestU);
+        Store(hit->v, nearestV);
+        for (int i = 0; i < 4; ++i)
+            hit->triangle[i] = nearestTriangle[i];
+    }
+    return hitMask;
+}
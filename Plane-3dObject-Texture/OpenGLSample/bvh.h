@@ -0,0 +1,94 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Default BVH values
+const unsigned BVH_SAH_BINS = 16;               // candidate split planes per axis
+const unsigned BVH_MAX_LEAF_TRIANGLES = 4;      // a larger leaf is always split, whatever the SAH says
+const unsigned BVH_MAX_DEPTH = 48;              // bounds the traversal stack
+const float BVH_TRAVERSAL_COST = 1.0f;          // cost of a node visit relative to one triangle test
+const uint32_t BVH_NO_HIT = 0xFFFFFFFFu;
+
+
+// Four rays traced together, stored as structure of arrays for the SIMD tests.
+// A ray with tMax <= 0 is inactive.
+struct BvhRayPacket
+{
+    float originX[4], originY[4], originZ[4];
+    float directionX[4], directionY[4], directionZ[4];
+    float tMax[4];
+};
+
+// Nearest hit of every ray in a packet
+struct BvhPacketHit
+{
+    float t[4];
+    uint32_t triangle[4];       // index of the triangle as given to Build(), or BVH_NO_HIT
+    float u[4], v[4];           // barycentric weights of the triangle's second and third vertex
+};
+
+
+/* Bounding volume hierarchy over triangles, built with the binned surface area heuristic.
+ *
+ * Nodes are 32 bytes and stored depth first: an inner node's left child follows it and its right
+ * child is at 'offset'. Traversal works on packets of four rays with SSE (plain floats elsewhere):
+ * each node's box is tested against all four rays at once and the packet descends as long as any
+ * ray still hits, visiting the child nearer to the packet's first active ray first. Triangles are
+ * two-sided. A Bvh is read only after Build(), so any number of threads may trace through it.
+ */
+class Bvh
+{
+public:
+    Bvh() {}
+
+    // triangles are index triples into 'positions'
+    void Build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+    // nearest hit of every active ray; returns a bit mask of the rays that hit something
+    unsigned Intersect(const BvhRayPacket& packet, BvhPacketHit& hit) const;
+
+    // returns a bit mask of the active rays blocked before their tMax; stops at any hit
+    unsigned Occluded(const BvhRayPacket& packet) const;
+
+    size_t NodeCount() const { return nodes.size(); }
+    size_t TriangleCount() const { return triangles.size(); }
+
+private:
+    struct Node
+    {
+        float boundsMin[3];
+        uint32_t offset;        // first triangle of a leaf, right child of an inner node
+        float boundsMax[3];
+        uint32_t count : 30;    // triangles in a leaf, 0 for an inner node; a leaf forced at BVH_MAX_DEPTH may be large
+        uint32_t axis : 2;      // split axis of an inner node
+    };
+
+    // Moller-Trumbore form: first vertex and the two edges leaving it
+    struct Triangle
+    {
+        float v0[3];
+        float edge1[3];
+        float edge2[3];
+    };
+
+    struct BuildReference
+    {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        glm::vec3 centroid;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;    // in leaf order
+    std::vector<uint32_t> ids;          // original index of each triangle
+
+    void subdivide(uint32_t nodeIndex, std::vector<BuildReference>& references, std::vector<uint32_t>& order,
+                   uint32_t first, uint32_t count, unsigned depth);
+    unsigned traverse(const BvhRayPacket& packet, BvhPacketHit* hit) const;
+};
+#endif
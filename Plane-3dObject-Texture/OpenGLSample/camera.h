@@ -18,7 +18,9 @@ https://creativecommons.org/licenses/by-nc/4.0/legalcode
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
+#include <cmath>
 #include <vector>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
@@ -32,15 +34,42 @@ enum Camera_Movement {
     
 };
 
+// Frustum planes, in the order GetFrustumPlanes() returns them
+enum Camera_Plane {
+    PLANE_LEFT,
+    PLANE_RIGHT,
+    PLANE_BOTTOM,
+    PLANE_TOP,
+    PLANE_NEAR,
+    PLANE_FAR,
+    PLANE_COUNT
+};
+
 // Default camera values
 const float YAW = -90.0f;
 const float PITCH = 0.0f;
 const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
+const float DAMPING = 0.0f;         // seconds for the view to cover 63% of a turn; 0 turns at once
+const float ASPECT = 4.0f / 3.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
 
 
-// An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
+/* An abstract camera class that processes input and calculates the corresponding Vectors and Matrices for use in OpenGL
+ *
+ * Mouse movement only adds to the target yaw and pitch; Update() turns the camera toward them once per
+ * frame, so a mouse reporting hundreds of times a frame costs a few additions each time. The turn
+ * builds one quaternion (yaw about WorldUp, then pitch about the camera's right axis) and reads Front,
+ * Right and Up off its rotation, without cross products or normalizations. With Damping set the
+ * camera closes a fixed share of the remaining turn per second instead of snapping, whatever the
+ * frame rate.
+ *
+ * View and projection are cached and rebuilt on first use after a turn, SetPosition(),
+ * SetPerspective() or a change to Position or Zoom; their product and the frustum planes only when
+ * asked for after that, since most frames never use them.
+ */
 class Camera
 {
 public:
@@ -51,39 +80,80 @@ public:
     glm::vec3 Right;
     glm::vec3 WorldUp;
     glm::vec3 ORTHA = glm::vec3(1.0f, 2.0f, 15.0f);
-    // euler Angles
+    glm::quat Orientation;
+    // euler Angles the camera shows
     float Yaw;
     float Pitch;
     // camera options
     float MovementSpeed;
     float MouseSensitivity;
     float Zoom;
+    float Damping;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), Damping(DAMPING)
     {
         Position = position;
         WorldUp = up;
-        Yaw = yaw;
-        Pitch = pitch;
-        updateCameraVectors();
+        initialize(yaw, pitch);
     }
     // constructor with scalar values
-    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM), Damping(DAMPING)
     {
         Position = glm::vec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
-        Yaw = yaw;
-        Pitch = pitch;
-        updateCameraVectors();
+        initialize(yaw, pitch);
+    }
+
+    // returns the view matrix of the camera's orientation and position
+    const glm::mat4& GetViewMatrix() const
+    {
+        refresh();
+        return view;
+    }
+
+    const glm::mat4& GetProjectionMatrix() const
+    {
+        refresh();
+        return projection;
+    }
+
+    const glm::mat4& GetViewProjectionMatrix() const
+    {
+        refreshProduct();
+        return viewProjection;
+    }
+
+    // PLANE_COUNT world space planes as (normal, distance), normals pointing inward: a point p is
+    // inside when dot(plane, vec4(p, 1)) >= 0 for all of them
+    const glm::vec4* GetFrustumPlanes() const
+    {
+        refreshProduct();
+        return planes;
     }
 
-    // returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix() const
+    void SetPosition(const glm::vec3& position)
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        Position = position;
     }
 
+    // vertical field of view in degrees; kept in Zoom
+    void SetPerspective(float fovy, float aspect, float nearPlane, float farPlane)
+    {
+        if (fovy == Zoom && aspect == aspectRatio && nearPlane == zNear && farPlane == zFar)
+            return;
+        Zoom = fovy;
+        aspectRatio = aspect;
+        zNear = nearPlane;
+        zFar = farPlane;
+        projectionDirty = true;
+    }
+
+    // the rest of the perspective SetPerspective() set
+    float AspectRatio() const { return aspectRatio; }
+    float NearPlane() const { return zNear; }
+    float FarPlane() const { return zFar; }
+
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
@@ -109,24 +179,55 @@ public:
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
+    // Only moves the target; the camera turns in the next Update()
     void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true)
     {
-        xoffset *= MouseSensitivity;
-        yoffset *= MouseSensitivity;
-
-        Yaw += xoffset;
-        Pitch += yoffset;
+        targetYaw += xoffset * MouseSensitivity;
+        targetPitch += yoffset * MouseSensitivity;
 
         // make sure that when pitch is out of bounds, screen doesn't get flipped
         if (constrainPitch)
         {
-            if (Pitch > 89.0f)
-                Pitch = 89.0f;
-            if (Pitch < -89.0f)
-                Pitch = -89.0f;
+            if (targetPitch > 89.0f)
+                targetPitch = 89.0f;
+            if (targetPitch < -89.0f)
+                targetPitch = -89.0f;
+        }
+    }
+
+    // turns the camera toward the mouse movement since the last call; once per frame
+    void Update(float deltaTime)
+    {
+        if (targetYaw == Yaw && targetPitch == Pitch)
+            return;
+
+        float t = 1.0f;
+        if (Damping > 0.0f)
+            t = 1.0f - std::exp(-deltaTime / Damping);
+
+        // snap once the rest of the turn is too small to see
+        if (std::fabs(targetYaw - Yaw) < 1e-3f && std::fabs(targetPitch - Pitch) < 1e-3f)
+            t = 1.0f;
+
+        Yaw += (targetYaw - Yaw) * t;
+        Pitch += (targetPitch - Pitch) * t;
+        if (t == 1.0f)
+        {
+            Yaw = targetYaw;
+            Pitch = targetPitch;
         }
+        updateCameraVectors();
+    }
 
-        // update Front, Right and Up Vectors using the updated Euler angles
+    // sets the euler angles directly, e.g. to follow a camera that is turned on another thread
+    void SetOrientation(float yaw, float pitch)
+    {
+        targetYaw = yaw;
+        targetPitch = pitch;
+        if (yaw == Yaw && pitch == Pitch)
+            return;
+        Yaw = yaw;
+        Pitch = pitch;
         updateCameraVectors();
     }
 
@@ -141,18 +242,103 @@ public:
     }
 
 private:
-    // calculates the front vector from the Camera's (updated) Euler Angles
+    // where mouse movement has turned to; the camera catches up in Update()
+    float targetYaw;
+    float targetPitch;
+
+    // projection parameters besides Zoom
+    float aspectRatio;
+    float zNear;
+    float zFar;
+
+    // cached matrices and planes, and what they were built from
+    mutable glm::mat4 view;
+    mutable glm::mat4 projection;
+    mutable glm::mat4 viewProjection;
+    mutable glm::vec4 planes[PLANE_COUNT];
+    mutable glm::vec3 viewPosition;
+    mutable float projectionZoom;
+    mutable bool viewDirty;
+    mutable bool projectionDirty;
+    mutable bool productDirty;
+
+    void initialize(float yaw, float pitch)
+    {
+        Yaw = targetYaw = yaw;
+        Pitch = targetPitch = pitch;
+        aspectRatio = ASPECT;
+        zNear = NEAR_PLANE;
+        zFar = FAR_PLANE;
+        viewPosition = Position;
+        projectionZoom = Zoom;
+        projectionDirty = true;
+        productDirty = true;
+        updateCameraVectors();
+    }
+
+    // calculates the orientation and the Front, Right and Up vectors from the Camera's (updated) Euler Angles
     void updateCameraVectors()
     {
-        // calculate the new Front vector
-        glm::vec3 front;
-        front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        front.y = sin(glm::radians(Pitch));
-        front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        Front = glm::normalize(front);
-        // also re-calculate the Right and Up vector
-        Right = glm::normalize(glm::cross(Front, WorldUp));  // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
-        Up = glm::normalize(glm::cross(Right, Front));
+        // at the default yaw of -90 degrees the camera looks down -z, the identity orientation
+        glm::quat yaw = glm::angleAxis(glm::radians(-90.0f - Yaw), WorldUp);
+        glm::quat pitch = glm::angleAxis(glm::radians(Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+        Orientation = yaw * pitch;
+
+        // the rotation's columns are the camera axes
+        glm::mat3 axes = glm::mat3_cast(Orientation);
+        Right = axes[0];
+        Up = axes[1];
+        Front = -axes[2];
+        viewDirty = true;
+    }
+
+    // rebuilds whatever changed since the last call
+    void refresh() const
+    {
+        if (Position != viewPosition)
+            viewDirty = true;
+        if (Zoom != projectionZoom)
+            projectionDirty = true;
+        if (!viewDirty && !projectionDirty)
+            return;
+
+        if (viewDirty)
+        {
+            // the inverse of the camera's rotation and translation; the same matrix lookAt builds
+            view = glm::mat4(glm::transpose(glm::mat3(Right, Up, -Front)));
+            view[3] = glm::vec4(-glm::dot(Right, Position), -glm::dot(Up, Position), glm::dot(Front, Position), 1.0f);
+            viewPosition = Position;
+            viewDirty = false;
+        }
+        if (projectionDirty)
+        {
+            projection = glm::perspective(glm::radians(Zoom), aspectRatio, zNear, zFar);
+            projectionZoom = Zoom;
+            projectionDirty = false;
+        }
+        productDirty = true;
+    }
+
+    // rebuilds the view projection matrix and the frustum planes if the view or projection changed
+    void refreshProduct() const
+    {
+        refresh();
+        if (!productDirty)
+            return;
+
+        viewProjection = projection * view;
+
+        // planes from the rows of the view projection matrix (Gribb and Hartmann)
+        glm::mat4 rows = glm::transpose(viewProjection);
+        planes[PLANE_LEFT] = rows[3] + rows[0];
+        planes[PLANE_RIGHT] = rows[3] - rows[0];
+        planes[PLANE_BOTTOM] = rows[3] + rows[1];
+        planes[PLANE_TOP] = rows[3] - rows[1];
+        planes[PLANE_NEAR] = rows[3] + rows[2];
+        planes[PLANE_FAR] = rows[3] - rows[2];
+        for (int i = 0; i < PLANE_COUNT; ++i)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        productDirty = false;
     }
 };
 #endif
\ No newline at end of file
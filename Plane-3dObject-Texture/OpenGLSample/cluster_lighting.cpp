@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLUSTER_LIGHTING_SSE 1
+#endif
+
+#include "cluster_lighting.h"
+
+ClusterLighting::ClusterLighting(JobSystem& jobs)
+    : jobs(jobs), tanHalfFov(0.0f), aspectRatio(0.0f), lightCount(0), maxPerCluster(0), paramsBuffer(0)
+{
+    memset(&params, 0, sizeof(params));
+    buffers[0] = buffers[1] = buffers[2] = 0;
+    slices.resize(CLUSTER_GRID_Z);
+    grid.resize(size_t(CLUSTER_GRID_X) * CLUSTER_GRID_Y * CLUSTER_GRID_Z * 2);
+}
+
+
+ClusterLighting::~ClusterLighting()
+{
+    if (paramsBuffer != 0)
+        glDeleteBuffers(1, &paramsBuffer);
+    if (buffers[0] != 0)
+        glDeleteBuffers(3, buffers);
+}
+
+
+void ClusterLighting::SetProjection(float fovYRadians, float aspect, float nearPlane, float farPlane, int width, int height)
+{
+    float tangent = tanf(fovYRadians * 0.5f);
+    float logRatio = logf(farPlane / nearPlane);
+
+    ClusterBlockData next;
+    next.gridSize[0] = CLUSTER_GRID_X;
+    next.gridSize[1] = CLUSTER_GRID_Y;
+    next.gridSize[2] = CLUSTER_GRID_Z;
+    next.gridSize[3] = 0;
+    next.depthParams[0] = nearPlane;
+    next.depthParams[1] = farPlane;
+    // slice = log(depth) * scale + bias puts slice k at near * (far / near)^(k / Z)
+    next.depthParams[2] = float(CLUSTER_GRID_Z) / logRatio;
+    next.depthParams[3] = -float(CLUSTER_GRID_Z) * logf(nearPlane) / logRatio;
+    next.screenSize[0] = float(width);
+    next.screenSize[1] = float(height);
+    next.screenSize[2] = 1.0f / float(std::max(width, 1));
+    next.screenSize[3] = 1.0f / float(std::max(height, 1));
+
+    if (!bounds.empty() && memcmp(&next, &params, sizeof(next)) == 0 && tangent == tanHalfFov && aspect == aspectRatio)
+        return;
+    params = next;
+    tanHalfFov = tangent;
+    aspectRatio = aspect;
+
+    if (paramsBuffer == 0)
+        glGenBuffers(1, &paramsBuffer);
+    upload(GL_UNIFORM_BUFFER, paramsBuffer, &params, sizeof(params));
+    computeBounds();
+}
+
+
+// View-space box around every cluster. A tile's side planes pass through the eye, so over a depth
+// slice its x and y extents are reached at the slice's near or far distance.
+void ClusterLighting::computeBounds()
+{
+    const float scaleY = tanHalfFov;
+    const float scaleX = tanHalfFov * aspectRatio;
+
+    sliceDepth.resize(CLUSTER_GRID_Z + 1);
+    const float nearPlane = params.depthParams[0];
+    const float farPlane = params.depthParams[1];
+    for (unsigned z = 0; z <= CLUSTER_GRID_Z; ++z)
+        sliceDepth[z] = nearPlane * powf(farPlane / nearPlane, float(z) / float(CLUSTER_GRID_Z));
+
+    bounds.resize(size_t(CLUSTER_GRID_X) * CLUSTER_GRID_Y * CLUSTER_GRID_Z);
+    for (unsigned z = 0; z < CLUSTER_GRID_Z; ++z)
+    {
+        const float depthNear = sliceDepth[z];
+        const float depthFar = sliceDepth[z + 1];
+        for (unsigned y = 0; y < CLUSTER_GRID_Y; ++y)
+        {
+            // tile rows count up from the bottom of the screen, like gl_FragCoord
+            const float ndcY0 = -1.0f + 2.0f * float(y) / float(CLUSTER_GRID_Y);
+            const float ndcY1 = -1.0f + 2.0f * float(y + 1) / float(CLUSTER_GRID_Y);
+            for (unsigned x = 0; x < CLUSTER_GRID_X; ++x)
+            {
+                const float ndcX0 = -1.0f + 2.0f * float(x) / float(CLUSTER_GRID_X);
+                const float ndcX1 = -1.0f + 2.0f * float(x + 1) / float(CLUSTER_GRID_X);
+
+                ClusterBounds& box = bounds[(size_t(z) * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x];
+                box.minX = std::min(ndcX0 * depthNear, ndcX0 * depthFar) * scaleX;
+                box.maxX = std::max(ndcX1 * depthNear, ndcX1 * depthFar) * scaleX;
+                box.minY = std::min(ndcY0 * depthNear, ndcY0 * depthFar) * scaleY;
+                box.maxY = std::max(ndcY1 * depthNear, ndcY1 * depthFar) * scaleY;
+                box.minZ = -depthFar;
+                box.maxZ = -depthNear;
+            }
+        }
+    }
+}
+
+
+void ClusterLighting::Build(const glm::mat4& view, const std::vector<LightBlockPointLight>& lights)
+{
+    if (bounds.empty())
+    {
+        std::cout << "ERROR::CLUSTER_LIGHTING::NO_PROJECTION" << std::endl;
+        return;
+    }
+
+    lightCount = std::min(lights.size(), size_t(CLUSTER_MAX_LIGHTS));
+    lightX.resize(lightCount);
+    lightY.resize(lightCount);
+    lightZ.resize(lightCount);
+    lightRadiusSquared.resize(lightCount);
+    lightNear.resize(lightCount);
+    lightFar.resize(lightCount);
+
+    const float infinite = params.depthParams[1] * 4.0f + 1.0f;
+    for (size_t i = 0; i < lightCount; ++i)
+    {
+        const glm::vec3& p = lights[i].position;
+        float x = view[0][0] * p.x + view[1][0] * p.y + view[2][0] * p.z + view[3][0];
+        float y = view[0][1] * p.x + view[1][1] * p.y + view[2][1] * p.z + view[3][1];
+        float z = view[0][2] * p.x + view[1][2] * p.y + view[2][2] * p.z + view[3][2];
+        // no range: reaches every cluster
+        float radius = lights[i].radius > 0.0f ? lights[i].radius : infinite;
+        lightX[i] = x;
+        lightY[i] = y;
+        lightZ[i] = z;
+        lightRadiusSquared[i] = radius * radius;
+        lightNear[i] = -z - radius;
+        lightFar[i] = -z + radius;
+    }
+
+    jobs.ParallelFor(0, CLUSTER_GRID_Z, 1, [this](size_t first, size_t last) {
+        for (size_t z = first; z < last; ++z)
+            assignSlice(unsigned(z));
+    });
+
+    // stitch the slices together: cluster lists are stored in cluster order
+    indices.clear();
+    maxPerCluster = 0;
+    const size_t clustersPerSlice = size_t(CLUSTER_GRID_X) * CLUSTER_GRID_Y;
+    for (unsigned z = 0; z < CLUSTER_GRID_Z; ++z)
+    {
+        const Slice& slice = slices[z];
+        GLuint first = GLuint(indices.size());
+        for (size_t c = 0; c < clustersPerSlice; ++c)
+        {
+            size_t cluster = z * clustersPerSlice + c;
+            grid[cluster * 2] = first;
+            grid[cluster * 2 + 1] = slice.counts[c];
+            first += slice.counts[c];
+            maxPerCluster = std::max(maxPerCluster, unsigned(slice.counts[c]));
+        }
+        indices.insert(indices.end(), slice.indices.begin(), slice.indices.end());
+    }
+
+    if (buffers[0] == 0)
+        glGenBuffers(3, buffers);
+    upload(GL_SHADER_STORAGE_BUFFER, buffers[0], lights.data(), lightCount * sizeof(LightBlockPointLight));
+    upload(GL_SHADER_STORAGE_BUFFER, buffers[1], grid.data(), grid.size() * sizeof(GLuint));
+    upload(GL_SHADER_STORAGE_BUFFER, buffers[2], indices.data(), indices.size() * sizeof(GLuint));
+}
+
+
+void ClusterLighting::assignSlice(unsigned z)
+{
+    Slice& slice = slices[z];
+    const size_t clustersPerSlice = size_t(CLUSTER_GRID_X) * CLUSTER_GRID_Y;
+    slice.indices.clear();
+    slice.counts.assign(clustersPerSlice, 0);
+
+    // lights whose depth range overlaps the slice, in groups of four
+    const float depthNear = sliceDepth[z];
+    const float depthFar = sliceDepth[z + 1];
+    slice.candidates.clear();
+    for (size_t i = 0; i < lightCount; ++i)
+    {
+        if (lightFar[i] >= depthNear && lightNear[i] <= depthFar)
+            slice.candidates.push_back(uint32_t(i));
+    }
+    if (slice.candidates.empty())
+        return;
+
+    // x, y, z, radius^2 rows of four lights; padding lanes never pass the distance test
+    const size_t groups = (slice.candidates.size() + 3) / 4;
+    std::vector<float>& soa = slice.soa;
+    soa.resize(groups * 16);
+    for (size_t g = 0; g < groups; ++g)
+    {
+        float* row = &soa[g * 16];
+        for (size_t lane = 0; lane < 4; ++lane)
+        {
+            size_t k = g * 4 + lane;
+            bool real = k < slice.candidates.size();
+            size_t light = real ? slice.candidates[k] : 0;
+            row[lane] = real ? lightX[light] : 0.0f;
+            row[4 + lane] = real ? lightY[light] : 0.0f;
+            row[8 + lane] = real ? lightZ[light] : 0.0f;
+            row[12 + lane] = real ? lightRadiusSquared[light] : -1.0f;
+        }
+    }
+
+    const ClusterBounds* box = &bounds[size_t(z) * clustersPerSlice];
+    for (size_t c = 0; c < clustersPerSlice; ++c, ++box)
+    {
+        uint32_t count = 0;
+        for (size_t g = 0; g < groups; ++g)
+        {
+            const float* row = &soa[g * 16];
+            int mask = 0;
+#ifdef CLUSTER_LIGHTING_SSE
+            // squared distance from each sphere centre to the box: clamp the centre into the box
+            const __m128 zero = _mm_setzero_ps();
+            __m128 px = _mm_loadu_ps(row);
+            __m128 py = _mm_loadu_ps(row + 4);
+            __m128 pz = _mm_loadu_ps(row + 8);
+            __m128 r2 = _mm_loadu_ps(row + 12);
+            __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(box->minX), px), zero),
+                                   _mm_max_ps(_mm_sub_ps(px, _mm_set1_ps(box->maxX)), zero));
+            __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(box->minY), py), zero),
+                                   _mm_max_ps(_mm_sub_ps(py, _mm_set1_ps(box->maxY)), zero));
+            __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(box->minZ), pz), zero),
+                                   _mm_max_ps(_mm_sub_ps(pz, _mm_set1_ps(box->maxZ)), zero));
+            __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+#else
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                float dx = std::max(box->minX - row[lane], 0.0f) + std::max(row[lane] - box->maxX, 0.0f);
+                float dy = std::max(box->minY - row[4 + lane], 0.0f) + std::max(row[4 + lane] - box->maxY, 0.0f);
+                float dz = std::max(box->minZ - row[8 + lane], 0.0f) + std::max(row[8 + lane] - box->maxZ, 0.0f);
+                if (dx * dx + dy * dy + dz * dz <= row[12 + lane])
+                    mask |= 1 << lane;
+            }
+#endif
+            for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+            {
+                if (mask & 1)
+                {
+                    slice.indices.push_back(slice.candidates[g * 4 + size_t(lane)]);
+                    ++count;
+                }
+            }
+        }
+        slice.counts[c] = count;
+    }
+}
+
+
+void ClusterLighting::Bind() const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_BLOCK_BINDING, paramsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHTS_BINDING, buffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, buffers[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDICES_BINDING, buffers[2]);
+}
+
+
+// orphans the buffer's storage so the upload never waits for the frame still reading the old lists
+void ClusterLighting::upload(GLenum target, GLuint buffer, const void* data, size_t size)
+{
+    glBindBuffer(target, buffer);
+    // an empty buffer cannot be bound to an indexed target; keep at least one element
+    const GLuint empty[4] = { 0, 0, 0, 0 };
+    if (size == 0)
+    {
+        data = empty;
+        size = sizeof(empty);
+    }
+    glBufferData(target, GLsizeiptr(size), NULL, GL_STREAM_DRAW);
+    glBufferSubData(target, 0, GLsizeiptr(size), data);
+    glBindBuffer(target, 0);
+}
@@ -0,0 +1,113 @@
+#ifndef CLUSTER_LIGHTING_H
+#define CLUSTER_LIGHTING_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+#include "light_block.h"
+
+// Default cluster grid values; the shaders read the grid size from ClusterBlock
+const unsigned CLUSTER_GRID_X = 16;            // screen tiles across
+const unsigned CLUSTER_GRID_Y = 9;             // screen tiles down
+const unsigned CLUSTER_GRID_Z = 24;            // depth slices, spaced exponentially between near and far
+const unsigned CLUSTER_MAX_LIGHTS = 1u << 16;  // point lights uploaded per frame
+
+// Shader bindings (layout(binding = N) in clusters.glsl)
+const GLuint CLUSTER_BLOCK_BINDING = 1;        // uniform buffer; 0 is the LightBlock
+const GLuint CLUSTER_LIGHTS_BINDING = 1;       // shader storage: PointLight[]
+const GLuint CLUSTER_GRID_BINDING = 2;         // shader storage: uvec2 (first index, count) per cluster
+const GLuint CLUSTER_INDICES_BINDING = 3;      // shader storage: uint light indices
+
+
+// std140 mirror of ClusterBlock in clusters.glsl
+struct ClusterBlockData
+{
+    GLuint gridSize[4];         // x, y, z, unused
+    GLfloat depthParams[4];     // near, far, slice scale, slice bias
+    GLfloat screenSize[4];      // width, height, 1 / width, 1 / height
+};
+
+
+/* Clustered forward shading.
+ *
+ * The view frustum is cut into CLUSTER_GRID_X * Y screen tiles times CLUSTER_GRID_Z exponential depth
+ * slices. Build() moves every point light into view space, assigns it to each cluster its range
+ * sphere touches and uploads three storage buffers: the lights, a (first, count) pair per cluster and
+ * the packed index lists those pairs point into. A fragment finds its cluster from gl_FragCoord and
+ * its depth and shades only the lights listed there, so the cost follows the lights that actually
+ * reach it rather than the total.
+ *
+ * Assignment runs one depth slice per job: each slice first keeps the lights whose depth range
+ * overlaps it, then tests them against the slice's clusters four at a time with SSE sphere/box tests.
+ * Lights need a range (LightBlockPointLight::radius, see PointLightRange()); a light without one
+ * reaches every cluster.
+ */
+class ClusterLighting
+{
+public:
+    explicit ClusterLighting(JobSystem& jobs);
+    ~ClusterLighting();
+
+    // perspective the clusters are cut from; cheap to call every frame, only recomputes on change
+    void SetProjection(float fovYRadians, float aspect, float nearPlane, float farPlane, int width, int height);
+
+    // assigns the lights (world space) to clusters and uploads the result; GL thread
+    void Build(const glm::mat4& view, const std::vector<LightBlockPointLight>& lights);
+
+    // binds the uniform block and storage buffers to their CLUSTER_* bindings
+    void Bind() const;
+
+    // statistics from the last Build()
+    size_t LightCount() const { return lightCount; }
+    size_t IndexCount() const { return indices.size(); }
+    unsigned MaxLightsPerCluster() const { return maxPerCluster; }
+
+private:
+    struct ClusterBounds
+    {
+        float minX, minY, minZ;
+        float maxX, maxY, maxZ;
+    };
+
+    // one slice's output, filled by its own job
+    struct Slice
+    {
+        std::vector<uint32_t> candidates;     // lights overlapping the slice's depth range
+        std::vector<float> soa;               // the candidates as x, y, z, radius^2 rows of four
+        std::vector<uint32_t> indices;        // cluster lists of this slice, back to back
+        std::vector<uint32_t> counts;         // lights per cluster of this slice
+    };
+
+    JobSystem& jobs;
+    ClusterBlockData params;
+    float tanHalfFov;
+    float aspectRatio;
+    std::vector<ClusterBounds> bounds;        // view space, CLUSTER_GRID_X * Y * Z
+    std::vector<float> sliceDepth;            // CLUSTER_GRID_Z + 1 distances along -z
+
+    // lights in view space
+    std::vector<float> lightX, lightY, lightZ, lightRadiusSquared;
+    std::vector<float> lightNear, lightFar;   // depth range each light's sphere covers
+    size_t lightCount;
+
+    std::vector<Slice> slices;
+    std::vector<GLuint> grid;                 // (first, count) per cluster
+    std::vector<GLuint> indices;
+    unsigned maxPerCluster;
+
+    GLuint paramsBuffer;
+    GLuint buffers[3];                        // lights, grid, indices
+
+    void computeBounds();
+    void assignSlice(unsigned z);
+    static void upload(GLenum target, GLuint buffer, const void* data, size_t size);
+
+    ClusterLighting(const ClusterLighting&);
+    ClusterLighting& operator=(const ClusterLighting&);
+};
+#endif
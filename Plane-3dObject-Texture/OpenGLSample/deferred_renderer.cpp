@@ -0,0 +1,337 @@
+#include <cmath>
+#include <iostream>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "cluster_lighting.h"
+#include "deferred_renderer.h"
+#include "shader_batch.h"
+#include "shader_permutations.h"
+
+namespace
+{
+    const char* const GEOMETRY_VERTEX_SHADER = "shaderfiles/6.multiple_lights.vs";
+    const char* const GEOMETRY_FRAGMENT_SHADER = "shaderfiles/gbuffer.fs";
+    const char* const FULLSCREEN_VERTEX_SHADER = "shaderfiles/deferred_fullscreen.vs";
+    const char* const LIGHTS_FRAGMENT_SHADER = "shaderfiles/deferred_lights.fs";
+    const char* const VOLUME_VERTEX_SHADER = "shaderfiles/deferred_volume.vs";
+    const char* const VOLUME_FRAGMENT_SHADER = "shaderfiles/deferred_volume.fs";
+
+    constexpr uint32_t UNIFORM_ALBEDO_SPEC = ShaderNameId("gAlbedoSpec");
+    constexpr uint32_t UNIFORM_NORMAL_SHININESS = ShaderNameId("gNormalShininess");
+    constexpr uint32_t UNIFORM_DEPTH = ShaderNameId("gDepth");
+    constexpr uint32_t UNIFORM_INVERSE_VIEW_PROJECTION = ShaderNameId("inverseViewProjection");
+    constexpr uint32_t UNIFORM_INVERSE_SCREEN_SIZE = ShaderNameId("inverseScreenSize");
+    constexpr uint32_t UNIFORM_VIEW_POS = ShaderNameId("viewPos");
+    constexpr uint32_t UNIFORM_VIEW_PROJECTION = ShaderNameId("viewProjection");
+    constexpr uint32_t UNIFORM_VOLUME_SCALE = ShaderNameId("volumeScale");
+}
+
+
+DeferredRenderer::DeferredRenderer()
+    : width(0), height(0), mode(DEFERRED_LIGHT_TILED), framebuffer(0),
+      geometryProgram(0), lightsProgram(0), tiledProgram(0), volumeProgram(0),
+      emptyVao(0), sphereVao(0), sphereIndexCount(0), lightBuffer(0)
+{
+    for (int i = 0; i < TARGET_COUNT; ++i)
+        textures[i] = 0;
+    sphereBuffers[0] = sphereBuffers[1] = 0;
+}
+
+
+DeferredRenderer::~DeferredRenderer()
+{
+    release();
+    if (emptyVao != 0)
+        glDeleteVertexArrays(1, &emptyVao);
+    if (sphereVao != 0)
+    {
+        glDeleteVertexArrays(1, &sphereVao);
+        glDeleteBuffers(2, sphereBuffers);
+    }
+    if (lightBuffer != 0)
+        glDeleteBuffers(1, &lightBuffer);
+    // the programs belong to the permutation cache
+}
+
+
+bool DeferredRenderer::Create(ShaderPermutationCache& shaders, const ShaderDefines& defines)
+{
+    ShaderDefines tiled = defines;
+    tiled.Set("DEFERRED_TILED", 1);
+
+    ShaderBatch batch;
+    const GLuint* slots[] = {
+        shaders.Queue(ShaderPermutation(GEOMETRY_VERTEX_SHADER, GEOMETRY_FRAGMENT_SHADER, defines), batch),
+        shaders.Queue(ShaderPermutation(FULLSCREEN_VERTEX_SHADER, LIGHTS_FRAGMENT_SHADER, defines), batch),
+        shaders.Queue(ShaderPermutation(FULLSCREEN_VERTEX_SHADER, LIGHTS_FRAGMENT_SHADER, tiled), batch),
+        shaders.Queue(ShaderPermutation(VOLUME_VERTEX_SHADER, VOLUME_FRAGMENT_SHADER, defines), batch),
+    };
+    batch.Submit();
+    batch.Finish();
+
+    geometryProgram = *slots[0];
+    lightsProgram = *slots[1];
+    tiledProgram = *slots[2];
+    volumeProgram = *slots[3];
+    setupLighting(lightsUniforms, lightsProgram);
+    setupLighting(tiledUniforms, tiledProgram);
+    setupLighting(volumeUniforms, volumeProgram);
+
+    if (emptyVao == 0)
+        glGenVertexArrays(1, &emptyVao);
+    if (sphereVao == 0)
+        createSphere();
+
+    if (geometryProgram == 0 || lightsProgram == 0 || volumeProgram == 0)
+    {
+        std::cout << "ERROR::DEFERRED::PROGRAMS_FAILED" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool DeferredRenderer::Resize(int newWidth, int newHeight)
+{
+    if (newWidth <= 0 || newHeight <= 0)
+        return false;
+    if (framebuffer != 0 && newWidth == width && newHeight == height)
+        return true;
+
+    release();
+    width = newWidth;
+    height = newHeight;
+
+    // depth is DEPTH24_STENCIL8 like the usual default framebuffer, so Shade() can blit it across
+    const GLenum internalFormats[TARGET_COUNT] = { GL_RGBA8, GL_RGB10_A2, GL_DEPTH24_STENCIL8 };
+    const GLenum formats[TARGET_COUNT] = { GL_RGBA, GL_RGBA, GL_DEPTH_STENCIL };
+    const GLenum types[TARGET_COUNT] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_INT_2_10_10_10_REV, GL_UNSIGNED_INT_24_8 };
+
+    glGenTextures(TARGET_COUNT, textures);
+    for (int i = 0; i < TARGET_COUNT; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], NULL);
+        // the lighting passes only texelFetch
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[TARGET_ALBEDO_SPEC], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures[TARGET_NORMAL_SHININESS], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, textures[TARGET_DEPTH], 0);
+    const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "ERROR::DEFERRED::GBUFFER_INCOMPLETE 0x" << std::hex << status << std::dec << std::endl;
+        release();
+        return false;
+    }
+    return true;
+}
+
+
+void DeferredRenderer::BeginGeometry()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+
+void DeferredRenderer::EndGeometry()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void DeferredRenderer::Shade(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+                             const std::vector<LightBlockPointLight>& lights, const ClusterLighting* clusters, GLuint target)
+{
+    if (framebuffer == 0 || lightsProgram == 0)
+        return;
+
+    const glm::mat4 viewProjection = projection * view;
+    const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+
+    // scene depth first: the light volumes test against it and later forward passes draw over it
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glViewport(0, 0, width, height);
+
+    for (int i = 0; i < TARGET_COUNT; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    const bool tiled = mode == DEFERRED_LIGHT_TILED && clusters != NULL && tiledProgram != 0;
+    if (tiled)
+        clusters->Bind();
+
+    // directional and spot light, plus the clustered point lights when tiled
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_BLEND);
+    ProgramReflection& uniforms = tiled ? tiledUniforms : lightsUniforms;
+    setFrame(uniforms, inverseViewProjection, viewPos);
+    glUseProgram(uniforms.Program());
+    glBindVertexArray(emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    if (!tiled && !lights.empty())
+        shadeVolumes(viewProjection, inverseViewProjection, viewPos, lights);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
+
+
+// One instanced sphere per light. Drawing only back faces that lie behind the scene depth marks the
+// pixels whose surface is inside (or in front of) the volume, including when the camera is inside;
+// depth clamping keeps spheres that cross the far plane whole.
+void DeferredRenderer::shadeVolumes(const glm::mat4& viewProjection, const glm::mat4& inverseViewProjection, const glm::vec3& viewPos,
+                                    const std::vector<LightBlockPointLight>& lights)
+{
+    volumeLights = lights;
+    for (size_t i = 0; i < volumeLights.size(); ++i)
+    {
+        if (volumeLights[i].radius <= 0.0f)
+            volumeLights[i].radius = PointLightRange(volumeLights[i]);
+    }
+
+    if (lightBuffer == 0)
+        glGenBuffers(1, &lightBuffer);
+    // orphan last frame's storage so the upload never waits on draws still reading it
+    GLsizeiptr size = GLsizeiptr(volumeLights.size() * sizeof(LightBlockPointLight));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, volumeLights.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DEFERRED_LIGHTS_BINDING, lightBuffer);
+
+    volumeUniforms.Set(UNIFORM_VIEW_PROJECTION, 'm', glm::value_ptr(viewProjection), 16);
+    setFrame(volumeUniforms, inverseViewProjection, viewPos);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GEQUAL);
+    glEnable(GL_DEPTH_CLAMP);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glUseProgram(volumeProgram);
+    glBindVertexArray(sphereVao);
+    glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_SHORT, NULL, GLsizei(volumeLights.size()));
+
+    glCullFace(GL_BACK);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_CLAMP);
+}
+
+
+void DeferredRenderer::setupLighting(ProgramReflection& uniforms, GLuint program)
+{
+    uniforms.Reflect(program);
+    if (program == 0)
+        return;
+    const GLint units[TARGET_COUNT] = { 0, 1, 2 };
+    uniforms.Set(UNIFORM_ALBEDO_SPEC, 'i', &units[TARGET_ALBEDO_SPEC], 1);
+    uniforms.Set(UNIFORM_NORMAL_SHININESS, 'i', &units[TARGET_NORMAL_SHININESS], 1);
+    uniforms.Set(UNIFORM_DEPTH, 'i', &units[TARGET_DEPTH], 1);
+    uniforms.Set(UNIFORM_VOLUME_SCALE, 'f', &DEFERRED_VOLUME_SCALE, 1);
+    uniforms.Flush();
+}
+
+
+void DeferredRenderer::setFrame(ProgramReflection& uniforms, const glm::mat4& inverseViewProjection, const glm::vec3& viewPos)
+{
+    const GLfloat inverseScreenSize[2] = { 1.0f / float(width), 1.0f / float(height) };
+    uniforms.Set(UNIFORM_INVERSE_VIEW_PROJECTION, 'm', glm::value_ptr(inverseViewProjection), 16);
+    uniforms.Set(UNIFORM_INVERSE_SCREEN_SIZE, 'f', inverseScreenSize, 2);
+    uniforms.Set(UNIFORM_VIEW_POS, 'f', glm::value_ptr(viewPos), 3);
+    uniforms.Flush();
+}
+
+
+// Unit sphere as latitude/longitude rings; positions double as the only attribute
+void DeferredRenderer::createSphere()
+{
+    const float pi = 3.14159265358979f;
+    std::vector<GLfloat> vertices;
+    std::vector<GLushort> indices;
+    for (unsigned stack = 0; stack <= DEFERRED_SPHERE_STACKS; ++stack)
+    {
+        float phi = pi * float(stack) / float(DEFERRED_SPHERE_STACKS);
+        for (unsigned slice = 0; slice <= DEFERRED_SPHERE_SLICES; ++slice)
+        {
+            float theta = 2.0f * pi * float(slice) / float(DEFERRED_SPHERE_SLICES);
+            vertices.push_back(sinf(phi) * cosf(theta));
+            vertices.push_back(cosf(phi));
+            vertices.push_back(sinf(phi) * sinf(theta));
+        }
+    }
+    const unsigned ring = DEFERRED_SPHERE_SLICES + 1;
+    for (unsigned stack = 0; stack < DEFERRED_SPHERE_STACKS; ++stack)
+    {
+        for (unsigned slice = 0; slice < DEFERRED_SPHERE_SLICES; ++slice)
+        {
+            GLushort a = GLushort(stack * ring + slice);
+            GLushort b = GLushort(a + ring);
+            // counter-clockwise seen from outside
+            indices.push_back(a);
+            indices.push_back(GLushort(a + 1));
+            indices.push_back(b);
+            indices.push_back(GLushort(a + 1));
+            indices.push_back(GLushort(b + 1));
+            indices.push_back(b);
+        }
+    }
+    sphereIndexCount = GLsizei(indices.size());
+
+    glGenVertexArrays(1, &sphereVao);
+    glGenBuffers(2, sphereBuffers);
+    glBindVertexArray(sphereVao);
+    glBindBuffer(GL_ARRAY_BUFFER, sphereBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(vertices.size() * sizeof(GLfloat)), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereBuffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(indices.size() * sizeof(GLushort)), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+}
+
+
+void DeferredRenderer::release()
+{
+    if (framebuffer != 0)
+        glDeleteFramebuffers(1, &framebuffer);
+    if (textures[0] != 0)
+        glDeleteTextures(TARGET_COUNT, textures);
+    framebuffer = 0;
+    for (int i = 0; i < TARGET_COUNT; ++i)
+        textures[i] = 0;
+}
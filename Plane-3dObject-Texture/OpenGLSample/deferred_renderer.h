@@ -0,0 +1,122 @@
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "light_block.h"
+#include "program_reflection.h"
+
+class ClusterLighting;
+class ShaderDefines;
+class ShaderPermutationCache;
+
+// How the deferred path shades its point lights
+enum DeferredLightMode
+{
+    DEFERRED_LIGHT_TILED,       // one full-screen pass reading ClusterLighting's per-cluster lists
+    DEFERRED_LIGHT_VOLUMES      // one instanced sphere per light, blended additively
+};
+
+// Shader bindings (layout(binding = N) in deferred_volume.vs/.fs)
+const GLuint DEFERRED_LIGHTS_BINDING = 4;       // shader storage: PointLight[]; 1-3 belong to the clusters
+
+// Light volume mesh; the scale makes the flat faces of the sphere enclose its unit radius
+const unsigned DEFERRED_SPHERE_SLICES = 16;
+const unsigned DEFERRED_SPHERE_STACKS = 8;
+const float DEFERRED_VOLUME_SCALE = 1.1f;
+
+
+/* Deferred shading, an alternative to the forward path in 6.multiple_lights.fs.
+ *
+ * The geometry pass writes each visible surface once into a compact G-buffer (see gbuffer.glsl):
+ * albedo and specular intensity in RGBA8, an octahedral normal and log shininess in RGB10_A2 and the
+ * depth, from which the lighting passes rebuild world position. Lighting then costs one shade per
+ * pixel and light no matter how many hidden surfaces were drawn behind it.
+ *
+ * Shade() always runs a full-screen pass for the directional and spot lights. Point lights go either
+ * through the same pass using the light lists ClusterLighting built for the frame (tiled), or as
+ * instanced spheres drawn back faces only against the scene depth (volumes); SetMode() picks one at
+ * any time. Both modes need ranged lights; volumes give a light without a radius PointLightRange().
+ */
+class DeferredRenderer
+{
+public:
+    DeferredRenderer();
+    ~DeferredRenderer();
+
+    // compiles the geometry and lighting programs as one batch, each with 'defines' (HAS_SPECULAR_MAP,
+    // for one); GL thread, returns false if any failed
+    bool Create(ShaderPermutationCache& shaders, const ShaderDefines& defines);
+
+    // (re)allocates the G-buffer for the window size; does nothing if the size is unchanged
+    bool Resize(int width, int height);
+
+    void SetMode(DeferredLightMode lightMode) { mode = lightMode; }
+    DeferredLightMode Mode() const { return mode; }
+
+    // binds and clears the G-buffer; draw opaque geometry with GeometryProgram() until EndGeometry()
+    void BeginGeometry();
+    void EndGeometry();
+
+    // 6.multiple_lights.vs with gbuffer.fs: model/view/projection and the usual material uniforms
+    GLuint GeometryProgram() const { return geometryProgram; }
+
+    // Lights the G-buffer into 'target' and copies the depth there so forward passes can follow.
+    // The LightBlock must be uploaded. Tiled mode uses 'clusters', built from 'lights' this frame;
+    // without them it falls back to volumes.
+    void Shade(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos,
+               const std::vector<LightBlockPointLight>& lights, const ClusterLighting* clusters, GLuint target = 0);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // depth target of the G-buffer, for callers tracking it as a texture; 0 until Resize()
+    GLuint DepthTexture() const { return textures[TARGET_DEPTH]; }
+
+private:
+    enum Target
+    {
+        TARGET_ALBEDO_SPEC,
+        TARGET_NORMAL_SHININESS,
+        TARGET_DEPTH,
+        TARGET_COUNT
+    };
+
+    int width;
+    int height;
+    DeferredLightMode mode;
+
+    GLuint framebuffer;
+    GLuint textures[TARGET_COUNT];
+
+    GLuint geometryProgram;
+    GLuint lightsProgram;           // directional and spot only
+    GLuint tiledProgram;            // plus the clustered point lights
+    GLuint volumeProgram;
+    ProgramReflection lightsUniforms;
+    ProgramReflection tiledUniforms;
+    ProgramReflection volumeUniforms;
+
+    GLuint emptyVao;                // the full-screen triangle needs no attributes
+    GLuint sphereVao;
+    GLuint sphereBuffers[2];        // vertices, indices
+    GLsizei sphereIndexCount;
+
+    GLuint lightBuffer;
+    std::vector<LightBlockPointLight> volumeLights;
+
+    void release();
+    void createSphere();
+    static void setupLighting(ProgramReflection& uniforms, GLuint program);
+    void setFrame(ProgramReflection& uniforms, const glm::mat4& inverseViewProjection, const glm::vec3& viewPos);
+    void shadeVolumes(const glm::mat4& viewProjection, const glm::mat4& inverseViewProjection, const glm::vec3& viewPos,
+                      const std::vector<LightBlockPointLight>& lights);
+
+    DeferredRenderer(const DeferredRenderer&);
+    DeferredRenderer& operator=(const DeferredRenderer&);
+};
+#endif
@@ -0,0 +1,72 @@
+#ifndef FIXED_TIMESTEP_H
+#define FIXED_TIMESTEP_H
+
+// Default fixed timestep values
+const double FIXED_TIMESTEP_HZ = 60.0;          // simulation steps per second
+const int FIXED_TIMESTEP_MAX_STEPS = 5;         // steps run per frame at most before time is dropped
+const double FIXED_TIMESTEP_MAX_FRAME = 0.25;   // seconds of one frame counted at most (breakpoints, window drags)
+
+
+/* Accumulator for a simulation that advances in equal steps whatever the frame rate.
+ *
+ * Each frame Advance() adds the frame's wall time and returns how many whole steps are due; the
+ * remainder carries over, and Alpha() says how far between the last two simulated states the frame
+ * falls, so the renderer can interpolate instead of showing the stepped state.
+ *
+ * When simulating takes longer than the time it covers, the debt would grow every frame (the spiral
+ * of death). Frames are capped at FIXED_TIMESTEP_MAX_FRAME and at most FIXED_TIMESTEP_MAX_STEPS steps
+ * run per frame; time beyond that is dropped and counted, so the simulation slows down instead.
+ */
+class FixedTimestep
+{
+public:
+    explicit FixedTimestep(double hz = FIXED_TIMESTEP_HZ) : step(1.0 / hz), accumulator(0.0), dropped(0.0), maxSteps(FIXED_TIMESTEP_MAX_STEPS) {}
+
+    // takes effect from the next step; the time already accumulated is kept
+    void SetRate(double hz)
+    {
+        if (hz > 0.0)
+            step = 1.0 / hz;
+    }
+
+    void SetMaxSteps(int steps) { maxSteps = steps > 0 ? steps : 1; }
+
+    // adds a frame's wall time and returns the number of steps to simulate now
+    int Advance(double frameSeconds)
+    {
+        if (frameSeconds < 0.0)
+            frameSeconds = 0.0;
+        if (frameSeconds > FIXED_TIMESTEP_MAX_FRAME)
+        {
+            dropped += frameSeconds - FIXED_TIMESTEP_MAX_FRAME;
+            frameSeconds = FIXED_TIMESTEP_MAX_FRAME;
+        }
+
+        accumulator += frameSeconds;
+        int steps = int(accumulator / step);
+        if (steps > maxSteps)
+        {
+            dropped += (steps - maxSteps) * step;
+            accumulator -= (steps - maxSteps) * step;
+            steps = maxSteps;
+        }
+        accumulator -= steps * step;
+        return steps;
+    }
+
+    // 0 shows the state before the last step, 1 the state after it
+    float Alpha() const { return float(accumulator / step); }
+
+    double StepSeconds() const { return step; }
+    double StepRate() const { return 1.0 / step; }
+
+    // wall time the simulation fell behind by and skipped, since the start
+    double DroppedSeconds() const { return dropped; }
+
+private:
+    double step;
+    double accumulator;
+    double dropped;
+    int maxSteps;
+};
+#endif
@@ -0,0 +1,261 @@
+#ifndef GL_BACKEND_H
+#define GL_BACKEND_H
+
+// Include after the GL loader (GLEW or glad); like program_cache.h this header only uses its types.
+
+#include <cstddef>
+
+// Default null backend values
+const GLuint GL_NULL_FIRST_NAME = 1;        // object names the null backend hands out count up from here
+
+
+// What a frame asked of the backend
+struct GLBackendStats
+{
+    size_t calls;
+    size_t draws;
+    size_t indices;             // indices drawn
+    size_t bytes;               // buffer data and uniform values passed in
+
+    GLBackendStats() : calls(0), draws(0), indices(0), bytes(0) {}
+};
+
+
+/* The GL calls the scene makes to upload and draw its meshes (UCreateMesh, URender, Mesh::Draw and
+ * ProgramReflection::Flush), behind one interface so the driver can be swapped out.
+ *
+ * GLDriverBackend forwards every call to the loaded GL functions. GLNullBackend issues nothing and
+ * only counts calls and bytes, handing out made-up object names; with it a frame costs exactly the
+ * CPU work of building it (matrix math, uniform packing, draw submission), which is what a CPU
+ * benchmark wants to see without the driver's or the GPU's noise. Object set up, queries and shader
+ * compilation stay on plain GL. Both keep GLBackendStats, reset by the caller once per frame.
+ */
+class GLBackend
+{
+public:
+    virtual ~GLBackend() {}
+
+    virtual bool IsNull() const = 0;
+
+    // state
+    virtual void Enable(GLenum capability) = 0;
+    virtual void Disable(GLenum capability) = 0;
+    virtual void BlendFunc(GLenum source, GLenum destination) = 0;
+    virtual void DepthFunc(GLenum function) = 0;
+    virtual void DepthMask(GLboolean write) = 0;
+    virtual void ColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) = 0;
+    virtual void PolygonMode(GLenum face, GLenum mode) = 0;
+    virtual void Viewport(GLint x, GLint y, GLsizei width, GLsizei height) = 0;
+    virtual void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) = 0;
+    virtual void Clear(GLbitfield mask) = 0;
+    virtual void UseProgram(GLuint program) = 0;
+    virtual void ActiveTexture(GLenum unit) = 0;
+    virtual void BindTexture(GLenum target, GLuint texture) = 0;
+    virtual void BindVertexArray(GLuint vertexArray) = 0;
+    virtual void BindBuffer(GLenum target, GLuint buffer) = 0;
+
+    // objects
+    virtual void GenVertexArrays(GLsizei count, GLuint* names) = 0;
+    virtual void GenBuffers(GLsizei count, GLuint* names) = 0;
+    virtual void DeleteVertexArrays(GLsizei count, const GLuint* names) = 0;
+    virtual void DeleteBuffers(GLsizei count, const GLuint* names) = 0;
+    virtual void BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) = 0;
+    virtual void VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* offset) = 0;
+    virtual void EnableVertexAttribArray(GLuint index) = 0;
+
+    // 'count' values of a uniform of kind 'f', 'i', 'u' or 'm' with 'components' each (ProgramReflection's layout)
+    virtual void ProgramUniform(GLuint program, GLint location, char kind, GLint components, GLsizei count, const void* value) = 0;
+
+    virtual void DrawElements(GLenum mode, GLsizei count, GLenum type, const void* offset) = 0;
+
+    const GLBackendStats& Stats() const { return stats; }
+    virtual void ResetStats() { stats = GLBackendStats(); }
+
+protected:
+    GLBackendStats stats;
+};
+
+
+// Forwards to the driver
+class GLDriverBackend : public GLBackend
+{
+public:
+    bool IsNull() const { return false; }
+
+    void Enable(GLenum capability) { ++stats.calls; glEnable(capability); }
+    void Disable(GLenum capability) { ++stats.calls; glDisable(capability); }
+    void BlendFunc(GLenum source, GLenum destination) { ++stats.calls; glBlendFunc(source, destination); }
+    void DepthFunc(GLenum function) { ++stats.calls; glDepthFunc(function); }
+    void DepthMask(GLboolean write) { ++stats.calls; glDepthMask(write); }
+    void ColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) { ++stats.calls; glColorMask(red, green, blue, alpha); }
+    void PolygonMode(GLenum face, GLenum mode) { ++stats.calls; glPolygonMode(face, mode); }
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height) { ++stats.calls; glViewport(x, y, width, height); }
+    void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) { ++stats.calls; glClearColor(red, green, blue, alpha); }
+    void Clear(GLbitfield mask) { ++stats.calls; glClear(mask); }
+    void UseProgram(GLuint program) { ++stats.calls; glUseProgram(program); }
+    void ActiveTexture(GLenum unit) { ++stats.calls; glActiveTexture(unit); }
+    void BindTexture(GLenum target, GLuint texture) { ++stats.calls; glBindTexture(target, texture); }
+    void BindVertexArray(GLuint vertexArray) { ++stats.calls; glBindVertexArray(vertexArray); }
+    void BindBuffer(GLenum target, GLuint buffer) { ++stats.calls; glBindBuffer(target, buffer); }
+
+    void GenVertexArrays(GLsizei count, GLuint* names) { ++stats.calls; glGenVertexArrays(count, names); }
+    void GenBuffers(GLsizei count, GLuint* names) { ++stats.calls; glGenBuffers(count, names); }
+    void DeleteVertexArrays(GLsizei count, const GLuint* names) { ++stats.calls; glDeleteVertexArrays(count, names); }
+    void DeleteBuffers(GLsizei count, const GLuint* names) { ++stats.calls; glDeleteBuffers(count, names); }
+
+    void BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        ++stats.calls;
+        stats.bytes += size_t(size);
+        glBufferData(target, size, data, usage);
+    }
+
+    void VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* offset)
+    {
+        ++stats.calls;
+        glVertexAttribPointer(index, size, type, normalized, stride, offset);
+    }
+
+    void EnableVertexAttribArray(GLuint index) { ++stats.calls; glEnableVertexAttribArray(index); }
+
+    void ProgramUniform(GLuint program, GLint location, char kind, GLint components, GLsizei count, const void* value)
+    {
+        ++stats.calls;
+        stats.bytes += size_t(count) * components * 4;
+
+        const GLfloat* f = static_cast<const GLfloat*>(value);
+        const GLint* s = static_cast<const GLint*>(value);
+        const GLuint* u = static_cast<const GLuint*>(value);
+        switch (kind)
+        {
+        case 'm':
+            if (components == 4)
+                glProgramUniformMatrix2fv(program, location, count, GL_FALSE, f);
+            else if (components == 9)
+                glProgramUniformMatrix3fv(program, location, count, GL_FALSE, f);
+            else
+                glProgramUniformMatrix4fv(program, location, count, GL_FALSE, f);
+            break;
+        case 'f':
+            if (components == 1)
+                glProgramUniform1fv(program, location, count, f);
+            else if (components == 2)
+                glProgramUniform2fv(program, location, count, f);
+            else if (components == 3)
+                glProgramUniform3fv(program, location, count, f);
+            else
+                glProgramUniform4fv(program, location, count, f);
+            break;
+        case 'i':
+            if (components == 1)
+                glProgramUniform1iv(program, location, count, s);
+            else if (components == 2)
+                glProgramUniform2iv(program, location, count, s);
+            else if (components == 3)
+                glProgramUniform3iv(program, location, count, s);
+            else
+                glProgramUniform4iv(program, location, count, s);
+            break;
+        default:
+            if (components == 1)
+                glProgramUniform1uiv(program, location, count, u);
+            else if (components == 2)
+                glProgramUniform2uiv(program, location, count, u);
+            else if (components == 3)
+                glProgramUniform3uiv(program, location, count, u);
+            else
+                glProgramUniform4uiv(program, location, count, u);
+            break;
+        }
+    }
+
+    void DrawElements(GLenum mode, GLsizei count, GLenum type, const void* offset)
+    {
+        ++stats.calls;
+        ++stats.draws;
+        stats.indices += size_t(count);
+        glDrawElements(mode, count, type, offset);
+    }
+};
+
+
+// Counts and discards
+class GLNullBackend : public GLBackend
+{
+public:
+    GLNullBackend() : nextName(GL_NULL_FIRST_NAME) {}
+
+    bool IsNull() const { return true; }
+
+    void Enable(GLenum) { ++stats.calls; }
+    void Disable(GLenum) { ++stats.calls; }
+    void BlendFunc(GLenum, GLenum) { ++stats.calls; }
+    void DepthFunc(GLenum) { ++stats.calls; }
+    void DepthMask(GLboolean) { ++stats.calls; }
+    void ColorMask(GLboolean, GLboolean, GLboolean, GLboolean) { ++stats.calls; }
+    void PolygonMode(GLenum, GLenum) { ++stats.calls; }
+    void Viewport(GLint, GLint, GLsizei, GLsizei) { ++stats.calls; }
+    void ClearColor(GLfloat, GLfloat, GLfloat, GLfloat) { ++stats.calls; }
+    void Clear(GLbitfield) { ++stats.calls; }
+    void UseProgram(GLuint) { ++stats.calls; }
+    void ActiveTexture(GLenum) { ++stats.calls; }
+    void BindTexture(GLenum, GLuint) { ++stats.calls; }
+    void BindVertexArray(GLuint) { ++stats.calls; }
+    void BindBuffer(GLenum, GLuint) { ++stats.calls; }
+
+    void GenVertexArrays(GLsizei count, GLuint* names) { ++stats.calls; generate(count, names); }
+    void GenBuffers(GLsizei count, GLuint* names) { ++stats.calls; generate(count, names); }
+    void DeleteVertexArrays(GLsizei, const GLuint*) { ++stats.calls; }
+    void DeleteBuffers(GLsizei, const GLuint*) { ++stats.calls; }
+    void BufferData(GLenum, GLsizeiptr size, const void*, GLenum) { ++stats.calls; stats.bytes += size_t(size); }
+    void VertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) { ++stats.calls; }
+    void EnableVertexAttribArray(GLuint) { ++stats.calls; }
+
+    void ProgramUniform(GLuint, GLint, char, GLint components, GLsizei count, const void*)
+    {
+        ++stats.calls;
+        stats.bytes += size_t(count) * components * 4;
+    }
+
+    void DrawElements(GLenum, GLsizei count, GLenum, const void*)
+    {
+        ++stats.calls;
+        ++stats.draws;
+        stats.indices += size_t(count);
+    }
+
+private:
+    GLuint nextName;
+
+    void generate(GLsizei count, GLuint* names)
+    {
+        for (GLsizei i = 0; i < count; ++i)
+            names[i] = nextName++;
+    }
+};
+
+
+inline GLDriverBackend& DriverGLBackend()
+{
+    static GLDriverBackend driver;
+    return driver;
+}
+
+inline GLBackend*& CurrentGLBackendSlot()
+{
+    static GLBackend* backend = &DriverGLBackend();
+    return backend;
+}
+
+// The backend in use; the driver unless SetGLBackend() picked another one
+inline GLBackend& CurrentGLBackend()
+{
+    return *CurrentGLBackendSlot();
+}
+
+// null restores the driver backend; switch before any mesh is created, names do not carry over
+inline void SetGLBackend(GLBackend* backend)
+{
+    CurrentGLBackendSlot() = backend != nullptr ? backend : &DriverGLBackend();
+}
+#endif
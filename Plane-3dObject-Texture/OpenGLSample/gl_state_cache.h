@@ -0,0 +1,397 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+// Include after the GL loader (GLEW or glad); like program_cache.h this header only uses its types.
+
+#include <cstddef>
+
+#include "gl_backend.h"
+
+// Default state cache values
+const int GL_STATE_CACHE_TEXTURE_UNITS = 16;    // units tracked; higher ones always reach the backend
+
+
+/* Shadow copy of the GL state the frame sets, as a GLBackend in front of another one.
+ *
+ * Program, buffer bindings (except the element array, which belongs to the VAO), textures per unit
+ * and target, capabilities, blend and depth functions, depth and color masks, polygon mode, viewport
+ * and clear color are compared against what was last sent and dropped when nothing would change.
+ * Two bindings are deferred instead: the VAO until something draws or edits vertex state, and the
+ * active texture unit until a texture is bound to it, so the unbind-then-rebind pairs of URender
+ * and Mesh::Draw collapse into one call or none.
+ *
+ * Code that calls GL directly behind the cache's back makes the copy stale: InvalidateBindings()
+ * sends what is deferred and forgets the bindings (call it at the end of every frame, before the
+ * texture uploads and shader swaps that bind outside it), Invalidate() forgets everything.
+ * Unknown state is always sent.
+ * Stats() counts the calls asked for; Next().Stats() the calls that were actually issued.
+ */
+class GLStateCache : public GLBackend
+{
+public:
+    explicit GLStateCache(GLBackend& next)
+        : next(next), currentVertexArray(0), pendingVertexArray(NO_PENDING), vertexArrayKnown(false), activeUnit(GL_TEXTURE0),
+          pendingUnit(GL_TEXTURE0), activeUnitKnown(false)
+    {
+        Invalidate();
+    }
+
+    GLBackend& Next() { return next; }
+
+    // requested calls that never reached the next backend since the last ResetStats()
+    size_t FilteredCalls() const { return stats.calls > next.Stats().calls ? stats.calls - next.Stats().calls : 0; }
+
+    void ResetStats()
+    {
+        stats = GLBackendStats();
+        next.ResetStats();
+    }
+
+    // sends a deferred VAO binding first, so GL is left as the frame asked
+    void InvalidateBindings()
+    {
+        flushVertexArray();
+        programKnown = false;
+        vertexArrayKnown = false;
+        pendingVertexArray = NO_PENDING;
+        activeUnitKnown = false;
+        for (int i = 0; i < BUFFER_TARGET_COUNT; ++i)
+            bufferKnown[i] = false;
+        for (int unit = 0; unit < GL_STATE_CACHE_TEXTURE_UNITS; ++unit)
+            for (int i = 0; i < TEXTURE_TARGET_COUNT; ++i)
+                textureKnown[unit][i] = false;
+    }
+
+    void Invalidate()
+    {
+        InvalidateBindings();
+        for (int i = 0; i < CAPABILITY_COUNT; ++i)
+            capabilityState[i] = STATE_UNKNOWN;
+        blendKnown = depthFuncKnown = depthMaskKnown = colorMaskKnown = polygonModeKnown = viewportKnown = clearColorKnown = false;
+    }
+
+    bool IsNull() const { return next.IsNull(); }
+
+    void Enable(GLenum capability) { setCapability(capability, true); }
+    void Disable(GLenum capability) { setCapability(capability, false); }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        ++stats.calls;
+        if (blendKnown && blendSource == source && blendDestination == destination)
+            return;
+        blendKnown = true;
+        blendSource = source;
+        blendDestination = destination;
+        next.BlendFunc(source, destination);
+    }
+
+    void DepthFunc(GLenum function)
+    {
+        ++stats.calls;
+        if (depthFuncKnown && depthFunc == function)
+            return;
+        depthFuncKnown = true;
+        depthFunc = function;
+        next.DepthFunc(function);
+    }
+
+    void DepthMask(GLboolean write)
+    {
+        ++stats.calls;
+        if (depthMaskKnown && depthMask == write)
+            return;
+        depthMaskKnown = true;
+        depthMask = write;
+        next.DepthMask(write);
+    }
+
+    void ColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+    {
+        ++stats.calls;
+        if (colorMaskKnown && colorMask[0] == red && colorMask[1] == green && colorMask[2] == blue && colorMask[3] == alpha)
+            return;
+        colorMaskKnown = true;
+        colorMask[0] = red;
+        colorMask[1] = green;
+        colorMask[2] = blue;
+        colorMask[3] = alpha;
+        next.ColorMask(red, green, blue, alpha);
+    }
+
+    // only GL_FRONT_AND_BACK is tracked, as core profiles allow nothing else
+    void PolygonMode(GLenum face, GLenum mode)
+    {
+        ++stats.calls;
+        if (face == GL_FRONT_AND_BACK && polygonModeKnown && polygonMode == mode)
+            return;
+        polygonModeKnown = face == GL_FRONT_AND_BACK;
+        polygonMode = mode;
+        next.PolygonMode(face, mode);
+    }
+
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        ++stats.calls;
+        if (viewportKnown && viewport[0] == x && viewport[1] == y && viewport[2] == width && viewport[3] == height)
+            return;
+        viewportKnown = true;
+        viewport[0] = x;
+        viewport[1] = y;
+        viewport[2] = width;
+        viewport[3] = height;
+        next.Viewport(x, y, width, height);
+    }
+
+    void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+    {
+        ++stats.calls;
+        if (clearColorKnown && clearColor[0] == red && clearColor[1] == green && clearColor[2] == blue && clearColor[3] == alpha)
+            return;
+        clearColorKnown = true;
+        clearColor[0] = red;
+        clearColor[1] = green;
+        clearColor[2] = blue;
+        clearColor[3] = alpha;
+        next.ClearColor(red, green, blue, alpha);
+    }
+
+    void Clear(GLbitfield mask)
+    {
+        ++stats.calls;
+        next.Clear(mask);
+    }
+
+    void UseProgram(GLuint program)
+    {
+        ++stats.calls;
+        if (programKnown && currentProgram == program)
+            return;
+        programKnown = true;
+        currentProgram = program;
+        next.UseProgram(program);
+    }
+
+    void ActiveTexture(GLenum unit)
+    {
+        ++stats.calls;
+        pendingUnit = unit;
+    }
+
+    void BindTexture(GLenum target, GLuint texture)
+    {
+        ++stats.calls;
+        int unit = int(pendingUnit - GL_TEXTURE0);
+        int index = textureTargetIndex(target);
+        bool tracked = unit >= 0 && unit < GL_STATE_CACHE_TEXTURE_UNITS && index >= 0;
+        if (tracked && textureKnown[unit][index] && textures[unit][index] == texture)
+            return;
+        if (tracked)
+        {
+            textureKnown[unit][index] = true;
+            textures[unit][index] = texture;
+        }
+        flushActiveUnit();
+        next.BindTexture(target, texture);
+    }
+
+    void BindVertexArray(GLuint vertexArray)
+    {
+        ++stats.calls;
+        pendingVertexArray = vertexArray;
+    }
+
+    void BindBuffer(GLenum target, GLuint buffer)
+    {
+        ++stats.calls;
+        int index = bufferTargetIndex(target);
+        if (index < 0)
+        {
+            // the element array binding is part of the VAO
+            flushVertexArray();
+            next.BindBuffer(target, buffer);
+            return;
+        }
+        if (bufferKnown[index] && buffers[index] == buffer)
+            return;
+        bufferKnown[index] = true;
+        buffers[index] = buffer;
+        next.BindBuffer(target, buffer);
+    }
+
+    void GenVertexArrays(GLsizei count, GLuint* names) { ++stats.calls; next.GenVertexArrays(count, names); }
+    void GenBuffers(GLsizei count, GLuint* names) { ++stats.calls; next.GenBuffers(count, names); }
+
+    // deleting a bound object binds 0 in its place
+    void DeleteVertexArrays(GLsizei count, const GLuint* names)
+    {
+        ++stats.calls;
+        flushVertexArray();
+        for (GLsizei i = 0; i < count; ++i)
+            if (vertexArrayKnown && names[i] != 0 && names[i] == currentVertexArray)
+                pendingVertexArray = currentVertexArray = 0;
+        next.DeleteVertexArrays(count, names);
+    }
+
+    void DeleteBuffers(GLsizei count, const GLuint* names)
+    {
+        ++stats.calls;
+        flushVertexArray();
+        for (GLsizei i = 0; i < count; ++i)
+            for (int target = 0; target < BUFFER_TARGET_COUNT; ++target)
+                if (bufferKnown[target] && names[i] != 0 && buffers[target] == names[i])
+                    buffers[target] = 0;
+        next.DeleteBuffers(count, names);
+    }
+
+    void BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        ++stats.calls;
+        stats.bytes += size_t(size);
+        flushVertexArray();
+        next.BufferData(target, size, data, usage);
+    }
+
+    void VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* offset)
+    {
+        ++stats.calls;
+        flushVertexArray();
+        next.VertexAttribPointer(index, size, type, normalized, stride, offset);
+    }
+
+    void EnableVertexAttribArray(GLuint index)
+    {
+        ++stats.calls;
+        flushVertexArray();
+        next.EnableVertexAttribArray(index);
+    }
+
+    void ProgramUniform(GLuint program, GLint location, char kind, GLint components, GLsizei count, const void* value)
+    {
+        ++stats.calls;
+        stats.bytes += size_t(count) * components * 4;
+        next.ProgramUniform(program, location, kind, components, count, value);
+    }
+
+    void DrawElements(GLenum mode, GLsizei count, GLenum type, const void* offset)
+    {
+        ++stats.calls;
+        ++stats.draws;
+        stats.indices += size_t(count);
+        flushVertexArray();
+        next.DrawElements(mode, count, type, offset);
+    }
+
+private:
+    enum CapabilityState { STATE_UNKNOWN, STATE_DISABLED, STATE_ENABLED };
+
+    static const int CAPABILITY_COUNT = 6;
+    static const int BUFFER_TARGET_COUNT = 5;
+    static const int TEXTURE_TARGET_COUNT = 4;
+    static const GLuint NO_PENDING = 0xFFFFFFFFu;     // no VAO asked for since the bindings were forgotten
+
+    GLBackend& next;
+
+    GLuint currentProgram;
+    bool programKnown;
+
+    GLuint currentVertexArray;
+    GLuint pendingVertexArray;
+    bool vertexArrayKnown;
+
+    GLenum activeUnit;
+    GLenum pendingUnit;
+    bool activeUnitKnown;
+
+    GLuint buffers[BUFFER_TARGET_COUNT];
+    bool bufferKnown[BUFFER_TARGET_COUNT];
+
+    GLuint textures[GL_STATE_CACHE_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+    bool textureKnown[GL_STATE_CACHE_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+
+    CapabilityState capabilityState[CAPABILITY_COUNT];
+    GLenum blendSource, blendDestination;
+    GLenum depthFunc;
+    GLboolean depthMask;
+    GLboolean colorMask[4];
+    GLenum polygonMode;
+    GLint viewport[4];
+    GLfloat clearColor[4];
+    bool blendKnown, depthFuncKnown, depthMaskKnown, colorMaskKnown, polygonModeKnown, viewportKnown, clearColorKnown;
+
+    static int capabilityIndex(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_DEPTH_TEST: return 0;
+        case GL_BLEND: return 1;
+        case GL_CULL_FACE: return 2;
+        case GL_SCISSOR_TEST: return 3;
+        case GL_DEPTH_CLAMP: return 4;
+        case GL_STENCIL_TEST: return 5;
+        default: return -1;
+        }
+    }
+
+    static int bufferTargetIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_UNIFORM_BUFFER: return 1;
+        case GL_SHADER_STORAGE_BUFFER: return 2;
+        case GL_PIXEL_UNPACK_BUFFER: return 3;
+        case GL_DRAW_INDIRECT_BUFFER: return 4;
+        default: return -1;
+        }
+    }
+
+    static int textureTargetIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        case GL_TEXTURE_3D: return 3;
+        default: return -1;
+        }
+    }
+
+    void setCapability(GLenum capability, bool enabled)
+    {
+        ++stats.calls;
+        int index = capabilityIndex(capability);
+        CapabilityState state = enabled ? STATE_ENABLED : STATE_DISABLED;
+        if (index >= 0 && capabilityState[index] == state)
+            return;
+        if (index >= 0)
+            capabilityState[index] = state;
+        if (enabled)
+            next.Enable(capability);
+        else
+            next.Disable(capability);
+    }
+
+    void flushVertexArray()
+    {
+        if (pendingVertexArray == NO_PENDING || (vertexArrayKnown && currentVertexArray == pendingVertexArray))
+            return;
+        vertexArrayKnown = true;
+        currentVertexArray = pendingVertexArray;
+        next.BindVertexArray(currentVertexArray);
+    }
+
+    void flushActiveUnit()
+    {
+        if (activeUnitKnown && activeUnit == pendingUnit)
+            return;
+        activeUnitKnown = true;
+        activeUnit = pendingUnit;
+        next.ActiveTexture(activeUnit);
+    }
+
+    GLStateCache(const GLStateCache&);
+    GLStateCache& operator=(const GLStateCache&);
+};
+#endif
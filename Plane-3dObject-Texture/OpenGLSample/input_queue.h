@@ -0,0 +1,68 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+
+// Default input queue values
+const uint32_t INPUT_QUEUE_CAPACITY = 1024;     // samples in flight at most; a power of two
+
+
+// One mouse movement, as the window system delivered it
+struct InputSample
+{
+    float dx, dy;       // cursor offset since the previous sample, y up
+    double time;        // glfwGetTime() when the sample was taken
+};
+
+
+/* Ring of input samples handed from the thread that polls the window to the thread that uses them.
+ *
+ * One producer and one consumer: each side owns one index and publishes it with a release store the
+ * other side reads with an acquire load, so pushing and popping never lock or wait. A full ring drops
+ * the new sample and counts it rather than block the event loop.
+ */
+class InputQueue
+{
+public:
+    InputQueue() : head(0), tail(0), dropped(0) {}
+
+    // producer: false if the ring was full and the sample was dropped
+    bool Push(const InputSample& sample)
+    {
+        uint32_t index = tail.load(std::memory_order_relaxed);
+        if (index - head.load(std::memory_order_acquire) == INPUT_QUEUE_CAPACITY)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        samples[index & (INPUT_QUEUE_CAPACITY - 1)] = sample;
+        tail.store(index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: false once the ring is empty
+    bool Pop(InputSample& sample)
+    {
+        uint32_t index = head.load(std::memory_order_relaxed);
+        if (index == tail.load(std::memory_order_acquire))
+            return false;
+        sample = samples[index & (INPUT_QUEUE_CAPACITY - 1)];
+        head.store(index + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    static_assert((INPUT_QUEUE_CAPACITY & (INPUT_QUEUE_CAPACITY - 1)) == 0, "INPUT_QUEUE_CAPACITY must be a power of two");
+
+    InputSample samples[INPUT_QUEUE_CAPACITY];
+    std::atomic<uint32_t> head;         // next sample to pop; consumer only
+    std::atomic<uint32_t> tail;         // next slot to push; producer only
+    std::atomic<uint64_t> dropped;
+
+    InputQueue(const InputQueue&);
+    InputQueue& operator=(const InputQueue&);
+};
+#endif
@@ -0,0 +1,289 @@
+#include "job_system.h"
+
+namespace
+{
+    // which JobSystem (if any) the current thread works for, and as which worker
+    thread_local const JobSystem* tlSystem = nullptr;
+    thread_local int tlWorker = -1;
+}
+
+
+JobSystem::JobSystem(unsigned threadCount) : sharedCount(0), epoch(0), sleepers(0), stopping(false)
+{
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+
+    for (unsigned i = 0; i < threadCount; ++i)
+        deques.push_back(new JobDeque());
+
+    // the creating thread is worker 0; it runs jobs while it waits
+    tlSystem = this;
+    tlWorker = 0;
+    for (unsigned i = 1; i < threadCount; ++i)
+        threads.push_back(std::thread(&JobSystem::workerLoop, this, int(i)));
+}
+
+
+JobSystem::~JobSystem()
+{
+    stopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    // jobs nobody waited for are dropped
+    for (size_t i = 0; i < deques.size(); ++i)
+    {
+        while (Job* job = deques[i]->Steal())
+            delete job;
+        delete deques[i];
+    }
+    for (size_t i = 0; i < shared.size(); ++i)
+        delete shared[i];
+
+    if (tlSystem == this)
+    {
+        tlSystem = nullptr;
+        tlWorker = -1;
+    }
+}
+
+
+void JobSystem::Run(const std::function<void()>& work, JobCounter* counter, JobCounter* after)
+{
+    Job* job = new Job();
+    job->work = work;
+    job->counter = counter;
+    if (counter)
+        counter->count.fetch_add(1, std::memory_order_relaxed);
+
+    if (after)
+    {
+        // park the job on the counter; finish() releases it when the counter reaches zero
+        std::lock_guard<std::mutex> lock(after->waitersMutex);
+        if (!after->Done())
+        {
+            after->waiters.push_back(job);
+            return;
+        }
+    }
+    push(job);
+}
+
+
+void JobSystem::Wait(JobCounter& counter)
+{
+    // help with queued jobs; once there are none, yield for a while and then sleep until a job is
+    // published or a counter reaches zero, so a waiter outside the workers does not spin on a core
+    int worker = CurrentWorker();
+    unsigned idleRounds = 0;
+    for (;;)
+    {
+        unsigned seen = epoch.load();
+        if (counter.Done())
+            break;
+
+        Job* job = find(worker);
+        if (job)
+        {
+            execute(job);
+            idleRounds = 0;
+            continue;
+        }
+
+        if (++idleRounds < JOB_SPINS_BEFORE_SLEEP)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepers.fetch_add(1);
+        wake.wait(lock, [this, &counter, seen]() { return counter.Done() || epoch.load() != seen; });
+        sleepers.fetch_sub(1);
+        idleRounds = 0;
+    }
+
+    // wait for the job that finished the counter to let go of it
+    std::lock_guard<std::mutex> lock(counter.waitersMutex);
+}
+
+
+void JobSystem::ParallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+    if (end <= begin)
+        return;
+    if (grain == 0)
+        grain = JOB_DEFAULT_GRAIN;
+
+    JobCounter counter;
+    splitFor(begin, end, grain, &body, &counter);
+    Wait(counter);
+}
+
+
+int JobSystem::CurrentWorker() const
+{
+    return tlSystem == this ? tlWorker : -1;
+}
+
+
+void JobSystem::push(Job* job)
+{
+    int worker = CurrentWorker();
+    if (worker < 0 || !deques[worker]->Push(job))
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        shared.push_back(job);
+        sharedCount.fetch_add(1);
+    }
+
+    // publish, then wake a sleeper; sleepers check the epoch under sleepMutex so none can miss this
+    epoch.fetch_add(1);
+    if (sleepers.load() > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+}
+
+
+Job* JobSystem::find(int worker)
+{
+    if (worker >= 0)
+    {
+        Job* job = deques[worker]->Pop();
+        if (job)
+            return job;
+    }
+
+    if (sharedCount.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (!shared.empty())
+        {
+            Job* job = shared.front();
+            shared.pop_front();
+            sharedCount.fetch_sub(1);
+            return job;
+        }
+    }
+
+    // steal, starting with the next worker so thieves spread out over the victims
+    size_t count = deques.size();
+    size_t start = worker >= 0 ? size_t(worker) + 1 : 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t victim = (start + i) % count;
+        if (int(victim) == worker)
+            continue;
+        Job* job = deques[victim]->Steal();
+        if (job)
+            return job;
+    }
+    return nullptr;
+}
+
+
+void JobSystem::execute(Job* job)
+{
+    job->work();
+    finish(job->counter);
+    delete job;
+}
+
+
+void JobSystem::finish(JobCounter* counter)
+{
+    if (!counter)
+        return;
+
+    // the last job on a counter takes its waiters; Wait() syncs on the same mutex before returning,
+    // so the counter (often on the waiter's stack) is never touched after it can go away
+    std::vector<Job*> released;
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock(counter->waitersMutex);
+        if (counter->count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            released.swap(counter->waiters);
+            done = true;
+        }
+    }
+    for (size_t i = 0; i < released.size(); ++i)
+        push(released[i]);
+
+    // wake anyone sleeping in Wait(); workers woken with it find nothing and go back to sleep
+    if (done)
+    {
+        epoch.fetch_add(1);
+        if (sleepers.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+            }
+            wake.notify_all();
+        }
+    }
+}
+
+
+void JobSystem::splitFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>* body, JobCounter* counter)
+{
+    // hand the upper half to the deque and keep splitting the lower half until it is one grain
+    while (end - begin > grain)
+    {
+        size_t middle = begin + (end - begin) / 2;
+        Run([this, middle, end, grain, body, counter]() { splitFor(middle, end, grain, body, counter); }, counter);
+        end = middle;
+    }
+    (*body)(begin, end);
+}
+
+
+void JobSystem::workerLoop(int worker)
+{
+    tlSystem = this;
+    tlWorker = worker;
+
+    unsigned idleRounds = 0;
+    while (!stopping.load())
+    {
+        Job* job = find(worker);
+        if (job)
+        {
+            execute(job);
+            idleRounds = 0;
+            continue;
+        }
+
+        if (++idleRounds < JOB_SPINS_BEFORE_SLEEP)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // nothing to do: sleep until someone publishes work
+        unsigned seen = epoch.load();
+        job = find(worker);
+        if (job)
+        {
+            execute(job);
+            idleRounds = 0;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepers.fetch_add(1);
+        wake.wait(lock, [this, seen]() { return stopping.load() || epoch.load() != seen; });
+        sleepers.fetch_sub(1);
+        idleRounds = 0;
+    }
+}
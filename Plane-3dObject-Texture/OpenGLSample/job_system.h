@@ -0,0 +1,175 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Default job system values
+const size_t JOB_DEQUE_CAPACITY = 4096;     // jobs per worker deque (power of two)
+const size_t JOB_DEFAULT_GRAIN = 64;        // items per parallel_for leaf when no grain is given
+const unsigned JOB_SPINS_BEFORE_SLEEP = 64; // failed steal rounds before an idle worker sleeps
+
+class JobSystem;
+struct Job;
+
+
+// Counts unfinished jobs. Jobs scheduled with a counter increment it and decrement it when they
+// finish; Wait() returns once it reaches zero, and jobs scheduled to run after a counter start then.
+class JobCounter
+{
+public:
+    JobCounter() : count(0) {}
+
+    bool Done() const { return count.load(std::memory_order_acquire) == 0; }
+
+private:
+    std::atomic<int> count;
+    std::mutex waitersMutex;
+    std::vector<Job*> waiters;  // jobs waiting for this counter to reach zero
+
+    friend class JobSystem;
+
+    JobCounter(const JobCounter&);
+    JobCounter& operator=(const JobCounter&);
+};
+
+
+struct Job
+{
+    std::function<void()> work;
+    JobCounter* counter;        // decremented when the job finishes, may be null
+};
+
+
+// Fixed-size Chase-Lev work-stealing deque. The owning worker pushes and pops at the bottom;
+// any other thread steals from the top. Follows the C11 formulation by Le, Pop, Cohen and
+// Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+class JobDeque
+{
+public:
+    JobDeque() : top(0), bottom(0), slots(JOB_DEQUE_CAPACITY)
+    {
+    }
+
+    // owner only; returns false when full
+    bool Push(Job* job)
+    {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_acquire);
+        if (b - t >= long(slots.size()))
+            return false;
+        slots[size_t(b) & (slots.size() - 1)].store(job, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // owner only
+    Job* Pop()
+    {
+        long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        Job* job = slots[size_t(b) & (slots.size() - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // last job: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    // any thread
+    Job* Steal()
+    {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        Job* job = slots[size_t(t) & (slots.size() - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+private:
+    // top and bottom on separate cache lines so thieves do not bounce the owner's line
+    std::atomic<long> top;
+    char padding[64 - sizeof(std::atomic<long>)];
+    std::atomic<long> bottom;
+    std::vector<std::atomic<Job*> > slots;
+};
+
+
+/* Work-stealing job scheduler.
+ *
+ * The thread that creates the JobSystem becomes worker 0 and runs jobs whenever it waits on a
+ * counter; the remaining workers are background threads. Each worker owns a JobDeque and, when it
+ * runs dry, steals from the others. Threads that are not workers (the asset reader, for example)
+ * submit through a shared queue that every worker also drains.
+ */
+class JobSystem
+{
+public:
+    // 0 threads means one per hardware thread, including the calling thread
+    explicit JobSystem(unsigned threadCount = 0);
+    ~JobSystem();
+
+    // schedules a job; 'counter' (optional) tracks it, 'after' (optional) delays it until that counter is done
+    void Run(const std::function<void()>& work, JobCounter* counter = nullptr, JobCounter* after = nullptr);
+
+    // runs jobs on the calling thread until the counter reaches zero, sleeping while there are none to run
+    void Wait(JobCounter& counter);
+
+    // calls body(first, last) over [begin, end) in chunks of at most 'grain' items and waits for all of them;
+    // ranges are split in halves so idle workers steal large pieces first
+    void ParallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+    unsigned WorkerCount() const { return unsigned(deques.size()); }
+
+    // worker index of the calling thread, or -1 if it is not one of ours
+    int CurrentWorker() const;
+
+private:
+    std::vector<JobDeque*> deques;
+    std::vector<std::thread> threads;
+
+    std::mutex sharedMutex;
+    std::deque<Job*> shared;                // jobs submitted from outside the workers
+    std::atomic<size_t> sharedCount;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<unsigned> epoch;            // bumped whenever work is published
+    std::atomic<unsigned> sleepers;
+    std::atomic<bool> stopping;
+
+    void push(Job* job);
+    Job* find(int worker);
+    void execute(Job* job);
+    void finish(JobCounter* counter);
+    void splitFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>* body, JobCounter* counter);
+    void workerLoop(int worker);
+
+    JobSystem(const JobSystem&);
+    JobSystem& operator=(const JobSystem&);
+};
+#endif
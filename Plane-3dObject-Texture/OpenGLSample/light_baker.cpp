@@ -0,0 +1,553 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include "job_system.h"
+#include "light_baker.h"
+
+namespace
+{
+    const float PI = 3.14159265358979f;
+    const float FAR_AWAY = 1e30f;
+
+    // integer hash (lowbias32); seeds each point's sample rotation
+    inline uint32_t Hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    inline float HashToFloat(uint32_t x)
+    {
+        return float(Hash(x) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // second coordinate of the Hammersley set: the sample index with its bits mirrored
+    inline float RadicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+        bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+        bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+        return float(bits) * 2.3283064365386963e-10f;
+    }
+
+    // orthonormal basis around a unit normal (Duff et al., "Building an Orthonormal Basis, Revisited")
+    inline void Basis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent)
+    {
+        float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + n.z);
+        float b = n.x * n.y * a;
+        tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+    }
+
+    inline float Luminance(const glm::vec3& color)
+    {
+        return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+    }
+
+    inline void SetRay(BvhRayPacket& packet, int lane, const glm::vec3& origin, const glm::vec3& direction, float tMax)
+    {
+        packet.originX[lane] = origin.x;
+        packet.originY[lane] = origin.y;
+        packet.originZ[lane] = origin.z;
+        packet.directionX[lane] = direction.x;
+        packet.directionY[lane] = direction.y;
+        packet.directionZ[lane] = direction.z;
+        packet.tMax[lane] = tMax;
+    }
+
+    // the two coordinates a chart keeps when projected along 'axis'
+    inline glm::vec2 Project(const glm::vec3& p, int axis)
+    {
+        return axis == 0 ? glm::vec2(p.y, p.z) : (axis == 1 ? glm::vec2(p.x, p.z) : glm::vec2(p.x, p.y));
+    }
+}
+
+
+LightBaker::LightBaker(JobSystem& jobs)
+    : jobs(jobs)
+{
+}
+
+
+size_t LightBaker::AddMesh(const float* vertices, size_t vertexCount, size_t stride, size_t colorOffset,
+                           const uint16_t* meshIndices, size_t indexCount, const glm::mat4& model)
+{
+    Mesh mesh;
+    mesh.firstVertex = positions.size();
+    mesh.vertexCount = vertexCount;
+    mesh.firstIndex = indices.size();
+    mesh.indexCount = indexCount - indexCount % 3;
+    mesh.stride = stride;
+    mesh.colorOffset = colorOffset;
+
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        const float* vertex = vertices + i * stride;
+        positions.push_back(glm::vec3(model * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f)));
+        albedo.push_back(glm::vec3(vertex[colorOffset], vertex[colorOffset + 1], vertex[colorOffset + 2]));
+        normals.push_back(glm::vec3(0.0f));
+    }
+
+    // vertex normals from the area-weighted normals of the faces around them, in world space, so a
+    // mirroring model matrix still yields the side the triangles are wound toward
+    for (size_t i = 0; i < mesh.indexCount; i += 3)
+    {
+        uint32_t a = uint32_t(mesh.firstVertex + meshIndices[i]);
+        uint32_t b = uint32_t(mesh.firstVertex + meshIndices[i + 1]);
+        uint32_t c = uint32_t(mesh.firstVertex + meshIndices[i + 2]);
+        glm::vec3 face = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+        normals[a] += face;
+        normals[b] += face;
+        normals[c] += face;
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+    for (size_t i = mesh.firstVertex; i < positions.size(); ++i)
+    {
+        float length = glm::length(normals[i]);
+        normals[i] = length > 0.0f ? normals[i] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    meshes.push_back(mesh);
+    return meshes.size() - 1;
+}
+
+
+void LightBaker::Build()
+{
+    bvh.Build(positions, indices);
+}
+
+
+void LightBaker::BakeVertexColors(size_t meshIndex, float* vertices)
+{
+    if (meshIndex >= meshes.size())
+        return;
+    const Mesh& mesh = meshes[meshIndex];
+
+    jobs.ParallelFor(0, mesh.vertexCount, BAKE_GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+            size_t v = mesh.firstVertex + i;
+            glm::vec3 color = albedo[v] * bake(positions[v], normals[v], uint32_t(v));
+            float* out = vertices + i * mesh.stride + mesh.colorOffset;
+            out[0] = std::min(color.x, 1.0f);
+            out[1] = std::min(color.y, 1.0f);
+            out[2] = std::min(color.z, 1.0f);
+        }
+    });
+}
+
+
+bool LightBaker::BakeLightmap(float texelsPerUnit, int maxSize, Lightmap& lightmap)
+{
+    if (indices.empty() || texelsPerUnit <= 0.0f)
+        return false;
+
+    // chart and pack, halving the atlas area whenever the charts do not fit
+    std::vector<Chart> charts;
+    int size = 0;
+    float scale = texelsPerUnit;
+    for (int attempt = 0; attempt < 16; ++attempt)
+    {
+        buildCharts(scale, charts);
+        double area = 0.0;
+        for (size_t i = 0; i < charts.size(); ++i)
+            area += double(charts[i].width) * double(charts[i].height);
+        int candidate = 16;
+        while (double(candidate) * double(candidate) < area)
+            candidate *= 2;
+        for (; candidate <= maxSize && size == 0; candidate *= 2)
+        {
+            if (packCharts(charts, candidate))
+                size = candidate;
+        }
+        if (size != 0)
+            break;
+        scale *= 0.7071f;
+    }
+    if (size == 0)
+    {
+        std::cout << "ERROR::BAKE::ATLAS_FULL " << maxSize << std::endl;
+        return false;
+    }
+
+    lightmap.width = lightmap.height = size;
+    lightmap.texels.assign(size_t(size) * size * 3, 0.0f);
+    lightmap.uvs.assign(meshes.size(), std::vector<glm::vec2>());
+    for (size_t m = 0; m < meshes.size(); ++m)
+        lightmap.uvs[m].assign(meshes[m].indexCount, glm::vec2(0.0f));
+
+    // corner UVs, then every texel center a triangle covers becomes one sample
+    std::vector<Sample> samples;
+    std::vector<bool> covered(size_t(size) * size, false);
+    for (size_t c = 0; c < charts.size(); ++c)
+    {
+        const Chart& chart = charts[c];
+        glm::vec2 origin = glm::vec2(float(chart.x + BAKE_CHART_PADDING), float(chart.y + BAKE_CHART_PADDING)) - chart.boundsMin;
+        for (size_t t = 0; t < chart.triangles.size(); ++t)
+        {
+            uint32_t triangle = chart.triangles[t];
+            size_t corner = size_t(triangle) * 3;
+            size_t meshIndex = 0;
+            while (meshIndex + 1 < meshes.size() && meshes[meshIndex + 1].firstIndex <= corner)
+                ++meshIndex;
+
+            glm::vec2 texel[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                texel[k] = Project(positions[indices[corner + k]], chart.axis) * scale + origin;
+                lightmap.uvs[meshIndex][corner + k - meshes[meshIndex].firstIndex] = texel[k] / float(size);
+            }
+
+            float area = (texel[1].x - texel[0].x) * (texel[2].y - texel[0].y) - (texel[2].x - texel[0].x) * (texel[1].y - texel[0].y);
+            if (fabsf(area) < 1e-8f)
+                continue;
+            int x0 = std::max(int(floorf(std::min(texel[0].x, std::min(texel[1].x, texel[2].x)))), 0);
+            int y0 = std::max(int(floorf(std::min(texel[0].y, std::min(texel[1].y, texel[2].y)))), 0);
+            int x1 = std::min(int(ceilf(std::max(texel[0].x, std::max(texel[1].x, texel[2].x)))), size - 1);
+            int y1 = std::min(int(ceilf(std::max(texel[0].y, std::max(texel[1].y, texel[2].y)))), size - 1);
+            for (int y = y0; y <= y1; ++y)
+            {
+                for (int x = x0; x <= x1; ++x)
+                {
+                    glm::vec2 p(float(x) + 0.5f, float(y) + 0.5f);
+                    float w1 = ((p.x - texel[0].x) * (texel[2].y - texel[0].y) - (texel[2].x - texel[0].x) * (p.y - texel[0].y)) / area;
+                    float w2 = ((texel[1].x - texel[0].x) * (p.y - texel[0].y) - (p.x - texel[0].x) * (texel[1].y - texel[0].y)) / area;
+                    float w0 = 1.0f - w1 - w2;
+                    size_t index = size_t(y) * size + x;
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f || covered[index])
+                        continue;
+                    covered[index] = true;
+
+                    Sample sample;
+                    sample.texel = index;
+                    sample.position = positions[indices[corner]] * w0 + positions[indices[corner + 1]] * w1 + positions[indices[corner + 2]] * w2;
+                    glm::vec3 normal = normals[indices[corner]] * w0 + normals[indices[corner + 1]] * w1 + normals[indices[corner + 2]] * w2;
+                    float length = glm::length(normal);
+                    sample.normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+                    samples.push_back(sample);
+                }
+            }
+        }
+    }
+
+    jobs.ParallelFor(0, samples.size(), BAKE_GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+            glm::vec3 light = bake(samples[i].position, samples[i].normal, uint32_t(samples[i].texel));
+            float* out = &lightmap.texels[samples[i].texel * 3];
+            out[0] = light.x;
+            out[1] = light.y;
+            out[2] = light.z;
+        }
+    });
+
+    // grow the charts into their gutters so bilinear filtering never reads unbaked texels
+    for (int pass = 0; pass < BAKE_CHART_PADDING; ++pass)
+    {
+        std::vector<bool> next = covered;
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                size_t index = size_t(y) * size + x;
+                if (covered[index])
+                    continue;
+                glm::vec3 sum(0.0f);
+                int count = 0;
+                const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+                for (int k = 0; k < 4; ++k)
+                {
+                    int nx = x + offsets[k][0], ny = y + offsets[k][1];
+                    if (nx < 0 || ny < 0 || nx >= size || ny >= size || !covered[size_t(ny) * size + nx])
+                        continue;
+                    const float* texel = &lightmap.texels[(size_t(ny) * size + nx) * 3];
+                    sum += glm::vec3(texel[0], texel[1], texel[2]);
+                    ++count;
+                }
+                if (count == 0)
+                    continue;
+                sum /= float(count);
+                lightmap.texels[index * 3 + 0] = sum.x;
+                lightmap.texels[index * 3 + 1] = sum.y;
+                lightmap.texels[index * 3 + 2] = sum.z;
+                next[index] = true;
+            }
+        }
+        covered.swap(next);
+    }
+
+    std::cout << "INFO: Baked a " << size << "x" << size << " lightmap, " << charts.size() << " charts, " << samples.size() << " texels" << std::endl;
+    return true;
+}
+
+
+// Light reaching a point; with twoSided both faces are tried and the brighter one wins
+glm::vec3 LightBaker::bake(const glm::vec3& position, const glm::vec3& normal, uint32_t seed) const
+{
+    glm::vec3 front = gather(position, normal, seed);
+    if (!settings.twoSided)
+        return front;
+    glm::vec3 back = gather(position, -normal, seed);
+    return Luminance(back) > Luminance(front) ? back : front;
+}
+
+
+glm::vec3 LightBaker::gather(const glm::vec3& position, const glm::vec3& normal, uint32_t seed) const
+{
+    glm::vec3 tangent, bitangent;
+    Basis(normal, tangent, bitangent);
+    const glm::vec3 origin = position + normal * BAKE_RAY_OFFSET;
+
+    // Hammersley points, rotated per point so neighbours do not share their error pattern
+    const unsigned packets = std::max((settings.samples + 3) / 4, 1u);
+    const unsigned count = packets * 4;
+    const float rotateU = HashToFloat(seed * 2u);
+    const float rotateV = HashToFloat(seed * 2u + 1u);
+    const float reach = settings.indirect ? FAR_AWAY : settings.aoDistance;
+
+    float open = 0.0f;
+    glm::vec3 bounce(0.0f);
+    for (unsigned p = 0; p < packets; ++p)
+    {
+        BvhRayPacket packet;
+        glm::vec3 directions[4];
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            unsigned i = p * 4 + unsigned(lane);
+            float u = float(i) / float(count) + rotateU;
+            float v = RadicalInverse(i) + rotateV;
+            u -= floorf(u);
+            v -= floorf(v);
+            // cosine-weighted: uniform on the disk, lifted onto the hemisphere
+            float radius = sqrtf(v);
+            float angle = 2.0f * PI * u;
+            float x = radius * cosf(angle), y = radius * sinf(angle);
+            directions[lane] = tangent * x + bitangent * y + normal * sqrtf(std::max(0.0f, 1.0f - v));
+            SetRay(packet, lane, origin, directions[lane], reach);
+        }
+
+        BvhPacketHit hit;
+        unsigned hits = bvh.Intersect(packet, hit);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (((hits >> lane) & 1u) == 0 || hit.t[lane] > settings.aoDistance)
+            {
+                open += 1.0f;
+                continue;
+            }
+            if (!settings.indirect)
+                continue;
+
+            // the hit surface reflects its own direct light, tinted by its vertex colors
+            size_t corner = size_t(hit.triangle[lane]) * 3;
+            const glm::vec3& a = positions[indices[corner]];
+            const glm::vec3& b = positions[indices[corner + 1]];
+            const glm::vec3& c = positions[indices[corner + 2]];
+            glm::vec3 faceNormal = glm::cross(b - a, c - a);
+            float length = glm::length(faceNormal);
+            if (length <= 0.0f)
+                continue;
+            faceNormal /= length;
+            if (glm::dot(faceNormal, directions[lane]) > 0.0f)
+                faceNormal = -faceNormal;
+
+            float u = hit.u[lane], v = hit.v[lane];
+            glm::vec3 color = albedo[indices[corner]] * (1.0f - u - v) + albedo[indices[corner + 1]] * u + albedo[indices[corner + 2]] * v;
+            glm::vec3 point = origin + directions[lane] * hit.t[lane];
+            bounce += color * direct(point, faceNormal);
+        }
+    }
+
+    // cosine-weighted samples make both estimates plain averages
+    return direct(position, normal) + settings.skyColor * (open / float(count)) + bounce / float(count);
+}
+
+
+// Sun and point lights at a point, each behind a shadow ray; rays go out four at a time
+glm::vec3 LightBaker::direct(const glm::vec3& position, const glm::vec3& normal) const
+{
+    const glm::vec3 origin = position + normal * BAKE_RAY_OFFSET;
+    glm::vec3 total(0.0f);
+
+    BvhRayPacket packet;
+    glm::vec3 contribution[4];
+    int lanes = 0;
+    const size_t lightCount = pointLights.size() + 1;
+    for (size_t i = 0; i < lightCount; ++i)
+    {
+        glm::vec3 direction;
+        float distance;
+        glm::vec3 light;
+        if (i == 0)
+        {
+            direction = -glm::normalize(settings.sunDirection);
+            distance = FAR_AWAY;
+            light = settings.sunColor * glm::dot(normal, direction);
+        }
+        else
+        {
+            const BakePointLight& point = pointLights[i - 1];
+            glm::vec3 toLight = point.position - origin;
+            distance = glm::length(toLight);
+            if (distance <= 0.0f || (point.radius > 0.0f && distance >= point.radius))
+                continue;
+            direction = toLight / distance;
+            // inverse square, faded to zero at the range like CalcPointLight() in lights.glsl
+            float attenuation = 1.0f / (1.0f + distance * distance);
+            if (point.radius > 0.0f)
+            {
+                float ratio = distance / point.radius;
+                float window = std::max(0.0f, 1.0f - ratio * ratio * ratio * ratio);
+                attenuation *= window * window;
+            }
+            light = point.color * (glm::dot(normal, direction) * attenuation);
+        }
+        if (glm::dot(normal, direction) <= 0.0f)
+            continue;
+
+        contribution[lanes] = light;
+        SetRay(packet, lanes, origin, direction, distance);
+        ++lanes;
+        if (lanes == 4)
+        {
+            for (int lane = lanes; lane < 4; ++lane)
+                SetRay(packet, lane, origin, normal, 0.0f);
+            unsigned blocked = bvh.Occluded(packet);
+            for (int lane = 0; lane < lanes; ++lane)
+            {
+                if (((blocked >> lane) & 1u) == 0)
+                    total += contribution[lane];
+            }
+            lanes = 0;
+        }
+    }
+    if (lanes > 0)
+    {
+        for (int lane = lanes; lane < 4; ++lane)
+            SetRay(packet, lane, origin, normal, 0.0f);
+        unsigned blocked = bvh.Occluded(packet);
+        for (int lane = 0; lane < lanes; ++lane)
+        {
+            if (((blocked >> lane) & 1u) == 0)
+                total += contribution[lane];
+        }
+    }
+    return total;
+}
+
+
+// Groups edge-connected triangles whose normals share a major axis and sign, and projects each
+// group onto that axis' plane. Such a group cannot fold over itself in the projection.
+void LightBaker::buildCharts(float texelsPerUnit, std::vector<Chart>& charts) const
+{
+    charts.clear();
+    const size_t triangleCount = indices.size() / 3;
+
+    std::vector<int> keys(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        const glm::vec3& a = positions[indices[t * 3]];
+        glm::vec3 n = glm::cross(positions[indices[t * 3 + 1]] - a, positions[indices[t * 3 + 2]] - a);
+        glm::vec3 magnitude = glm::abs(n);
+        int axis = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+        keys[t] = axis * 2 + (n[axis] < 0.0f ? 1 : 0);
+    }
+
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<uint32_t> > edges;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            uint32_t a = indices[t * 3 + k], b = indices[t * 3 + (k + 1) % 3];
+            edges[std::make_pair(std::min(a, b), std::max(a, b))].push_back(uint32_t(t));
+        }
+    }
+
+    std::vector<bool> assigned(triangleCount, false);
+    std::vector<uint32_t> stack;
+    for (size_t seed = 0; seed < triangleCount; ++seed)
+    {
+        if (assigned[seed])
+            continue;
+        Chart chart;
+        chart.axis = keys[seed] / 2;
+        chart.x = chart.y = chart.width = chart.height = 0;
+        assigned[seed] = true;
+        stack.push_back(uint32_t(seed));
+        while (!stack.empty())
+        {
+            uint32_t t = stack.back();
+            stack.pop_back();
+            chart.triangles.push_back(t);
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t a = indices[t * 3 + k], b = indices[t * 3 + (k + 1) % 3];
+                const std::vector<uint32_t>& neighbours = edges[std::make_pair(std::min(a, b), std::max(a, b))];
+                for (size_t n = 0; n < neighbours.size(); ++n)
+                {
+                    uint32_t other = neighbours[n];
+                    if (!assigned[other] && keys[other] == keys[seed])
+                    {
+                        assigned[other] = true;
+                        stack.push_back(other);
+                    }
+                }
+            }
+        }
+
+        chart.boundsMin = glm::vec2(FAR_AWAY);
+        chart.boundsMax = glm::vec2(-FAR_AWAY);
+        for (size_t i = 0; i < chart.triangles.size(); ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                glm::vec2 p = Project(positions[indices[size_t(chart.triangles[i]) * 3 + k]], chart.axis) * texelsPerUnit;
+                chart.boundsMin = glm::min(chart.boundsMin, p);
+                chart.boundsMax = glm::max(chart.boundsMax, p);
+            }
+        }
+        chart.width = int(ceilf(chart.boundsMax.x - chart.boundsMin.x)) + 1 + 2 * BAKE_CHART_PADDING;
+        chart.height = int(ceilf(chart.boundsMax.y - chart.boundsMin.y)) + 1 + 2 * BAKE_CHART_PADDING;
+        charts.push_back(chart);
+    }
+}
+
+
+// Shelf packing, tallest charts first; returns false if they do not fit in size x size
+bool LightBaker::packCharts(std::vector<Chart>& charts, int size)
+{
+    std::sort(charts.begin(), charts.end(), [](const Chart& a, const Chart& b) { return a.height > b.height; });
+    int x = 0, y = 0, shelfHeight = 0;
+    for (size_t i = 0; i < charts.size(); ++i)
+    {
+        Chart& chart = charts[i];
+        if (chart.width > size)
+            return false;
+        if (x + chart.width > size)
+        {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        if (y + chart.height > size)
+            return false;
+        chart.x = x;
+        chart.y = y;
+        x += chart.width;
+        shelfHeight = std::max(shelfHeight, chart.height);
+    }
+    return true;
+}
@@ -0,0 +1,144 @@
+#ifndef LIGHT_BAKER_H
+#define LIGHT_BAKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+class JobSystem;
+
+// Default bake values
+const unsigned BAKE_DEFAULT_SAMPLES = 64;       // hemisphere rays per baked point
+const float BAKE_DEFAULT_AO_DISTANCE = 1.0f;    // occluders further away than this do not darken
+const float BAKE_RAY_OFFSET = 1e-3f;            // lifts ray origins off the surface they start on
+const int BAKE_CHART_PADDING = 2;               // texels of gutter around every lightmap chart
+const size_t BAKE_GRAIN = 16;                   // points per job
+
+
+struct BakeSettings
+{
+    glm::vec3 sunDirection;     // direction the sunlight travels in
+    glm::vec3 sunColor;         // irradiance on a surface facing the sun
+    glm::vec3 skyColor;         // irradiance from a fully open sky
+    unsigned samples;           // hemisphere rays per point, in packets of four
+    float aoDistance;
+    bool indirect;              // one bounce of direct light off nearby surfaces
+    bool twoSided;              // bake both faces and keep the brighter; for meshes without consistent winding
+
+    BakeSettings()
+        : sunDirection(-0.2f, -1.0f, -0.3f), sunColor(0.8f), skyColor(0.25f), samples(BAKE_DEFAULT_SAMPLES),
+          aoDistance(BAKE_DEFAULT_AO_DISTANCE), indirect(true), twoSided(true)
+    {
+    }
+};
+
+struct BakePointLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float radius;               // range cutoff, like LightBlockPointLight::radius
+};
+
+// Baked irradiance of every mesh packed into one atlas
+struct Lightmap
+{
+    int width;
+    int height;
+    std::vector<float> texels;                  // RGB per texel, rows from the bottom (GL order)
+    std::vector<std::vector<glm::vec2> > uvs;   // per mesh, one UV per index (triangle corner)
+
+    Lightmap() : width(0), height(0) {}
+};
+
+
+/* Offline CPU light baker for static scenes.
+ *
+ * Meshes are added in the layout UCreateMesh uploads (position followed by an RGBA color, indexed
+ * with 16-bit triangles) and gathered into one BVH (bvh.h). Every baked point then traces a
+ * stratified, cosine-weighted set of rays in packets of four:
+ * - ambient occlusion: rays that leave without hitting anything within aoDistance see the sky
+ * - direct light: shadow rays to the sun and each point light in range
+ * - indirect light: rays that hit a nearby surface pick up that surface's direct light times its
+ *   vertex color (one bounce)
+ * Points are baked on the JobSystem's work-stealing workers; the per-point random sequences are
+ * seeded from the point alone, so a bake is identical however the work is split.
+ *
+ * BakeVertexColors() writes albedo * light into a mesh's own color attribute, so the existing unlit
+ * shaders draw it as is. BakeLightmap() charts the meshes into an atlas instead and stores the light
+ * alone, for shaders that multiply it with their textures.
+ */
+class LightBaker
+{
+public:
+    explicit LightBaker(JobSystem& jobs);
+
+    // 'stride' floats per vertex, position first, RGBA color at 'colorOffset'; returns the mesh index
+    size_t AddMesh(const float* vertices, size_t vertexCount, size_t stride, size_t colorOffset,
+                   const uint16_t* indices, size_t indexCount, const glm::mat4& model = glm::mat4(1.0f));
+    void AddPointLight(const BakePointLight& light) { pointLights.push_back(light); }
+    void SetSettings(const BakeSettings& values) { settings = values; }
+
+    // builds the BVH over every mesh added so far; call before baking
+    void Build();
+
+    // writes the baked color over the RGB of each vertex of mesh 'mesh' (same layout as AddMesh(), alpha kept)
+    void BakeVertexColors(size_t mesh, float* vertices);
+
+    // charts every mesh into one atlas of at most maxSize texels a side and bakes it
+    bool BakeLightmap(float texelsPerUnit, int maxSize, Lightmap& lightmap);
+
+    size_t TriangleCount() const { return indices.size() / 3; }
+
+private:
+    struct Mesh
+    {
+        size_t firstVertex;
+        size_t vertexCount;
+        size_t firstIndex;
+        size_t indexCount;
+        size_t stride;
+        size_t colorOffset;
+    };
+
+    // one chart of the lightmap atlas: connected triangles facing the same major axis
+    struct Chart
+    {
+        std::vector<uint32_t> triangles;
+        int axis;                       // dropped coordinate of the planar projection
+        glm::vec2 boundsMin, boundsMax; // projected, in texels
+        int x, y, width, height;        // placement in the atlas
+    };
+
+    struct Sample
+    {
+        size_t texel;
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    JobSystem& jobs;
+    BakeSettings settings;
+    std::vector<BakePointLight> pointLights;
+    std::vector<Mesh> meshes;
+
+    // world space scene, all meshes back to back
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> albedo;
+    std::vector<uint32_t> indices;
+    Bvh bvh;
+
+    glm::vec3 bake(const glm::vec3& position, const glm::vec3& normal, uint32_t seed) const;
+    glm::vec3 gather(const glm::vec3& position, const glm::vec3& normal, uint32_t seed) const;
+    glm::vec3 direct(const glm::vec3& position, const glm::vec3& normal) const;
+    void buildCharts(float texelsPerUnit, std::vector<Chart>& charts) const;
+    static bool packCharts(std::vector<Chart>& charts, int size);
+
+    LightBaker(const LightBaker&);
+    LightBaker& operator=(const LightBaker&);
+};
+#endif
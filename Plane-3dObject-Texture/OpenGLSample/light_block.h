@@ -0,0 +1,200 @@
+#ifndef LIGHT_BLOCK_H
+#define LIGHT_BLOCK_H
+
+// Include after the GL loader (GLEW or glad); like program_cache.h this header only uses its types.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+/* std140 uniform block holding every light, shared by all lit programs
+ *
+ * layout(std140) uniform LightBlock {           offset
+ *     DirLight dirLight;                         0
+ *     SpotLight spotLight;                       64
+ *     PointLight pointLights[MAX_POINT_LIGHTS];  144
+ *     int pointLightCount;                       144 + 64 * MAX_POINT_LIGHTS
+ * };
+ *
+ * The structs below mirror shaderfiles/lights.glsl byte for byte: each vec3 is followed by the float
+ * std140 packs into its fourth component (or padding), and every struct is a multiple of 16 bytes.
+ * The static_asserts catch a mirror that drifts from the GLSL.
+ */
+
+const GLuint LIGHT_BLOCK_BINDING = 0;               // uniform buffer binding point the block is attached to
+const int LIGHT_BLOCK_MAX_POINT_LIGHTS = 16;        // must match MAX_POINT_LIGHTS in lights.glsl
+const char* const LIGHT_BLOCK_NAME = "LightBlock";
+
+struct LightBlockDirLight
+{
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct LightBlockPointLight
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    float radius;           // range cutoff; 0 lights everything (see PointLightRange())
+};
+
+struct LightBlockSpotLight
+{
+    glm::vec3 position;
+    float cutOff;
+    glm::vec3 direction;
+    float outerCutOff;
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+};
+
+struct LightBlockData
+{
+    LightBlockDirLight dirLight;
+    LightBlockSpotLight spotLight;
+    LightBlockPointLight pointLights[LIGHT_BLOCK_MAX_POINT_LIGHTS];
+    GLint pointLightCount;
+    GLint padding[3];
+};
+
+// distance at which a point light's attenuation drops its brightest channel below 'cutoff'
+inline float PointLightRange(const LightBlockPointLight& light, float cutoff = 1.0f / 256.0f)
+{
+    float brightest = 0.0f;
+    const glm::vec3* colors[] = { &light.ambient, &light.diffuse, &light.specular };
+    for (int i = 0; i < 3; ++i)
+        brightest = std::max(brightest, std::max(std::max(colors[i]->x, colors[i]->y), colors[i]->z));
+    if (cutoff <= 0.0f)
+        return 0.0f;
+    if (brightest <= 0.0f)
+        return 1e-3f;   // contributes nothing; the smallest range that still means "cut off"
+    // solve constant + linear * d + quadratic * d^2 = brightest / cutoff
+    float c = light.constant - brightest / cutoff;
+    if (c >= 0.0f)
+        return 1e-3f;
+    if (light.quadratic <= 0.0f)
+        return light.linear > 0.0f ? -c / light.linear : 0.0f;   // constant attenuation never fades
+    return (-light.linear + sqrtf(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+}
+
+static_assert(sizeof(glm::vec3) == 12, "glm::vec3 must be tightly packed to mirror std140");
+static_assert(sizeof(LightBlockDirLight) == 64, "DirLight does not match its std140 layout");
+static_assert(sizeof(LightBlockPointLight) == 64, "PointLight does not match its std140 layout");
+static_assert(sizeof(LightBlockSpotLight) == 80, "SpotLight does not match its std140 layout");
+static_assert(offsetof(LightBlockData, spotLight) == 64, "LightBlock.spotLight offset");
+static_assert(offsetof(LightBlockData, pointLights) == 144, "LightBlock.pointLights offset");
+static_assert(offsetof(LightBlockData, pointLightCount) == 144 + 64 * LIGHT_BLOCK_MAX_POINT_LIGHTS, "LightBlock.pointLightCount offset");
+static_assert(sizeof(LightBlockData) % 16 == 0, "LightBlock size must be a multiple of 16");
+
+
+// Owns the light uniform buffer. Setters only touch the CPU copy and note whether anything changed;
+// Upload() then writes the whole block with one glBufferSubData, and only on frames where a light did
+// change. Every lit program reads the same buffer through LIGHT_BLOCK_BINDING, so the cost of light
+// setup no longer grows with the number of lights, uniforms or programs.
+class LightBlock
+{
+public:
+    LightBlock() : buffer(0), dirty(true)
+    {
+        memset(static_cast<void*>(&data), 0, sizeof(data));
+    }
+
+    ~LightBlock()
+    {
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+    }
+
+    void SetDirLight(const LightBlockDirLight& light) { assign(data.dirLight, light); }
+    void SetSpotLight(const LightBlockSpotLight& light) { assign(data.spotLight, light); }
+
+    // returns false if 'index' is past LIGHT_BLOCK_MAX_POINT_LIGHTS
+    bool SetPointLight(int index, const LightBlockPointLight& light)
+    {
+        if (index < 0 || index >= LIGHT_BLOCK_MAX_POINT_LIGHTS)
+            return false;
+        assign(data.pointLights[index], light);
+        return true;
+    }
+
+    // number of point lights the shaders loop over (programs built with NR_POINT_LIGHTS use theirs instead)
+    void SetPointLightCount(int count)
+    {
+        GLint clamped = count < 0 ? 0 : (count > LIGHT_BLOCK_MAX_POINT_LIGHTS ? LIGHT_BLOCK_MAX_POINT_LIGHTS : count);
+        assign(data.pointLightCount, clamped);
+    }
+
+    const LightBlockData& Data() const { return data; }
+
+    // writes the block if a light changed and binds it; call once per frame before drawing lit geometry
+    void Upload()
+    {
+        if (buffer == 0)
+        {
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(data), &data, GL_DYNAMIC_DRAW);
+            dirty = false;
+        }
+        else if (dirty)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+            dirty = false;
+        }
+        glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, buffer);
+    }
+
+    // points a program's LightBlock at LIGHT_BLOCK_BINDING; returns false if the program has no such block
+    static bool Attach(GLuint program)
+    {
+        GLuint index = glGetUniformBlockIndex(program, LIGHT_BLOCK_NAME);
+        if (index == GL_INVALID_INDEX)
+            return false;
+
+        // the driver may round the block up, but never past our mirror of it
+        GLint size = 0;
+        glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        if (size > GLint(sizeof(LightBlockData)))
+            std::cout << "ERROR::LIGHT_BLOCK::SIZE_MISMATCH " << size << " != " << sizeof(LightBlockData) << std::endl;
+        glUniformBlockBinding(program, index, LIGHT_BLOCK_BINDING);
+        return true;
+    }
+
+private:
+    GLuint buffer;
+    LightBlockData data;
+    bool dirty;
+
+    template <typename T>
+    void assign(T& target, const T& value)
+    {
+        if (memcmp(&target, &value, sizeof(T)) == 0)
+            return;
+        target = value;
+        dirty = true;
+    }
+
+    LightBlock(const LightBlock&);
+    LightBlock& operator=(const LightBlock&);
+};
+#endif
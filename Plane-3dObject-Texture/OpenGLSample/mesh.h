@@ -6,7 +6,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "gl_backend.h"
 #include "shader.h"
+#include "asset_pack.h"
 
 #include <string>
 #include <vector>
@@ -38,6 +40,7 @@ public:
 	vector<unsigned int> indices;
 	vector<Texture>      textures;
 	unsigned int VAO;
+	unsigned int indexCount;
 
 	// constructor
 	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
@@ -45,14 +48,43 @@ public:
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		indexCount = (unsigned int)indices.size();
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setupMesh(&this->vertices[0], this->vertices.size(), &this->indices[0], this->indices.size());
+	}
+
+	// constructor for a mesh cooked into an asset pack: the buffers are filled straight from the
+	// mapping and no CPU-side copy of the vertices or indices is kept
+	Mesh(const AssetView& cooked, vector<Texture> textures)
+	{
+		this->textures = textures;
+		VAO = VBO = EBO = 0;
+		indexCount = 0;
+
+		// the header and both arrays it describes must lie inside the view, or a damaged pack reads past it
+		const CookedMeshHeader* header = cooked.mesh();
+		if (cooked.type != ASSET_MESH || cooked.size < sizeof(CookedMeshHeader) || header->floatsPerVertex * sizeof(float) != sizeof(Vertex))
+		{
+			std::cout << "ERROR::MESH::INVALID_COOKED_MESH" << std::endl;
+			return;
+		}
+		uint64_t vertexBytes = uint64_t(header->vertexCount) * sizeof(Vertex);
+		uint64_t indexBytes = uint64_t(header->indexCount) * sizeof(uint32_t);
+		if (sizeof(CookedMeshHeader) + vertexBytes + indexBytes > cooked.size)
+		{
+			std::cout << "ERROR::MESH::TRUNCATED_COOKED_MESH" << std::endl;
+			return;
+		}
+		indexCount = header->indexCount;
+		setupMesh(reinterpret_cast<const Vertex*>(cooked.meshVertices()), header->vertexCount, cooked.meshIndices(), header->indexCount);
 	}
 
 	// render the mesh
 	void Draw(Shader &shader)
 	{
+		GLBackend& gl = CurrentGLBackend();
+
 		// bind appropriate textures
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
@@ -60,7 +92,7 @@ public:
 		unsigned int heightNr = 1;
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+			gl.ActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
 			// retrieve texture number (the N in diffuse_textureN)
 			string number;
 			string name = textures[i].type;
@@ -73,19 +105,21 @@ public:
 			else if (name == "texture_height")
 				number = std::to_string(heightNr++); // transfer unsigned int to stream
 
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+			// now set the sampler to the correct texture unit (written by the flush below if it changed)
+			shader.setInt(name + number, i);
 			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			gl.BindTexture(GL_TEXTURE_2D, textures[i].id);
 		}
 
+		shader.flush();
+
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		gl.BindVertexArray(VAO);
+		gl.DrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+		gl.BindVertexArray(0);
 
 		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+		gl.ActiveTexture(GL_TEXTURE0);
 	}
 
 private:
@@ -93,42 +127,44 @@ private:
 	unsigned int VBO, EBO;
 
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const Vertex* vertexData, size_t numVertices, const unsigned int* indexData, size_t numIndices)
 	{
+		GLBackend& gl = CurrentGLBackend();
+
 		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		gl.GenVertexArrays(1, &VAO);
+		gl.GenBuffers(1, &VBO);
+		gl.GenBuffers(1, &EBO);
 
-		glBindVertexArray(VAO);
+		gl.BindVertexArray(VAO);
 		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		gl.BindBuffer(GL_ARRAY_BUFFER, VBO);
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
 		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		gl.BufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		gl.BufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
 
 		// set the vertex attribute pointers
 		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		gl.EnableVertexAttribArray(0);
+		gl.VertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
 		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		gl.EnableVertexAttribArray(1);
+		gl.VertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
 		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		gl.EnableVertexAttribArray(2);
+		gl.VertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+		gl.EnableVertexAttribArray(3);
+		gl.VertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
 		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		gl.EnableVertexAttribArray(4);
+		gl.VertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
-		glBindVertexArray(0);
+		gl.BindVertexArray(0);
 	}
 };
 #endif
\ No newline at end of file
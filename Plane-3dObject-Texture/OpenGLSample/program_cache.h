@@ -0,0 +1,193 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+// Include after the GL loader (GLEW or glad); like shader.hpp this header only uses its types.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "resource_cache.h"
+
+/* On-disk cache of linked program binaries
+ *
+ * <PROGRAM_CACHE_DIR>/<key>.bin = [ProgramBinaryHeader][glGetProgramBinary output]
+ *
+ * The key hashes every stage's source, the injected defines and the GL vendor, renderer and version
+ * strings, so a driver update or a different GPU simply misses instead of feeding the driver a binary
+ * it might reject. Drivers may still refuse a binary; the loader then deletes the file and the caller
+ * compiles from source as before.
+ */
+
+const char* const PROGRAM_CACHE_DIR = "shadercache";
+const uint32_t PROGRAM_CACHE_MAGIC = 0x4E494250;  // "PBIN"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramBinaryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t length;
+};
+
+// What the cache needs to know about the driver, queried once
+struct ProgramCacheDriver
+{
+    GLint binaryFormats;
+    std::string identity;   // vendor|renderer|version
+
+    ProgramCacheDriver() : binaryFormats(0)
+    {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+        const GLubyte* vendor = glGetString(GL_VENDOR);
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        const GLubyte* version = glGetString(GL_VERSION);
+        identity = std::string(vendor ? reinterpret_cast<const char*>(vendor) : "") + "|" +
+            (renderer ? reinterpret_cast<const char*>(renderer) : "") + "|" +
+            (version ? reinterpret_cast<const char*>(version) : "");
+    }
+};
+
+// Built by the first caller, which needs a current context; the static's initialization is
+// thread safe, so the shader reloader's compile thread and the main thread can both get here.
+// Call InitProgramCache() on the GL thread at startup so that first caller is the main context.
+inline const ProgramCacheDriver& ProgramCacheDriverInfo()
+{
+    static const ProgramCacheDriver driver;
+    return driver;
+}
+
+inline void InitProgramCache()
+{
+    ProgramCacheDriverInfo();
+}
+
+// true if the driver can hand out program binaries at all
+inline bool ProgramCacheSupported()
+{
+    return ProgramCacheDriverInfo().binaryFormats > 0;
+}
+
+// hashes the sources of every stage together with the defines and the driver identity
+inline uint64_t ProgramCacheKey(const char* const* sources, const GLint* lengths, int count, const std::string& defines = std::string())
+{
+    uint64_t key = HashString(ProgramCacheDriverInfo().identity);
+    key = HashString(defines, key);
+    for (int i = 0; i < count; ++i)
+    {
+        size_t length = lengths ? size_t(lengths[i]) : strlen(sources[i]);
+        // fold the stage index in so swapping two stages changes the key
+        key = HashBytes(sources[i], length, key + uint64_t(i));
+    }
+    return key;
+}
+
+inline std::string ProgramCachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return std::string(PROGRAM_CACHE_DIR) + "/" + name;
+}
+
+// creates a program from a cached binary; returns 0 on a miss or if the driver rejects the binary
+inline GLuint LoadCachedProgram(uint64_t key)
+{
+    if (!ProgramCacheSupported())
+        return 0;
+
+    std::string path = ProgramCachePath(key);
+    std::vector<unsigned char> bytes;
+    if (!ReadFileBytes(path, bytes) || bytes.size() < sizeof(ProgramBinaryHeader))
+        return 0;
+
+    ProgramBinaryHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION ||
+        header.key != key || bytes.size() - sizeof(header) < header.length)
+    {
+        remove(path.c_str());
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, bytes.data() + sizeof(header), GLsizei(header.length));
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        // stale or foreign binary: drop it so the next run recompiles and stores a fresh one
+        std::cout << "INFO: Program binary " << path << " rejected, recompiling" << std::endl;
+        glDeleteProgram(program);
+        remove(path.c_str());
+        return 0;
+    }
+    return program;
+}
+
+// call on a program before glLinkProgram so the driver keeps its binary around for StoreCachedProgram
+inline void PrepareProgramForCache(GLuint program)
+{
+    if (ProgramCacheSupported())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+// writes a successfully linked program's binary to the cache
+inline bool StoreCachedProgram(uint64_t key, GLuint program)
+{
+    if (!ProgramCacheSupported())
+        return false;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    std::vector<unsigned char> bytes(sizeof(ProgramBinaryHeader) + size_t(length));
+    GLenum binaryFormat = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &binaryFormat, bytes.data() + sizeof(ProgramBinaryHeader));
+    if (written <= 0)
+        return false;
+
+    ProgramBinaryHeader header;
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.length = uint32_t(written);
+    memcpy(bytes.data(), &header, sizeof(header));
+
+#ifdef _WIN32
+    _mkdir(PROGRAM_CACHE_DIR);
+#else
+    mkdir(PROGRAM_CACHE_DIR, 0755);
+#endif
+
+    // write beside the final name and rename, so a crash never leaves a truncated binary behind
+    std::string path = ProgramCachePath(key);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+        file.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(sizeof(header) + size_t(written)));
+        if (!file.good())
+            return false;
+    }
+    remove(path.c_str());
+    return rename(temporary.c_str(), path.c_str()) == 0;
+}
+#endif
@@ -0,0 +1,320 @@
+#ifndef PROGRAM_REFLECTION_H
+#define PROGRAM_REFLECTION_H
+
+// Include after the GL loader (GLEW or glad); like program_cache.h this header only uses its types.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gl_backend.h"
+
+// Longest uniform, block or attribute name the reflection reads back
+const GLsizei PROGRAM_REFLECTION_MAX_NAME = 256;
+
+
+// 32-bit FNV-1a of a uniform, block or attribute name. constexpr, so an ID written as
+// `constexpr uint32_t MODEL = ShaderNameId("model");` is folded at compile time.
+constexpr uint32_t ShaderNameId(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; ++name)
+    {
+        hash ^= uint32_t(uint8_t(*name));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+// how a uniform's value is read back and written: component count and scalar kind
+// ('f' float, 'm' float matrix, 'i' int/bool/sampler, 'u' unsigned)
+inline bool UniformShape(GLenum type, int& components, char& kind)
+{
+    switch (type)
+    {
+    case GL_FLOAT:             components = 1; kind = 'f'; return true;
+    case GL_FLOAT_VEC2:        components = 2; kind = 'f'; return true;
+    case GL_FLOAT_VEC3:        components = 3; kind = 'f'; return true;
+    case GL_FLOAT_VEC4:        components = 4; kind = 'f'; return true;
+    case GL_FLOAT_MAT2:        components = 4; kind = 'm'; return true;
+    case GL_FLOAT_MAT3:        components = 9; kind = 'm'; return true;
+    case GL_FLOAT_MAT4:        components = 16; kind = 'm'; return true;
+    case GL_INT:
+    case GL_BOOL:              components = 1; kind = 'i'; return true;
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:         components = 2; kind = 'i'; return true;
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:         components = 3; kind = 'i'; return true;
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:         components = 4; kind = 'i'; return true;
+    case GL_UNSIGNED_INT:      components = 1; kind = 'u'; return true;
+    case GL_UNSIGNED_INT_VEC2: components = 2; kind = 'u'; return true;
+    case GL_UNSIGNED_INT_VEC3: components = 3; kind = 'u'; return true;
+    case GL_UNSIGNED_INT_VEC4: components = 4; kind = 'u'; return true;
+    // samplers hold the texture unit they read from
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_2D_MULTISAMPLE:
+    case GL_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_2D:
+    case GL_UNSIGNED_INT_SAMPLER_2D:
+                               components = 1; kind = 'i'; return true;
+    default:
+        return false;
+    }
+}
+
+
+struct ProgramUniform
+{
+    uint32_t id;            // ShaderNameId of the name; an array of a basic type is listed as "name" and
+                            // once per element as "name[i]", sharing the shadow value of "name"
+    GLint location;         // -1 for block members
+    GLenum type;
+    GLint arraySize;        // 1 for the per-element entries
+    GLint blockIndex;       // -1 in the default block
+    int components;
+    char kind;              // see UniformShape(); 0 if the type cannot be set through the table
+    uint32_t offset;        // byte offset of the shadow value
+};
+
+struct ProgramBlock
+{
+    uint32_t id;
+    GLenum interface;       // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+    GLuint index;
+    GLint binding;
+    GLint dataSize;
+};
+
+struct ProgramAttribute
+{
+    uint32_t id;
+    GLint location;
+    GLenum type;
+};
+
+
+/* Flat table of a linked program's uniforms, blocks and vertex inputs, read once with the program
+ * interface queries and sorted by name ID so lookups are a binary search instead of a GL call.
+ *
+ * Default-block uniforms also get a shadow copy of their value. Set() compares against the shadow
+ * and only marks the uniform dirty when the value changes; Flush() then writes every dirty uniform
+ * with glProgramUniform*, which needs no glUseProgram, covering only the elements that were set.
+ * Writes reach GL at the next Flush().
+ */
+class ProgramReflection
+{
+public:
+    ProgramReflection() : program(0) {}
+
+    void Reflect(GLuint programId)
+    {
+        program = programId;
+        uniforms.clear();
+        blocks.clear();
+        attributes.clear();
+        values.clear();
+        written.clear();
+        queued.clear();
+        setCounts.clear();
+        dirty.clear();
+        if (program == 0)
+            return;
+
+        char name[PROGRAM_REFLECTION_MAX_NAME];
+
+        GLint count = 0;
+        glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        const GLenum uniformProperties[] = { GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE, GL_BLOCK_INDEX };
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint properties[4];
+            glGetProgramResourceiv(program, GL_UNIFORM, GLuint(i), 4, uniformProperties, 4, NULL, properties);
+            GLsizei length = 0;
+            glGetProgramResourceName(program, GL_UNIFORM, GLuint(i), sizeof(name), &length, name);
+
+            // "lights[0]" is the whole array of a basic type; address it as "lights"
+            if (properties[2] > 1 && length > 3 && strcmp(name + length - 3, "[0]") == 0)
+                name[length - 3] = '\0';
+
+            ProgramUniform uniform;
+            uniform.id = ShaderNameId(name);
+            uniform.location = properties[0];
+            uniform.type = GLenum(properties[1]);
+            uniform.arraySize = std::max(properties[2], 1);
+            uniform.blockIndex = properties[3];
+            uniform.components = 0;
+            uniform.kind = 0;
+            uniform.offset = 0;
+            if (uniform.location >= 0 && UniformShape(uniform.type, uniform.components, uniform.kind))
+            {
+                uniform.offset = uint32_t(values.size());
+                values.resize(values.size() + size_t(uniform.components) * 4 * size_t(uniform.arraySize));
+            }
+            else
+                uniform.kind = 0;
+            uniforms.push_back(uniform);
+
+            // "name[i]" addresses one element, at its own location and inside the array's shadow value
+            if (uniform.kind != 0 && uniform.arraySize > 1)
+            {
+                std::string base = name;
+                for (GLint element = 0; element < uniform.arraySize; ++element)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    ProgramUniform single = uniform;
+                    single.id = ShaderNameId(elementName.c_str());
+                    single.location = glGetProgramResourceLocation(program, GL_UNIFORM, elementName.c_str());
+                    single.arraySize = 1;
+                    single.offset = uniform.offset + uint32_t(uniform.components) * 4 * uint32_t(element);
+                    if (single.location >= 0)
+                        uniforms.push_back(single);
+                }
+            }
+        }
+
+        reflectBlocks(GL_UNIFORM_BLOCK);
+        reflectBlocks(GL_SHADER_STORAGE_BLOCK);
+
+        count = 0;
+        glGetProgramInterfaceiv(program, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+        const GLenum attributeProperties[] = { GL_LOCATION, GL_TYPE };
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint properties[2];
+            glGetProgramResourceiv(program, GL_PROGRAM_INPUT, GLuint(i), 2, attributeProperties, 2, NULL, properties);
+            glGetProgramResourceName(program, GL_PROGRAM_INPUT, GLuint(i), sizeof(name), NULL, name);
+            ProgramAttribute attribute;
+            attribute.id = ShaderNameId(name);
+            attribute.location = properties[0];
+            attribute.type = GLenum(properties[1]);
+            attributes.push_back(attribute);
+        }
+
+        std::sort(uniforms.begin(), uniforms.end(), byId<ProgramUniform>);
+        std::sort(blocks.begin(), blocks.end(), byId<ProgramBlock>);
+        std::sort(attributes.begin(), attributes.end(), byId<ProgramAttribute>);
+        written.assign(uniforms.size(), false);
+        queued.assign(uniforms.size(), false);
+        setCounts.assign(uniforms.size(), 0);
+    }
+
+    GLuint Program() const { return program; }
+
+    const ProgramUniform* Uniform(uint32_t id) const { return find(uniforms, id); }
+    const ProgramBlock* Block(uint32_t id) const { return find(blocks, id); }
+    const ProgramAttribute* Attribute(uint32_t id) const { return find(attributes, id); }
+
+    GLint Location(uint32_t id) const
+    {
+        const ProgramUniform* uniform = Uniform(id);
+        return uniform ? uniform->location : -1;
+    }
+
+    const std::vector<ProgramUniform>& Uniforms() const { return uniforms; }
+    const std::vector<ProgramBlock>& Blocks() const { return blocks; }
+    const std::vector<ProgramAttribute>& Attributes() const { return attributes; }
+
+    // stores 'count' elements of 'kind' scalars; returns false if the program has no such settable uniform
+    bool Set(uint32_t id, char kind, const void* data, int components, int count = 1)
+    {
+        std::vector<ProgramUniform>::iterator uniform = std::lower_bound(uniforms.begin(), uniforms.end(), id, idBelow<ProgramUniform>);
+        if (uniform == uniforms.end() || uniform->id != id || uniform->kind == 0)
+            return false;
+        // a matrix is written as floats, an int also sets a bool or sampler
+        char expected = uniform->kind == 'm' ? 'f' : uniform->kind;
+        if (kind == 'm')
+            kind = 'f';
+        if (kind != expected || components != uniform->components)
+            return false;
+
+        count = std::max(1, std::min(count, uniform->arraySize));
+        size_t bytes = size_t(components) * 4 * size_t(count);
+        unsigned char* shadow = &values[uniform->offset];
+        size_t index = size_t(uniform - uniforms.begin());
+        if (written[index] && memcmp(shadow, data, bytes) == 0)
+            return true;
+
+        memcpy(shadow, data, bytes);
+        written[index] = true;
+        setCounts[index] = std::max(setCounts[index], count);
+        if (!queued[index])
+        {
+            queued[index] = true;
+            dirty.push_back(uint32_t(index));
+        }
+        return true;
+    }
+
+    // writes every changed uniform to the program
+    void Flush()
+    {
+        for (size_t i = 0; i < dirty.size(); ++i)
+        {
+            const ProgramUniform& uniform = uniforms[dirty[i]];
+            const void* value = &values[uniform.offset];
+            CurrentGLBackend().ProgramUniform(program, uniform.location, uniform.kind, uniform.components, setCounts[dirty[i]], value);
+            queued[dirty[i]] = false;
+            setCounts[dirty[i]] = 0;
+        }
+        dirty.clear();
+    }
+
+    bool Dirty() const { return !dirty.empty(); }
+
+private:
+    GLuint program;
+    std::vector<ProgramUniform> uniforms;
+    std::vector<ProgramBlock> blocks;
+    std::vector<ProgramAttribute> attributes;
+    std::vector<unsigned char> values;      // shadow copies of the default-block uniforms
+    std::vector<bool> written;              // false until a value was set, so the first Set() always writes
+    std::vector<bool> queued;               // already listed in 'dirty'
+    std::vector<int> setCounts;             // leading elements set since the last Flush(), written by it
+    std::vector<uint32_t> dirty;            // indices into 'uniforms'
+
+    void reflectBlocks(GLenum interface)
+    {
+        char name[PROGRAM_REFLECTION_MAX_NAME];
+        GLint count = 0;
+        glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES, &count);
+        const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint values[2];
+            glGetProgramResourceiv(program, interface, GLuint(i), 2, properties, 2, NULL, values);
+            glGetProgramResourceName(program, interface, GLuint(i), sizeof(name), NULL, name);
+            ProgramBlock block;
+            block.id = ShaderNameId(name);
+            block.interface = interface;
+            block.index = GLuint(i);
+            block.binding = values[0];
+            block.dataSize = values[1];
+            blocks.push_back(block);
+        }
+    }
+
+    template <typename T>
+    static bool byId(const T& a, const T& b) { return a.id < b.id; }
+
+    template <typename T>
+    static bool idBelow(const T& a, uint32_t id) { return a.id < id; }
+
+    template <typename T>
+    static const T* find(const std::vector<T>& table, uint32_t id)
+    {
+        typename std::vector<T>::const_iterator it = std::lower_bound(table.begin(), table.end(), id, idBelow<T>);
+        return it != table.end() && it->id == id ? &*it : nullptr;
+    }
+};
+#endif
@@ -0,0 +1,685 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "render_graph.h"
+#include "gl_backend.h"
+
+namespace
+{
+    const GLbitfield ALL_STORAGE_BARRIERS = GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT;
+}
+
+
+RenderGraph::RenderGraph() : declarationFailed(false), compiled(false)
+{
+}
+
+
+RenderGraph::~RenderGraph()
+{
+    for (size_t i = 0; i < framebufferPool.size(); ++i)
+        glDeleteFramebuffers(1, &framebufferPool[i].framebuffer);
+    for (size_t i = 0; i < texturePool.size(); ++i)
+        glDeleteTextures(1, &texturePool[i].texture);
+}
+
+
+void RenderGraph::Reset()
+{
+    resources.clear();
+    passes.clear();
+    order.clear();
+    declarationFailed = false;
+    compiled = false;
+}
+
+
+RenderResource RenderGraph::CreateTexture(const char* name, const RenderTextureDesc& desc)
+{
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resource.imported = false;
+    resource.texture = 0;
+    resource.physical = -1;
+    resource.firstUse = resource.lastUse = -1;
+    resources.push_back(resource);
+    return RenderResource(resources.size() - 1);
+}
+
+
+RenderResource RenderGraph::ImportTexture(const char* name, GLuint texture, const RenderTextureDesc& desc)
+{
+    RenderResource handle = CreateTexture(name, desc);
+    resources[handle].imported = true;
+    resources[handle].texture = texture;
+    return handle;
+}
+
+
+RenderResource RenderGraph::ImportBackbuffer(GLsizei width, GLsizei height)
+{
+    // texture 0 marks the default framebuffer; the format only matters for the size
+    return ImportTexture("backbuffer", 0, RenderTextureDesc(width, height, GL_RGBA8));
+}
+
+
+RenderPass RenderGraph::AddPass(const char* name, ExecuteFunction execute)
+{
+    Pass pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.keepAlive = false;
+    pass.live = false;
+    pass.barriers = 0;
+    pass.framebuffer = -1;
+    pass.attachesBackbuffer = false;
+    pass.width = pass.height = 0;
+    passes.push_back(pass);
+    return RenderPass(passes.size() - 1);
+}
+
+
+void RenderGraph::Read(RenderPass pass, RenderResource resource, RenderAccess access)
+{
+    if (pass >= passes.size() || resource >= resources.size())
+    {
+        std::cout << "ERROR::RENDER_GRAPH::INVALID_HANDLE" << std::endl;
+        declarationFailed = true;
+        return;
+    }
+    Access read = { resource, access, false };
+    passes[pass].accesses.push_back(read);
+}
+
+
+void RenderGraph::Write(RenderPass pass, RenderResource resource, RenderAccess access)
+{
+    if (pass >= passes.size() || resource >= resources.size() || access == RENDER_ACCESS_SAMPLED)
+    {
+        std::cout << "ERROR::RENDER_GRAPH::INVALID_WRITE" << std::endl;
+        declarationFailed = true;
+        return;
+    }
+    Access write = { resource, access, true };
+    passes[pass].accesses.push_back(write);
+}
+
+
+void RenderGraph::KeepAlive(RenderPass pass)
+{
+    if (pass < passes.size())
+        passes[pass].keepAlive = true;
+}
+
+
+bool RenderGraph::Compile()
+{
+    compiled = false;
+    stats = RenderGraphStats();
+    stats.passes = passes.size();
+    if (declarationFailed || !buildDependencies())
+        return false;
+
+    cull();
+    sortPasses();
+    assignTextures();
+    if (!assignFramebuffers())
+        return false;
+    planBarriers();
+    releaseUnused();
+
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        if (!passes[i].live)
+            ++stats.culled;
+        else if (passes[i].barriers != 0)
+            ++stats.barriers;
+    }
+    for (size_t i = 0; i < resources.size(); ++i)
+        if (!resources[i].imported && resources[i].firstUse >= 0)
+            ++stats.transientTextures;
+    for (size_t i = 0; i < texturePool.size(); ++i)
+    {
+        const RenderTextureDesc& desc = texturePool[i].desc;
+        ++stats.physicalTextures;
+        stats.transientBytes += size_t(desc.width) * size_t(desc.height) * bytesPerTexel(desc.internalFormat);
+    }
+
+    compiled = true;
+    return true;
+}
+
+
+void RenderGraph::Execute()
+{
+    if (!compiled)
+        return;
+
+    GLBackend& gl = CurrentGLBackend();
+    GLuint bound = RENDER_GRAPH_NONE;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        Pass& pass = passes[order[i]];
+        if (pass.barriers != 0)
+            glMemoryBarrier(pass.barriers);
+        if (pass.attachesBackbuffer || pass.framebuffer >= 0)
+        {
+            GLuint framebuffer = pass.attachesBackbuffer ? 0 : framebufferPool[pass.framebuffer].framebuffer;
+            if (framebuffer != bound)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+                bound = framebuffer;
+            }
+            gl.Viewport(0, 0, pass.width, pass.height);
+        }
+        if (pass.execute)
+            pass.execute(*this);
+    }
+
+    // leave the default framebuffer bound for whatever draws outside the graph
+    if (bound != 0 && bound != RENDER_GRAPH_NONE)
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+GLuint RenderGraph::Texture(RenderResource resource) const
+{
+    return resource < resources.size() ? resources[resource].texture : 0;
+}
+
+
+std::string RenderGraph::Describe() const
+{
+    if (!compiled)
+        return "not compiled\n";
+
+    std::ostringstream out;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const Pass& pass = passes[order[i]];
+        out << i << ": " << pass.name;
+        if (pass.barriers != 0)
+            out << " (barrier 0x" << std::hex << pass.barriers << std::dec << ")";
+        for (size_t j = 0; j < pass.accesses.size(); ++j)
+        {
+            const Access& access = pass.accesses[j];
+            const Resource& resource = resources[access.resource];
+            out << (access.write ? " >" : " <") << resource.name;
+            if (resource.physical >= 0)
+                out << "@" << resource.physical;
+        }
+        out << "\n";
+    }
+    for (size_t i = 0; i < passes.size(); ++i)
+        if (!passes[i].live)
+            out << "culled: " << passes[i].name << "\n";
+    return out.str();
+}
+
+
+// Edges in declaration order: a reader after the last writer, a writer after the last writer and the
+// readers since. Producers (reads and overwrites of what a pass wrote) also decide what is culled.
+bool RenderGraph::buildDependencies()
+{
+    producers.assign(passes.size(), std::vector<uint32_t>());
+    successors.assign(passes.size(), std::vector<uint32_t>());
+    std::vector<uint32_t> lastWriter(resources.size(), RENDER_GRAPH_NONE);
+    std::vector<std::vector<uint32_t> > readers(resources.size());
+
+    for (uint32_t p = 0; p < passes.size(); ++p)
+    {
+        const std::vector<Access>& accesses = passes[p].accesses;
+        for (size_t i = 0; i < accesses.size(); ++i)
+        {
+            const Access& access = accesses[i];
+            RenderResource r = access.resource;
+            if (access.write)
+            {
+                // sampling or image loads of a texture while it is attached would read what is being drawn
+                for (size_t j = 0; j < accesses.size(); ++j)
+                    if (!accesses[j].write && accesses[j].resource == r && (access.access == RENDER_ACCESS_ATTACHMENT) != (accesses[j].access == RENDER_ACCESS_ATTACHMENT))
+                    {
+                        std::cout << "ERROR::RENDER_GRAPH::FEEDBACK_LOOP " << passes[p].name << " " << resources[r].name << std::endl;
+                        return false;
+                    }
+                continue;
+            }
+            if (lastWriter[r] == RENDER_GRAPH_NONE && !resources[r].imported)
+            {
+                std::cout << "ERROR::RENDER_GRAPH::READ_BEFORE_WRITE " << passes[p].name << " " << resources[r].name << std::endl;
+                return false;
+            }
+            if (lastWriter[r] != RENDER_GRAPH_NONE)
+            {
+                producers[p].push_back(lastWriter[r]);
+                successors[lastWriter[r]].push_back(p);
+            }
+            readers[r].push_back(p);
+        }
+
+        for (size_t i = 0; i < accesses.size(); ++i)
+        {
+            if (!accesses[i].write)
+                continue;
+            RenderResource r = accesses[i].resource;
+            if (lastWriter[r] == p)
+                continue;
+            if (lastWriter[r] != RENDER_GRAPH_NONE)
+            {
+                producers[p].push_back(lastWriter[r]);
+                successors[lastWriter[r]].push_back(p);
+            }
+            for (size_t j = 0; j < readers[r].size(); ++j)
+                if (readers[r][j] != p)
+                    successors[readers[r][j]].push_back(p);
+            readers[r].clear();
+            lastWriter[r] = p;
+        }
+    }
+    return true;
+}
+
+
+void RenderGraph::cull()
+{
+    std::vector<uint32_t> stack;
+    for (uint32_t p = 0; p < passes.size(); ++p)
+    {
+        Pass& pass = passes[p];
+        pass.live = pass.keepAlive;
+        for (size_t i = 0; i < pass.accesses.size() && !pass.live; ++i)
+            pass.live = pass.accesses[i].write && resources[pass.accesses[i].resource].imported;
+        if (pass.live)
+            stack.push_back(p);
+    }
+
+    while (!stack.empty())
+    {
+        uint32_t p = stack.back();
+        stack.pop_back();
+        for (size_t i = 0; i < producers[p].size(); ++i)
+        {
+            uint32_t producer = producers[p][i];
+            if (!passes[producer].live)
+            {
+                passes[producer].live = true;
+                stack.push_back(producer);
+            }
+        }
+    }
+}
+
+
+// Topological order of the live passes. Of the ready passes the one whose latest producer ran most
+// recently goes next, then the earliest declared, so consumers follow their producers closely.
+void RenderGraph::sortPasses()
+{
+    std::vector<int> pending(passes.size(), 0);
+    std::vector<int> position(passes.size(), -1);
+    for (uint32_t p = 0; p < passes.size(); ++p)
+        if (passes[p].live)
+            for (size_t i = 0; i < successors[p].size(); ++i)
+                if (passes[successors[p][i]].live)
+                    ++pending[successors[p][i]];
+
+    std::vector<uint32_t> ready;
+    for (uint32_t p = 0; p < passes.size(); ++p)
+        if (passes[p].live && pending[p] == 0)
+            ready.push_back(p);
+
+    order.clear();
+    while (!ready.empty())
+    {
+        size_t best = 0;
+        int bestRecency = -2;
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            int recency = -1;
+            const std::vector<uint32_t>& inputs = producers[ready[i]];
+            for (size_t j = 0; j < inputs.size(); ++j)
+                recency = std::max(recency, position[inputs[j]]);
+            if (recency > bestRecency || (recency == bestRecency && ready[i] < ready[best]))
+            {
+                best = i;
+                bestRecency = recency;
+            }
+        }
+
+        uint32_t p = ready[best];
+        ready.erase(ready.begin() + best);
+        position[p] = int(order.size());
+        order.push_back(p);
+        for (size_t i = 0; i < successors[p].size(); ++i)
+        {
+            uint32_t next = successors[p][i];
+            if (passes[next].live && --pending[next] == 0)
+                ready.push_back(next);
+        }
+    }
+}
+
+
+// Greedy interval assignment by first use: a transient texture takes any pooled texture of its
+// description that is free by then, which needs no more textures than the most alive at once.
+void RenderGraph::assignTextures()
+{
+    for (size_t i = 0; i < resources.size(); ++i)
+    {
+        Resource& resource = resources[i];
+        resource.firstUse = resource.lastUse = -1;
+        if (!resource.imported)
+        {
+            resource.texture = 0;
+            resource.physical = -1;
+        }
+    }
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const std::vector<Access>& accesses = passes[order[i]].accesses;
+        for (size_t j = 0; j < accesses.size(); ++j)
+        {
+            Resource& resource = resources[accesses[j].resource];
+            if (resource.firstUse < 0)
+                resource.firstUse = int(i);
+            resource.lastUse = int(i);
+        }
+    }
+
+    std::vector<uint32_t> transients;
+    for (uint32_t i = 0; i < resources.size(); ++i)
+        if (!resources[i].imported && resources[i].firstUse >= 0)
+            transients.push_back(i);
+    std::stable_sort(transients.begin(), transients.end(),
+                     [this](uint32_t a, uint32_t b) { return resources[a].firstUse < resources[b].firstUse; });
+
+    for (size_t i = 0; i < texturePool.size(); ++i)
+    {
+        texturePool[i].used = false;
+        texturePool[i].busyUntil = -1;
+    }
+
+    for (size_t i = 0; i < transients.size(); ++i)
+    {
+        Resource& resource = resources[transients[i]];
+        int physical = -1;
+        for (size_t j = 0; j < texturePool.size() && physical < 0; ++j)
+            if (texturePool[j].desc == resource.desc && texturePool[j].busyUntil < resource.firstUse)
+                physical = int(j);
+
+        if (physical < 0)
+        {
+            PooledTexture pooled;
+            pooled.desc = resource.desc;
+            glGenTextures(1, &pooled.texture);
+            glBindTexture(GL_TEXTURE_2D, pooled.texture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, resource.desc.internalFormat, resource.desc.width, resource.desc.height);
+            // passes that filter set their own sampler state
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            texturePool.push_back(pooled);
+            physical = int(texturePool.size() - 1);
+        }
+
+        texturePool[physical].used = true;
+        texturePool[physical].busyUntil = resource.lastUse;
+        resource.physical = physical;
+        resource.texture = texturePool[physical].texture;
+    }
+}
+
+
+bool RenderGraph::assignFramebuffers()
+{
+    for (size_t i = 0; i < framebufferPool.size(); ++i)
+        framebufferPool[i].used = false;
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        Pass& pass = passes[order[i]];
+        pass.framebuffer = -1;
+        pass.attachesBackbuffer = false;
+
+        // colors first in declaration order, then the depth attachment
+        GLuint attachments[RENDER_GRAPH_MAX_ATTACHMENTS];
+        GLenum points[RENDER_GRAPH_MAX_ATTACHMENTS];
+        RenderResource attached[RENDER_GRAPH_MAX_ATTACHMENTS];
+        int count = 0;
+        int colorCount = 0;
+        RenderResource depth = RENDER_GRAPH_NONE;
+        for (size_t j = 0; j < pass.accesses.size(); ++j)
+        {
+            const Access& access = pass.accesses[j];
+            if (access.access != RENDER_ACCESS_ATTACHMENT || std::find(attached, attached + count, access.resource) != attached + count
+                || access.resource == depth)
+                continue;
+            const Resource& resource = resources[access.resource];
+            if (resource.imported && resource.texture == 0)
+            {
+                pass.attachesBackbuffer = true;
+                pass.width = resource.desc.width;
+                pass.height = resource.desc.height;
+                continue;
+            }
+            if (isDepthFormat(resource.desc.internalFormat))
+            {
+                if (depth != RENDER_GRAPH_NONE)
+                {
+                    std::cout << "ERROR::RENDER_GRAPH::TWO_DEPTH_ATTACHMENTS " << pass.name << std::endl;
+                    return false;
+                }
+                depth = access.resource;
+                continue;
+            }
+            if (count == RENDER_GRAPH_MAX_ATTACHMENTS - 1)
+            {
+                std::cout << "ERROR::RENDER_GRAPH::TOO_MANY_ATTACHMENTS " << pass.name << std::endl;
+                return false;
+            }
+            attached[count] = access.resource;
+            attachments[count] = resource.texture;
+            points[count] = GL_COLOR_ATTACHMENT0 + colorCount++;
+            ++count;
+        }
+        if (depth != RENDER_GRAPH_NONE)
+        {
+            GLenum format = resources[depth].desc.internalFormat;
+            attached[count] = depth;
+            attachments[count] = resources[depth].texture;
+            points[count] = format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+            ++count;
+        }
+
+        if (pass.attachesBackbuffer)
+        {
+            if (count > 0)
+            {
+                std::cout << "ERROR::RENDER_GRAPH::BACKBUFFER_WITH_ATTACHMENTS " << pass.name << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (count == 0)
+            continue;
+
+        pass.width = resources[attached[0]].desc.width;
+        pass.height = resources[attached[0]].desc.height;
+        for (int j = 1; j < count; ++j)
+            if (resources[attached[j]].desc.width != pass.width || resources[attached[j]].desc.height != pass.height)
+            {
+                std::cout << "ERROR::RENDER_GRAPH::ATTACHMENT_SIZE_MISMATCH " << pass.name << std::endl;
+                return false;
+            }
+
+        pass.framebuffer = acquireFramebuffer(attachments, points, count, colorCount);
+        if (pass.framebuffer < 0)
+            return false;
+    }
+    return true;
+}
+
+
+int RenderGraph::acquireFramebuffer(const GLuint* attachments, const GLenum* attachmentPoints, int count, int colorCount)
+{
+    for (size_t i = 0; i < framebufferPool.size(); ++i)
+    {
+        PooledFramebuffer& pooled = framebufferPool[i];
+        if (pooled.attachmentCount == count && std::equal(attachments, attachments + count, pooled.attachments))
+        {
+            pooled.used = true;
+            return int(i);
+        }
+    }
+
+    PooledFramebuffer pooled;
+    pooled.attachmentCount = count;
+    std::copy(attachments, attachments + count, pooled.attachments);
+    pooled.used = true;
+    glGenFramebuffers(1, &pooled.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, pooled.framebuffer);
+    for (int i = 0; i < count; ++i)
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachmentPoints[i], GL_TEXTURE_2D, attachments[i], 0);
+    if (colorCount > 0)
+        glDrawBuffers(colorCount, attachmentPoints);
+    else
+        glDrawBuffer(GL_NONE);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "ERROR::RENDER_GRAPH::FRAMEBUFFER_INCOMPLETE 0x" << std::hex << status << std::dec << std::endl;
+        glDeleteFramebuffers(1, &pooled.framebuffer);
+        return -1;
+    }
+    framebufferPool.push_back(pooled);
+    return int(framebufferPool.size() - 1);
+}
+
+
+// Image stores are the only writes GL leaves unsynchronized. After one, each kind of later access
+// needs its barrier bit once; any other write orders everything again.
+void RenderGraph::planBarriers()
+{
+    unsynchronized.assign(texturePool.size() + resources.size(), 0);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        Pass& pass = passes[order[i]];
+        pass.barriers = 0;
+        for (size_t j = 0; j < pass.accesses.size(); ++j)
+        {
+            const Access& access = pass.accesses[j];
+            const Resource& resource = resources[access.resource];
+            GLbitfield& pending = unsynchronized[resource.physical >= 0 ? size_t(resource.physical) : texturePool.size() + access.resource];
+            GLbitfield bit = barrierBit(access.access);
+            if (pending & bit)
+            {
+                pass.barriers |= bit;
+                pending &= ~bit;
+            }
+        }
+        for (size_t j = 0; j < pass.accesses.size(); ++j)
+        {
+            const Access& access = pass.accesses[j];
+            if (!access.write)
+                continue;
+            const Resource& resource = resources[access.resource];
+            GLbitfield& pending = unsynchronized[resource.physical >= 0 ? size_t(resource.physical) : texturePool.size() + access.resource];
+            pending = access.access == RENDER_ACCESS_STORAGE ? ALL_STORAGE_BARRIERS : 0;
+        }
+    }
+}
+
+
+void RenderGraph::releaseUnused()
+{
+    // framebuffers first: only unused ones can still reference unused textures
+    std::vector<int> remap(framebufferPool.size(), -1);
+    size_t kept = 0;
+    for (size_t i = 0; i < framebufferPool.size(); ++i)
+    {
+        if (framebufferPool[i].used)
+        {
+            remap[i] = int(kept);
+            framebufferPool[kept++] = framebufferPool[i];
+        }
+        else
+            glDeleteFramebuffers(1, &framebufferPool[i].framebuffer);
+    }
+    framebufferPool.resize(kept);
+    for (size_t i = 0; i < order.size(); ++i)
+        if (passes[order[i]].framebuffer >= 0)
+            passes[order[i]].framebuffer = remap[passes[order[i]].framebuffer];
+
+    remap.assign(texturePool.size(), -1);
+    kept = 0;
+    for (size_t i = 0; i < texturePool.size(); ++i)
+    {
+        if (texturePool[i].used)
+        {
+            remap[i] = int(kept);
+            texturePool[kept++] = texturePool[i];
+        }
+        else
+            glDeleteTextures(1, &texturePool[i].texture);
+    }
+    texturePool.resize(kept);
+    for (size_t i = 0; i < resources.size(); ++i)
+        if (resources[i].physical >= 0)
+            resources[i].physical = remap[resources[i].physical];
+}
+
+
+GLbitfield RenderGraph::barrierBit(RenderAccess access)
+{
+    switch (access)
+    {
+    case RENDER_ACCESS_SAMPLED: return GL_TEXTURE_FETCH_BARRIER_BIT;
+    case RENDER_ACCESS_STORAGE: return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    case RENDER_ACCESS_EXTERNAL: return ALL_STORAGE_BARRIERS;  // may fetch, load or attach it
+    default: return GL_FRAMEBUFFER_BARRIER_BIT;
+    }
+}
+
+
+bool RenderGraph::isDepthFormat(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_DEPTH_COMPONENT16:
+    case GL_DEPTH_COMPONENT24:
+    case GL_DEPTH_COMPONENT32:
+    case GL_DEPTH_COMPONENT32F:
+    case GL_DEPTH24_STENCIL8:
+    case GL_DEPTH32F_STENCIL8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+size_t RenderGraph::bytesPerTexel(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_R8:
+        return 1;
+    case GL_RG8:
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+        return 2;
+    case GL_RGBA16F:
+    case GL_RG32F:
+    case GL_DEPTH32F_STENCIL8:
+        return 8;
+    case GL_RGBA32F:
+        return 16;
+    default:
+        return 4;
+    }
+}
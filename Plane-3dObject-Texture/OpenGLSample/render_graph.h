@@ -0,0 +1,193 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Handles into the graph declared since the last Reset()
+typedef uint32_t RenderResource;
+typedef uint32_t RenderPass;
+
+// Default render graph values
+const uint32_t RENDER_GRAPH_NONE = 0xFFFFFFFFu;
+const int RENDER_GRAPH_MAX_ATTACHMENTS = 8;     // color and depth attachments of one pass together
+
+// How a pass touches a resource
+enum RenderAccess
+{
+    RENDER_ACCESS_ATTACHMENT,   // framebuffer attachment: drawn into, or depth tested against when read
+    RENDER_ACCESS_SAMPLED,      // texture fetches; read only
+    RENDER_ACCESS_STORAGE,      // image load/store from shaders
+    RENDER_ACCESS_EXTERNAL      // through framebuffers or calls of the pass's own; ordered, but nothing is bound for it
+};
+
+// A 2D texture with one level
+struct RenderTextureDesc
+{
+    GLsizei width;
+    GLsizei height;
+    GLenum internalFormat;
+
+    RenderTextureDesc() : width(0), height(0), internalFormat(GL_RGBA8) {}
+    RenderTextureDesc(GLsizei width, GLsizei height, GLenum internalFormat)
+        : width(width), height(height), internalFormat(internalFormat)
+    {
+    }
+
+    bool operator==(const RenderTextureDesc& other) const
+    {
+        return width == other.width && height == other.height && internalFormat == other.internalFormat;
+    }
+};
+
+// What the last Compile() made of the frame
+struct RenderGraphStats
+{
+    size_t passes;              // declared
+    size_t culled;              // declared but not contributing to any output
+    size_t transientTextures;   // transient textures some remaining pass uses
+    size_t physicalTextures;    // GL textures backing them
+    size_t transientBytes;      // memory of those GL textures
+    size_t barriers;            // glMemoryBarrier calls
+
+    RenderGraphStats() : passes(0), culled(0), transientTextures(0), physicalTextures(0), transientBytes(0), barriers(0) {}
+};
+
+
+/* Frame graph: the frame is declared as passes with the resources each one reads and writes, then
+ * compiled and run.
+ *
+ * Compile() works from the outputs back. Passes that write an imported resource (the backbuffer or a
+ * texture owned elsewhere) or are marked KeepAlive() are the roots; a pass survives only if a survivor
+ * reads or overwrites something it wrote, so a pass whose results nobody consumes costs nothing.
+ * The survivors are then ordered: a pass runs after the passes that wrote what it touches and, for a
+ * write, after the earlier readers of the old contents; among the passes ready to run the one that
+ * consumes the most recent output goes first, which keeps transient textures alive for fewer passes.
+ *
+ * Transient textures are created by the graph. Each one lives from the first to the last pass that
+ * uses it, and textures of the same size and format whose lifetimes do not overlap share one GL
+ * texture (OpenGL has no placement of textures in shared memory, so equal descriptions are what can
+ * alias). The textures and the framebuffers built from the passes' attachments are pooled across
+ * frames; whatever a frame no longer needs is deleted at the end of Compile().
+ *
+ * Barriers follow the access types: only image stores are incoherent in GL, so a glMemoryBarrier with
+ * the bits for the next access goes before the first pass that uses what a storage write produced.
+ * Execute() binds each pass's framebuffer and viewport before calling it; passes clear what they need.
+ */
+class RenderGraph
+{
+public:
+    typedef std::function<void(RenderGraph&)> ExecuteFunction;
+
+    RenderGraph();
+    ~RenderGraph();
+
+    // forgets the declared frame; pooled textures and framebuffers are kept for the next Compile()
+    void Reset();
+
+    RenderResource CreateTexture(const char* name, const RenderTextureDesc& desc);
+    RenderResource ImportTexture(const char* name, GLuint texture, const RenderTextureDesc& desc);
+    // the default framebuffer; a pass attaching it can attach nothing else
+    RenderResource ImportBackbuffer(GLsizei width, GLsizei height);
+
+    RenderPass AddPass(const char* name, ExecuteFunction execute);
+    void Read(RenderPass pass, RenderResource resource, RenderAccess access = RENDER_ACCESS_SAMPLED);
+    void Write(RenderPass pass, RenderResource resource, RenderAccess access = RENDER_ACCESS_ATTACHMENT);
+    // the pass has effects outside the graph (readbacks, queries) and is never culled
+    void KeepAlive(RenderPass pass);
+
+    // culls, orders, assigns textures and plans barriers; returns false on an invalid frame, which
+    // Execute() then skips
+    bool Compile();
+    void Execute();
+
+    // GL texture behind a resource once compiled; 0 for the backbuffer and culled resources
+    GLuint Texture(RenderResource resource) const;
+    const RenderTextureDesc& Desc(RenderResource resource) const { return resources[resource].desc; }
+
+    bool IsCulled(RenderPass pass) const { return !passes[pass].live; }
+    const RenderGraphStats& Stats() const { return stats; }
+
+    // passes in execution order, with the barriers and aliasing, one line each
+    std::string Describe() const;
+
+private:
+    struct Resource
+    {
+        std::string name;
+        RenderTextureDesc desc;
+        bool imported;
+        GLuint texture;             // imported texture, or the pooled one assigned by Compile()
+        int physical;               // pool index for transient textures, -1 otherwise
+        int firstUse, lastUse;      // positions in the execution order, -1 when unused
+    };
+
+    struct Access
+    {
+        RenderResource resource;
+        RenderAccess access;
+        bool write;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        ExecuteFunction execute;
+        std::vector<Access> accesses;
+        bool keepAlive;
+        bool live;
+        GLbitfield barriers;        // issued before the pass runs
+        int framebuffer;            // framebuffer pool index, -1 for the backbuffer or none
+        bool attachesBackbuffer;
+        GLsizei width, height;      // viewport, from the attachments
+    };
+
+    struct PooledTexture
+    {
+        RenderTextureDesc desc;
+        GLuint texture;
+        bool used;                  // by the frame compiled last
+        int busyUntil;              // while assigning: last use of the current occupant
+    };
+
+    struct PooledFramebuffer
+    {
+        GLuint framebuffer;
+        GLuint attachments[RENDER_GRAPH_MAX_ATTACHMENTS];
+        int attachmentCount;
+        bool used;
+    };
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<uint32_t> order;                    // live passes in execution order
+    std::vector<std::vector<uint32_t> > producers;  // per pass: the passes whose writes it depends on
+    std::vector<std::vector<uint32_t> > successors; // per pass: the passes that must run after it
+    std::vector<PooledTexture> texturePool;
+    std::vector<PooledFramebuffer> framebufferPool;
+    std::vector<GLbitfield> unsynchronized;         // per pooled, then per imported texture: barrier bits image stores still need
+    RenderGraphStats stats;
+    bool declarationFailed;
+    bool compiled;
+
+    bool buildDependencies();
+    void cull();
+    void sortPasses();
+    void assignTextures();
+    bool assignFramebuffers();
+    void planBarriers();
+    void releaseUnused();
+    int acquireFramebuffer(const GLuint* attachments, const GLenum* attachmentPoints, int count, int colorCount);
+    static GLbitfield barrierBit(RenderAccess access);
+    static bool isDepthFormat(GLenum internalFormat);
+    static size_t bytesPerTexel(GLenum internalFormat);
+
+    RenderGraph(const RenderGraph&);
+    RenderGraph& operator=(const RenderGraph&);
+};
+#endif
@@ -0,0 +1,307 @@
+#ifndef RESOURCE_CACHE_H
+#define RESOURCE_CACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 64-bit xxHash (XXH64) of a block of memory, used as the content address of loaded resources
+inline uint64_t HashBytes(const void* data, size_t length, uint64_t seed = 0)
+{
+    const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    struct Helpers
+    {
+        static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+        static uint64_t read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+        static uint32_t read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+        static uint64_t round(uint64_t acc, uint64_t input)
+        {
+            acc += input * 0xC2B2AE3D27D4EB4FULL;
+            acc = rotl(acc, 31);
+            return acc * 0x9E3779B185EBCA87ULL;
+        }
+        static uint64_t merge(uint64_t acc, uint64_t val)
+        {
+            acc ^= round(0, val);
+            return acc * 0x9E3779B185EBCA87ULL + 0x85EBCA77C2B2AE63ULL;
+        }
+    };
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + length;
+    uint64_t h;
+
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        do
+        {
+            v1 = Helpers::round(v1, Helpers::read64(p));
+            v2 = Helpers::round(v2, Helpers::read64(p + 8));
+            v3 = Helpers::round(v3, Helpers::read64(p + 16));
+            v4 = Helpers::round(v4, Helpers::read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = Helpers::rotl(v1, 1) + Helpers::rotl(v2, 7) + Helpers::rotl(v3, 12) + Helpers::rotl(v4, 18);
+        h = Helpers::merge(h, v1);
+        h = Helpers::merge(h, v2);
+        h = Helpers::merge(h, v3);
+        h = Helpers::merge(h, v4);
+    }
+    else
+        h = seed + PRIME5;
+
+    h += uint64_t(length);
+
+    while (p + 8 <= end)
+    {
+        h ^= Helpers::round(0, Helpers::read64(p));
+        h = Helpers::rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= uint64_t(Helpers::read32(p)) * PRIME1;
+        h = Helpers::rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h ^= uint64_t(*p) * PRIME5;
+        h = Helpers::rotl(h, 11) * PRIME1;
+        ++p;
+    }
+
+    // final avalanche
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t HashString(const std::string& text, uint64_t seed = 0)
+{
+    return HashBytes(text.data(), text.size(), seed);
+}
+
+// Turns any spelling of a path into one canonical key: forward slashes, no "." or empty
+// segments, ".." folded into its parent, and case-insensitive on Windows.
+inline std::string NormalizePath(const std::string& path)
+{
+    std::vector<std::string> segments;
+    std::string segment;
+    bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+
+    for (size_t i = 0; i <= path.size(); ++i)
+    {
+        char c = i < path.size() ? path[i] : '/';
+        if (c != '/' && c != '\\')
+        {
+#ifdef _WIN32
+            if (c >= 'A' && c <= 'Z')
+                c = char(c - 'A' + 'a');
+#endif
+            segment += c;
+            continue;
+        }
+
+        if (segment == "..")
+        {
+            if (!segments.empty() && segments.back() != "..")
+                segments.pop_back();
+            else if (!absolute)
+                segments.push_back(segment);
+        }
+        else if (!segment.empty() && segment != ".")
+            segments.push_back(segment);
+        segment.clear();
+    }
+
+    std::string normalized = absolute ? "/" : "";
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        if (i > 0)
+            normalized += '/';
+        normalized += segments[i];
+    }
+    return normalized;
+}
+
+// reads a whole file into memory; returns false if it cannot be opened
+inline bool ReadFileBytes(const std::string& path, std::vector<unsigned char>& bytes)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+
+// Content-addressed cache of shared resources. Every resource is keyed by the xxHash of the file
+// it was decoded from, and every normalized path remembers the hash it resolved to, so the same
+// file (or a byte-identical copy under another name) is decoded and uploaded once while any
+// handle to it is alive. The lock covers the lookups only: files are read, hashed and loaded
+// outside it, so a hit never waits behind another thread's load, and if two threads load the same
+// new file at once the first to finish is kept. The cache only holds weak references: once the
+// last handle goes away the resource's deleter releases it and the entry is dropped by Purge().
+template <typename T>
+class ResourceCache
+{
+public:
+    typedef std::shared_ptr<T> Handle;
+    // decodes the file contents into a resource; returns an empty handle on failure
+    typedef std::function<Handle(const unsigned char* bytes, size_t size, const std::string& path)> Loader;
+
+    ResourceCache() : hits(0), misses(0)
+    {
+    }
+
+    // returns the shared resource for a file, loading it only if no live copy exists
+    Handle Acquire(const std::string& path, const Loader& loader)
+    {
+        std::string key = NormalizePath(path);
+
+        // known path whose resource is still alive: no I/O at all
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unordered_map<std::string, uint64_t>::iterator known = paths.find(key);
+            if (known != paths.end())
+            {
+                Handle handle = lookup(known->second);
+                if (handle)
+                {
+                    ++hits;
+                    return handle;
+                }
+            }
+        }
+
+        std::vector<unsigned char> bytes;
+        if (!ReadFileBytes(path, bytes))
+            return Handle();
+        uint64_t hash = HashBytes(bytes.data(), bytes.size());
+
+        // same contents reached through a different path
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            paths[key] = hash;
+            Handle handle = lookup(hash);
+            if (handle)
+            {
+                ++hits;
+                return handle;
+            }
+        }
+
+        Handle handle = loader(bytes.data(), bytes.size(), path);
+        if (!handle)
+            return handle;
+
+        // another thread may have loaded the same contents meanwhile; its copy wins and ours is released
+        std::lock_guard<std::mutex> lock(mutex);
+        Handle existing = lookup(hash);
+        if (existing)
+        {
+            ++hits;
+            return existing;
+        }
+        ++misses;
+        entries[hash] = handle;
+        return handle;
+    }
+
+    // registers a resource decoded elsewhere (e.g. from memory) under its content hash and,
+    // if given, the path it came from
+    Handle Insert(uint64_t hash, const Handle& handle, const std::string& path = std::string())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!path.empty())
+            paths[NormalizePath(path)] = hash;
+        Handle existing = lookup(hash);
+        if (existing)
+            return existing;
+        entries[hash] = handle;
+        return handle;
+    }
+
+    // returns the live resource with this content hash, if any
+    Handle Find(uint64_t hash)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lookup(hash);
+    }
+
+    // returns the live resource last loaded from this path, if any, without touching the disk
+    Handle FindPath(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<std::string, uint64_t>::iterator known = paths.find(NormalizePath(path));
+        if (known == paths.end())
+            return Handle();
+        return lookup(known->second);
+    }
+
+    // drops entries whose resources have been released
+    void Purge()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (typename std::unordered_map<uint64_t, std::weak_ptr<T> >::iterator it = entries.begin(); it != entries.end();)
+        {
+            if (it->second.expired())
+                it = entries.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    size_t LiveCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t live = 0;
+        for (typename std::unordered_map<uint64_t, std::weak_ptr<T> >::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            if (!it->second.expired())
+                ++live;
+        }
+        return live;
+    }
+
+    unsigned long long Hits() const { return hits; }
+    unsigned long long Misses() const { return misses; }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::weak_ptr<T> > entries;   // content hash -> resource
+    std::unordered_map<std::string, uint64_t> paths;            // normalized path -> content hash
+    unsigned long long hits;
+    unsigned long long misses;
+
+    Handle lookup(uint64_t hash)
+    {
+        typename std::unordered_map<uint64_t, std::weak_ptr<T> >::iterator it = entries.find(hash);
+        if (it == entries.end())
+            return Handle();
+        return it->second.lock();
+    }
+};
+#endif
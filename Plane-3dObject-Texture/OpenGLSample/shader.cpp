@@ -13,6 +13,8 @@ using namespace std;
 #include <GL/glew.h>
 
 #include "shader.hpp"
+#include "program_cache.h"
+#include "shader_preprocessor.h"
 
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
 
@@ -20,28 +22,31 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
 	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-	// Read the Vertex Shader code from the file
+	// Read the Vertex Shader code from the asset pack or the file, expanding #include
 	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
+	if(!PreprocessShader(vertex_file_path, ShaderDefines(), VertexShaderCode)){
 		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
 		getchar();
 		return 0;
 	}
+	char const * VertexSourcePointer = VertexShaderCode.c_str();
+	GLint VertexSourceLength = GLint(VertexShaderCode.size());
 
-	// Read the Fragment Shader code from the file
+	// Read the Fragment Shader code from the asset pack or the file, expanding #include
 	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+	PreprocessShader(fragment_file_path, ShaderDefines(), FragmentShaderCode);
+	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+	GLint FragmentSourceLength = GLint(FragmentShaderCode.size());
+
+	// Reuse the program linked on a previous run when the driver accepts its binary
+	const char * Sources[] = { VertexSourcePointer, FragmentSourcePointer };
+	const GLint Lengths[] = { VertexSourceLength, FragmentSourceLength };
+	uint64_t CacheKey = ProgramCacheKey(Sources, Lengths, 2);
+	GLuint CachedProgramID = LoadCachedProgram(CacheKey);
+	if ( CachedProgramID != 0 ){
+		glDeleteShader(VertexShaderID);
+		glDeleteShader(FragmentShaderID);
+		return CachedProgramID;
 	}
 
 	GLint Result = GL_FALSE;
@@ -50,8 +55,7 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 	// Compile Vertex Shader
 	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , &VertexSourceLength);
 	glCompileShader(VertexShaderID);
 
 	// Check Vertex Shader
@@ -67,8 +71,7 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 	// Compile Fragment Shader
 	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , &FragmentSourceLength);
 	glCompileShader(FragmentShaderID);
 
 	// Check Fragment Shader
@@ -85,6 +88,7 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	// Link the program
 	printf("Linking program\n");
 	GLuint ProgramID = glCreateProgram();
+	PrepareProgramForCache(ProgramID);
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
 	glLinkProgram(ProgramID);
@@ -97,6 +101,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
+	if ( Result == GL_TRUE )
+		StoreCachedProgram(CacheKey, ProgramID);
 
 	
 	glDetachShader(ProgramID, VertexShaderID);
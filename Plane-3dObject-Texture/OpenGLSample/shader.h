@@ -5,6 +5,12 @@
 
 #include <glm/glm.hpp>
 
+#include "light_block.h"
+#include "program_cache.h"
+#include "program_reflection.h"
+#include "shadow_block.h"
+#include "shader_preprocessor.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -16,156 +22,174 @@ public:
 	unsigned int ID;
 	// constructor generates the shader on the fly
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const ShaderDefines& defines = ShaderDefines())
 	{
-		// 1. retrieve the vertex/fragment source code from filePath
+		// 1. expand the vertex/fragment source (#include and the given defines) from the mounted asset pack or from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
 		std::string geometryCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-		std::ifstream gShaderFile;
-		// ensure ifstream objects can throw exceptions:
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
-		{
-			// open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-			// if geometry shader path is present, also load a geometry shader
-			if (geometryPath != nullptr)
-			{
-				gShaderFile.open(geometryPath);
-				std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
-			}
-		}
-		catch (std::ifstream::failure& e)
+		if (!PreprocessShader(vertexPath, defines, vertexCode) || !PreprocessShader(fragmentPath, defines, fragmentCode) ||
+			(geometryPath != nullptr && !PreprocessShader(geometryPath, defines, geometryCode)))
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
 		const char* vShaderCode = vertexCode.c_str();
-		const char * fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
+		const char* fShaderCode = fragmentCode.c_str();
+		const char* gShaderCode = geometryCode.c_str();
+		GLint vShaderLength = GLint(vertexCode.size()), fShaderLength = GLint(fragmentCode.size()), gShaderLength = GLint(geometryCode.size());
+		// 2. reuse the program linked on a previous run when the driver accepts its binary
+		const char* sources[] = { vShaderCode, fShaderCode, gShaderCode };
+		const GLint lengths[] = { vShaderLength, fShaderLength, gShaderLength };
+		uint64_t cacheKey = ProgramCacheKey(sources, lengths, geometryPath != nullptr ? 3 : 2);
+		ID = LoadCachedProgram(cacheKey);
+		if (ID != 0)
+		{
+			LightBlock::Attach(ID);
+			ShadowBlock::Attach(ID);
+			reflection.Reflect(ID);
+			return;
+		}
+		// 3. compile shaders
 		unsigned int vertex, fragment;
 		// vertex shader
 		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
+		glShaderSource(vertex, 1, &vShaderCode, &vShaderLength);
 		glCompileShader(vertex);
 		checkCompileErrors(vertex, "VERTEX");
 		// fragment Shader
 		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
+		glShaderSource(fragment, 1, &fShaderCode, &fShaderLength);
 		glCompileShader(fragment);
 		checkCompileErrors(fragment, "FRAGMENT");
 		// if geometry shader is given, compile geometry shader
 		unsigned int geometry;
 		if (geometryPath != nullptr)
 		{
-			const char * gShaderCode = geometryCode.c_str();
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
+			glShaderSource(geometry, 1, &gShaderCode, &gShaderLength);
 			glCompileShader(geometry);
 			checkCompileErrors(geometry, "GEOMETRY");
 		}
 		// shader Program
 		ID = glCreateProgram();
+		PrepareProgramForCache(ID);
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
 		if (geometryPath != nullptr)
 			glAttachShader(ID, geometry);
 		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
+		if (checkCompileErrors(ID, "PROGRAM"))
+			StoreCachedProgram(cacheKey, ID);
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
-
+		// 4. attach the shared light and shadow blocks (if the program uses them) and read the uniform, block and
+		// attribute tables once, so setters never ask GL for a location
+		LightBlock::Attach(ID);
+		ShadowBlock::Attach(ID);
+		reflection.Reflect(ID);
 	}
-	// activate the shader
+	// activate the shader and write the uniforms that changed since the last use()
 	// ------------------------------------------------------------------------
 	void use()
 	{
 		glUseProgram(ID);
+		flush();
 	}
-	// utility uniform functions
+	// write changed uniforms without binding the program; uniform writes reach GL here or in use()
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void flush() const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		reflection.Flush();
 	}
+	// the program's uniforms, blocks and attributes
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	const ProgramReflection& reflect() const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		return reflection;
 	}
+	// utility uniform functions, keyed by ShaderNameId("name"); a constexpr ID costs no hashing at run time
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setBool(uint32_t id, bool value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		GLint v = (int)value;
+		reflection.Set(id, 'i', &v, 1);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setInt(uint32_t id, int value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		reflection.Set(id, 'i', &value, 1);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	// ------------------------------------------------------------------------
+	void setFloat(uint32_t id, float value) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		reflection.Set(id, 'f', &value, 1);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec2(uint32_t id, const glm::vec2 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		reflection.Set(id, 'f', &value[0], 2);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec2(uint32_t id, float x, float y) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setVec2(id, glm::vec2(x, y));
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec3(uint32_t id, const glm::vec3 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		reflection.Set(id, 'f', &value[0], 3);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec3(uint32_t id, float x, float y, float z) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec3(id, glm::vec3(x, y, z));
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setVec4(uint32_t id, const glm::vec4 &value) const
+	{
+		reflection.Set(id, 'f', &value[0], 4);
+	}
+	void setVec4(uint32_t id, float x, float y, float z, float w) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setVec4(id, glm::vec4(x, y, z, w));
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat2(uint32_t id, const glm::mat2 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		reflection.Set(id, 'm', &mat[0][0], 4);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat3(uint32_t id, const glm::mat3 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		reflection.Set(id, 'm', &mat[0][0], 9);
 	}
+	// ------------------------------------------------------------------------
+	void setMat4(uint32_t id, const glm::mat4 &mat) const
+	{
+		reflection.Set(id, 'm', &mat[0][0], 16);
+	}
+	// by name: hashes the name on every call, but still no GL lookup
+	// ------------------------------------------------------------------------
+	void setBool(const std::string &name, bool value) const { setBool(ShaderNameId(name.c_str()), value); }
+	void setInt(const std::string &name, int value) const { setInt(ShaderNameId(name.c_str()), value); }
+	void setFloat(const std::string &name, float value) const { setFloat(ShaderNameId(name.c_str()), value); }
+	void setVec2(const std::string &name, const glm::vec2 &value) const { setVec2(ShaderNameId(name.c_str()), value); }
+	void setVec2(const std::string &name, float x, float y) const { setVec2(ShaderNameId(name.c_str()), x, y); }
+	void setVec3(const std::string &name, const glm::vec3 &value) const { setVec3(ShaderNameId(name.c_str()), value); }
+	void setVec3(const std::string &name, float x, float y, float z) const { setVec3(ShaderNameId(name.c_str()), x, y, z); }
+	void setVec4(const std::string &name, const glm::vec4 &value) const { setVec4(ShaderNameId(name.c_str()), value); }
+	void setVec4(const std::string &name, float x, float y, float z, float w) const { setVec4(ShaderNameId(name.c_str()), x, y, z, w); }
+	void setMat2(const std::string &name, const glm::mat2 &mat) const { setMat2(ShaderNameId(name.c_str()), mat); }
+	void setMat3(const std::string &name, const glm::mat3 &mat) const { setMat3(ShaderNameId(name.c_str()), mat); }
+	void setMat4(const std::string &name, const glm::mat4 &mat) const { setMat4(ShaderNameId(name.c_str()), mat); }
 
 private:
-	// utility function for checking shader compilation/linking errors.
+	// uniform table and shadow values; mutable so the const setters can record writes
+	mutable ProgramReflection reflection;
+	// utility function for checking shader compilation/linking errors; returns true on success.
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	bool checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -187,6 +211,7 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
 	}
 };
 #endif
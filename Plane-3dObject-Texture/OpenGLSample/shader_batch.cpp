@@ -0,0 +1,258 @@
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "light_block.h"
+#include "program_cache.h"
+#include "shadow_block.h"
+#include "shader_batch.h"
+
+// same token for the KHR and ARB versions of the extension
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace
+{
+    typedef void (APIENTRY* MaxShaderCompilerThreadsProc)(GLuint count);
+}
+
+
+ShaderBatch::ShaderBatch() : parallel(false), failures(0), prewarmVao(0)
+{
+    // loaded through GLFW so this works whether or not the GLEW build knows the extension
+    MaxShaderCompilerThreadsProc maxThreads = nullptr;
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        maxThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+
+    if (maxThreads != nullptr)
+    {
+        maxThreads(SHADER_BATCH_COMPILER_THREADS);
+        parallel = true;
+    }
+}
+
+
+ShaderBatch::~ShaderBatch()
+{
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].state != DONE)
+            fail(entries[i]);
+    }
+    if (prewarmVao != 0)
+        glDeleteVertexArrays(1, &prewarmVao);
+}
+
+
+void ShaderBatch::Add(GLuint* programId, const std::string& vertexSource, const std::string& fragmentSource, const std::string& name)
+{
+    Entry entry;
+    entry.id = programId;
+    entry.name = name;
+    entry.vertexSource = vertexSource;
+    entry.fragmentSource = fragmentSource;
+    entry.cacheKey = 0;
+    entry.vertex = 0;
+    entry.fragment = 0;
+    entry.program = 0;
+    entry.state = QUEUED;
+    entries.push_back(entry);
+    *programId = 0;
+}
+
+
+void ShaderBatch::Submit()
+{
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        Entry& entry = entries[i];
+        if (entry.state != QUEUED)
+            continue;
+
+        // a cached binary skips compiling entirely; it only needs the pre-warm draw
+        const char* sources[] = { entry.vertexSource.c_str(), entry.fragmentSource.c_str() };
+        const GLint lengths[] = { GLint(entry.vertexSource.size()), GLint(entry.fragmentSource.size()) };
+        entry.cacheKey = ProgramCacheKey(sources, lengths, 2);
+        entry.program = LoadCachedProgram(entry.cacheKey);
+        if (entry.program != 0)
+        {
+            // block bindings are not part of the binary
+            LightBlock::Attach(entry.program);
+            ShadowBlock::Attach(entry.program);
+            prewarm(entry.program);
+            *entry.id = entry.program;
+            entry.state = DONE;
+            continue;
+        }
+
+        // no status queries here: each one would wait for that compile to finish
+        entry.vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(entry.vertex, 1, &sources[0], &lengths[0]);
+        glCompileShader(entry.vertex);
+
+        entry.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(entry.fragment, 1, &sources[1], &lengths[1]);
+        glCompileShader(entry.fragment);
+
+        entry.state = COMPILING;
+    }
+}
+
+
+bool ShaderBatch::Poll()
+{
+    bool done = true;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        Entry& entry = entries[i];
+        switch (entry.state)
+        {
+        case QUEUED:
+            done = false;
+            break;
+
+        case COMPILING:
+            if (!complete(entry.vertex, false) || !complete(entry.fragment, false))
+            {
+                done = false;
+                break;
+            }
+            if (!checkCompile(entry, entry.vertex, "VERTEX") || !checkCompile(entry, entry.fragment, "FRAGMENT"))
+            {
+                fail(entry);
+                break;
+            }
+
+            entry.program = glCreateProgram();
+            PrepareProgramForCache(entry.program);
+            glAttachShader(entry.program, entry.vertex);
+            glAttachShader(entry.program, entry.fragment);
+            glLinkProgram(entry.program);
+            entry.state = LINKING;
+            done = false;
+            break;
+
+        case LINKING:
+        {
+            if (!complete(entry.program, true))
+            {
+                done = false;
+                break;
+            }
+
+            GLint success = 0;
+            glGetProgramiv(entry.program, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                char infoLog[512];
+                glGetProgramInfoLog(entry.program, sizeof(infoLog), NULL, infoLog);
+                std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED " << entry.name << "\n" << infoLog << std::endl;
+                fail(entry);
+                break;
+            }
+
+            glDetachShader(entry.program, entry.vertex);
+            glDetachShader(entry.program, entry.fragment);
+            glDeleteShader(entry.vertex);
+            glDeleteShader(entry.fragment);
+            entry.vertex = entry.fragment = 0;
+
+            StoreCachedProgram(entry.cacheKey, entry.program);
+            LightBlock::Attach(entry.program);
+            ShadowBlock::Attach(entry.program);
+            prewarm(entry.program);
+            *entry.id = entry.program;
+            entry.state = DONE;
+            break;
+        }
+
+        case DONE:
+            break;
+        }
+    }
+    return done;
+}
+
+
+bool ShaderBatch::Finish()
+{
+    Submit();
+    while (!Poll())
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    return failures == 0;
+}
+
+
+bool ShaderBatch::complete(GLuint object, bool isProgram) const
+{
+    // without the extension every object counts as complete and the status query that follows blocks
+    if (!parallel)
+        return true;
+
+    GLint status = GL_FALSE;
+    if (isProgram)
+        glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &status);
+    else
+        glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &status);
+    return status == GL_TRUE;
+}
+
+
+bool ShaderBatch::checkCompile(Entry& entry, GLuint shader, const char* stage)
+{
+    GLint success = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (success)
+        return true;
+
+    char infoLog[512];
+    glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+    std::cout << "ERROR::SHADER::" << stage << "::COMPILATION_FAILED " << entry.name << "\n" << infoLog << std::endl;
+    return false;
+}
+
+
+// Draws one degenerate triangle with everything scissored away. Drivers finish compiling for the
+// current state on the first draw, so doing it here moves that hitch out of the first real frame.
+void ShaderBatch::prewarm(GLuint program)
+{
+    if (prewarmVao == 0)
+        glGenVertexArrays(1, &prewarmVao);
+
+    GLboolean scissorEnabled = glIsEnabled(GL_SCISSOR_TEST);
+    GLint scissorBox[4];
+    glGetIntegerv(GL_SCISSOR_BOX, scissorBox);
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, 0, 0);
+    glUseProgram(program);
+    glBindVertexArray(prewarmVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    glScissor(scissorBox[0], scissorBox[1], scissorBox[2], scissorBox[3]);
+    if (!scissorEnabled)
+        glDisable(GL_SCISSOR_TEST);
+}
+
+
+void ShaderBatch::fail(Entry& entry)
+{
+    if (entry.vertex != 0)
+        glDeleteShader(entry.vertex);
+    if (entry.fragment != 0)
+        glDeleteShader(entry.fragment);
+    if (entry.program != 0)
+        glDeleteProgram(entry.program);
+    entry.vertex = entry.fragment = entry.program = 0;
+    *entry.id = 0;
+    entry.state = DONE;
+    ++failures;
+}
@@ -0,0 +1,76 @@
+#ifndef SHADER_BATCH_H
+#define SHADER_BATCH_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Default batch values
+const GLuint SHADER_BATCH_COMPILER_THREADS = 0xFFFFFFFFu;  // let the driver pick (GL_KHR_parallel_shader_compile)
+
+
+/* Compiles a set of programs together instead of one blocking compile at a time.
+ *
+ * Submit() issues every compile (or program binary cache load) without asking for a status, so a
+ * driver with GL_KHR_parallel_shader_compile (or the ARB version) works on all of them at once.
+ * Poll() moves each program along without blocking: stages whose GL_COMPLETION_STATUS_KHR is set are
+ * checked and linked, and linked programs are cached and pre-warmed with a draw that touches no
+ * pixels, so the driver's deferred work happens now and not on the program's first real draw.
+ * Without the extension Poll() still links everything before checking any link status.
+ */
+class ShaderBatch
+{
+public:
+    ShaderBatch();
+    ~ShaderBatch();
+
+    // queues a program; *programId receives the linked program (or 0) once the batch is done
+    void Add(GLuint* programId, const std::string& vertexSource, const std::string& fragmentSource, const std::string& name = std::string());
+
+    // issues every queued compile
+    void Submit();
+
+    // advances the batch without waiting on the driver; returns true once every program is done
+    bool Poll();
+
+    // polls until the batch is done; returns true if every program linked
+    bool Finish();
+
+    bool UsingParallelCompile() const { return parallel; }
+    size_t Failures() const { return failures; }
+
+private:
+    enum State
+    {
+        QUEUED,
+        COMPILING,
+        LINKING,
+        DONE
+    };
+
+    struct Entry
+    {
+        GLuint* id;
+        std::string name;
+        std::string vertexSource;
+        std::string fragmentSource;
+        uint64_t cacheKey;
+        GLuint vertex;
+        GLuint fragment;
+        GLuint program;
+        State state;
+    };
+
+    std::vector<Entry> entries;
+    bool parallel;
+    size_t failures;
+    GLuint prewarmVao;
+
+    bool complete(GLuint object, bool isProgram) const;
+    bool checkCompile(Entry& entry, GLuint shader, const char* stage);
+    void prewarm(GLuint program);
+    void fail(Entry& entry);
+};
+#endif
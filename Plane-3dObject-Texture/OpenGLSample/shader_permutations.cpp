@@ -0,0 +1,74 @@
+#include <iostream>
+
+#include "resource_cache.h"
+#include "shader_batch.h"
+#include "shader_permutations.h"
+
+uint64_t ShaderPermutation::Key() const
+{
+    uint64_t key = HashString(NormalizePath(vertexPath));
+    key = HashString(NormalizePath(fragmentPath), key);
+    return HashString(defines.Text(), key);
+}
+
+
+ShaderPermutationCache::~ShaderPermutationCache()
+{
+    Clear();
+}
+
+
+const GLuint* ShaderPermutationCache::Queue(const ShaderPermutation& permutation, ShaderBatch& batch)
+{
+    uint64_t key = permutation.Key();
+    std::unordered_map<uint64_t, GLuint>::iterator found = programs.find(key);
+    if (found != programs.end())
+        return &found->second;
+
+    GLuint& slot = programs[key];
+    slot = 0;
+
+    std::string vertexSource, fragmentSource;
+    if (!PreprocessShader(permutation.vertexPath, permutation.defines, vertexSource) ||
+        !PreprocessShader(permutation.fragmentPath, permutation.defines, fragmentSource))
+    {
+        std::cout << "ERROR::SHADER_PERMUTATION::PREPROCESS_FAILED " << permutation.fragmentPath << std::endl;
+        return &slot;
+    }
+
+    batch.Add(&slot, vertexSource, fragmentSource, permutation.fragmentPath);
+    return &slot;
+}
+
+
+GLuint ShaderPermutationCache::Acquire(const ShaderPermutation& permutation)
+{
+    // built (or failed) before: no second compile
+    std::unordered_map<uint64_t, GLuint>::const_iterator found = programs.find(permutation.Key());
+    if (found != programs.end())
+        return found->second;
+
+    ShaderBatch batch;
+    const GLuint* slot = Queue(permutation, batch);
+    batch.Submit();
+    batch.Finish();
+    return *slot;
+}
+
+
+GLuint ShaderPermutationCache::Find(const ShaderPermutation& permutation) const
+{
+    std::unordered_map<uint64_t, GLuint>::const_iterator found = programs.find(permutation.Key());
+    return found != programs.end() ? found->second : 0;
+}
+
+
+void ShaderPermutationCache::Clear()
+{
+    for (std::unordered_map<uint64_t, GLuint>::iterator it = programs.begin(); it != programs.end(); ++it)
+    {
+        if (it->second != 0)
+            glDeleteProgram(it->second);
+    }
+    programs.clear();
+}
@@ -0,0 +1,68 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "shader_preprocessor.h"
+
+class ShaderBatch;
+
+
+// One specialization of a vertex/fragment pair: which files, and which defines to build them with
+struct ShaderPermutation
+{
+    std::string vertexPath;
+    std::string fragmentPath;
+    ShaderDefines defines;
+
+    ShaderPermutation(const std::string& vertex, const std::string& fragment, const ShaderDefines& values = ShaderDefines())
+        : vertexPath(vertex), fragmentPath(fragment), defines(values)
+    {
+    }
+
+    // the same files with the same defines always give the same key
+    uint64_t Key() const;
+};
+
+
+/* Builds shader permutations on demand and keeps them for the life of the cache.
+ *
+ * Each permutation is run through PreprocessShader() and compiled once; the expanded sources also
+ * key the on-disk program binary cache, so a permutation built on a previous run loads without
+ * compiling. Queue() lets several permutations share a ShaderBatch so the driver compiles them in
+ * parallel; Acquire() builds a single one on the spot.
+ */
+class ShaderPermutationCache
+{
+public:
+    ShaderPermutationCache() {}
+    ~ShaderPermutationCache();
+
+    // adds the permutation to 'batch' unless it is already built or queued; the returned slot holds
+    // the program once the batch is done (0 if it failed) and stays valid until Clear()
+    const GLuint* Queue(const ShaderPermutation& permutation, ShaderBatch& batch);
+
+    // returns the permutation's program, compiling it first if needed (0 if it fails to build; a failed
+    // permutation is not retried until Clear())
+    GLuint Acquire(const ShaderPermutation& permutation);
+
+    // returns the program if the permutation was built already, 0 otherwise; never compiles
+    GLuint Find(const ShaderPermutation& permutation) const;
+
+    // deletes every program the cache built
+    void Clear();
+
+    size_t Size() const { return programs.size(); }
+
+private:
+    // node-based, so slot addresses handed to ShaderBatch survive rehashing
+    std::unordered_map<uint64_t, GLuint> programs;
+
+    ShaderPermutationCache(const ShaderPermutationCache&);
+    ShaderPermutationCache& operator=(const ShaderPermutationCache&);
+};
+#endif
@@ -0,0 +1,214 @@
+#include <iostream>
+#include <set>
+
+#include "asset_pack.h"
+#include "resource_cache.h"
+#include "shader_preprocessor.h"
+
+namespace
+{
+    struct Expansion
+    {
+        bool usePack;
+        std::vector<std::string> files;     // normalized, in the order they were first read
+        std::set<std::string> included;
+        std::string output;
+    };
+
+    std::string directoryOf(const std::string& normalizedPath)
+    {
+        size_t slash = normalizedPath.find_last_of('/');
+        return slash == std::string::npos ? std::string() : normalizedPath.substr(0, slash + 1);
+    }
+
+    bool readText(const std::string& path, bool usePack, std::string& text)
+    {
+        AssetPack* pack = usePack ? MountedAssetPack() : nullptr;
+        AssetView view = pack ? pack->Find(path) : AssetView();
+        if (view.valid() && view.type == ASSET_SHADER)
+        {
+            text.assign(reinterpret_cast<const char*>(view.data), size_t(view.size));
+            return true;
+        }
+
+        std::vector<unsigned char> bytes;
+        if (!ReadFileBytes(path, bytes))
+            return false;
+        text.assign(bytes.begin(), bytes.end());
+        return true;
+    }
+
+    // blanks out // and /* */ comments so directives inside them are not acted on; the newlines in
+    // block comments are kept, so line numbers do not move
+    std::string stripComments(const std::string& text)
+    {
+        std::string stripped;
+        stripped.reserve(text.size());
+        size_t i = 0;
+        while (i < text.size())
+        {
+            if (text.compare(i, 2, "//") == 0)
+            {
+                i = text.find('\n', i);
+                if (i == std::string::npos)
+                    break;
+            }
+            else if (text.compare(i, 2, "/*") == 0)
+            {
+                size_t close = text.find("*/", i + 2);
+                size_t end = close == std::string::npos ? text.size() : close + 2;
+                stripped += ' ';
+                for (; i < end; ++i)
+                {
+                    if (text[i] == '\n')
+                        stripped += '\n';
+                }
+            }
+            else
+                stripped += text[i++];
+        }
+        return stripped;
+    }
+
+    // returns the directive name if the line is a preprocessor directive ("version", "include", ...)
+    std::string directive(const std::string& line, size_t& end)
+    {
+        size_t i = line.find_first_not_of(" \t");
+        if (i == std::string::npos || line[i] != '#')
+            return std::string();
+        i = line.find_first_not_of(" \t", i + 1);
+        if (i == std::string::npos)
+            return std::string();
+        end = line.find_first_of(" \t\"<", i);
+        if (end == std::string::npos)
+            end = line.size();
+        return line.substr(i, end - i);
+    }
+
+    // the file name of an #include line, between quotes or angle brackets
+    bool includeTarget(const std::string& line, size_t from, std::string& target)
+    {
+        size_t open = line.find_first_of("\"<", from);
+        if (open == std::string::npos)
+            return false;
+        size_t close = line.find(line[open] == '"' ? '"' : '>', open + 1);
+        if (close == std::string::npos || close == open + 1)
+            return false;
+        target = line.substr(open + 1, close - open - 1);
+        return true;
+    }
+
+    bool expand(Expansion& state, const std::string& path, const ShaderDefines& defines, int depth)
+    {
+        if (depth > SHADER_MAX_INCLUDE_DEPTH)
+        {
+            std::cout << "ERROR::SHADER_PREPROCESSOR::INCLUDE_TOO_DEEP " << path << std::endl;
+            return false;
+        }
+
+        std::string source;
+        if (!readText(path, state.usePack, source))
+        {
+            std::cout << "ERROR::SHADER_PREPROCESSOR::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+            return false;
+        }
+        std::string text = stripComments(source);
+        state.included.insert(path);
+        const int fileIndex = int(state.files.size());
+        state.files.push_back(path);
+        if (depth > 0)
+            state.output += "#line 1 " + std::to_string(fileIndex) + "\n";
+
+        // the top-level file gets the defines after #version, or before its first other line if it has
+        // none; blank lines, which include the comments stripped above, may come before #version
+        bool definesPending = depth == 0;
+        bool sawVersion = false;
+        int lineNumber = 0;
+        size_t start = 0;
+        while (start < text.size())
+        {
+            size_t newline = text.find('\n', start);
+            size_t next = newline == std::string::npos ? text.size() : newline + 1;
+            std::string line = text.substr(start, next - start);
+            start = next;
+            ++lineNumber;
+
+            size_t end = 0;
+            std::string name = directive(line, end);
+
+            if (definesPending && line.find_first_not_of(" \t\r\n") == std::string::npos)
+            {
+                state.output += line;
+                continue;
+            }
+
+            if (definesPending && name != "version" && !sawVersion)
+            {
+                // no #version: defines go first and the file's lines keep their numbers
+                state.output += defines.Text();
+                state.output += "#line " + std::to_string(lineNumber) + " " + std::to_string(fileIndex) + "\n";
+                definesPending = false;
+            }
+
+            if (name == "version")
+            {
+                if (depth > 0)
+                {
+                    // an included file may carry #version to compile on its own; the top-level one wins
+                    state.output += "\n";
+                    continue;
+                }
+                state.output += line;
+                if (newline == std::string::npos)
+                    state.output += "\n";
+                state.output += defines.Text();
+                state.output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+                definesPending = false;
+                sawVersion = true;
+                continue;
+            }
+
+            if (name == "include")
+            {
+                std::string target;
+                if (!includeTarget(line, end, target))
+                {
+                    std::cout << "ERROR::SHADER_PREPROCESSOR::BAD_INCLUDE " << path << ":" << lineNumber << std::endl;
+                    return false;
+                }
+                std::string resolved = NormalizePath(directoryOf(path) + target);
+                if (state.included.count(resolved) == 0)
+                {
+                    if (!expand(state, resolved, defines, depth + 1))
+                        return false;
+                }
+                // back to the line after the #include
+                state.output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+                continue;
+            }
+
+            state.output += line;
+            if (newline == std::string::npos)
+                state.output += "\n";
+        }
+
+        if (definesPending)
+            state.output += defines.Text();
+        return true;
+    }
+}
+
+
+bool PreprocessShader(const std::string& path, const ShaderDefines& defines, std::string& output,
+    std::vector<std::string>* files, bool usePack)
+{
+    Expansion state;
+    state.usePack = usePack;
+    bool expanded = expand(state, NormalizePath(path), defines, 0);
+    if (files != nullptr)
+        files->swap(state.files);
+    if (!expanded)
+        return false;
+    output.swap(state.output);
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Deepest #include chain before the preprocessor assumes a cycle
+const int SHADER_MAX_INCLUDE_DEPTH = 16;
+
+
+// A set of #defines injected into a shader. Kept sorted so equal sets always produce the same
+// text, and therefore the same permutation and program cache keys.
+class ShaderDefines
+{
+public:
+    ShaderDefines& Set(const std::string& name, const std::string& value = "1")
+    {
+        values[name] = value;
+        return *this;
+    }
+
+    ShaderDefines& Set(const std::string& name, int value)
+    {
+        return Set(name, std::to_string(value));
+    }
+
+    bool Empty() const { return values.empty(); }
+
+    // one "#define NAME VALUE" line per entry
+    std::string Text() const
+    {
+        std::string text;
+        for (std::map<std::string, std::string>::const_iterator it = values.begin(); it != values.end(); ++it)
+            text += "#define " + it->first + " " + it->second + "\n";
+        return text;
+    }
+
+private:
+    std::map<std::string, std::string> values;
+};
+
+
+/* Expands a GLSL file for the compiler.
+ *
+ * - comments are removed first (line breaks inside them are kept), so commented-out directives
+ *   have no effect.
+ * - #include "file" (or <file>) is replaced by that file, resolved relative to the including file;
+ *   each file is included at most once per shader, like #pragma once.
+ * - the defines are injected right after #version, which must stay the first directive; blank
+ *   lines and comments may come before it.
+ * - #line directives keep compiler messages pointing at the right line; the source string number in
+ *   them is the file's index in 'files' (0 is the top-level file).
+ *
+ * Files come from the mounted asset pack when it has them (unless 'usePack' is false, for rebuilds
+ * of edited files), otherwise from disk. 'files' (optional) receives the normalized path of every
+ * file that was read, for callers that watch them for edits.
+ */
+bool PreprocessShader(const std::string& path, const ShaderDefines& defines, std::string& output,
+    std::vector<std::string>* files = nullptr, bool usePack = true);
+
+#endif
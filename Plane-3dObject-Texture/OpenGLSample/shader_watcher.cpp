@@ -0,0 +1,590 @@
+#include <chrono>
+#include <iostream>
+
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "resource_cache.h"
+#include "program_cache.h"
+#include "program_reflection.h"
+#include "shader_preprocessor.h"
+#include "shader_watcher.h"
+
+namespace
+{
+    long long modificationTime(const std::string& path)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return -1;
+        return (long long)info.st_mtime;
+    }
+
+    std::string directoryOf(const std::string& normalizedPath)
+    {
+        size_t slash = normalizedPath.find_last_of('/');
+        if (slash == std::string::npos)
+            return ".";
+        if (slash == 0)
+            return "/";
+        return normalizedPath.substr(0, slash);
+    }
+
+    void copyUniform(GLuint from, GLint fromLocation, GLuint to, GLint toLocation, int components, char kind)
+    {
+        if (kind == 'f' || kind == 'm')
+        {
+            GLfloat value[16];
+            glGetUniformfv(from, fromLocation, value);
+            if (kind == 'm')
+            {
+                if (components == 4)
+                    glProgramUniformMatrix2fv(to, toLocation, 1, GL_FALSE, value);
+                else if (components == 9)
+                    glProgramUniformMatrix3fv(to, toLocation, 1, GL_FALSE, value);
+                else
+                    glProgramUniformMatrix4fv(to, toLocation, 1, GL_FALSE, value);
+            }
+            else if (components == 1)
+                glProgramUniform1fv(to, toLocation, 1, value);
+            else if (components == 2)
+                glProgramUniform2fv(to, toLocation, 1, value);
+            else if (components == 3)
+                glProgramUniform3fv(to, toLocation, 1, value);
+            else
+                glProgramUniform4fv(to, toLocation, 1, value);
+        }
+        else if (kind == 'i')
+        {
+            GLint value[4];
+            glGetUniformiv(from, fromLocation, value);
+            if (components == 1)
+                glProgramUniform1iv(to, toLocation, 1, value);
+            else if (components == 2)
+                glProgramUniform2iv(to, toLocation, 1, value);
+            else if (components == 3)
+                glProgramUniform3iv(to, toLocation, 1, value);
+            else
+                glProgramUniform4iv(to, toLocation, 1, value);
+        }
+        else
+        {
+            GLuint value[4];
+            glGetUniformuiv(from, fromLocation, value);
+            if (components == 1)
+                glProgramUniform1uiv(to, toLocation, 1, value);
+            else if (components == 2)
+                glProgramUniform2uiv(to, toLocation, 1, value);
+            else if (components == 3)
+                glProgramUniform3uiv(to, toLocation, 1, value);
+            else
+                glProgramUniform4uiv(to, toLocation, 1, value);
+        }
+    }
+}
+
+
+FileWatcher::FileWatcher() : inotifyFd(-1), stopping(false)
+{
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0)
+    {
+        thread = std::thread(&FileWatcher::inotifyLoop, this);
+        return;
+    }
+#endif
+    thread = std::thread(&FileWatcher::pollLoop, this);
+}
+
+
+FileWatcher::~FileWatcher()
+{
+    stopping.store(true);
+    thread.join();
+#ifdef __linux__
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+#endif
+}
+
+
+void FileWatcher::Watch(const std::string& path)
+{
+    std::string normalized = NormalizePath(path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!watched.insert(normalized).second)
+        return;
+
+#ifdef __linux__
+    if (inotifyFd >= 0)
+    {
+        std::string directory = directoryOf(normalized);
+        for (size_t i = 0; i < directories.size(); ++i)
+        {
+            if (directories[i].second == directory)
+                return;
+        }
+        int descriptor = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (descriptor < 0)
+            std::cout << "ERROR::FILE_WATCHER::CANNOT_WATCH " << directory << std::endl;
+        else
+            directories.push_back(std::make_pair(descriptor, directory));
+        return;
+    }
+#endif
+    mtimes.push_back(std::make_pair(normalized, modificationTime(normalized)));
+}
+
+
+std::vector<std::string> FileWatcher::TakeChanged()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> paths(changed.begin(), changed.end());
+    changed.clear();
+    return paths;
+}
+
+
+void FileWatcher::inotifyLoop()
+{
+#ifdef __linux__
+    // editors often write a file several times per save; report a burst once it has gone quiet
+    std::set<std::string> settling;
+    std::chrono::steady_clock::time_point lastEvent;
+
+    while (!stopping.load())
+    {
+        struct pollfd descriptor;
+        descriptor.fd = inotifyFd;
+        descriptor.events = POLLIN;
+        descriptor.revents = 0;
+        if (poll(&descriptor, 1, FILE_WATCHER_SETTLE_MS) > 0)
+        {
+            alignas(struct inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (char* p = buffer; p < buffer + length;)
+                {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+                    p += sizeof(struct inotify_event) + event->len;
+                    if (event->len == 0)
+                        continue;
+
+                    for (size_t i = 0; i < directories.size(); ++i)
+                    {
+                        if (directories[i].first != event->wd)
+                            continue;
+                        std::string path = NormalizePath(directories[i].second + "/" + event->name);
+                        if (watched.count(path))
+                        {
+                            settling.insert(path);
+                            lastEvent = std::chrono::steady_clock::now();
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (!settling.empty() && std::chrono::steady_clock::now() - lastEvent >= std::chrono::milliseconds(FILE_WATCHER_SETTLE_MS))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            changed.insert(settling.begin(), settling.end());
+            settling.clear();
+        }
+    }
+#endif
+}
+
+
+void FileWatcher::pollLoop()
+{
+    while (!stopping.load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(FILE_WATCHER_POLL_MS));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < mtimes.size(); ++i)
+        {
+            long long current = modificationTime(mtimes[i].first);
+            if (current != mtimes[i].second)
+            {
+                mtimes[i].second = current;
+                if (current >= 0)
+                    changed.insert(mtimes[i].first);
+            }
+        }
+    }
+}
+
+
+ShaderReloader::ShaderReloader(GLFWwindow* window) : context(nullptr), stopping(false)
+{
+    // a hidden 1x1 window whose context shares programs with the main one; it inherits the
+    // version and profile hints the main window was created with
+    if (window != nullptr)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        context = glfwCreateWindow(1, 1, "shader compiler", NULL, window);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    }
+
+    if (context != nullptr)
+        compiler = std::thread(&ShaderReloader::compileLoop, this);
+    else
+        std::cout << "INFO: No shared context for shader reloads, rebuilding on the render thread" << std::endl;
+}
+
+
+ShaderReloader::~ShaderReloader()
+{
+    Shutdown();
+}
+
+
+void ShaderReloader::Watch(GLuint* programId, const char* vertexPath, const char* fragmentPath, const char* geometryPath,
+                           const ShaderDefines& defines)
+{
+    Program program;
+    program.id = programId;
+    program.defines = defines;
+    program.paths.push_back(NormalizePath(vertexPath));
+    program.paths.push_back(NormalizePath(fragmentPath));
+    if (geometryPath != nullptr)
+        program.paths.push_back(NormalizePath(geometryPath));
+
+    // expand each stage once to learn which files it includes
+    for (size_t i = 0; i < program.paths.size(); ++i)
+    {
+        std::string expanded;
+        std::vector<std::string> files;
+        PreprocessShader(program.paths[i], program.defines, expanded, &files, false);
+        if (files.empty())
+            files.push_back(program.paths[i]);
+        program.files.insert(program.files.end(), files.begin(), files.end());
+    }
+
+    for (size_t i = 0; i < program.files.size(); ++i)
+        watcher.Watch(program.files[i]);
+    programs.push_back(program);
+}
+
+
+void ShaderReloader::Forget(GLuint* programId)
+{
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        if (programs[i].id == programId)
+        {
+            programs.erase(programs.begin() + i);
+            return;
+        }
+    }
+}
+
+
+unsigned ShaderReloader::Update()
+{
+    // queue every program that uses an edited file
+    std::vector<std::string> changed = watcher.TakeChanged();
+    for (size_t i = 0; i < programs.size() && !changed.empty(); ++i)
+    {
+        bool edited = false;
+        for (size_t j = 0; j < programs[i].files.size() && !edited; ++j)
+        {
+            for (size_t k = 0; k < changed.size() && !edited; ++k)
+                edited = programs[i].files[j] == changed[k];
+        }
+        if (!edited)
+            continue;
+
+        if (context != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(programs[i]);
+            wake.notify_one();
+        }
+        else
+        {
+            Rebuilt result;
+            result.id = programs[i].id;
+            result.program = build(programs[i], result.files);
+            std::lock_guard<std::mutex> lock(mutex);
+            rebuilt.push_back(result);
+        }
+    }
+
+    std::deque<Rebuilt> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.swap(rebuilt);
+    }
+
+    unsigned swapped = 0;
+    for (size_t i = 0; i < ready.size(); ++i)
+    {
+        GLuint* id = ready[i].id;
+        GLuint program = ready[i].program;
+
+        Program* registered = nullptr;
+        for (size_t j = 0; j < programs.size() && registered == nullptr; ++j)
+        {
+            if (programs[j].id == id)
+                registered = &programs[j];
+        }
+        if (registered == nullptr)
+        {
+            if (program != 0)
+                glDeleteProgram(program);
+            continue;
+        }
+
+        // follow the #includes as they are now, even if the edit broke the compile
+        if (!ready[i].files.empty())
+        {
+            registered->files = ready[i].files;
+            for (size_t j = 0; j < registered->files.size(); ++j)
+                watcher.Watch(registered->files[j]);
+        }
+
+        if (program == 0)
+        {
+            std::cout << "INFO: Shader reload failed, keeping the previous program" << std::endl;
+            continue;
+        }
+
+        // carry the old program's state over, then swap; a bound program is rebound so the draw that follows uses it
+        GLuint previous = *id;
+        copyState(previous, program);
+        GLint current = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+        *id = program;
+        if (GLuint(current) == previous)
+            glUseProgram(program);
+        glDeleteProgram(previous);
+        ++swapped;
+    }
+
+    if (swapped > 0)
+        std::cout << "INFO: Reloaded " << swapped << " shader program(s)" << std::endl;
+    return swapped;
+}
+
+
+void ShaderReloader::Shutdown()
+{
+    if (compiler.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        compiler.join();
+    }
+
+    for (size_t i = 0; i < rebuilt.size(); ++i)
+    {
+        if (rebuilt[i].program != 0)
+            glDeleteProgram(rebuilt[i].program);
+    }
+    rebuilt.clear();
+    queued.clear();
+
+    if (context != nullptr)
+    {
+        glfwDestroyWindow(context);
+        context = nullptr;
+    }
+}
+
+
+void ShaderReloader::compileLoop()
+{
+    glfwMakeContextCurrent(context);
+
+    for (;;)
+    {
+        Program program;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !queued.empty(); });
+            if (stopping)
+                break;
+            program = queued.front();
+            queued.pop_front();
+        }
+
+        Rebuilt result;
+        result.id = program.id;
+        result.program = build(program, result.files);
+        // the program object must be complete before another context uses it
+        glFinish();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        rebuilt.push_back(result);
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+
+GLuint ShaderReloader::build(const Program& program, std::vector<std::string>& files)
+{
+    static const GLenum STAGES[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+
+    // always the files on disk: the mounted pack still holds the text from before the edit
+    std::vector<std::string> texts(program.paths.size());
+    std::vector<const char*> sources(program.paths.size());
+    std::vector<GLint> lengths(program.paths.size());
+    files.clear();
+    for (size_t i = 0; i < program.paths.size(); ++i)
+    {
+        std::vector<std::string> stageFiles;
+        bool expanded = PreprocessShader(program.paths[i], program.defines, texts[i], &stageFiles, false);
+        files.insert(files.end(), stageFiles.begin(), stageFiles.end());
+        if (!expanded || texts[i].empty())
+        {
+            std::cout << "ERROR::SHADER_RELOAD::FILE_NOT_SUCCESFULLY_READ " << program.paths[i] << std::endl;
+            // a partial list would stop watching files the program still uses
+            files.clear();
+            return 0;
+        }
+        sources[i] = texts[i].c_str();
+        lengths[i] = GLint(texts[i].size());
+    }
+
+    GLuint id = glCreateProgram();
+    PrepareProgramForCache(id);
+    std::vector<GLuint> shaders;
+    bool compiled = true;
+    char infoLog[1024];
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        GLuint shader = glCreateShader(STAGES[i]);
+        glShaderSource(shader, 1, &sources[i], &lengths[i]);
+        glCompileShader(shader);
+
+        GLint success = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+            std::cout << "ERROR::SHADER_RELOAD::COMPILATION_FAILED " << program.paths[i] << "\n" << infoLog << std::endl;
+            compiled = false;
+        }
+        glAttachShader(id, shader);
+        shaders.push_back(shader);
+    }
+
+    GLint linked = GL_FALSE;
+    if (compiled)
+    {
+        glLinkProgram(id);
+        glGetProgramiv(id, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            glGetProgramInfoLog(id, sizeof(infoLog), NULL, infoLog);
+            std::cout << "ERROR::SHADER_RELOAD::LINKING_FAILED\n" << infoLog << std::endl;
+        }
+    }
+
+    for (size_t i = 0; i < shaders.size(); ++i)
+    {
+        glDetachShader(id, shaders[i]);
+        glDeleteShader(shaders[i]);
+    }
+
+    if (!linked)
+    {
+        glDeleteProgram(id);
+        return 0;
+    }
+
+    // the next launch starts from the edited program without compiling it
+    StoreCachedProgram(ProgramCacheKey(sources.data(), lengths.data(), int(sources.size())), id);
+    return id;
+}
+
+
+void ShaderReloader::copyState(GLuint from, GLuint to)
+{
+    // default-block uniforms whose name and type survived the edit keep their values
+    GLint count = 0;
+    glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        char name[256];
+        GLsizei nameLength = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(from, GLuint(i), sizeof(name), &nameLength, &size, &type, name);
+
+        int components;
+        char kind;
+        if (!UniformShape(type, components, kind))
+            continue;
+
+        GLuint toIndex = GL_INVALID_INDEX;
+        const char* names[] = { name };
+        glGetUniformIndices(to, 1, names, &toIndex);
+        if (toIndex == GL_INVALID_INDEX)
+            continue;
+        GLint toType = 0;
+        glGetActiveUniformsiv(to, 1, &toIndex, GL_UNIFORM_TYPE, &toType);
+        if (GLenum(toType) != type)
+            continue;
+
+        // arrays are reported as "name[0]"; copy them element by element
+        std::string base(name, nameLength);
+        if (size > 1 && base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0)
+            base.erase(base.size() - 3);
+        for (GLint element = 0; element < size; ++element)
+        {
+            std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+            GLint fromLocation = glGetUniformLocation(from, elementName.c_str());
+            GLint toLocation = glGetUniformLocation(to, elementName.c_str());
+            if (fromLocation >= 0 && toLocation >= 0)
+                copyUniform(from, fromLocation, to, toLocation, components, kind);
+        }
+    }
+
+    // uniform block bindings
+    glGetProgramiv(from, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        char name[256];
+        glGetActiveUniformBlockName(from, GLuint(i), sizeof(name), NULL, name);
+        GLint binding = 0;
+        glGetActiveUniformBlockiv(from, GLuint(i), GL_UNIFORM_BLOCK_BINDING, &binding);
+        GLuint index = glGetUniformBlockIndex(to, name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(to, index, GLuint(binding));
+    }
+
+    // shader storage block bindings
+    count = 0;
+    glGetProgramInterfaceiv(from, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        char name[256];
+        glGetProgramResourceName(from, GL_SHADER_STORAGE_BLOCK, GLuint(i), sizeof(name), NULL, name);
+        const GLenum property = GL_BUFFER_BINDING;
+        GLint binding = 0;
+        glGetProgramResourceiv(from, GL_SHADER_STORAGE_BLOCK, GLuint(i), 1, &property, 1, NULL, &binding);
+        GLuint index = glGetProgramResourceIndex(to, GL_SHADER_STORAGE_BLOCK, name);
+        if (index != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(to, index, GLuint(binding));
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shader_preprocessor.h"
+
+struct GLFWwindow;
+
+// Default watcher values
+const int FILE_WATCHER_POLL_MS = 250;       // mtime polling interval where inotify is unavailable
+const int FILE_WATCHER_SETTLE_MS = 50;      // quiet time before a burst of saves is reported
+
+
+// Reports files that changed on disk. On Linux the directories holding the watched files are
+// watched with inotify (close-after-write and rename-into, which covers editors that save through a
+// temporary file); elsewhere a thread polls modification times.
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    void Watch(const std::string& path);
+
+    // returns (and clears) the normalized paths of watched files that changed since the last call
+    std::vector<std::string> TakeChanged();
+
+    bool UsingInotify() const { return inotifyFd >= 0; }
+
+private:
+    std::mutex mutex;
+    std::set<std::string> watched;          // normalized file paths
+    std::set<std::string> changed;
+    std::vector<std::pair<int, std::string> > directories;   // inotify watch descriptor, directory
+    std::vector<std::pair<std::string, long long> > mtimes;  // polling fallback
+    int inotifyFd;
+    std::atomic<bool> stopping;
+    std::thread thread;
+
+    void inotifyLoop();
+    void pollLoop();
+};
+
+
+/* Rebuilds programs whose source files change while the app runs.
+ *
+ * Update() (render thread, once per frame) hands edited programs to a compile thread that owns a
+ * hidden GL context sharing objects with the main window, so compiling and linking never stall a
+ * frame. A rebuilt program is swapped in on the next Update() only if it linked; its uniform values,
+ * sampler units and uniform/storage block bindings are copied over from the program it replaces.
+ * If no shared context can be created, the rebuild happens inside Update() instead.
+ */
+class ShaderReloader
+{
+public:
+    explicit ShaderReloader(GLFWwindow* window);
+    ~ShaderReloader();
+
+    // watches the stage files (and the files they #include) of the program whose name is stored in
+    // *programId; a swap rewrites *programId. Rebuilds expand the stages with 'defines', so a program
+    // built from a permutation keeps them
+    void Watch(GLuint* programId, const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+               const ShaderDefines& defines = ShaderDefines());
+    void Forget(GLuint* programId);
+
+    // render thread: queues rebuilds for edited programs and swaps in the ones that linked; returns the swap count
+    unsigned Update();
+
+    // main thread: stops the compile thread and destroys its context
+    void Shutdown();
+
+    bool CompilesInBackground() const { return context != nullptr; }
+
+private:
+    struct Program
+    {
+        GLuint* id;
+        std::vector<std::string> paths;   // vertex, fragment[, geometry]
+        ShaderDefines defines;            // injected into every stage, as when the program was first built
+        std::vector<std::string> files;   // every file the stages read, #includes too
+    };
+
+    struct Rebuilt
+    {
+        GLuint* id;
+        GLuint program;                   // 0 if the rebuild failed
+        std::vector<std::string> files;   // files the rebuild read, to follow added or removed #includes
+    };
+
+    FileWatcher watcher;
+    std::vector<Program> programs;
+
+    GLFWwindow* context;                  // hidden window sharing the main context, owned by the compile thread
+    std::thread compiler;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Program> queued;
+    std::deque<Rebuilt> rebuilt;
+    bool stopping;
+
+    void compileLoop();
+    static GLuint build(const Program& program, std::vector<std::string>& files);
+    static void copyState(GLuint from, GLuint to);
+
+    ShaderReloader(const ShaderReloader&);
+    ShaderReloader& operator=(const ShaderReloader&);
+};
+#endif
@@ -0,0 +1,62 @@
+#version 430 core
+out vec4 FragColor;
+
+// Clustered variant of 6.multiple_lights.fs: each fragment shades only the point lights
+// ClusterLighting assigned to its cluster, so thousands of ranged lights stay affordable.
+#ifndef HAS_SPECULAR_MAP
+#define HAS_SPECULAR_MAP 1
+#endif
+#ifndef HAS_SHADOWS
+#define HAS_SHADOWS 0
+#endif
+
+#include "lights.glsl"
+#if HAS_SHADOWS
+#include "shadows.glsl"
+#endif
+#include "clusters.glsl"
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+}; 
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform vec3 viewPos;
+uniform Material material;
+
+void main()
+{    
+    // properties
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(viewPos - FragPos);
+    // sample the material once for every light
+    vec3 albedo = vec3(texture(material.diffuse, TexCoords));
+#if HAS_SPECULAR_MAP
+    vec3 specularColor = vec3(texture(material.specular, TexCoords));
+#else
+    vec3 specularColor = vec3(0.5);
+#endif
+
+    // phase 1: directional lighting
+#if HAS_SHADOWS
+    float shadow = CalcDirShadow(FragPos, norm);
+#else
+    float shadow = 1.0;
+#endif
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, albedo, specularColor, material.shininess, shadow);
+    // phase 2: the point lights listed for this fragment's cluster
+    uvec2 range = clusterRanges[ClusterIndex(gl_FragCoord)];
+    for(uint i = 0u; i < range.y; i++)
+        result += CalcPointLight(clusterLights[clusterLightIndices[range.x + i]], norm, FragPos, viewDir, albedo, specularColor, material.shininess);
+    // phase 3: spot light
+#if SHADING_LOD < 2
+    result += CalcSpotLight(spotLight, norm, FragPos, viewDir, albedo, specularColor, material.shininess);    
+#endif
+    
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,35 @@
+// Clustered light lists written by ClusterLighting (cluster_lighting.h). Needs #version 430 for the
+// storage buffers; include after lights.glsl, which declares PointLight.
+
+layout(std140, binding = 1) uniform ClusterBlock {
+    uvec4 clusterGrid;          // x, y, z
+    vec4 clusterDepth;          // near, far, slice scale, slice bias
+    vec4 clusterScreen;         // width, height, 1 / width, 1 / height
+};
+
+layout(std430, binding = 1) readonly buffer ClusterLights {
+    PointLight clusterLights[];
+};
+
+layout(std430, binding = 2) readonly buffer ClusterGrid {
+    uvec2 clusterRanges[];      // first index, count
+};
+
+layout(std430, binding = 3) readonly buffer ClusterIndices {
+    uint clusterLightIndices[];
+};
+
+// index of the cluster holding this fragment
+uint ClusterIndex(vec4 fragCoord)
+{
+    // window depth back to the distance along -z
+    float zNear = clusterDepth.x;
+    float zFar = clusterDepth.y;
+    float ndcDepth = fragCoord.z * 2.0 - 1.0;
+    float depth = 2.0 * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+
+    uvec3 cell;
+    cell.xy = uvec2(clamp(fragCoord.xy * clusterScreen.zw * vec2(clusterGrid.xy), vec2(0.0), vec2(clusterGrid.xy) - 1.0));
+    cell.z = uint(clamp(floor(log(depth) * clusterDepth.z + clusterDepth.w), 0.0, float(clusterGrid.z) - 1.0));
+    return (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x;
+}
@@ -0,0 +1,8 @@
+#version 430 core
+
+// One triangle covering the screen, built from gl_VertexID; draw 3 vertices with no buffers bound.
+void main()
+{
+    vec2 position = vec2(float((gl_VertexID & 1) << 2), float((gl_VertexID & 2) << 1)) - 1.0;
+    gl_Position = vec4(position, 1.0, 1.0);
+}
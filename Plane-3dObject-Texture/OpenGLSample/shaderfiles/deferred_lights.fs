@@ -0,0 +1,51 @@
+#version 430 core
+out vec4 FragColor;
+
+// Full-screen lighting pass of the deferred path. Always shades the directional and spot light;
+// with DEFERRED_TILED it also shades the point lights ClusterLighting listed for the pixel's cluster,
+// otherwise deferred_volume.fs adds them afterwards.
+#ifndef DEFERRED_TILED
+#define DEFERRED_TILED 0
+#endif
+#ifndef HAS_SHADOWS
+#define HAS_SHADOWS 0
+#endif
+#define GBUFFER_READ
+
+#include "lights.glsl"
+#include "gbuffer.glsl"
+#if HAS_SHADOWS
+#include "shadows.glsl"
+#endif
+#if DEFERRED_TILED
+#include "clusters.glsl"
+#endif
+
+uniform vec3 viewPos;
+
+void main()
+{
+    Surface surface;
+    if (!ReadGBuffer(gl_FragCoord, surface))
+        discard;
+    vec3 viewDir = normalize(viewPos - surface.position);
+
+#if HAS_SHADOWS
+    float shadow = CalcDirShadow(surface.position, surface.normal);
+#else
+    float shadow = 1.0;
+#endif
+    vec3 result = CalcDirLight(dirLight, surface.normal, viewDir, surface.albedo, surface.specular, surface.shininess, shadow);
+#if SHADING_LOD < 2
+    result += CalcSpotLight(spotLight, surface.normal, surface.position, viewDir, surface.albedo, surface.specular, surface.shininess);
+#endif
+#if DEFERRED_TILED
+    // the cluster lookup wants the fragment's own depth, which is the G-buffer's
+    vec4 fragCoord = vec4(gl_FragCoord.xy, texelFetch(gDepth, ivec2(gl_FragCoord.xy), 0).r, 1.0);
+    uvec2 range = clusterRanges[ClusterIndex(fragCoord)];
+    for(uint i = 0u; i < range.y; i++)
+        result += CalcPointLight(clusterLights[clusterLightIndices[range.x + i]], surface.normal, surface.position, viewDir, surface.albedo, surface.specular, surface.shininess);
+#endif
+
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,26 @@
+#version 430 core
+out vec4 FragColor;
+
+// Adds one point light to the pixels its volume covers; blended additively over deferred_lights.fs.
+#define GBUFFER_READ
+
+#include "lights.glsl"
+#include "gbuffer.glsl"
+
+layout(std430, binding = 4) readonly buffer DeferredLights {
+    PointLight deferredLights[];
+};
+
+uniform vec3 viewPos;
+
+flat in int lightIndex;
+
+void main()
+{
+    Surface surface;
+    if (!ReadGBuffer(gl_FragCoord, surface))
+        discard;
+    vec3 viewDir = normalize(viewPos - surface.position);
+
+    FragColor = vec4(CalcPointLight(deferredLights[lightIndex], surface.normal, surface.position, viewDir, surface.albedo, surface.specular, surface.shininess), 1.0);
+}
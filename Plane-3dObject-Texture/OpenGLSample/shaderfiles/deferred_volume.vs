@@ -0,0 +1,22 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+
+// Light volume pass of the deferred path: one instance of a unit sphere per point light, scaled to
+// the light's range.
+#include "lights.glsl"
+
+layout(std430, binding = 4) readonly buffer DeferredLights {
+    PointLight deferredLights[];
+};
+
+uniform mat4 viewProjection;
+uniform float volumeScale;      // grows the sphere so its flat faces still enclose the range
+
+flat out int lightIndex;
+
+void main()
+{
+    PointLight light = deferredLights[gl_InstanceID];
+    lightIndex = gl_InstanceID;
+    gl_Position = viewProjection * vec4(light.position + aPos * light.radius * volumeScale, 1.0);
+}
@@ -0,0 +1,6 @@
+#version 440 core
+
+// Depth prepass: scene.vs writes the depth the shading pass tests for equality; no color is written.
+void main()
+{
+}
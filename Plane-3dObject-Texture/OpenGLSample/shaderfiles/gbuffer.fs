@@ -0,0 +1,35 @@
+#version 330 core
+layout (location = 0) out vec4 gAlbedoSpec;
+layout (location = 1) out vec4 gNormalShininess;
+
+// Geometry pass of the deferred path: writes the material into the G-buffer instead of lighting it.
+// Pairs with 6.multiple_lights.vs.
+#ifndef HAS_SPECULAR_MAP
+#define HAS_SPECULAR_MAP 1
+#endif
+
+#include "gbuffer.glsl"
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    float shininess;
+}; 
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+
+void main()
+{
+    gAlbedoSpec.rgb = texture(material.diffuse, TexCoords).rgb;
+#if HAS_SPECULAR_MAP
+    // one intensity instead of a specular color keeps the target at 32 bits
+    gAlbedoSpec.a = texture(material.specular, TexCoords).r;
+#else
+    gAlbedoSpec.a = 0.5;
+#endif
+    gNormalShininess = vec4(EncodeNormal(normalize(Normal)), EncodeShininess(material.shininess), 0.0);
+}
@@ -0,0 +1,77 @@
+// Compact G-buffer layout shared by gbuffer.fs and the deferred lighting passes (deferred_renderer.h).
+//   target 0  RGBA8      albedo.rgb, specular intensity
+//   target 1  RGB10_A2   octahedral normal .xy, log2 shininess / 10 .z
+//   depth     DEPTH24    world position is rebuilt from it, nothing stores it
+
+// folds the lower hemisphere of an octahedral normal over the upper one
+vec2 OctWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// unit normal to two [0, 1] values
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+    return e * 0.5 + 0.5;
+}
+
+vec3 DecodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// shininess 1 to 1024 in one channel, with the precision where the highlights change most
+float EncodeShininess(float shininess)
+{
+    return clamp(log2(max(shininess, 1.0)) / 10.0, 0.0, 1.0);
+}
+
+float DecodeShininess(float e)
+{
+    return exp2(e * 10.0);
+}
+
+#ifdef GBUFFER_READ
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormalShininess;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 inverseScreenSize;
+
+struct Surface {
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    vec3 specular;
+    float shininess;
+};
+
+// unpacks the pixel under fragCoord; false where nothing was drawn
+bool ReadGBuffer(vec4 fragCoord, out Surface surface)
+{
+    ivec2 pixel = ivec2(fragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth >= 1.0)
+        return false;
+
+    vec4 albedoSpec = texelFetch(gAlbedoSpec, pixel, 0);
+    vec4 normalShininess = texelFetch(gNormalShininess, pixel, 0);
+    // window position and depth back through the inverse view-projection
+    vec4 ndc = vec4(fragCoord.xy * inverseScreenSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = inverseViewProjection * ndc;
+
+    surface.position = world.xyz / world.w;
+    surface.normal = DecodeNormal(normalShininess.xy);
+    surface.albedo = albedoSpec.rgb;
+    surface.specular = vec3(albedoSpec.a);
+    surface.shininess = DecodeShininess(normalShininess.z);
+    return true;
+}
+#endif
@@ -0,0 +1,121 @@
+// Light types and their shading functions, shared by the lit fragment shaders through #include.
+// SHADING_LOD trades quality for speed: 0 shades every term, 1 drops specular highlights,
+// 2 also drops the spot light (see 6.multiple_lights.fs).
+#ifndef SHADING_LOD
+#define SHADING_LOD 0
+#endif
+
+// Every light lives in one std140 block shared by all lit programs (light_block.h mirrors it in C++,
+// fields are ordered so each float fills the slot after a vec3). MAX_POINT_LIGHTS must match
+// LIGHT_BLOCK_MAX_POINT_LIGHTS.
+#define MAX_POINT_LIGHTS 16
+
+struct DirLight {
+    vec3 direction;
+	
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+    float radius;       // range cutoff; 0 lights everything
+};
+
+struct SpotLight {
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;
+    float quadratic;
+};
+
+layout(std140) uniform LightBlock {
+    DirLight dirLight;
+    SpotLight spotLight;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+    int pointLightCount;
+};
+
+// specular shading
+float CalcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir, float shininess)
+{
+#if SHADING_LOD >= 1
+    return 0.0;
+#else
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+#endif
+}
+
+// calculates the color when using a directional light; 'shadow' scales all but the ambient term
+// (1 when unshadowed, see CalcDirShadow() in shadows.glsl).
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor, float shininess, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir, shininess);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
+    return ambient + (diffuse + specular) * shadow;
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor, float shininess)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir, shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // fade to exactly zero at the range cutoff, so culling a light outside it changes nothing
+    if (light.radius > 0.0)
+    {
+        float ratio = distance / light.radius;
+        float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        attenuation *= window * window;
+    }
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+// calculates the color when using a spot light.
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor, float shininess)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = CalcSpecular(lightDir, normal, viewDir, shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction)); 
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularColor;
+    return (ambient + diffuse + specular) * attenuation * intensity;
+}
@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth is all the shadow pass writes.
+void main()
+{
+}
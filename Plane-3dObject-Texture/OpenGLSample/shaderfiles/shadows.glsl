@@ -0,0 +1,40 @@
+// Cascaded shadows of the directional light, rendered by ShadowCascades (shadow_cascades.h).
+// shadow_block.h mirrors ShadowBlock; SHADOW_CASCADE_COUNT must match.
+#define SHADOW_CASCADE_COUNT 4
+
+layout(std140) uniform ShadowBlock {
+    mat4 shadowMatrices[SHADOW_CASCADE_COUNT];  // world to light clip space
+    vec4 shadowSplits;                          // far distance of each cascade
+    vec4 shadowTexelSize;                       // world units per texel of each cascade
+    vec4 shadowViewDepth;                       // dot with a world position gives its camera depth
+};
+
+uniform sampler2DArrayShadow shadowMap;
+
+// 1 where the directional light reaches worldPos, 0 in full shadow
+float CalcDirShadow(vec3 worldPos, vec3 normal)
+{
+    float depth = dot(shadowViewDepth, vec4(worldPos, 1.0));
+    if (depth > shadowSplits[SHADOW_CASCADE_COUNT - 1])
+        return 1.0;
+    int cascade = 0;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT - 1; ++i)
+    {
+        if (depth > shadowSplits[i])
+            cascade = i + 1;
+    }
+
+    // push the lookup off the surface by about a texel of this cascade to avoid acne
+    vec3 offsetPos = worldPos + normal * shadowTexelSize[cascade] * 1.5;
+    vec3 coords = (shadowMatrices[cascade] * vec4(offsetPos, 1.0)).xyz * 0.5 + 0.5;
+
+    // four taps, each already a bilinear comparison in hardware
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int y = 0; y < 2; ++y)
+    {
+        for (int x = 0; x < 2; ++x)
+            lit += texture(shadowMap, vec4(coords.xy + (vec2(x, y) - 0.5) * texel, float(cascade), coords.z));
+    }
+    return lit * 0.25;
+}
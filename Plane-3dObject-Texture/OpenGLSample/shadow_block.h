@@ -0,0 +1,112 @@
+#ifndef SHADOW_BLOCK_H
+#define SHADOW_BLOCK_H
+
+// Include after the GL loader (GLEW or glad); like program_cache.h this header only uses its types.
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+/* std140 uniform block describing the directional light's shadow cascades
+ *
+ * layout(std140) uniform ShadowBlock {                   offset
+ *     mat4 shadowMatrices[SHADOW_CASCADE_COUNT];          0
+ *     vec4 shadowSplits;                                  256   far distance of each cascade
+ *     vec4 shadowTexelSize;                               272   world units per texel of each cascade
+ *     vec4 shadowViewDepth;                               288   camera view matrix row giving -depth
+ * };
+ *
+ * Mirrors shaderfiles/shadows.glsl, which samples the cascades through the sampler2DArrayShadow
+ * "shadowMap" on texture unit SHADOW_MAP_UNIT.
+ */
+
+const GLuint SHADOW_BLOCK_BINDING = 2;              // uniform buffer binding; 0 is the LightBlock, 1 the ClusterBlock
+const int SHADOW_CASCADE_COUNT = 4;                 // must match SHADOW_CASCADE_COUNT in shadows.glsl
+const GLint SHADOW_MAP_UNIT = 8;                    // texture unit the cascade array is bound to
+const char* const SHADOW_BLOCK_NAME = "ShadowBlock";
+const char* const SHADOW_MAP_NAME = "shadowMap";
+
+struct ShadowBlockData
+{
+    glm::mat4 matrices[SHADOW_CASCADE_COUNT];       // world to light clip space
+    glm::vec4 splits;
+    glm::vec4 texelSize;
+    glm::vec4 viewDepth;
+};
+
+static_assert(sizeof(glm::mat4) == 64, "glm::mat4 must be tightly packed to mirror std140");
+static_assert(offsetof(ShadowBlockData, splits) == 64 * SHADOW_CASCADE_COUNT, "ShadowBlock.shadowSplits offset");
+static_assert(sizeof(ShadowBlockData) == 64 * SHADOW_CASCADE_COUNT + 48, "ShadowBlock does not match its std140 layout");
+
+
+// Owns the shadow uniform buffer; written by ShadowCascades, read by every program including shadows.glsl
+class ShadowBlock
+{
+public:
+    ShadowBlock() : buffer(0)
+    {
+        memset(static_cast<void*>(&data), 0, sizeof(data));
+    }
+
+    ~ShadowBlock()
+    {
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+    }
+
+    // writes the block if it changed and binds it
+    void Upload(const ShadowBlockData& next)
+    {
+        if (buffer == 0)
+        {
+            data = next;
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(data), &data, GL_DYNAMIC_DRAW);
+        }
+        else if (memcmp(&data, &next, sizeof(data)) != 0)
+        {
+            data = next;
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+        }
+        Bind();
+    }
+
+    void Bind() const
+    {
+        glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_BLOCK_BINDING, buffer);
+    }
+
+    const ShadowBlockData& Data() const { return data; }
+
+    // points a program's ShadowBlock at SHADOW_BLOCK_BINDING and its shadowMap at SHADOW_MAP_UNIT;
+    // returns false if the program samples no shadows
+    static bool Attach(GLuint program)
+    {
+        GLuint index = glGetUniformBlockIndex(program, SHADOW_BLOCK_NAME);
+        if (index == GL_INVALID_INDEX)
+            return false;
+
+        GLint size = 0;
+        glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        if (size > GLint(sizeof(ShadowBlockData)))
+            std::cout << "ERROR::SHADOW_BLOCK::SIZE_MISMATCH " << size << " != " << sizeof(ShadowBlockData) << std::endl;
+        glUniformBlockBinding(program, index, SHADOW_BLOCK_BINDING);
+
+        GLint location = glGetUniformLocation(program, SHADOW_MAP_NAME);
+        if (location >= 0)
+            glProgramUniform1i(program, location, SHADOW_MAP_UNIT);
+        return true;
+    }
+
+private:
+    GLuint buffer;
+    ShadowBlockData data;
+
+    ShadowBlock(const ShadowBlock&);
+    ShadowBlock& operator=(const ShadowBlock&);
+};
+#endif
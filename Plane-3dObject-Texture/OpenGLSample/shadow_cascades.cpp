@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shader_permutations.h"
+#include "shadow_cascades.h"
+
+namespace
+{
+    const char* const DEPTH_VERTEX_SHADER = "shaderfiles/shadow_depth.vs";
+    const char* const DEPTH_FRAGMENT_SHADER = "shaderfiles/shadow_depth.fs";
+
+    constexpr uint32_t UNIFORM_LIGHT_VIEW_PROJECTION = ShaderNameId("lightViewProjection");
+    constexpr uint32_t UNIFORM_MODEL = ShaderNameId("model");
+
+    // light directions closer than this (cosine) keep the cached cascades
+    const float LIGHT_DIRECTION_TOLERANCE = 0.999999f;
+}
+
+
+bool CreateShadowMesh(ShadowMesh& mesh, const GLfloat* vertices, size_t vertexCount, size_t stride,
+                      const GLushort* indices, size_t indexCount)
+{
+    if (vertices == NULL || vertexCount == 0 || stride < 3)
+        return false;
+
+    std::vector<GLfloat> positions(vertexCount * 3);
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        positions[i * 3 + 0] = vertices[i * stride + 0];
+        positions[i * 3 + 1] = vertices[i * stride + 1];
+        positions[i * 3 + 2] = vertices[i * stride + 2];
+    }
+
+    DestroyShadowMesh(mesh);
+    glGenVertexArrays(1, &mesh.vao);
+    glBindVertexArray(mesh.vao);
+    glGenBuffers(indices != NULL ? 2 : 1, mesh.buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(positions.size() * sizeof(GLfloat)), positions.data(), GL_STATIC_DRAW);
+    if (indices != NULL)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.buffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(indexCount * sizeof(GLushort)), indices, GL_STATIC_DRAW);
+    }
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    mesh.count = GLsizei(indices != NULL ? indexCount : vertexCount);
+    return true;
+}
+
+
+void DestroyShadowMesh(ShadowMesh& mesh)
+{
+    if (mesh.vao != 0)
+        glDeleteVertexArrays(1, &mesh.vao);
+    if (mesh.buffers[0] != 0)
+        glDeleteBuffers(mesh.buffers[1] != 0 ? 2 : 1, mesh.buffers);
+    mesh = ShadowMesh();
+}
+
+
+ShadowCascades::ShadowCascades()
+    : tanHalfFov(0.0f), aspectRatio(0.0f), zNear(0.0f), zFar(0.0f), lightDirection(0.0f, -1.0f, 0.0f),
+      program(0), framebuffer(0), staticRenders(0), dynamicDraws(0)
+{
+    maps[0] = maps[1] = 0;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; ++i)
+    {
+        Cascade& cascade = cascades[i];
+        cascade.nearDistance = cascade.farDistance = 0.0f;
+        cascade.radius = cascade.extent = cascade.sphereDepth = 0.0f;
+        cascade.center = glm::vec3(0.0f);
+        cascade.viewProjection = glm::mat4(1.0f);
+        cascade.staticValid = false;
+        cascade.dynamicDrawn = false;
+    }
+    memset(static_cast<void*>(&blockData), 0, sizeof(blockData));
+    lightRotation = glm::lookAt(glm::vec3(0.0f), lightDirection, glm::vec3(1.0f, 0.0f, 0.0f));
+}
+
+
+ShadowCascades::~ShadowCascades()
+{
+    if (framebuffer != 0)
+        glDeleteFramebuffers(1, &framebuffer);
+    if (maps[0] != 0)
+        glDeleteTextures(2, maps);
+    // the program belongs to the permutation cache
+}
+
+
+bool ShadowCascades::Create(ShaderPermutationCache& shaders)
+{
+    program = shaders.Acquire(ShaderPermutation(DEPTH_VERTEX_SHADER, DEPTH_FRAGMENT_SHADER));
+    uniforms.Reflect(program);
+    if (program == 0)
+    {
+        std::cout << "ERROR::SHADOW::DEPTH_PROGRAM_FAILED" << std::endl;
+        return false;
+    }
+
+    if (maps[0] == 0)
+    {
+        glGenTextures(2, maps);
+        for (int i = 0; i < 2; ++i)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, maps[i]);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADE_COUNT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+
+        // the sampled array compares in hardware; outside a cascade counts as lit
+        const GLfloat border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glBindTexture(GL_TEXTURE_2D_ARRAY, maps[0]);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    if (framebuffer == 0)
+    {
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, maps[1], 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::SHADOW::FRAMEBUFFER_INCOMPLETE 0x" << std::hex << status << std::dec << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void ShadowCascades::SetProjection(float fovYRadians, float aspect, float nearPlane, float farPlane)
+{
+    float tangent = tanf(fovYRadians * 0.5f);
+    if (tangent == tanHalfFov && aspect == aspectRatio && nearPlane == zNear && farPlane == zFar)
+        return;
+    tanHalfFov = tangent;
+    aspectRatio = aspect;
+    zNear = nearPlane;
+    zFar = farPlane;
+    split();
+}
+
+
+void ShadowCascades::SetLightDirection(const glm::vec3& direction)
+{
+    glm::vec3 next = glm::normalize(direction);
+    if (glm::dot(next, lightDirection) >= LIGHT_DIRECTION_TOLERANCE)
+        return;
+    lightDirection = next;
+    // any up that is not parallel to the light; the basis only depends on the direction
+    glm::vec3 up = fabsf(next.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    lightRotation = glm::lookAt(glm::vec3(0.0f), next, up);
+    InvalidateStatic();
+}
+
+
+void ShadowCascades::InvalidateStatic()
+{
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; ++i)
+        cascades[i].staticValid = false;
+}
+
+
+// Splits blend uniform and logarithmic spacing. Each slice gets the smallest sphere through its
+// near and far corners; it depends on nothing but the projection, so a cascade's size never changes
+// while the camera turns.
+void ShadowCascades::split()
+{
+    const float k = tanHalfFov * tanHalfFov * (1.0f + aspectRatio * aspectRatio);  // squared corner slope
+    float previous = zNear;
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; ++i)
+    {
+        float t = float(i + 1) / float(SHADOW_CASCADE_COUNT);
+        float uniformSplit = zNear + (zFar - zNear) * t;
+        float logSplit = zNear * powf(zFar / zNear, t);
+
+        Cascade& cascade = cascades[i];
+        cascade.nearDistance = previous;
+        cascade.farDistance = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+        previous = cascade.farDistance;
+
+        // center equidistant from both sets of corners, unless the far corners alone bound the slice
+        float n = cascade.nearDistance;
+        float f = cascade.farDistance;
+        float center = std::min(0.5f * (f + n) * (1.0f + k), f);
+        float radius = sqrtf((f - center) * (f - center) + f * f * k);
+
+        // round up so float noise in the inputs cannot change the size
+        cascade.radius = ceilf(radius * 16.0f) / 16.0f;
+        cascade.extent = cascade.radius * (1.0f + SHADOW_CACHE_MARGIN);
+        cascade.sphereDepth = center;
+        cascade.staticValid = false;
+    }
+}
+
+
+// Keeps the cached box while the cascade's sphere stays inside it; otherwise re-centers it on the
+// sphere, snapped to whole texels so the static casters land on the same texels as before.
+void ShadowCascades::fit(Cascade& cascade, const glm::mat4& inverseView)
+{
+    glm::vec3 world = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -cascade.sphereDepth, 1.0f));
+    glm::vec3 light = glm::mat3(lightRotation) * world;
+
+    const float slack = cascade.extent - cascade.radius;
+    bool inside = fabsf(light.x - cascade.center.x) <= slack && fabsf(light.y - cascade.center.y) <= slack &&
+                  fabsf(light.z - cascade.center.z) <= slack;
+    if (cascade.staticValid && inside)
+        return;
+
+    const float texel = 2.0f * cascade.extent / float(SHADOW_MAP_SIZE);
+    cascade.center.x = floorf(light.x / texel) * texel;
+    cascade.center.y = floorf(light.y / texel) * texel;
+    cascade.center.z = floorf(light.z / texel) * texel;
+    cascade.staticValid = false;
+
+    // light space looks down -z, with the casters between the box and the light at larger z
+    const float zMin = cascade.center.z - cascade.extent;
+    const float zMax = cascade.center.z + cascade.extent + SHADOW_CASTER_DISTANCE;
+    glm::mat4 projection = glm::ortho(cascade.center.x - cascade.extent, cascade.center.x + cascade.extent,
+                                      cascade.center.y - cascade.extent, cascade.center.y + cascade.extent,
+                                      -zMax, -zMin);
+    cascade.viewProjection = projection * lightRotation;
+}
+
+
+// Collects the casters whose sphere reaches the cascade's box. Nothing is culled toward the light:
+// depth clamping flattens casters past the near plane onto it, where they still cast.
+void ShadowCascades::cull(const Cascade& cascade, const std::vector<ShadowCaster>& casters)
+{
+    visible.clear();
+    const glm::mat3 rotation(lightRotation);
+    const float zMin = cascade.center.z - cascade.extent;
+    for (size_t i = 0; i < casters.size(); ++i)
+    {
+        const ShadowCaster& caster = casters[i];
+        if (caster.mesh == NULL || caster.mesh->vao == 0)
+            continue;
+        if (caster.radius > 0.0f)
+        {
+            glm::vec3 light = rotation * caster.center;
+            float reach = cascade.extent + caster.radius;
+            if (fabsf(light.x - cascade.center.x) > reach || fabsf(light.y - cascade.center.y) > reach ||
+                light.z + caster.radius < zMin)
+                continue;
+        }
+        visible.push_back(&caster);
+    }
+}
+
+
+void ShadowCascades::drawLayer(GLuint texture, int layer, const Cascade& cascade, bool clear)
+{
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+    if (clear)
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+    uniforms.Set(UNIFORM_LIGHT_VIEW_PROJECTION, 'm', glm::value_ptr(cascade.viewProjection), 16);
+    for (size_t i = 0; i < visible.size(); ++i)
+    {
+        const ShadowCaster& caster = *visible[i];
+        uniforms.Set(UNIFORM_MODEL, 'm', glm::value_ptr(caster.model), 16);
+        uniforms.Flush();
+        glBindVertexArray(caster.mesh->vao);
+        if (caster.mesh->buffers[1] != 0)
+            glDrawElements(GL_TRIANGLES, caster.mesh->count, GL_UNSIGNED_SHORT, NULL);
+        else
+            glDrawArrays(GL_TRIANGLES, 0, caster.mesh->count);
+    }
+}
+
+
+void ShadowCascades::Render(const glm::mat4& view, const std::vector<ShadowCaster>& staticCasters,
+                            const std::vector<ShadowCaster>& dynamicCasters)
+{
+    staticRenders = 0;
+    dynamicDraws = 0;
+    if (program == 0 || framebuffer == 0 || zFar <= zNear)
+        return;
+
+    const glm::mat4 inverseView = glm::inverse(view);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_CLAMP);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.5f, 4.0f);
+    glUseProgram(program);
+
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; ++i)
+    {
+        Cascade& cascade = cascades[i];
+        fit(cascade, inverseView);
+
+        // static casters only when the cached layer went stale
+        bool refreshed = false;
+        if (!cascade.staticValid)
+        {
+            cull(cascade, staticCasters);
+            drawLayer(maps[1], i, cascade, true);
+            cascade.staticValid = true;
+            refreshed = true;
+            ++staticRenders;
+        }
+
+        // the sampled layer is the cached one plus whatever dynamic casters reach it this frame
+        cull(cascade, dynamicCasters);
+        if (refreshed || cascade.dynamicDrawn || !visible.empty())
+        {
+            glCopyImageSubData(maps[1], GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                               maps[0], GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                               SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 1);
+        }
+        if (!visible.empty())
+        {
+            drawLayer(maps[0], i, cascade, false);
+            dynamicDraws += int(visible.size());
+        }
+        cascade.dynamicDrawn = !visible.empty();
+
+        blockData.matrices[i] = cascade.viewProjection;
+        blockData.splits[i] = cascade.farDistance;
+        blockData.texelSize[i] = 2.0f * cascade.extent / float(SHADOW_MAP_SIZE);
+    }
+    // row of the view matrix that gives the distance along -z
+    blockData.viewDepth = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+    block.Upload(blockData);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_DEPTH_CLAMP);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+void ShadowCascades::Bind() const
+{
+    glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, maps[0]);
+    glActiveTexture(GL_TEXTURE0);
+    block.Bind();
+}
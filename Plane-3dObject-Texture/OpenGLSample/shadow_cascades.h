@@ -0,0 +1,133 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "program_reflection.h"
+#include "shadow_block.h"
+
+class ShaderPermutationCache;
+
+// Default cascade values
+const GLsizei SHADOW_MAP_SIZE = 2048;           // texels per side of every cascade
+const float SHADOW_SPLIT_LAMBDA = 0.75f;        // 0 spaces the splits evenly, 1 logarithmically
+const float SHADOW_CACHE_MARGIN = 0.25f;        // extra cascade size, as a fraction of its radius, the camera can move through before a re-render
+const float SHADOW_CASTER_DISTANCE = 100.0f;    // how far toward the light casters are kept in depth range
+
+
+// Position-only copy of a mesh for the depth pass: a tight vec3 stream fetches a third of the bytes
+// of the interleaved position/color vertices the scene draws with
+struct ShadowMesh
+{
+    GLuint vao;
+    GLuint buffers[2];      // positions, indices (0 when drawn unindexed)
+    GLsizei count;          // indices, or vertices when unindexed
+
+    ShadowMesh() : vao(0), count(0) { buffers[0] = buffers[1] = 0; }
+};
+
+// copies the first three floats of every 'stride'-float vertex; 'indices' may be NULL
+bool CreateShadowMesh(ShadowMesh& mesh, const GLfloat* vertices, size_t vertexCount, size_t stride,
+                      const GLushort* indices = NULL, size_t indexCount = 0);
+void DestroyShadowMesh(ShadowMesh& mesh);
+
+// One draw of the depth pass. A bounding sphere lets cascades skip it; radius 0 draws it everywhere.
+struct ShadowCaster
+{
+    const ShadowMesh* mesh;
+    glm::mat4 model;
+    glm::vec3 center;       // world space
+    float radius;
+};
+
+
+/* Cascaded shadow maps for the directional light.
+ *
+ * The view frustum is split into SHADOW_CASCADE_COUNT ranges, each covered by an orthographic light
+ * view around the range's bounding sphere. The sphere's radius depends only on the projection and its
+ * center is snapped to whole texels in light space, so cascades do not shimmer as the camera turns or
+ * moves.
+ *
+ * Each cascade is made SHADOW_CACHE_MARGIN larger than its sphere and is only re-centered once the
+ * sphere leaves it, which keeps the light matrices fixed from frame to frame. Static casters are then
+ * rendered into a cached layer once and re-rendered only when the cascade moves, the light turns or
+ * InvalidateStatic() reports changed static geometry. Each frame the cached layer is copied into the
+ * sampled map and only the dynamic casters inside the cascade are drawn over it; a cascade with no
+ * dynamic casters costs nothing at all.
+ */
+class ShadowCascades
+{
+public:
+    ShadowCascades();
+    ~ShadowCascades();
+
+    // compiles the depth program and allocates the cascade maps; GL thread
+    bool Create(ShaderPermutationCache& shaders);
+
+    // camera projection the cascades are split from; only recomputes on change
+    void SetProjection(float fovYRadians, float aspect, float nearPlane, float farPlane);
+
+    // direction the light travels in (DirLight::direction); the cache survives tiny changes
+    void SetLightDirection(const glm::vec3& direction);
+
+    // call when static geometry moved, appeared or disappeared
+    void InvalidateStatic();
+
+    // fits the cascades to the camera and renders what changed. Leaves framebuffer 0 bound; the
+    // caller restores its viewport.
+    void Render(const glm::mat4& view, const std::vector<ShadowCaster>& staticCasters,
+                const std::vector<ShadowCaster>& dynamicCasters);
+
+    // binds the sampled cascade array to SHADOW_MAP_UNIT and the ShadowBlock to its binding
+    void Bind() const;
+
+    // the sampled cascade array, for callers tracking it as a texture; 0 until Create()
+    GLuint Texture() const { return maps[0]; }
+
+    // statistics from the last Render()
+    int StaticRenders() const { return staticRenders; }
+    int DynamicDraws() const { return dynamicDraws; }
+
+private:
+    struct Cascade
+    {
+        float nearDistance, farDistance;
+        float radius;               // bounding sphere of the frustum slice
+        float extent;               // half size of the cached ortho box
+        float sphereDepth;          // distance of the sphere center along -z
+        glm::vec3 center;           // light space center of the cached box
+        glm::mat4 viewProjection;
+        bool staticValid;           // the cached layer matches the current box
+        bool dynamicDrawn;          // the sampled layer holds dynamic casters from the previous frame
+    };
+
+    Cascade cascades[SHADOW_CASCADE_COUNT];
+    float tanHalfFov;
+    float aspectRatio;
+    float zNear, zFar;
+    glm::vec3 lightDirection;
+    glm::mat4 lightRotation;        // world to light space, no translation
+
+    GLuint program;
+    ProgramReflection uniforms;
+    GLuint maps[2];                 // sampled, static cache
+    GLuint framebuffer;
+    ShadowBlock block;
+    ShadowBlockData blockData;
+    int staticRenders;
+    int dynamicDraws;
+    std::vector<const ShadowCaster*> visible;
+
+    void split();
+    void fit(Cascade& cascade, const glm::mat4& inverseView);
+    void cull(const Cascade& cascade, const std::vector<ShadowCaster>& casters);
+    void drawLayer(GLuint texture, int layer, const Cascade& cascade, bool clear);
+
+    ShadowCascades(const ShadowCascades&);
+    ShadowCascades& operator=(const ShadowCascades&);
+};
+#endif
@@ -0,0 +1,90 @@
+#ifndef SNAPSHOT_QUEUE_H
+#define SNAPSHOT_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Default snapshot queue values
+const unsigned SNAPSHOT_SPINS_BEFORE_SLEEP = 64;    // yields while waiting before sleeping in short naps
+const int SNAPSHOT_SLEEP_US = 100;                  // length of one nap
+
+
+/* Two snapshot slots handed from one producer thread to one consumer thread.
+ *
+ * The producer fills the slot BeginWrite() returns and publishes it with EndWrite(); the consumer
+ * reads the oldest published slot from BeginRead() until EndRead() gives it back. Two slots let the
+ * producer build frame N+1 while the consumer still works on frame N, and never more than one frame
+ * ahead: with both slots taken the producer waits, so input never queues up behind the renderer.
+ *
+ * The slots change hands through two counters alone, each written by one side (release) and read by
+ * the other (acquire), so neither thread takes a lock; a side that has to wait yields, then naps.
+ * Stop() wakes both sides; the consumer still drains what was published.
+ */
+template <typename T>
+class SnapshotQueue
+{
+public:
+    SnapshotQueue() : written(0), read(0), stopping(false), producerWaits(0), consumerWaits(0) {}
+
+    // the slot to fill, or null once stopped
+    T* BeginWrite()
+    {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        if (!wait([this, index]() { return index - read.load(std::memory_order_acquire) < 2; }, producerWaits))
+            return nullptr;
+        return &slots[index & 1];
+    }
+
+    void EndWrite() { written.store(written.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // the oldest published snapshot, or null once stopped and drained
+    const T* BeginRead()
+    {
+        uint64_t index = read.load(std::memory_order_relaxed);
+        if (!wait([this, index]() { return written.load(std::memory_order_acquire) != index; }, consumerWaits) &&
+            written.load(std::memory_order_acquire) == index)
+            return nullptr;
+        return &slots[index & 1];
+    }
+
+    void EndRead() { read.store(read.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    void Stop() { stopping.store(true, std::memory_order_release); }
+
+    // times each side found nothing to do; a renderer that keeps up has the producer wait rarely
+    uint64_t ProducerWaits() const { return producerWaits.load(std::memory_order_relaxed); }
+    uint64_t ConsumerWaits() const { return consumerWaits.load(std::memory_order_relaxed); }
+
+private:
+    T slots[2];
+    std::atomic<uint64_t> written;      // snapshots published; producer only
+    std::atomic<uint64_t> read;         // snapshots given back; consumer only
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> producerWaits;
+    std::atomic<uint64_t> consumerWaits;
+
+    // false if stopped before 'ready' held
+    template <typename Ready>
+    bool wait(Ready ready, std::atomic<uint64_t>& waits)
+    {
+        if (ready())
+            return true;
+        waits.fetch_add(1, std::memory_order_relaxed);
+        for (unsigned spins = 0; !ready(); ++spins)
+        {
+            if (stopping.load(std::memory_order_acquire))
+                return ready();
+            if (spins < SNAPSHOT_SPINS_BEFORE_SLEEP)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(SNAPSHOT_SLEEP_US));
+        }
+        return true;
+    }
+
+    SnapshotQueue(const SnapshotQueue&);
+    SnapshotQueue& operator=(const SnapshotQueue&);
+};
+#endif
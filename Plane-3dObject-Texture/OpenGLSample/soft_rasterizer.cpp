@@ -0,0 +1,550 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFT_SSE 1
+#endif
+
+#include "job_system.h"
+#include "soft_rasterizer.h"
+
+namespace
+{
+    const int SUBPIXEL_SCALE = 1 << SOFT_SUBPIXEL_BITS;
+    const int SUBPIXEL_HALF = SUBPIXEL_SCALE / 2;
+    const int MAX_CLIP_VERTICES = 3 + 5;    // a triangle clipped by the near and four guard band planes
+
+    // Four pixels of a row with the handful of operations the tile loop needs; SSE2 where available
+#if SOFT_SSE
+    typedef __m128 Floats;
+    typedef __m128i Ints;
+
+    inline Floats Splat(float value) { return _mm_set1_ps(value); }
+    inline Floats Load(const float* values) { return _mm_loadu_ps(values); }
+    inline void Store(float* values, Floats a) { _mm_storeu_ps(values, a); }
+    inline Floats Add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+    inline Floats Mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+    inline Floats Div(Floats a, Floats b) { return _mm_div_ps(a, b); }
+    inline unsigned LessMask(Floats a, Floats b) { return unsigned(_mm_movemask_ps(_mm_cmplt_ps(a, b))); }
+
+    inline Ints SplatInt(int32_t value) { return _mm_set1_epi32(value); }
+    inline Ints Ramp(int32_t step) { return _mm_set_epi32(3 * step, 2 * step, step, 0); }
+    inline Ints AddInt(Ints a, Ints b) { return _mm_add_epi32(a, b); }
+    // lanes where any of the three values is negative
+    inline unsigned NegativeMask(Ints a, Ints b, Ints c)
+    {
+        return unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(a, _mm_or_si128(b, c)))));
+    }
+#else
+    struct Floats
+    {
+        float f[4];
+    };
+
+    struct Ints
+    {
+        int32_t i[4];
+    };
+
+    inline Floats Splat(float value) { Floats r; r.f[0] = r.f[1] = r.f[2] = r.f[3] = value; return r; }
+    inline Floats Load(const float* values) { Floats r; memcpy(r.f, values, sizeof(r.f)); return r; }
+    inline void Store(float* values, Floats a) { memcpy(values, a.f, sizeof(a.f)); }
+
+#define SOFT_LANE_OP(name, expression) \
+    inline Floats name(Floats a, Floats b) { Floats r; for (int i = 0; i < 4; ++i) { float x = a.f[i], y = b.f[i]; r.f[i] = (expression); } return r; }
+    SOFT_LANE_OP(Add, x + y)
+    SOFT_LANE_OP(Mul, x * y)
+    SOFT_LANE_OP(Div, x / y)
+#undef SOFT_LANE_OP
+
+    inline unsigned LessMask(Floats a, Floats b)
+    {
+        unsigned bits = 0;
+        for (int i = 0; i < 4; ++i)
+            bits |= a.f[i] < b.f[i] ? 1u << i : 0u;
+        return bits;
+    }
+
+    inline Ints SplatInt(int32_t value) { Ints r; r.i[0] = r.i[1] = r.i[2] = r.i[3] = value; return r; }
+    inline Ints Ramp(int32_t step) { Ints r; for (int i = 0; i < 4; ++i) r.i[i] = i * step; return r; }
+    inline Ints AddInt(Ints a, Ints b) { Ints r; for (int i = 0; i < 4; ++i) r.i[i] = a.i[i] + b.i[i]; return r; }
+    inline unsigned NegativeMask(Ints a, Ints b, Ints c)
+    {
+        unsigned bits = 0;
+        for (int i = 0; i < 4; ++i)
+            bits |= (a.i[i] | b.i[i] | c.i[i]) < 0 ? 1u << i : 0u;
+        return bits;
+    }
+#endif
+
+    inline uint32_t PackColor(float r, float g, float b, float a)
+    {
+        r = std::min(std::max(r, 0.0f), 1.0f);
+        g = std::min(std::max(g, 0.0f), 1.0f);
+        b = std::min(std::max(b, 0.0f), 1.0f);
+        a = std::min(std::max(a, 0.0f), 1.0f);
+        return uint32_t(r * 255.0f + 0.5f) | uint32_t(g * 255.0f + 0.5f) << 8 |
+               uint32_t(b * 255.0f + 0.5f) << 16 | uint32_t(a * 255.0f + 0.5f) << 24;
+    }
+
+    // floor(value / SUBPIXEL_SCALE) for negative values too
+    inline int FloorToPixel(int32_t value)
+    {
+        return value >= 0 ? value >> SOFT_SUBPIXEL_BITS : -((-value + SUBPIXEL_SCALE - 1) >> SOFT_SUBPIXEL_BITS);
+    }
+
+    inline int Wrap(int value, int size)
+    {
+        value %= size;
+        return value < 0 ? value + size : value;
+    }
+
+    // bilinear with repeat wrapping, like the GL defaults the texture manager sets
+    glm::vec4 Sample(const SoftTexture& texture, float u, float v)
+    {
+        float x = u * float(texture.width) - 0.5f;
+        float y = v * float(texture.height) - 0.5f;
+        float fx = floorf(x);
+        float fy = floorf(y);
+        float tx = x - fx;
+        float ty = y - fy;
+        int x0 = Wrap(int(fx), texture.width);
+        int y0 = Wrap(int(fy), texture.height);
+        int x1 = Wrap(x0 + 1, texture.width);
+        int y1 = Wrap(y0 + 1, texture.height);
+
+        const uint8_t* row0 = texture.texels + size_t(y0) * texture.width * 4;
+        const uint8_t* row1 = texture.texels + size_t(y1) * texture.width * 4;
+        glm::vec4 result;
+        for (int c = 0; c < 4; ++c)
+        {
+            float bottom = float(row0[x0 * 4 + c]) + (float(row0[x1 * 4 + c]) - float(row0[x0 * 4 + c])) * tx;
+            float top = float(row1[x0 * 4 + c]) + (float(row1[x1 * 4 + c]) - float(row1[x0 * 4 + c])) * tx;
+            result[c] = (bottom + (top - bottom) * ty) * (1.0f / 255.0f);
+        }
+        return result;
+    }
+}
+
+
+SoftRasterizer::SoftRasterizer(JobSystem& jobs)
+    : jobs(jobs), width(0), height(0), tilesX(0), tilesY(0), clearColor(0.0f, 0.0f, 0.0f, 1.0f), viewProjection(1.0f),
+      binnedCount(0)
+{
+}
+
+
+void SoftRasterizer::Resize(int newWidth, int newHeight)
+{
+    width = std::max(newWidth, 1);
+    height = std::max(newHeight, 1);
+    tilesX = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    tilesY = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    color.assign(size_t(width) * height, 0u);
+    depth.assign(size_t(width) * height, 1.0f);
+    bins.assign(size_t(tilesX) * tilesY, std::vector<uint32_t>());
+}
+
+
+void SoftRasterizer::Begin(const glm::mat4& view, const glm::mat4& projection)
+{
+    viewProjection = projection * view;
+    triangles.clear();
+    binnedCount = 0;
+}
+
+
+void SoftRasterizer::Draw(const SoftDraw& draw)
+{
+    if (width == 0 || draw.vertices == nullptr || draw.indices == nullptr || draw.indexCount < 3)
+        return;
+
+    // Vertex stage
+    const glm::mat4 transform = viewProjection * draw.model;
+    clipVertices.resize(draw.vertexCount);
+    jobs.ParallelFor(0, draw.vertexCount, SOFT_VERTEX_GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+            const float* vertex = draw.vertices + i * draw.stride;
+            ClipVertex& out = clipVertices[i];
+            out.position = transform * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+            for (int c = 0; c < 4; ++c)
+                out.attributes[ATTRIBUTE_R + c] = draw.colorOffset != SOFT_NO_ATTRIBUTE ? vertex[draw.colorOffset + c] : 1.0f;
+            out.attributes[ATTRIBUTE_U] = draw.uvOffset != SOFT_NO_ATTRIBUTE ? vertex[draw.uvOffset + 0] : 0.0f;
+            out.attributes[ATTRIBUTE_V] = draw.uvOffset != SOFT_NO_ATTRIBUTE ? vertex[draw.uvOffset + 1] : 0.0f;
+        }
+    });
+
+    // Clip and set up in fixed chunks, then append the chunks in order so the triangle order never
+    // depends on which worker finished first
+    const size_t triangleCount = draw.indexCount / 3;
+    const size_t chunkCount = (triangleCount + SOFT_SETUP_GRAIN - 1) / SOFT_SETUP_GRAIN;
+    if (chunks.size() < chunkCount)
+        chunks.resize(chunkCount);
+    jobs.ParallelFor(0, chunkCount, 1, [&](size_t first, size_t last) {
+        for (size_t chunk = first; chunk < last; ++chunk)
+        {
+            std::vector<Triangle>& out = chunks[chunk];
+            out.clear();
+            size_t end = std::min(triangleCount, (chunk + 1) * SOFT_SETUP_GRAIN);
+            for (size_t t = chunk * SOFT_SETUP_GRAIN; t < end; ++t)
+            {
+                const uint16_t* index = draw.indices + t * 3;
+                if (index[0] >= draw.vertexCount || index[1] >= draw.vertexCount || index[2] >= draw.vertexCount)
+                    continue;
+                ClipVertex corners[3] = { clipVertices[index[0]], clipVertices[index[1]], clipVertices[index[2]] };
+                setupTriangle(corners, draw.texture, out);
+            }
+        }
+    });
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+        triangles.insert(triangles.end(), chunks[chunk].begin(), chunks[chunk].end());
+}
+
+
+void SoftRasterizer::End()
+{
+    if (width == 0)
+        return;
+
+    // Bin by bounding box, in submission order
+    for (size_t b = 0; b < bins.size(); ++b)
+        bins[b].clear();
+    binnedCount = 0;
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        const Triangle& triangle = triangles[i];
+        for (int ty = triangle.minY / SOFT_TILE_SIZE; ty <= triangle.maxY / SOFT_TILE_SIZE; ++ty)
+            for (int tx = triangle.minX / SOFT_TILE_SIZE; tx <= triangle.maxX / SOFT_TILE_SIZE; ++tx)
+                bins[size_t(ty) * tilesX + tx].push_back(uint32_t(i));
+        binnedCount += size_t(triangle.maxY / SOFT_TILE_SIZE - triangle.minY / SOFT_TILE_SIZE + 1) *
+                       size_t(triangle.maxX / SOFT_TILE_SIZE - triangle.minX / SOFT_TILE_SIZE + 1);
+    }
+
+    jobs.ParallelFor(0, bins.size(), 1, [&](size_t first, size_t last) {
+        for (size_t tile = first; tile < last; ++tile)
+            shadeTile(int(tile));
+    });
+}
+
+
+bool SoftRasterizer::WritePpm(const char* filename) const
+{
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cout << "ERROR::SOFT_RASTERIZER::CANNOT_WRITE " << filename << std::endl;
+        return false;
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<char> row(size_t(width) * 3);
+    for (int y = height - 1; y >= 0; --y)
+    {
+        const uint32_t* pixels = &color[size_t(y) * width];
+        for (int x = 0; x < width; ++x)
+        {
+            row[x * 3 + 0] = char(pixels[x] & 0xFF);
+            row[x * 3 + 1] = char((pixels[x] >> 8) & 0xFF);
+            row[x * 3 + 2] = char((pixels[x] >> 16) & 0xFF);
+        }
+        file.write(row.data(), std::streamsize(row.size()));
+    }
+    return bool(file);
+}
+
+
+void SoftRasterizer::setupTriangle(const ClipVertex* vertices, const SoftTexture* texture, std::vector<Triangle>& out) const
+{
+    // Planes as (x, y, z, w) coefficients, inside where the dot product with the position is >= 0:
+    // near, then the guard band left, right, bottom and top
+    const float guardX = 1.0f + 2.0f * SOFT_GUARD_BAND / float(width);
+    const float guardY = 1.0f + 2.0f * SOFT_GUARD_BAND / float(height);
+    const glm::vec4 planes[5] = {
+        glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+        glm::vec4(1.0f, 0.0f, 0.0f, guardX),
+        glm::vec4(-1.0f, 0.0f, 0.0f, guardX),
+        glm::vec4(0.0f, 1.0f, 0.0f, guardY),
+        glm::vec4(0.0f, -1.0f, 0.0f, guardY),
+    };
+
+    // Trivially reject triangles entirely outside one side of the view volume
+    unsigned outside[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const glm::vec4& p = vertices[i].position;
+        outside[i] = (p.x < -p.w ? 1u : 0u) | (p.x > p.w ? 2u : 0u) | (p.y < -p.w ? 4u : 0u) |
+                     (p.y > p.w ? 8u : 0u) | (p.z < -p.w ? 16u : 0u) | (p.z > p.w ? 32u : 0u);
+    }
+    if ((outside[0] & outside[1] & outside[2]) != 0)
+        return;
+
+    unsigned crossed = 0;
+    for (int p = 0; p < 5; ++p)
+        for (int i = 0; i < 3; ++i)
+            if (glm::dot(planes[p], vertices[i].position) < 0.0f)
+                crossed |= 1u << p;
+    if (crossed == 0)
+    {
+        emitTriangle(vertices[0], vertices[1], vertices[2], texture, out);
+        return;
+    }
+
+    // Sutherland-Hodgman against the crossed planes only
+    ClipVertex buffers[2][MAX_CLIP_VERTICES];
+    int count = 3;
+    std::copy(vertices, vertices + 3, buffers[0]);
+    int current = 0;
+    for (int p = 0; p < 5 && count >= 3; ++p)
+    {
+        if ((crossed & (1u << p)) == 0)
+            continue;
+        const ClipVertex* in = buffers[current];
+        ClipVertex* result = buffers[current ^ 1];
+        int resultCount = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const ClipVertex& a = in[i];
+            const ClipVertex& b = in[(i + 1) % count];
+            float da = glm::dot(planes[p], a.position);
+            float db = glm::dot(planes[p], b.position);
+            if (da >= 0.0f)
+                result[resultCount++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                ClipVertex& v = result[resultCount++];
+                v.position = a.position + (b.position - a.position) * t;
+                for (int c = 0; c < ATTRIBUTE_COUNT; ++c)
+                    v.attributes[c] = a.attributes[c] + (b.attributes[c] - a.attributes[c]) * t;
+            }
+        }
+        count = resultCount;
+        current ^= 1;
+    }
+
+    for (int i = 2; i < count; ++i)
+        emitTriangle(buffers[current][0], buffers[current][i - 1], buffers[current][i], texture, out);
+}
+
+
+void SoftRasterizer::emitTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, const SoftTexture* texture,
+                                  std::vector<Triangle>& out) const
+{
+    const ClipVertex* corners[3] = { &a, &b, &c };
+    Triangle triangle;
+    float invW[3], windowDepth[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        const glm::vec4& p = corners[i]->position;
+        invW[i] = 1.0f / p.w;
+        float x = (p.x * invW[i] * 0.5f + 0.5f) * float(width);
+        float y = (p.y * invW[i] * 0.5f + 0.5f) * float(height);
+        windowDepth[i] = p.z * invW[i] * 0.5f + 0.5f;
+        triangle.x[i] = int32_t(floorf(x * SUBPIXEL_SCALE + 0.5f));
+        triangle.y[i] = int32_t(floorf(y * SUBPIXEL_SCALE + 0.5f));
+    }
+
+    // Both faces are drawn: wind every triangle counter-clockwise
+    int64_t area = int64_t(triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) -
+                   int64_t(triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+    if (area == 0)
+        return;
+    if (area < 0)
+    {
+        std::swap(triangle.x[1], triangle.x[2]);
+        std::swap(triangle.y[1], triangle.y[2]);
+        std::swap(corners[1], corners[2]);
+        std::swap(invW[1], invW[2]);
+        std::swap(windowDepth[1], windowDepth[2]);
+        area = -area;
+    }
+
+    // Pixels whose centers fall inside the fixed point bounds
+    int32_t minX = std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2]));
+    int32_t maxX = std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2]));
+    int32_t minY = std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2]));
+    int32_t maxY = std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2]));
+    triangle.minX = std::max(FloorToPixel(minX - SUBPIXEL_HALF + SUBPIXEL_SCALE - 1), 0);
+    triangle.minY = std::max(FloorToPixel(minY - SUBPIXEL_HALF + SUBPIXEL_SCALE - 1), 0);
+    triangle.maxX = std::min(FloorToPixel(maxX - SUBPIXEL_HALF), width - 1);
+    triangle.maxY = std::min(FloorToPixel(maxY - SUBPIXEL_HALF), height - 1);
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    // Edge i runs between the two other vertices; the top-left rule keeps shared edges drawn once
+    for (int i = 0; i < 3; ++i)
+    {
+        int from = (i + 1) % 3;
+        int to = (i + 2) % 3;
+        int32_t dx = triangle.x[to] - triangle.x[from];
+        int32_t dy = triangle.y[to] - triangle.y[from];
+        bool topLeft = dy < 0 || (dy == 0 && dx < 0);
+        triangle.bias[i] = topLeft ? 0 : -1;
+    }
+
+    // Attribute planes, from the snapped positions so they agree with coverage
+    const double scale = 1.0 / SUBPIXEL_SCALE;
+    double x0 = triangle.x[0] * scale, y0 = triangle.y[0] * scale;
+    double x1 = triangle.x[1] * scale - x0, y1 = triangle.y[1] * scale - y0;
+    double x2 = triangle.x[2] * scale - x0, y2 = triangle.y[2] * scale - y0;
+    double invDeterminant = 1.0 / (double(area) * scale * scale);
+    triangle.originX = float(x0);
+    triangle.originY = float(y0);
+
+    triangle.depth = makePlane(windowDepth[0], windowDepth[1], windowDepth[2], x1, y1, x2, y2, invDeterminant);
+    triangle.invW = makePlane(invW[0], invW[1], invW[2], x1, y1, x2, y2, invDeterminant);
+    for (int c = 0; c < ATTRIBUTE_COUNT; ++c)
+        triangle.attributes[c] = makePlane(corners[0]->attributes[c] * invW[0], corners[1]->attributes[c] * invW[1],
+                                                  corners[2]->attributes[c] * invW[2], x1, y1, x2, y2, invDeterminant);
+    triangle.texture = texture != nullptr && texture->texels != nullptr && texture->width > 0 && texture->height > 0 ? texture : nullptr;
+
+    out.push_back(triangle);
+}
+
+
+SoftRasterizer::Plane SoftRasterizer::makePlane(double f0, double f1, double f2, double x1, double y1, double x2, double y2,
+                                                double invDeterminant)
+{
+    Plane plane;
+    plane.origin = float(f0);
+    plane.dx = float(((f1 - f0) * y2 - (f2 - f0) * y1) * invDeterminant);
+    plane.dy = float(((f2 - f0) * x1 - (f1 - f0) * x2) * invDeterminant);
+    return plane;
+}
+
+
+void SoftRasterizer::shadeTile(int tile)
+{
+    const int tileX0 = (tile % tilesX) * SOFT_TILE_SIZE;
+    const int tileY0 = (tile / tilesX) * SOFT_TILE_SIZE;
+    const int tileX1 = std::min(tileX0 + SOFT_TILE_SIZE, width) - 1;
+    const int tileY1 = std::min(tileY0 + SOFT_TILE_SIZE, height) - 1;
+
+    const uint32_t clear = PackColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
+    for (int y = tileY0; y <= tileY1; ++y)
+    {
+        std::fill(color.begin() + size_t(y) * width + tileX0, color.begin() + size_t(y) * width + tileX1 + 1, clear);
+        std::fill(depth.begin() + size_t(y) * width + tileX0, depth.begin() + size_t(y) * width + tileX1 + 1, 1.0f);
+    }
+
+    const std::vector<uint32_t>& bin = bins[tile];
+    for (size_t b = 0; b < bin.size(); ++b)
+    {
+        const Triangle& triangle = triangles[bin[b]];
+        const int x0 = std::max(triangle.minX, tileX0);
+        const int x1 = std::min(triangle.maxX, tileX1);
+        const int y0 = std::max(triangle.minY, tileY0);
+        const int y1 = std::min(triangle.maxY, tileY1);
+        if (x0 > x1 || y0 > y1)
+            continue;
+
+        // Edge values at the region's first pixel and their per pixel steps. An edge that is positive
+        // over the whole region is dropped (0, no step); a partial one is bounded by the region size,
+        // so it fits the 32-bit lanes even though the guard band does not
+        int32_t start[3], stepX[3], stepY[3];
+        bool rejected = false;
+        for (int i = 0; i < 3 && !rejected; ++i)
+        {
+            int from = (i + 1) % 3;
+            int to = (i + 2) % 3;
+            int64_t a = -int64_t(triangle.y[to] - triangle.y[from]);
+            int64_t c = int64_t(triangle.x[to] - triangle.x[from]);
+            int64_t cornerX[2] = { int64_t(x0) * SUBPIXEL_SCALE + SUBPIXEL_HALF - triangle.x[from],
+                                   int64_t(x1) * SUBPIXEL_SCALE + SUBPIXEL_HALF - triangle.x[from] };
+            int64_t cornerY[2] = { int64_t(y0) * SUBPIXEL_SCALE + SUBPIXEL_HALF - triangle.y[from],
+                                   int64_t(y1) * SUBPIXEL_SCALE + SUBPIXEL_HALF - triangle.y[from] };
+            int64_t lowest = INT64_MAX, highest = INT64_MIN;
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                int64_t value = a * cornerX[corner & 1] + c * cornerY[corner >> 1] + triangle.bias[i];
+                lowest = std::min(lowest, value);
+                highest = std::max(highest, value);
+            }
+
+            if (highest < 0)
+                rejected = true;
+            else if (lowest >= 0)
+                start[i] = stepX[i] = stepY[i] = 0;
+            else
+            {
+                start[i] = int32_t(a * cornerX[0] + c * cornerY[0] + triangle.bias[i]);
+                stepX[i] = int32_t(a * SUBPIXEL_SCALE);
+                stepY[i] = int32_t(c * SUBPIXEL_SCALE);
+            }
+        }
+        if (rejected)
+            continue;
+
+        const Ints ramp[3] = { Ramp(stepX[0]), Ramp(stepX[1]), Ramp(stepX[2]) };
+        const Ints quadStep[3] = { SplatInt(4 * stepX[0]), SplatInt(4 * stepX[1]), SplatInt(4 * stepX[2]) };
+        const float laneOffsets[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+        const Floats lanes = Load(laneOffsets);
+
+        for (int y = y0; y <= y1; ++y)
+        {
+            int32_t rows = y - y0;
+            Ints edge[3];
+            for (int i = 0; i < 3; ++i)
+                edge[i] = AddInt(SplatInt(start[i] + rows * stepY[i]), ramp[i]);
+
+            const float rowY = float(y) + 0.5f - triangle.originY;
+            float* depthRow = &depth[size_t(y) * width];
+            uint32_t* colorRow = &color[size_t(y) * width];
+
+            for (int x = x0; x <= x1; x += 4)
+            {
+                unsigned covered = ~NegativeMask(edge[0], edge[1], edge[2]) & 0xFu;
+                for (int i = 0; i < 3; ++i)
+                    edge[i] = AddInt(edge[i], quadStep[i]);
+                if (x1 - x < 3)
+                    covered &= (1u << (x1 - x + 1)) - 1u;
+                if (covered == 0)
+                    continue;
+
+                // Depth test against the four pixels; a partial quad at the right edge loads only the
+                // columns up to x1, since the ones after it belong to the next tile, which another job
+                // may be shading
+                const Floats offsetX = Add(Splat(float(x) + 0.5f - triangle.originX), lanes);
+                const Floats offsetY = Splat(rowY);
+                auto evaluate = [&](const Plane& plane) {
+                    return Add(Add(Splat(plane.origin), Mul(Splat(plane.dx), offsetX)), Mul(Splat(plane.dy), offsetY));
+                };
+                Floats z = evaluate(triangle.depth);
+                float stored[4];
+                if (x + 3 <= x1)
+                    memcpy(stored, depthRow + x, sizeof(stored));
+                else
+                    for (int lane = 0; lane < 4; ++lane)
+                        stored[lane] = x + lane <= x1 ? depthRow[x + lane] : 0.0f;
+                unsigned passed = covered & LessMask(z, Load(stored));
+                if (passed == 0)
+                    continue;
+
+                // Perspective correct attributes
+                Floats w = Div(Splat(1.0f), evaluate(triangle.invW));
+                float values[ATTRIBUTE_COUNT][4];
+                int attributeCount = triangle.texture != nullptr ? ATTRIBUTE_COUNT : ATTRIBUTE_U;
+                for (int c = 0; c < attributeCount; ++c)
+                    Store(values[c], Mul(evaluate(triangle.attributes[c]), w));
+                float depths[4];
+                Store(depths, z);
+
+                for (int lane = 0; lane < 4; ++lane)
+                {
+                    if ((passed & (1u << lane)) == 0)
+                        continue;
+                    glm::vec4 shaded(values[ATTRIBUTE_R][lane], values[ATTRIBUTE_G][lane], values[ATTRIBUTE_B][lane], values[ATTRIBUTE_A][lane]);
+                    if (triangle.texture != nullptr)
+                        shaded *= Sample(*triangle.texture, values[ATTRIBUTE_U][lane], values[ATTRIBUTE_V][lane]);
+                    depthRow[x + lane] = depths[lane];
+                    colorRow[x + lane] = PackColor(shaded.x, shaded.y, shaded.z, shaded.w);
+                }
+            }
+        }
+    }
+}
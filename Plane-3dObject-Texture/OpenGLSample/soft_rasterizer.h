@@ -0,0 +1,144 @@
+#ifndef SOFT_RASTERIZER_H
+#define SOFT_RASTERIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class JobSystem;
+
+// Default software rasterizer values
+const int SOFT_TILE_SIZE = 64;                  // pixels per tile side; one job shades one tile
+const int SOFT_SUBPIXEL_BITS = 4;               // vertices snap to 1/16 pixel
+const float SOFT_GUARD_BAND = 8192.0f;          // pixels beyond the viewport before triangles are clipped
+const size_t SOFT_VERTEX_GRAIN = 256;           // vertices per job
+const size_t SOFT_SETUP_GRAIN = 128;            // triangles per job
+const size_t SOFT_NO_ATTRIBUTE = size_t(-1);
+
+
+// RGBA8 image, rows from the bottom (GL order); owned by the caller
+struct SoftTexture
+{
+    int width;
+    int height;
+    const uint8_t* texels;
+};
+
+// One indexed draw in the layout UCreateMesh uploads: 'stride' floats per vertex, position first
+struct SoftDraw
+{
+    const float* vertices;
+    size_t vertexCount;
+    size_t stride;
+    size_t colorOffset;         // RGBA, or SOFT_NO_ATTRIBUTE for white
+    size_t uvOffset;            // texture coordinates, or SOFT_NO_ATTRIBUTE
+    const uint16_t* indices;
+    size_t indexCount;
+    glm::mat4 model;
+    const SoftTexture* texture; // modulates the color when set; must outlive End()
+
+    SoftDraw()
+        : vertices(nullptr), vertexCount(0), stride(3), colorOffset(SOFT_NO_ATTRIBUTE), uvOffset(SOFT_NO_ATTRIBUTE),
+          indices(nullptr), indexCount(0), model(1.0f), texture(nullptr)
+    {
+    }
+};
+
+
+/* Tile-based CPU rasterizer, the software counterpart of the scene shaders.
+ *
+ * A frame runs in three stages on the JobSystem's workers:
+ * - Draw(): vertices are transformed in parallel, then triangles are clipped (near plane and a
+ *   guard band around the viewport), snapped to fixed point and set up in parallel chunks
+ * - End(): triangles are binned by bounding box into SOFT_TILE_SIZE tiles in submission order
+ * - End(): every tile is cleared and shaded by one job, so tiles never share pixels or locks
+ * Coverage uses integer edge functions stepped four pixels at a time (SSE2, plain ints elsewhere)
+ * with the top-left fill rule; color, texture coordinates and depth are interpolated perspective
+ * correct and depth tested like GL_LESS. Both faces are drawn. Each tile walks its triangles in
+ * submission order with the same arithmetic however the tiles are spread over threads, so the image
+ * is identical on any machine with the same float behavior.
+ */
+class SoftRasterizer
+{
+public:
+    explicit SoftRasterizer(JobSystem& jobs);
+
+    void Resize(int width, int height);
+    void SetClearColor(const glm::vec4& color) { clearColor = color; }
+
+    // starts a frame; draws are set up as they come in and need their arrays only during Draw()
+    void Begin(const glm::mat4& view, const glm::mat4& projection);
+    void Draw(const SoftDraw& draw);
+    // bins the frame's triangles and shades every tile
+    void End();
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // RGBA8 pixels (red in the lowest byte) and window depth in [0, 1], rows from the bottom
+    const std::vector<uint32_t>& Color() const { return color; }
+    const std::vector<float>& Depth() const { return depth; }
+
+    // binary PPM, top row first
+    bool WritePpm(const char* filename) const;
+
+    size_t TriangleCount() const { return triangles.size(); }
+    size_t BinnedCount() const { return binnedCount; }
+
+private:
+    // value at pixel (x, y) = origin + dx * (x - originX) + dy * (y - originY), at pixel centers
+    struct Plane
+    {
+        float origin, dx, dy;
+    };
+
+    enum Attribute { ATTRIBUTE_R, ATTRIBUTE_G, ATTRIBUTE_B, ATTRIBUTE_A, ATTRIBUTE_U, ATTRIBUTE_V, ATTRIBUTE_COUNT };
+
+    // a set up triangle: counter-clockwise fixed point vertices and attribute planes
+    struct Triangle
+    {
+        int32_t x[3], y[3];
+        int32_t bias[3];                // -1 on edges that are not top or left
+        int minX, minY, maxX, maxY;     // pixel bounds, clamped to the viewport
+        float originX, originY;
+        Plane depth;
+        Plane invW;
+        Plane attributes[ATTRIBUTE_COUNT];  // divided by w
+        const SoftTexture* texture;
+    };
+
+    struct ClipVertex
+    {
+        glm::vec4 position;
+        float attributes[ATTRIBUTE_COUNT];
+    };
+
+    JobSystem& jobs;
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    glm::vec4 clearColor;
+    glm::mat4 viewProjection;
+
+    std::vector<uint32_t> color;
+    std::vector<float> depth;
+    std::vector<ClipVertex> clipVertices;
+    std::vector<std::vector<Triangle> > chunks;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t> > bins;   // triangle indices per tile
+    size_t binnedCount;
+
+    void setupTriangle(const ClipVertex* vertices, const SoftTexture* texture, std::vector<Triangle>& out) const;
+    void emitTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, const SoftTexture* texture,
+                      std::vector<Triangle>& out) const;
+    void shadeTile(int tile);
+    // plane through the values f0..f2 at vertex 0 and the vertex 1 and 2 offsets (x1, y1), (x2, y2)
+    static Plane makePlane(double f0, double f1, double f2, double x1, double y1, double x2, double y2, double invDeterminant);
+
+    SoftRasterizer(const SoftRasterizer&);
+    SoftRasterizer& operator=(const SoftRasterizer&);
+};
+#endif
@@ -0,0 +1,68 @@
+// Checks where PreprocessShader puts the permutation defines. Builds on its own, without a GL context:
+//   g++ -std=c++14 -I.. -I<glew/glfw includes> shader_preprocessor_test.cpp ../shader_preprocessor.cpp ../asset_pack.cpp
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "shader_preprocessor.h"
+
+// asset_pack.cpp decodes textures with stb_image; Source.cpp holds the implementation in the program
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            std::cout << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    std::string preprocess(const char* path, const std::string& text, const ShaderDefines& defines)
+    {
+        std::ofstream(path, std::ios::binary) << text;
+        std::string output;
+        check(PreprocessShader(path, defines, output, nullptr, false), path);
+        std::remove(path);
+        return output;
+    }
+
+    // the first line that is not blank
+    std::string firstLine(const std::string& text)
+    {
+        size_t start = text.find_first_not_of(" \t\r\n");
+        if (start == std::string::npos)
+            return std::string();
+        return text.substr(start, text.find('\n', start) - start);
+    }
+}
+
+
+int main()
+{
+    ShaderDefines defines;
+    defines.Set("HAS_SHADOWS", 1);
+
+    // a license comment before #version: the defines must not land above it
+    std::string licensed = preprocess("test_license.fs",
+        "/*\n * Licensed under the MIT license.\n */\n\n#version 440 core\nvoid main()\n{\n}\n", defines);
+    check(firstLine(licensed) == "#version 440 core", "#version stays first after a block comment");
+    check(licensed.find("#define HAS_SHADOWS 1") > licensed.find("#version"), "defines follow #version");
+
+    std::string commented = preprocess("test_line_comment.fs", "// scene shader\n#version 440 core\nvoid main() {}\n", defines);
+    check(firstLine(commented) == "#version 440 core", "#version stays first after a line comment");
+
+    // no #version at all: the defines come first
+    std::string bare = preprocess("test_bare.fs", "\nvoid main() {}\n", defines);
+    check(firstLine(bare) == "#define HAS_SHADOWS 1", "defines lead a file without #version");
+
+    if (failures == 0)
+        std::cout << "All shader preprocessor tests passed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
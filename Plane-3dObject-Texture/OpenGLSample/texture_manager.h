@@ -0,0 +1,498 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <GL/glew.h>
+#include "stb_image.h"
+#include "resource_cache.h"
+#include "asset_pack.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
+inline void flipImageVertically(unsigned char* image, int width, int height, int channels)
+{
+    for (int j = 0; j < height / 2; ++j)
+    {
+        int index1 = j * width * channels;
+        int index2 = (height - 1 - j) * width * channels;
+
+        for (int i = width * channels; i > 0; --i)
+        {
+            unsigned char tmp = image[index1];
+            image[index1] = image[index2];
+            image[index2] = tmp;
+            ++index1;
+            ++index2;
+        }
+    }
+}
+
+// Default texture manager values
+const size_t TEXTURE_BUDGET_BYTES = 256u * 1024u * 1024u; // VRAM budget for all resident textures
+const int TEXTURE_MIN_RESIDENT_SIZE = 64;                  // mips at or below this size are never evicted
+const int TEXTURE_MAX_RESTORES_PER_FRAME = 1;              // disk reloads allowed per Update()
+
+// Shared reference to a texture name; the texture is deleted when the last handle is released
+typedef std::shared_ptr<GLuint> TextureHandle;
+
+// An image decoded (and flipped) off the GL thread, waiting to be uploaded
+struct DecodedImage
+{
+    std::string path;
+    uint64_t contentHash;
+    unsigned char* pixels;  // owned; freed by TextureManager::AcquireDecoded
+    int width;
+    int height;
+    int channels;
+};
+
+// decodes an encoded image in memory; safe to call from any thread
+inline bool DecodeImage(const std::string& path, const unsigned char* bytes, size_t size, DecodedImage& image)
+{
+    image.path = path;
+    image.contentHash = HashBytes(bytes, size);
+    image.pixels = stbi_load_from_memory(bytes, int(size), &image.width, &image.height, &image.channels, 0);
+    if (!image.pixels)
+        return false;
+    flipImageVertically(image.pixels, image.width, image.height, image.channels);
+    return true;
+}
+
+
+// Tracks every texture it creates, keeps the sum of their mip chains under a VRAM budget and,
+// under pressure, drops the top mip levels of the least-recently-used textures. Dropped mips are
+// reloaded from disk the next time the texture is touched and the budget allows it.
+class TextureManager
+{
+public:
+    TextureManager(size_t budgetBytes = TEXTURE_BUDGET_BYTES) : budget(budgetBytes), residentBytes(0), frame(0), overBudget(false)
+    {
+    }
+
+    // loads an image from disk into a new mipmapped texture
+    bool Load(const char* filename, GLuint& textureId)
+    {
+        int width, height, channels;
+        unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+        if (!image)
+            return false;
+
+        return create(image, width, height, channels, filename, textureId);
+    }
+
+    // decodes an encoded image (png, jpg, ...) already in memory; 'path' is kept for mip restores
+    bool LoadFromMemory(const unsigned char* bytes, size_t size, const char* path, GLuint& textureId)
+    {
+        int width, height, channels;
+        unsigned char* image = stbi_load_from_memory(bytes, int(size), &width, &height, &channels, 0);
+        if (!image)
+            return false;
+
+        return create(image, width, height, channels, path, textureId);
+    }
+
+    // uploads a texture cooked into an asset pack straight from the mapping; the pack must stay mounted
+    bool LoadCooked(const AssetView& cooked, const char* path, GLuint& textureId)
+    {
+        const CookedTextureHeader* header = cooked.texture();
+        if (cooked.type != ASSET_TEXTURE || cooked.size < sizeof(CookedTextureHeader) ||
+            cooked.size < sizeof(CookedTextureHeader) + uint64_t(header->width) * header->height * header->channels)
+        {
+            std::cout << "ERROR::TEXTURES::INVALID_COOKED_TEXTURE " << path << std::endl;
+            return false;
+        }
+        return upload(cooked.texturePixels(), header->width, header->height, header->channels, path, cooked.texturePixels(), textureId);
+    }
+
+    // uploads an image decoded on another thread, or returns the live texture with the same content
+    TextureHandle AcquireDecoded(DecodedImage& image)
+    {
+        TextureHandle handle = cache.Find(image.contentHash);
+        if (!handle)
+        {
+            GLuint textureId;
+            if (upload(image.pixels, image.width, image.height, image.channels, image.path.c_str(), nullptr, textureId))
+                handle = makeHandle(textureId);
+        }
+        stbi_image_free(image.pixels);
+        image.pixels = nullptr;
+
+        if (!handle)
+            return handle;
+        return cache.Insert(image.contentHash, handle, image.path);
+    }
+
+    // returns a shared texture for the file, decoding and uploading it only once per unique content
+    TextureHandle Acquire(const char* filename)
+    {
+        // a mounted pack wins over loose files; its cooked pixels need no decode and no copy
+        AssetPack* pack = MountedAssetPack();
+        AssetView cooked = pack ? pack->Find(filename) : AssetView();
+        if (cooked.valid() && cooked.type == ASSET_TEXTURE)
+        {
+            TextureHandle handle = cache.Find(cooked.contentHash);
+            if (handle)
+                return handle;
+
+            GLuint textureId;
+            if (!LoadCooked(cooked, filename, textureId))
+                return TextureHandle();
+            return cache.Insert(cooked.contentHash, makeHandle(textureId));
+        }
+
+        return cache.Acquire(filename, [this](const unsigned char* bytes, size_t size, const std::string& path)
+        {
+            GLuint textureId;
+            if (!LoadFromMemory(bytes, size, path.c_str(), textureId))
+                return TextureHandle();
+            return makeHandle(textureId);
+        });
+    }
+
+    // returns the live texture for the file if it has already been loaded, without any I/O
+    TextureHandle FindLoaded(const char* filename)
+    {
+        return cache.FindPath(filename);
+    }
+
+    // creates a small magenta/black checkerboard to draw with while real textures stream in
+    TextureHandle CreatePlaceholder()
+    {
+        static const unsigned char checker[] = {
+            255, 0, 255, 255,   0, 0, 0, 255,
+              0, 0, 0, 255,   255, 0, 255, 255,
+        };
+        GLuint textureId;
+        if (!upload(checker, 2, 2, 4, "<placeholder>", checker, textureId))
+            return TextureHandle();
+
+        // nearest filtering keeps the checks crisp at any size
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return makeHandle(textureId);
+    }
+
+    // deletes the texture and stops tracking it
+    void Destroy(GLuint textureId)
+    {
+        std::unordered_map<GLuint, Entry>::iterator it = textures.find(textureId);
+        if (it != textures.end())
+        {
+            residentBytes -= it->second.bytes;
+            textures.erase(it);
+        }
+        glDeleteTextures(1, &textureId);
+    }
+
+    // marks the texture as used this frame; textures with dropped mips are queued for restore, unless
+    // an earlier restore of theirs failed
+    void Touch(GLuint textureId)
+    {
+        std::unordered_map<GLuint, Entry>::iterator it = textures.find(textureId);
+        if (it == textures.end())
+            return;
+
+        it->second.lastUsed = frame;
+        if (it->second.baseLevel > 0 && it->second.restorable)
+            it->second.restoreRequested = true;
+    }
+
+    // call once per frame: restores requested mips, then evicts down to the budget
+    void Update()
+    {
+        restoreRequested();
+        enforceBudget();
+        if (frame % 256 == 0)
+            cache.Purge();
+        ++frame;
+    }
+
+    void SetBudget(size_t budgetBytes)
+    {
+        budget = budgetBytes;
+        enforceBudget();
+    }
+
+    size_t Budget() const { return budget; }
+    size_t ResidentBytes() const { return residentBytes; }
+    size_t TextureCount() const { return textures.size(); }
+
+private:
+    struct Entry
+    {
+        std::string path;
+        GLint internalFormat;
+        GLenum format;
+        int width;
+        int height;
+        int levels;                 // full mip chain length
+        int baseLevel;              // first resident mip; levels below it have been dropped
+        unsigned long long lastUsed;
+        size_t bytes;               // bytes currently resident
+        bool restoreRequested;
+        bool restorable;            // cleared when a restore fails, so the same failure is not retried every frame
+        const unsigned char* source; // flipped level 0 pixels in a mapped asset pack, if any
+    };
+
+    size_t budget;
+    size_t residentBytes;
+    unsigned long long frame;
+    bool overBudget;
+    std::unordered_map<GLuint, Entry> textures;
+    ResourceCache<GLuint> cache;
+
+    TextureHandle makeHandle(GLuint textureId)
+    {
+        return TextureHandle(new GLuint(textureId), [this](GLuint* id)
+        {
+            Destroy(*id);
+            delete id;
+        });
+    }
+
+    // takes ownership of a decoded image and uploads it as a new tracked texture
+    bool create(unsigned char* image, int width, int height, int channels, const char* path, GLuint& textureId)
+    {
+        flipImageVertically(image, width, height, channels);
+        bool uploaded = upload(image, width, height, channels, path, nullptr, textureId);
+        stbi_image_free(image);
+        return uploaded;
+    }
+
+    // uploads already flipped pixels as a new tracked texture
+    bool upload(const unsigned char* pixels, int width, int height, int channels, const char* path, const unsigned char* source, GLuint& textureId)
+    {
+        Entry entry;
+        entry.path = path;
+        entry.width = width;
+        entry.height = height;
+        if (!formatForChannels(channels, entry.internalFormat, entry.format))
+        {
+            std::cout << "Not implemented to handle image with " << channels << " channels" << std::endl;
+            return false;
+        }
+        entry.levels = mipCount(width, height);
+        entry.baseLevel = 0;
+        entry.lastUsed = frame;
+        entry.restoreRequested = false;
+        entry.restorable = true;
+        entry.source = source;
+
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
+
+        // set the texture wrapping parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // set texture filtering parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        uploadFullChain(entry, pixels);
+
+        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+        entry.bytes = chainBytes(entry);
+        residentBytes += entry.bytes;
+        textures[textureId] = entry;
+
+        return true;
+    }
+
+    static bool formatForChannels(int channels, GLint& internalFormat, GLenum& format)
+    {
+        if (channels == 3)
+        {
+            internalFormat = GL_RGB8;
+            format = GL_RGB;
+        }
+        else if (channels == 4)
+        {
+            internalFormat = GL_RGBA8;
+            format = GL_RGBA;
+        }
+        else
+            return false;
+        return true;
+    }
+
+    static int mipCount(int width, int height)
+    {
+        int levels = 1;
+        while (width > 1 || height > 1)
+        {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            ++levels;
+        }
+        return levels;
+    }
+
+    // drivers pad RGB8 to 4 bytes per texel, so both supported formats cost 4 bytes
+    static size_t levelBytes(const Entry& entry, int level)
+    {
+        size_t w = std::max(1, entry.width >> level);
+        size_t h = std::max(1, entry.height >> level);
+        return w * h * 4;
+    }
+
+    static size_t chainBytes(const Entry& entry)
+    {
+        size_t bytes = 0;
+        for (int level = entry.baseLevel; level < entry.levels; ++level)
+            bytes += levelBytes(entry, level);
+        return bytes;
+    }
+
+    // lowest mip the manager is allowed to make the base level
+    static int maxBaseLevel(const Entry& entry)
+    {
+        int level = 0;
+        while (level < entry.levels - 1 &&
+            std::max(entry.width >> level, entry.height >> level) > TEXTURE_MIN_RESIDENT_SIZE)
+            ++level;
+        return level;
+    }
+
+    // uploads level 0 and lets the driver rebuild the remaining mips; expects the texture bound
+    static void uploadFullChain(const Entry& entry, const unsigned char* image)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, entry.internalFormat, entry.width, entry.height, 0, entry.format, GL_UNSIGNED_BYTE, image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    // frees the current top mip by respecifying it with zero size and moving the base level past it
+    void dropTopLevel(GLuint textureId, Entry& entry)
+    {
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glTexImage2D(GL_TEXTURE_2D, entry.baseLevel, entry.internalFormat, 0, 0, 0, entry.format, GL_UNSIGNED_BYTE, NULL);
+        residentBytes -= levelBytes(entry, entry.baseLevel);
+        ++entry.baseLevel;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.baseLevel);
+        entry.bytes = chainBytes(entry);
+    }
+
+    // reloads the image (from its pack mapping, else from disk) and rebuilds the full mip chain
+    bool restore(GLuint textureId, Entry& entry)
+    {
+        if (entry.source != nullptr)
+        {
+            glBindTexture(GL_TEXTURE_2D, textureId);
+            entry.baseLevel = 0;
+            uploadFullChain(entry, entry.source);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            residentBytes -= entry.bytes;
+            entry.bytes = chainBytes(entry);
+            residentBytes += entry.bytes;
+            return true;
+        }
+
+        int width, height, channels;
+        unsigned char* image = stbi_load(entry.path.c_str(), &width, &height, &channels, 0);
+        if (!image)
+        {
+            std::cout << "Failed to restore texture " << entry.path << std::endl;
+            return false;
+        }
+        if (width != entry.width || height != entry.height)
+        {
+            std::cout << "Texture " << entry.path << " changed size on disk; keeping dropped mips" << std::endl;
+            stbi_image_free(image);
+            return false;
+        }
+
+        flipImageVertically(image, width, height, channels);
+
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        entry.baseLevel = 0;
+        uploadFullChain(entry, image);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        stbi_image_free(image);
+
+        residentBytes -= entry.bytes;
+        entry.bytes = chainBytes(entry);
+        residentBytes += entry.bytes;
+        return true;
+    }
+
+    void restoreRequested()
+    {
+        int restores = 0;
+        for (std::unordered_map<GLuint, Entry>::iterator it = textures.begin(); it != textures.end(); ++it)
+        {
+            Entry& entry = it->second;
+            if (!entry.restoreRequested)
+                continue;
+
+            // checked before reclaiming, so nothing is evicted for a restore that waits for the next frame
+            if (restores == TEXTURE_MAX_RESTORES_PER_FRAME)
+                break;
+
+            // restore only when the full chain fits; eviction of older textures may make room later
+            size_t grow = chainBytes(entry, 0) - entry.bytes;
+            if (residentBytes + grow > budget && !reclaim(grow, frame))
+                continue;
+
+            entry.restoreRequested = false;
+            entry.restorable = restore(it->first, entry);
+            ++restores;
+        }
+    }
+
+    static size_t chainBytes(Entry entry, int baseLevel)
+    {
+        entry.baseLevel = baseLevel;
+        return chainBytes(entry);
+    }
+
+    // drops top mips of textures not used since 'usedBefore' until 'needed' bytes fit under the budget
+    bool reclaim(size_t needed, unsigned long long usedBefore)
+    {
+        std::vector<std::pair<unsigned long long, GLuint> > candidates;
+        for (std::unordered_map<GLuint, Entry>::iterator it = textures.begin(); it != textures.end(); ++it)
+        {
+            if (it->second.lastUsed < usedBefore && it->second.baseLevel < maxBaseLevel(it->second))
+                candidates.push_back(std::make_pair(it->second.lastUsed, it->first));
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (size_t i = 0; i < candidates.size() && residentBytes + needed > budget; ++i)
+        {
+            Entry& entry = textures[candidates[i].second];
+            int limit = maxBaseLevel(entry);
+            while (entry.baseLevel < limit && residentBytes + needed > budget)
+                dropTopLevel(candidates[i].second, entry);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return residentBytes + needed <= budget;
+    }
+
+    void enforceBudget()
+    {
+        if (residentBytes > budget)
+        {
+            // prefer textures not used this frame, then fall back to everything
+            if (!reclaim(0, frame))
+                reclaim(0, frame + 1);
+        }
+
+        // report once each time the minimum resident set alone no longer fits
+        bool exceeded = residentBytes > budget;
+        if (exceeded && !overBudget)
+            std::cout << "WARNING::TEXTURES::BUDGET_EXCEEDED " << residentBytes << " of " << budget << " bytes resident" << std::endl;
+        overBudget = exceeded;
+    }
+};
+#endif